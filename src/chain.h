@@ -165,7 +165,7 @@ public:
     //COutPoint prevoutStake;
     //unsigned int nStakeTime;
     //uint256 hashProofOfStake;
-    //uint256 hashProofOfWork;
+    uint256 hashProofOfWork;             // (memory only) cached PoW hash of the header, 0 if not known; persisted by CBlockTreeDB
     int64_t nMint;
     int64_t nMoneySupply;
     uint256 nStakeModifierV2;
@@ -209,7 +209,7 @@ public:
         //prevoutStake.SetNull();
         //nStakeTime = 0;
         //hashProofOfStake = uint256();
-        //hashProofOfWork = uint256();
+        hashProofOfWork = uint256();
 
         nVersion = 0;
         hashMerkleRoot = uint256();
@@ -1,4 +1,5 @@
 // Copyright (c) 2012-2014 The Bitcoin developers
+// Copyright (c) 2018-2019 The Simplicity developers
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
@@ -6,16 +7,19 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/**
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
@@ -24,136 +28,210 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every worker owns a deque. The master spreads added checks over the
+  * deques; a worker takes batches from the back of its own deque and, once
+  * that is empty, steals half of the front of another one. The deque locks
+  * are only contended when stealing, and the shared state is atomic, so
+  * no global lock is taken per batch. The first failing check cancels the
+  * checks still queued.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
-    boost::mutex mutex;
+    //! A worker's deque, on its own cache line
+    struct alignas(64) WorkerQueue {
+        boost::mutex mutex;
+        std::deque<T> checks;
+    };
 
-    //! Worker threads block on this when out of work
-    boost::condition_variable condWorker;
+    //! The deques: slot 0 belongs to the master, the workers share the others
+    std::vector<WorkerQueue> vQueues;
 
-    //! Master thread blocks on this when out of work
+    //! Mutex and condition variables used only to sleep and wake up
+    boost::mutex mutexSleep;
+    boost::condition_variable condWorker;
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! Number of workers waiting on condWorker
+    std::atomic<int> nIdle;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! Number of workers that have registered, used to pick their slot
+    std::atomic<unsigned int> nWorkers;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! Slot the next batch added by the master starts at
+    unsigned int nNextSlot;
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
+
+    //! Number of verifications still in some deque
+    std::atomic<unsigned int> nQueued;
 
     /**
      * Number of verifications that haven't completed yet.
-     * This includes elements that are not anymore in queue, but still in
+     * This includes elements that are not anymore in a deque, but still in
      * worker's own batches.
      */
-    unsigned int nTodo;
-
-    //! Whether we're shutting down.
-    bool fQuit;
+    std::atomic<unsigned int> nTodo;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
-    /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    //! Move up to nBatchSize checks from the back of slot i (the front when stealing) into vChecks
+    bool Take(unsigned int i, bool fSteal, std::vector<T>& vChecks)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master he can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+        WorkerQueue& q = vQueues[i];
+        boost::unique_lock<boost::mutex> lock(q.mutex, boost::defer_lock);
+        if (fSteal) {
+            // don't queue up behind the owner or another thief
+            if (!lock.try_lock())
+                return false;
+        } else {
+            lock.lock();
+        }
+        if (q.checks.empty())
+            return false;
+        // Take half of what is there, so the rest can still be stolen and
+        // the workers finish approximately simultaneously.
+        unsigned int nNow = std::max(1U, std::min(nBatchSize, (unsigned int)(q.checks.size() + 1) / 2));
+        vChecks.resize(nNow);
+        for (unsigned int n = 0; n < nNow; n++) {
+            if (fSteal) {
+                vChecks[n].swap(q.checks.front());
+                q.checks.pop_front();
+            } else {
+                vChecks[n].swap(q.checks.back());
+                q.checks.pop_back();
             }
-            // execute work
-            for (T& check : vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while (true);
+        }
+        nQueued -= nNow;
+        return true;
+    }
+
+    //! Find a batch: own deque first, then the others starting with the next slot
+    bool TakeAny(unsigned int nSlot, std::vector<T>& vChecks)
+    {
+        if (Take(nSlot, false, vChecks))
+            return true;
+        while (nQueued > 0) {
+            for (unsigned int n = 0; n < vQueues.size(); n++)
+                if (Take((nSlot + n) % vQueues.size(), n != 0, vChecks))
+                    return true;
+            // whatever is left is being taken or added right now
+            boost::this_thread::yield();
+        }
+        return false;
+    }
+
+    //! Drop every queued check after a failure; the result is already known
+    void Cancel()
+    {
+        for (WorkerQueue& q : vQueues) {
+            boost::unique_lock<boost::mutex> lock(q.mutex);
+            unsigned int nDropped = q.checks.size();
+            q.checks.clear();
+            nQueued -= nDropped;
+            Done(nDropped);
+        }
+    }
+
+    //! Account for completed (or dropped) checks and wake the master on the last one
+    void Done(unsigned int nDone)
+    {
+        if (nDone && (nTodo -= nDone) == 0) {
+            boost::unique_lock<boost::mutex> lock(mutexSleep);
+            condMaster.notify_one();
+        }
+    }
+
+    //! Run a batch, skipping it entirely once some check has failed
+    void Run(std::vector<T>& vChecks)
+    {
+        for (T& check : vChecks) {
+            if (!fAllOk)
+                break;
+            if (!check()) {
+                fAllOk = false;
+                Cancel();
+            }
+        }
+        unsigned int nDone = vChecks.size();
+        vChecks.clear();
+        Done(nDone);
     }
 
 public:
-    //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    //! Create a new check queue. Workers beyond nMaxWorkers share deques.
+    CCheckQueue(unsigned int nBatchSizeIn, unsigned int nMaxWorkers = 32) : vQueues(nMaxWorkers + 1), nIdle(0), nWorkers(0), nNextSlot(0), fAllOk(true), nQueued(0), nTodo(0), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        const unsigned int nSlot = 1 + nWorkers++ % (vQueues.size() - 1);
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        while (true) {
+            if (TakeAny(nSlot, vChecks)) {
+                Run(vChecks);
+                continue;
+            }
+            boost::unique_lock<boost::mutex> lock(mutexSleep);
+            nIdle++;
+            while (nQueued == 0)
+                condWorker.wait(lock); // wait
+            nIdle--;
+        }
     }
 
     //! Wait until execution finishes, and return whether all evaluations where successful.
     bool Wait()
     {
-        return Loop(true);
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        while (TakeAny(0, vChecks))
+            Run(vChecks);
+        {
+            boost::unique_lock<boost::mutex> lock(mutexSleep);
+            while (nTodo > 0)
+                condMaster.wait(lock);
+        }
+        // reset the status for new work later
+        bool fRet = fAllOk;
+        fAllOk = true;
+        return fRet;
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+
+        // Deal the checks out over the master and the registered workers in
+        // runs of nBatchSize, starting where the previous batch stopped.
+        const unsigned int nSlots = std::min<unsigned int>(nWorkers + 1, vQueues.size());
+        for (size_t nFirst = 0; nFirst < vChecks.size(); nFirst += nBatchSize) {
+            size_t nLast = std::min(vChecks.size(), nFirst + nBatchSize);
+            WorkerQueue& q = vQueues[nNextSlot];
+            nNextSlot = (nNextSlot + 1) % nSlots;
+            boost::unique_lock<boost::mutex> lock(q.mutex);
+            for (size_t n = nFirst; n < nLast; n++) {
+                q.checks.push_back(T());
+                vChecks[n].swap(q.checks.back());
+            }
+            nQueued += nLast - nFirst;
+        }
+
+        if (nIdle > 0) {
+            boost::unique_lock<boost::mutex> lock(mutexSleep);
+            if (vChecks.size() == 1)
+                condWorker.notify_one();
+            else
+                condWorker.notify_all();
+        }
     }
 
     ~CCheckQueue()
@@ -162,12 +240,11 @@ public:
 
     bool IsIdle()
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return nTodo == 0 && fAllOk;
     }
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
@@ -63,6 +63,7 @@ bool CCoinsView::GetCoins(const uint256& txid, CCoins& coins) const { return fal
 bool CCoinsView::HaveCoins(const uint256& txid) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(0); }
 bool CCoinsView::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) { return false; }
+bool CCoinsView::Sync() { return true; }
 bool CCoinsView::GetStats(CCoinsStats& stats) const { return false; }
 
 
@@ -72,11 +73,12 @@ bool CCoinsViewBacked::HaveCoins(const uint256& txid) const { return base->HaveC
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 void CCoinsViewBacked::SetBackend(CCoinsView& viewIn) { base = &viewIn; }
 bool CCoinsViewBacked::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::Sync() { return base->Sync(); }
 bool CCoinsViewBacked::GetStats(CCoinsStats& stats) const { return base->GetStats(stats); }
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView* baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), hashBlock(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView* baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), hashBlock(0), cachedCoinsUsage(0) {}
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -98,6 +100,7 @@ CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256& txid) const
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
     }
+    cachedCoinsUsage += ret->second.DynamicMemoryUsage();
     return ret;
 }
 
@@ -124,6 +127,9 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256& txid)
             // The parent view only has a pruned entry for this; mark it as fresh.
             ret.first->second.flags = CCoinsCacheEntry::FRESH;
         }
+    } else {
+        // Accounted for again when the modifier is done
+        cachedCoinsUsage -= ret.first->second.DynamicMemoryUsage();
     }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
@@ -177,6 +183,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlockIn
                     assert(it->second.flags & CCoinsCacheEntry::FRESH);
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
                     entry.coins.swap(it->second.coins);
+                    cachedCoinsUsage += entry.DynamicMemoryUsage();
                     entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
                 }
             } else {
@@ -184,11 +191,23 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlockIn
                     // The grandparent does not have an entry, and the child is
                     // modified and being pruned. This means we can just delete
                     // it from the parent.
+                    cachedCoinsUsage -= itUs->second.DynamicMemoryUsage();
                     cacheCoins.erase(itUs);
                 } else {
-                    // A normal modification.
+                    // A normal modification. What the child spent and added
+                    // is relative to our version, so it adds up with ours; a
+                    // fresh child replaced our pruned version altogether.
+                    cachedCoinsUsage -= itUs->second.DynamicMemoryUsage();
+                    // Our version is what our parent has, unless we changed it before
+                    if (!(itUs->second.flags & (CCoinsCacheEntry::FRESH | CCoinsCacheEntry::DIRTY)))
+                        itUs->second.coinsBefore.swap(itUs->second.coins);
                     itUs->second.coins.swap(it->second.coins);
+                    if (!(itUs->second.flags & CCoinsCacheEntry::FRESH))
+                        itUs->second.vSpent.insert(itUs->second.vSpent.end(), it->second.vSpent.begin(), it->second.vSpent.end());
+                    cachedCoinsUsage += itUs->second.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                    if (it->second.flags & (CCoinsCacheEntry::ADDED | CCoinsCacheEntry::FRESH))
+                        itUs->second.flags |= CCoinsCacheEntry::ADDED;
                 }
             }
         }
@@ -203,6 +222,7 @@ bool CCoinsViewCache::Flush()
 {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
+    cachedCoinsUsage = 0;
     return fOk;
 }
 
@@ -211,6 +231,11 @@ unsigned int CCoinsViewCache::GetCacheSize() const
     return cacheCoins.size();
 }
 
+size_t CCoinsViewCache::DynamicMemoryUsage() const
+{
+    return cacheCoins.DynamicMemoryUsage() + cachedCoinsUsage;
+}
+
 const CTxOut& CCoinsViewCache::GetOutputFor(const CTxIn& input) const
 {
     const CCoins* coins = AccessCoins(input.prevout.hash);
@@ -264,10 +289,18 @@ double CCoinsViewCache::GetPriority(const CTransaction& tx, int nHeight) const
     return tx.ComputePriority(dResult);
 }
 
-CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_) : cache(cache_), it(it_)
+CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_) : cache(cache_), it(it_), nHeightBefore(it_->second.coins.nHeight)
 {
     assert(!cache.hasModifier);
     cache.hasModifier = true;
+    if (!(it->second.flags & CCoinsCacheEntry::FRESH)) {
+        const std::vector<CTxOut>& vout = it->second.coins.vout;
+        if (it->second.coinsBefore.vout.empty())
+            it->second.coinsBefore = it->second.coins;
+        vAvailable.resize(vout.size());
+        for (unsigned int i = 0; i < vout.size(); i++)
+            vAvailable[i] = !vout[i].IsNull();
+    }
 }
 
 CCoinsModifier::~CCoinsModifier()
@@ -277,5 +310,22 @@ CCoinsModifier::~CCoinsModifier()
     it->second.coins.Cleanup();
     if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
         cache.cacheCoins.erase(it);
+        return;
+    }
+    if (!(it->second.flags & CCoinsCacheEntry::FRESH)) {
+        // Record the difference, so that a database can write single outputs.
+        // A transaction replaced by one with the same txid is added anew.
+        const std::vector<CTxOut>& vout = it->second.coins.vout;
+        if (it->second.coins.nHeight != nHeightBefore && !it->second.coins.IsPruned())
+            it->second.flags |= CCoinsCacheEntry::ADDED;
+        for (unsigned int i = 0; i < std::max(vout.size(), vAvailable.size()); i++) {
+            bool fBefore = i < vAvailable.size() && vAvailable[i];
+            bool fAfter = i < vout.size() && !vout[i].IsNull();
+            if (fBefore && !fAfter)
+                it->second.vSpent.push_back(i);
+            else if (fAfter && !fBefore)
+                it->second.flags |= CCoinsCacheEntry::ADDED;
+        }
     }
+    cache.cachedCoinsUsage += it->second.DynamicMemoryUsage();
 }
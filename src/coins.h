@@ -9,6 +9,8 @@
 
 //#include "chainparams.h"
 #include "compressor.h"
+#include "flatmap.h"
+#include "memusage.h"
 #include "script/standard.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -17,8 +19,6 @@
 #include <assert.h>
 #include <stdint.h>
 
-#include <boost/unordered_map.hpp>
-
 /** 
 
     ****Note - for Simplicity we added fCoinStake to the 2nd bit. Keep in mind when reading the following and adjust as needed.
@@ -284,6 +284,15 @@ public:
                 return false;
         return true;
     }
+
+    //! Heap memory of the outputs and their scripts
+    size_t DynamicMemoryUsage() const
+    {
+        size_t ret = memusage::DynamicUsage(vout);
+        for (const CTxOut& out : vout)
+            ret += memusage::DynamicUsage(*static_cast<const std::vector<unsigned char>*>(&out.scriptPubKey));
+        return ret;
+    }
 };
 
 class CCoinsKeyHasher
@@ -308,16 +317,25 @@ public:
 struct CCoinsCacheEntry {
     CCoins coins; // The actual cached data.
     unsigned char flags;
+    std::vector<uint32_t> vSpent; // Outputs spent since the entry was taken from the parent view.
+    CCoins coinsBefore; // The version the parent view has, kept from the first modification on unless FRESH.
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
+        ADDED = (1 << 2), // Outputs were added, not only spent, since the entry was taken from the parent view. Outputs are never changed in place.
     };
 
     CCoinsCacheEntry() : coins(), flags(0) {}
+
+    //! Heap memory of the coins and the spent list
+    size_t DynamicMemoryUsage() const
+    {
+        return coins.DynamicMemoryUsage() + memusage::DynamicUsage(vSpent) + coinsBefore.DynamicMemoryUsage();
+    }
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+typedef CFlatHashMap<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
 
 struct CCoinsStats {
     int nHeight;
@@ -350,6 +368,9 @@ public:
     //! The passed mapCoins can be modified.
     virtual bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
 
+    //! Wait until what BatchWrite was given is durable, and return whether it was written
+    virtual bool Sync();
+
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats& stats) const;
 
@@ -371,6 +392,7 @@ public:
     uint256 GetBestBlock() const;
     void SetBackend(CCoinsView& viewIn);
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
+    bool Sync();
     bool GetStats(CCoinsStats& stats) const;
 };
 
@@ -399,6 +421,8 @@ class CCoinsModifier
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
+    std::vector<bool> vAvailable; // Outputs there were before, for entries the parent view has
+    int nHeightBefore;
     CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
 
 public:
@@ -422,6 +446,9 @@ protected:
     mutable uint256 hashBlock;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage of the CCoins in cacheCoins. */
+    mutable size_t cachedCoinsUsage;
+
 public:
     CCoinsViewCache(CCoinsView* baseIn);
     ~CCoinsViewCache();
@@ -457,6 +484,9 @@ public:
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the heap memory the cache takes: the map, its entries and the outputs they hold
+    size_t DynamicMemoryUsage() const;
+
     /** 
      * Amount of simplicity coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
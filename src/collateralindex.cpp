@@ -0,0 +1,101 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "collateralindex.h"
+
+#include "chainparams.h"
+#include "coins.h"
+#include "masternode.h"
+#include "primitives/block.h"
+
+CCollateralIndex collateralIndex;
+
+bool CCollateralIndex::IsCollateralAmount(CAmount nValue)
+{
+    // The levels changed once, at the new tiers height
+    return CMasternode::Level(nValue, 0) != CMasternode::LevelValue::UNSPECIFIED ||
+           CMasternode::Level(nValue, Params().NewMNTiersHeight()) != CMasternode::LevelValue::UNSPECIFIED;
+}
+
+void CCollateralIndex::ConnectBlock(const CBlock& block, int nHeight)
+{
+    LOCK(cs);
+    for (const CTransaction& tx : block.vtx) {
+        if (!tx.IsCoinBase()) {
+            for (const CTxIn& txin : tx.vin)
+                mapCollateral.erase(txin.prevout);
+        }
+        const uint256 hash = tx.GetHash();
+        for (unsigned int n = 0; n < tx.vout.size(); n++) {
+            if (IsCollateralAmount(tx.vout[n].nValue)) {
+                CEntry& entry = mapCollateral[COutPoint(hash, n)];
+                entry.nValue = tx.vout[n].nValue;
+                entry.nHeight = nHeight;
+            }
+        }
+    }
+    nBestHeight = nHeight;
+}
+
+void CCollateralIndex::DisconnectBlock(const CBlock& block, int nHeight, const CCoinsViewCache& view)
+{
+    LOCK(cs);
+    for (std::vector<CTransaction>::const_reverse_iterator it = block.vtx.rbegin(); it != block.vtx.rend(); ++it) {
+        const CTransaction& tx = *it;
+        const uint256 hash = tx.GetHash();
+        for (unsigned int n = 0; n < tx.vout.size(); n++)
+            mapCollateral.erase(COutPoint(hash, n));
+        if (tx.IsCoinBase())
+            continue;
+        // What the block spent is unspent again in view, with its height
+        for (const CTxIn& txin : tx.vin) {
+            const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+            if (coins && coins->IsAvailable(txin.prevout.n) && IsCollateralAmount(coins->vout[txin.prevout.n].nValue)) {
+                CEntry& entry = mapCollateral[txin.prevout];
+                entry.nValue = coins->vout[txin.prevout.n].nValue;
+                entry.nHeight = coins->nHeight;
+            }
+        }
+    }
+    nBestHeight = nHeight - 1;
+}
+
+void CCollateralIndex::Add(const COutPoint& out, CAmount nValue, int nHeight)
+{
+    if (!IsCollateralAmount(nValue))
+        return;
+    LOCK(cs);
+    CEntry& entry = mapCollateral[out];
+    entry.nValue = nValue;
+    entry.nHeight = nHeight;
+}
+
+void CCollateralIndex::SetBestHeight(int nHeight)
+{
+    LOCK(cs);
+    nBestHeight = nHeight;
+}
+
+void CCollateralIndex::Clear()
+{
+    LOCK(cs);
+    mapCollateral.clear();
+    nBestHeight = -1;
+}
+
+int CCollateralIndex::GetAge(const COutPoint& out, CAmount& nValue) const
+{
+    LOCK(cs);
+    boost::unordered_map<COutPoint, CEntry, OutPointHasher>::const_iterator it = mapCollateral.find(out);
+    if (it == mapCollateral.end())
+        return -1;
+    nValue = it->second.nValue;
+    return nBestHeight + 1 - it->second.nHeight;
+}
+
+size_t CCollateralIndex::Size() const
+{
+    LOCK(cs);
+    return mapCollateral.size();
+}
@@ -0,0 +1,68 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COLLATERALINDEX_H
+#define BITCOIN_COLLATERALINDEX_H
+
+#include "amount.h"
+#include "primitives/transaction.h"
+#include "sync.h"
+
+#include <stddef.h>
+
+#include <boost/unordered_map.hpp>
+
+class CBlock;
+class CCoinsViewCache;
+class CCollateralIndex;
+
+extern CCollateralIndex collateralIndex;
+
+/**
+ * The unspent outputs of the active chain whose value is that of a masternode
+ * collateral, with the height they were confirmed at. It is kept in step with
+ * the tip by ConnectTip and DisconnectTip under cs_main, and read under a lock
+ * of its own, so masternode checks can tell whether a collateral is still
+ * unspent without cs_main and without building a transaction to test it.
+ */
+class CCollateralIndex
+{
+private:
+    struct OutPointHasher {
+        size_t operator()(const COutPoint& out) const { return out.hash.GetLow64() ^ out.n; }
+    };
+    struct CEntry {
+        CAmount nValue;
+        int nHeight;
+    };
+
+    mutable CCriticalSection cs;
+    boost::unordered_map<COutPoint, CEntry, OutPointHasher> mapCollateral;
+    int nBestHeight; //!< height of the tip the index is at, -1 before it is loaded
+
+public:
+    CCollateralIndex() : nBestHeight(-1) {}
+
+    //! Whether nValue is a collateral amount of any masternode level, at any height
+    static bool IsCollateralAmount(CAmount nValue);
+
+    //! Add the collateral outputs of block at nHeight and drop those it spends
+    void ConnectBlock(const CBlock& block, int nHeight);
+    //! Undo ConnectBlock; view is the coins with the block already disconnected
+    void DisconnectBlock(const CBlock& block, int nHeight, const CCoinsViewCache& view);
+
+    //! Add an unspent output while loading the index from the coin database
+    void Add(const COutPoint& out, CAmount nValue, int nHeight);
+    void SetBestHeight(int nHeight);
+    void Clear();
+
+    /**
+     * Confirmations of the collateral at out as of the tip of the index, and
+     * its value, or -1 if the output is spent or is not a collateral.
+     */
+    int GetAge(const COutPoint& out, CAmount& nValue) const;
+    size_t Size() const;
+};
+
+#endif // BITCOIN_COLLATERALINDEX_H
@@ -0,0 +1,1003 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/quark.h"
+
+#include "crypto/common.h"
+#include "crypto/sph_blake.h"
+#include "crypto/sph_bmw.h"
+#include "crypto/sph_groestl.h"
+#include "crypto/sph_jh.h"
+#include "crypto/sph_keccak.h"
+#include "crypto/sph_skein.h"
+#include "uint256.h"
+
+#include <string.h>
+
+/* ----------- Reference chain ------------------------------------------------ */
+
+static inline void quark_groestl512(const unsigned char* in, unsigned char* out)
+{
+    sph_groestl512_context ctx;
+    sph_groestl512_init(&ctx);
+    sph_groestl512(&ctx, in, 64);
+    sph_groestl512_close(&ctx, out);
+}
+
+static inline void quark_jh512(const unsigned char* in, unsigned char* out)
+{
+    sph_jh512_context ctx;
+    sph_jh512_init(&ctx);
+    sph_jh512(&ctx, in, 64);
+    sph_jh512_close(&ctx, out);
+}
+
+void quark_hash(const void* input, size_t len, unsigned char output[32])
+{
+    sph_blake512_context ctx_blake;
+    sph_bmw512_context ctx_bmw;
+    sph_keccak512_context ctx_keccak;
+    sph_skein512_context ctx_skein;
+    unsigned char hash[9][64];
+
+    sph_blake512_init(&ctx_blake);
+    sph_blake512(&ctx_blake, input, len);
+    sph_blake512_close(&ctx_blake, hash[0]);
+
+    sph_bmw512_init(&ctx_bmw);
+    sph_bmw512(&ctx_bmw, hash[0], 64);
+    sph_bmw512_close(&ctx_bmw, hash[1]);
+
+    if (hash[1][0] & 8) {
+        quark_groestl512(hash[1], hash[2]);
+    } else {
+        sph_skein512_init(&ctx_skein);
+        sph_skein512(&ctx_skein, hash[1], 64);
+        sph_skein512_close(&ctx_skein, hash[2]);
+    }
+
+    quark_groestl512(hash[2], hash[3]);
+    quark_jh512(hash[3], hash[4]);
+
+    if (hash[4][0] & 8) {
+        sph_blake512_init(&ctx_blake);
+        sph_blake512(&ctx_blake, hash[4], 64);
+        sph_blake512_close(&ctx_blake, hash[5]);
+    } else {
+        sph_bmw512_init(&ctx_bmw);
+        sph_bmw512(&ctx_bmw, hash[4], 64);
+        sph_bmw512_close(&ctx_bmw, hash[5]);
+    }
+
+    sph_keccak512_init(&ctx_keccak);
+    sph_keccak512(&ctx_keccak, hash[5], 64);
+    sph_keccak512_close(&ctx_keccak, hash[6]);
+
+    sph_skein512_init(&ctx_skein);
+    sph_skein512(&ctx_skein, hash[6], 64);
+    sph_skein512_close(&ctx_skein, hash[7]);
+
+    if (hash[7][0] & 8) {
+        sph_keccak512_init(&ctx_keccak);
+        sph_keccak512(&ctx_keccak, hash[7], 64);
+        sph_keccak512_close(&ctx_keccak, hash[8]);
+    } else {
+        quark_jh512(hash[7], hash[8]);
+    }
+
+    memcpy(output, hash[8], 32);
+}
+
+/* ----------- Multi-lane chain ----------------------------------------------- */
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_QUARK_MULTI 1
+
+/*
+ * The lane kernels are written once against GCC vector types and instantiated
+ * for 128-bit (SSE2, always present on x86_64) and 256-bit (AVX2) registers.
+ * Every inter-stage digest is held as eight little-endian 64-bit words per
+ * lane, which is how bmw, keccak, skein, groestl and jh consume their input;
+ * blake is big-endian and swaps on the way in and out. The round functions
+ * are fully unrolled with constant indices so that the state stays in
+ * registers, the same way the sph code is written.
+ */
+typedef uint64_t quark_v2 __attribute__((vector_size(16)));
+typedef uint64_t quark_v4 __attribute__((vector_size(32)));
+
+#define QUARK_INLINE static inline __attribute__((always_inline))
+
+// The kernels are always inlined into the target-specific entry points below,
+// so the vector-argument ABI of the generic templates never materializes.
+// GCC reports this at the end of the translation unit, so the warning stays
+// disabled for the rest of the file.
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+template <typename V>
+QUARK_INLINE V qrotl(const V& x, int n)
+{
+    return (x << n) | (x >> (64 - n));
+}
+
+template <typename V>
+QUARK_INLINE V qrotr(const V& x, int n)
+{
+    return (x >> n) | (x << (64 - n));
+}
+
+template <typename V>
+QUARK_INLINE V qbswap(const V& v)
+{
+    V x = ((v & 0x00FF00FF00FF00FFULL) << 8) | ((v >> 8) & 0x00FF00FF00FF00FFULL);
+    x = ((x & 0x0000FFFF0000FFFFULL) << 16) | ((x >> 16) & 0x0000FFFF0000FFFFULL);
+    return (x << 32) | (x >> 32);
+}
+
+/** All-ones in every lane whose first digest byte has bit 3 set (the Quark branch test). */
+template <typename V>
+QUARK_INLINE void qbranch(const V h[8], V& mask)
+{
+    mask = (V)((h[0] & 8) != 0);
+}
+
+template <typename V>
+QUARK_INLINE void qselect(V out[8], const V& mask, const V a[8], const V b[8])
+{
+    for (int i = 0; i < 8; i++)
+        out[i] = (a[i] & mask) | (b[i] & ~mask);
+}
+
+/* BLAKE-512, single block (input of N little-endian words, N <= 13) */
+
+static const uint64_t QUARK_BLAKE_IV[8] = {
+    0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL, 0x3C6EF372FE94F82BULL, 0xA54FF53A5F1D36F1ULL,
+    0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL, 0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL};
+
+static const uint64_t QUARK_BLAKE_CB[16] = {
+    0x243F6A8885A308D3ULL, 0x13198A2E03707344ULL, 0xA4093822299F31D0ULL, 0x082EFA98EC4E6C89ULL,
+    0x452821E638D01377ULL, 0xBE5466CF34E90C6CULL, 0xC0AC29B7C97C50DDULL, 0x3F84D5B5B5470917ULL,
+    0x9216D5D98979FB1BULL, 0xD1310BA698DFB5ACULL, 0x2FFD72DBD01ADFB7ULL, 0xB8E1AFED6A267E96ULL,
+    0xBA7C9045F12C7F99ULL, 0x24A19947B3916CF7ULL, 0x0801F2E2858EFC16ULL, 0x636920D871574E69ULL};
+
+static const unsigned char QUARK_BLAKE_SIGMA[10][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0}};
+
+#define QUARK_BLAKE_G(r, i, a, b, c, d)                                                          \
+    do {                                                                                         \
+        a = a + b + (m[QUARK_BLAKE_SIGMA[r][2 * i]] ^ QUARK_BLAKE_CB[QUARK_BLAKE_SIGMA[r][2 * i + 1]]); \
+        d = qrotr(d ^ a, 32);                                                                    \
+        c = c + d;                                                                               \
+        b = qrotr(b ^ c, 25);                                                                    \
+        a = a + b + (m[QUARK_BLAKE_SIGMA[r][2 * i + 1]] ^ QUARK_BLAKE_CB[QUARK_BLAKE_SIGMA[r][2 * i]]); \
+        d = qrotr(d ^ a, 16);                                                                    \
+        c = c + d;                                                                               \
+        b = qrotr(b ^ c, 11);                                                                    \
+    } while (0)
+
+#define QUARK_BLAKE_ROUND(r)                               \
+    do {                                                   \
+        QUARK_BLAKE_G(r, 0, v[0], v[4], v[8], v[12]);      \
+        QUARK_BLAKE_G(r, 1, v[1], v[5], v[9], v[13]);      \
+        QUARK_BLAKE_G(r, 2, v[2], v[6], v[10], v[14]);     \
+        QUARK_BLAKE_G(r, 3, v[3], v[7], v[11], v[15]);     \
+        QUARK_BLAKE_G(r, 4, v[0], v[5], v[10], v[15]);     \
+        QUARK_BLAKE_G(r, 5, v[1], v[6], v[11], v[12]);     \
+        QUARK_BLAKE_G(r, 6, v[2], v[7], v[8], v[13]);      \
+        QUARK_BLAKE_G(r, 7, v[3], v[4], v[9], v[14]);      \
+    } while (0)
+
+/** in: N little-endian message words per lane; out: 64-byte digest as little-endian words */
+template <typename V, int N>
+QUARK_INLINE void qblake512(const V in[N], V out[8])
+{
+    const uint64_t bits = (uint64_t)N * 64;
+    V m[16], v[16];
+    for (int i = 0; i < N; i++)
+        m[i] = qbswap(in[i]);
+    for (int i = N; i < 16; i++)
+        m[i] = V();
+    m[N] = m[N] ^ 0x8000000000000000ULL;
+    m[13] = m[13] ^ 1;
+    m[15] = m[15] ^ bits;
+
+    for (int i = 0; i < 8; i++)
+        v[i] = V() + QUARK_BLAKE_IV[i];
+    for (int i = 0; i < 4; i++)
+        v[8 + i] = V() + QUARK_BLAKE_CB[i];
+    v[12] = V() + (bits ^ QUARK_BLAKE_CB[4]);
+    v[13] = V() + (bits ^ QUARK_BLAKE_CB[5]);
+    v[14] = V() + QUARK_BLAKE_CB[6];
+    v[15] = V() + QUARK_BLAKE_CB[7];
+
+    QUARK_BLAKE_ROUND(0);
+    QUARK_BLAKE_ROUND(1);
+    QUARK_BLAKE_ROUND(2);
+    QUARK_BLAKE_ROUND(3);
+    QUARK_BLAKE_ROUND(4);
+    QUARK_BLAKE_ROUND(5);
+    QUARK_BLAKE_ROUND(6);
+    QUARK_BLAKE_ROUND(7);
+    QUARK_BLAKE_ROUND(8);
+    QUARK_BLAKE_ROUND(9);
+    QUARK_BLAKE_ROUND(0);
+    QUARK_BLAKE_ROUND(1);
+    QUARK_BLAKE_ROUND(2);
+    QUARK_BLAKE_ROUND(3);
+    QUARK_BLAKE_ROUND(4);
+    QUARK_BLAKE_ROUND(5);
+
+    for (int i = 0; i < 8; i++)
+        out[i] = qbswap(QUARK_BLAKE_IV[i] ^ v[i] ^ v[i + 8]);
+}
+
+#undef QUARK_BLAKE_ROUND
+#undef QUARK_BLAKE_G
+
+/* BMW-512, 64-byte input */
+
+static const uint64_t QUARK_BMW_IV[16] = {
+    0x8081828384858687ULL, 0x88898A8B8C8D8E8FULL, 0x9091929394959697ULL, 0x98999A9B9C9D9E9FULL,
+    0xA0A1A2A3A4A5A6A7ULL, 0xA8A9AAABACADAEAFULL, 0xB0B1B2B3B4B5B6B7ULL, 0xB8B9BABBBCBDBEBFULL,
+    0xC0C1C2C3C4C5C6C7ULL, 0xC8C9CACBCCCDCECFULL, 0xD0D1D2D3D4D5D6D7ULL, 0xD8D9DADBDCDDDEDFULL,
+    0xE0E1E2E3E4E5E6E7ULL, 0xE8E9EAEBECEDEEEFULL, 0xF0F1F2F3F4F5F6F7ULL, 0xF8F9FAFBFCFDFEFFULL};
+
+static const uint64_t QUARK_BMW_FINAL[16] = {
+    0xaaaaaaaaaaaaaaa0ULL, 0xaaaaaaaaaaaaaaa1ULL, 0xaaaaaaaaaaaaaaa2ULL, 0xaaaaaaaaaaaaaaa3ULL,
+    0xaaaaaaaaaaaaaaa4ULL, 0xaaaaaaaaaaaaaaa5ULL, 0xaaaaaaaaaaaaaaa6ULL, 0xaaaaaaaaaaaaaaa7ULL,
+    0xaaaaaaaaaaaaaaa8ULL, 0xaaaaaaaaaaaaaaa9ULL, 0xaaaaaaaaaaaaaaaaULL, 0xaaaaaaaaaaaaaaabULL,
+    0xaaaaaaaaaaaaaaacULL, 0xaaaaaaaaaaaaaaadULL, 0xaaaaaaaaaaaaaaaeULL, 0xaaaaaaaaaaaaaaafULL};
+
+template <typename V>
+QUARK_INLINE V qbmw_s0(const V& x) { return (x >> 1) ^ (x << 3) ^ qrotl(x, 4) ^ qrotl(x, 37); }
+template <typename V>
+QUARK_INLINE V qbmw_s1(const V& x) { return (x >> 1) ^ (x << 2) ^ qrotl(x, 13) ^ qrotl(x, 43); }
+template <typename V>
+QUARK_INLINE V qbmw_s2(const V& x) { return (x >> 2) ^ (x << 1) ^ qrotl(x, 19) ^ qrotl(x, 53); }
+template <typename V>
+QUARK_INLINE V qbmw_s3(const V& x) { return (x >> 2) ^ (x << 2) ^ qrotl(x, 28) ^ qrotl(x, 59); }
+template <typename V>
+QUARK_INLINE V qbmw_s4(const V& x) { return (x >> 1) ^ x; }
+template <typename V>
+QUARK_INLINE V qbmw_s5(const V& x) { return (x >> 2) ^ x; }
+
+#define QUARK_BMW_ADD_ELT(i)                                                                        \
+    ((qrotl(M[((i) - 16) & 15], (((i) - 16) & 15) + 1) + qrotl(M[((i) - 13) & 15], (((i) - 13) & 15) + 1) - \
+      qrotl(M[((i) - 6) & 15], (((i) - 6) & 15) + 1) + (uint64_t)(i) * 0x0555555555555555ULL) ^ H[((i) - 9) & 15])
+
+#define QUARK_BMW_EXPAND1(i)                                                                      \
+    q[i] = qbmw_s1(q[(i) - 16]) + qbmw_s2(q[(i) - 15]) + qbmw_s3(q[(i) - 14]) + qbmw_s0(q[(i) - 13]) + \
+           qbmw_s1(q[(i) - 12]) + qbmw_s2(q[(i) - 11]) + qbmw_s3(q[(i) - 10]) + qbmw_s0(q[(i) - 9]) +  \
+           qbmw_s1(q[(i) - 8]) + qbmw_s2(q[(i) - 7]) + qbmw_s3(q[(i) - 6]) + qbmw_s0(q[(i) - 5]) +    \
+           qbmw_s1(q[(i) - 4]) + qbmw_s2(q[(i) - 3]) + qbmw_s3(q[(i) - 2]) + qbmw_s0(q[(i) - 1]) +    \
+           QUARK_BMW_ADD_ELT(i)
+
+#define QUARK_BMW_EXPAND2(i)                                                                           \
+    q[i] = q[(i) - 16] + qrotl(q[(i) - 15], 5) + q[(i) - 14] + qrotl(q[(i) - 13], 11) + q[(i) - 12] +      \
+           qrotl(q[(i) - 11], 27) + q[(i) - 10] + qrotl(q[(i) - 9], 32) + q[(i) - 8] + qrotl(q[(i) - 7], 37) + \
+           q[(i) - 6] + qrotl(q[(i) - 5], 43) + q[(i) - 4] + qrotl(q[(i) - 3], 53) + qbmw_s4(q[(i) - 2]) +  \
+           qbmw_s5(q[(i) - 1]) + QUARK_BMW_ADD_ELT(i)
+
+/** BMW compression: dh = f(M, H), where H may be a broadcast constant table. */
+template <typename V>
+QUARK_INLINE void qbmw_compress(const V M[16], const V H[16], V dh[16])
+{
+    V mh[16], q[32], xl, xh;
+
+    for (int j = 0; j < 16; j++)
+        mh[j] = M[j] ^ H[j];
+
+    q[0] = qbmw_s0(mh[5] - mh[7] + mh[10] + mh[13] + mh[14]) + H[1];
+    q[1] = qbmw_s1(mh[6] - mh[8] + mh[11] + mh[14] - mh[15]) + H[2];
+    q[2] = qbmw_s2(mh[0] + mh[7] + mh[9] - mh[12] + mh[15]) + H[3];
+    q[3] = qbmw_s3(mh[0] - mh[1] + mh[8] - mh[10] + mh[13]) + H[4];
+    q[4] = qbmw_s4(mh[1] + mh[2] + mh[9] - mh[11] - mh[14]) + H[5];
+    q[5] = qbmw_s0(mh[3] - mh[2] + mh[10] - mh[12] + mh[15]) + H[6];
+    q[6] = qbmw_s1(mh[4] - mh[0] - mh[3] - mh[11] + mh[13]) + H[7];
+    q[7] = qbmw_s2(mh[1] - mh[4] - mh[5] - mh[12] - mh[14]) + H[8];
+    q[8] = qbmw_s3(mh[2] - mh[5] - mh[6] + mh[13] - mh[15]) + H[9];
+    q[9] = qbmw_s4(mh[0] - mh[3] + mh[6] - mh[7] + mh[14]) + H[10];
+    q[10] = qbmw_s0(mh[8] - mh[1] - mh[4] - mh[7] + mh[15]) + H[11];
+    q[11] = qbmw_s1(mh[8] - mh[0] - mh[2] - mh[5] + mh[9]) + H[12];
+    q[12] = qbmw_s2(mh[1] + mh[3] - mh[6] - mh[9] + mh[10]) + H[13];
+    q[13] = qbmw_s3(mh[2] + mh[4] + mh[7] + mh[10] + mh[11]) + H[14];
+    q[14] = qbmw_s4(mh[3] - mh[5] + mh[8] - mh[11] - mh[12]) + H[15];
+    q[15] = qbmw_s0(mh[12] - mh[4] - mh[6] - mh[9] + mh[13]) + H[0];
+
+    QUARK_BMW_EXPAND1(16);
+    QUARK_BMW_EXPAND1(17);
+    QUARK_BMW_EXPAND2(18);
+    QUARK_BMW_EXPAND2(19);
+    QUARK_BMW_EXPAND2(20);
+    QUARK_BMW_EXPAND2(21);
+    QUARK_BMW_EXPAND2(22);
+    QUARK_BMW_EXPAND2(23);
+    QUARK_BMW_EXPAND2(24);
+    QUARK_BMW_EXPAND2(25);
+    QUARK_BMW_EXPAND2(26);
+    QUARK_BMW_EXPAND2(27);
+    QUARK_BMW_EXPAND2(28);
+    QUARK_BMW_EXPAND2(29);
+    QUARK_BMW_EXPAND2(30);
+    QUARK_BMW_EXPAND2(31);
+
+    xl = q[16] ^ q[17] ^ q[18] ^ q[19] ^ q[20] ^ q[21] ^ q[22] ^ q[23];
+    xh = xl ^ q[24] ^ q[25] ^ q[26] ^ q[27] ^ q[28] ^ q[29] ^ q[30] ^ q[31];
+    dh[0] = ((xh << 5) ^ (q[16] >> 5) ^ M[0]) + (xl ^ q[24] ^ q[0]);
+    dh[1] = ((xh >> 7) ^ (q[17] << 8) ^ M[1]) + (xl ^ q[25] ^ q[1]);
+    dh[2] = ((xh >> 5) ^ (q[18] << 5) ^ M[2]) + (xl ^ q[26] ^ q[2]);
+    dh[3] = ((xh >> 1) ^ (q[19] << 5) ^ M[3]) + (xl ^ q[27] ^ q[3]);
+    dh[4] = ((xh >> 3) ^ q[20] ^ M[4]) + (xl ^ q[28] ^ q[4]);
+    dh[5] = ((xh << 6) ^ (q[21] >> 6) ^ M[5]) + (xl ^ q[29] ^ q[5]);
+    dh[6] = ((xh >> 4) ^ (q[22] << 6) ^ M[6]) + (xl ^ q[30] ^ q[6]);
+    dh[7] = ((xh >> 11) ^ (q[23] << 2) ^ M[7]) + (xl ^ q[31] ^ q[7]);
+    dh[8] = qrotl(dh[4], 9) + (xh ^ q[24] ^ M[8]) + ((xl << 8) ^ q[23] ^ q[8]);
+    dh[9] = qrotl(dh[5], 10) + (xh ^ q[25] ^ M[9]) + ((xl >> 6) ^ q[16] ^ q[9]);
+    dh[10] = qrotl(dh[6], 11) + (xh ^ q[26] ^ M[10]) + ((xl << 6) ^ q[17] ^ q[10]);
+    dh[11] = qrotl(dh[7], 12) + (xh ^ q[27] ^ M[11]) + ((xl << 4) ^ q[18] ^ q[11]);
+    dh[12] = qrotl(dh[0], 13) + (xh ^ q[28] ^ M[12]) + ((xl >> 3) ^ q[19] ^ q[12]);
+    dh[13] = qrotl(dh[1], 14) + (xh ^ q[29] ^ M[13]) + ((xl >> 4) ^ q[20] ^ q[13]);
+    dh[14] = qrotl(dh[2], 15) + (xh ^ q[30] ^ M[14]) + ((xl >> 7) ^ q[21] ^ q[14]);
+    dh[15] = qrotl(dh[3], 16) + (xh ^ q[31] ^ M[15]) + ((xl >> 2) ^ q[22] ^ q[15]);
+}
+
+#undef QUARK_BMW_EXPAND2
+#undef QUARK_BMW_EXPAND1
+#undef QUARK_BMW_ADD_ELT
+
+template <typename V>
+QUARK_INLINE void qbmw512(const V in[8], V out[8])
+{
+    V M[16], H[16], h2[16], h1[16];
+    for (int i = 0; i < 8; i++)
+        M[i] = in[i];
+    for (int i = 8; i < 16; i++)
+        M[i] = V();
+    M[8] = M[8] + 0x80;
+    M[15] = M[15] + 512;
+    for (int i = 0; i < 16; i++)
+        H[i] = V() + QUARK_BMW_IV[i];
+    qbmw_compress(M, H, h2);
+    for (int i = 0; i < 16; i++)
+        H[i] = V() + QUARK_BMW_FINAL[i];
+    qbmw_compress(h2, H, h1);
+    for (int i = 0; i < 8; i++)
+        out[i] = h1[8 + i];
+}
+
+/* Keccak-512 (original padding), 64-byte input */
+
+static const uint64_t QUARK_KECCAK_RC[24] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808AULL, 0x8000000080008000ULL,
+    0x000000000000808BULL, 0x0000000080000001ULL, 0x8000000080008081ULL, 0x8000000000008009ULL,
+    0x000000000000008AULL, 0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000AULL,
+    0x000000008000808BULL, 0x800000000000008BULL, 0x8000000000008089ULL, 0x8000000000008003ULL,
+    0x8000000000008002ULL, 0x8000000000000080ULL, 0x000000000000800AULL, 0x800000008000000AULL,
+    0x8000000080008081ULL, 0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL};
+
+#define QUARK_KECCAK_CHI(y)                                \
+    do {                                                   \
+        a[y + 0] = b[y + 0] ^ (~b[y + 1] & b[y + 2]);      \
+        a[y + 1] = b[y + 1] ^ (~b[y + 2] & b[y + 3]);      \
+        a[y + 2] = b[y + 2] ^ (~b[y + 3] & b[y + 4]);      \
+        a[y + 3] = b[y + 3] ^ (~b[y + 4] & b[y + 0]);      \
+        a[y + 4] = b[y + 4] ^ (~b[y + 0] & b[y + 1]);      \
+    } while (0)
+
+template <typename V>
+QUARK_INLINE void qkeccak512(const V in[8], V out[8])
+{
+    V a[25], b[25], c0, c1, c2, c3, c4, d0, d1, d2, d3, d4;
+    for (int i = 0; i < 8; i++)
+        a[i] = in[i];
+    for (int i = 8; i < 25; i++)
+        a[i] = V();
+    a[8] = a[8] + 0x8000000000000001ULL;
+
+    for (int round = 0; round < 24; round++) {
+        // theta
+        c0 = a[0] ^ a[5] ^ a[10] ^ a[15] ^ a[20];
+        c1 = a[1] ^ a[6] ^ a[11] ^ a[16] ^ a[21];
+        c2 = a[2] ^ a[7] ^ a[12] ^ a[17] ^ a[22];
+        c3 = a[3] ^ a[8] ^ a[13] ^ a[18] ^ a[23];
+        c4 = a[4] ^ a[9] ^ a[14] ^ a[19] ^ a[24];
+        d0 = c4 ^ qrotl(c1, 1);
+        d1 = c0 ^ qrotl(c2, 1);
+        d2 = c1 ^ qrotl(c3, 1);
+        d3 = c2 ^ qrotl(c4, 1);
+        d4 = c3 ^ qrotl(c0, 1);
+
+        // rho and pi
+        b[0] = a[0] ^ d0;
+        b[1] = qrotl(a[6] ^ d1, 44);
+        b[2] = qrotl(a[12] ^ d2, 43);
+        b[3] = qrotl(a[18] ^ d3, 21);
+        b[4] = qrotl(a[24] ^ d4, 14);
+        b[5] = qrotl(a[3] ^ d3, 28);
+        b[6] = qrotl(a[9] ^ d4, 20);
+        b[7] = qrotl(a[10] ^ d0, 3);
+        b[8] = qrotl(a[16] ^ d1, 45);
+        b[9] = qrotl(a[22] ^ d2, 61);
+        b[10] = qrotl(a[1] ^ d1, 1);
+        b[11] = qrotl(a[7] ^ d2, 6);
+        b[12] = qrotl(a[13] ^ d3, 25);
+        b[13] = qrotl(a[19] ^ d4, 8);
+        b[14] = qrotl(a[20] ^ d0, 18);
+        b[15] = qrotl(a[4] ^ d4, 27);
+        b[16] = qrotl(a[5] ^ d0, 36);
+        b[17] = qrotl(a[11] ^ d1, 10);
+        b[18] = qrotl(a[17] ^ d2, 15);
+        b[19] = qrotl(a[23] ^ d3, 56);
+        b[20] = qrotl(a[2] ^ d2, 62);
+        b[21] = qrotl(a[8] ^ d3, 55);
+        b[22] = qrotl(a[14] ^ d4, 39);
+        b[23] = qrotl(a[15] ^ d0, 41);
+        b[24] = qrotl(a[21] ^ d1, 2);
+
+        // chi and iota
+        QUARK_KECCAK_CHI(0);
+        QUARK_KECCAK_CHI(5);
+        QUARK_KECCAK_CHI(10);
+        QUARK_KECCAK_CHI(15);
+        QUARK_KECCAK_CHI(20);
+        a[0] = a[0] ^ QUARK_KECCAK_RC[round];
+    }
+
+    for (int i = 0; i < 8; i++)
+        out[i] = a[i];
+}
+
+#undef QUARK_KECCAK_CHI
+
+/* Skein-512-512, 64-byte input */
+
+static const uint64_t QUARK_SKEIN_IV[8] = {
+    0x4903ADFF749C51CEULL, 0x0D95DE399746DF03ULL, 0x8FD1934127C79BCEULL, 0x9A255629FF352CB1ULL,
+    0x5DB62599DF6CA7B0ULL, 0xEABE394CA9D5C3F4ULL, 0x991112C71A75B523ULL, 0xAE18A40B660FCC33ULL};
+
+#define QUARK_SKEIN_INJECT(s)                \
+    do {                                     \
+        p[0] = p[0] + k[(s + 0) % 9];        \
+        p[1] = p[1] + k[(s + 1) % 9];        \
+        p[2] = p[2] + k[(s + 2) % 9];        \
+        p[3] = p[3] + k[(s + 3) % 9];        \
+        p[4] = p[4] + k[(s + 4) % 9];        \
+        p[5] = p[5] + k[(s + 5) % 9] + t[(s) % 3];     \
+        p[6] = p[6] + k[(s + 6) % 9] + t[(s + 1) % 3]; \
+        p[7] = p[7] + k[(s + 7) % 9] + (uint64_t)(s);  \
+    } while (0)
+
+#define QUARK_SKEIN_MIX(x, y, rc)            \
+    do {                                     \
+        p[x] = p[x] + p[y];                  \
+        p[y] = qrotl(p[y], rc) ^ p[x];       \
+    } while (0)
+
+/** Four Threefish rounds, with the rotation constants of the even or odd half of the key schedule period. */
+#define QUARK_SKEIN_ROUNDS(r0, r1, r2, r3, r4, r5, r6, r7, r8, r9, r10, r11, r12, r13, r14, r15) \
+    do {                                                                                         \
+        QUARK_SKEIN_MIX(0, 1, r0);                                                               \
+        QUARK_SKEIN_MIX(2, 3, r1);                                                               \
+        QUARK_SKEIN_MIX(4, 5, r2);                                                               \
+        QUARK_SKEIN_MIX(6, 7, r3);                                                               \
+        QUARK_SKEIN_MIX(2, 1, r4);                                                               \
+        QUARK_SKEIN_MIX(4, 7, r5);                                                               \
+        QUARK_SKEIN_MIX(6, 5, r6);                                                               \
+        QUARK_SKEIN_MIX(0, 3, r7);                                                               \
+        QUARK_SKEIN_MIX(4, 1, r8);                                                               \
+        QUARK_SKEIN_MIX(6, 3, r9);                                                               \
+        QUARK_SKEIN_MIX(0, 5, r10);                                                              \
+        QUARK_SKEIN_MIX(2, 7, r11);                                                              \
+        QUARK_SKEIN_MIX(6, 1, r12);                                                              \
+        QUARK_SKEIN_MIX(0, 7, r13);                                                              \
+        QUARK_SKEIN_MIX(2, 5, r14);                                                              \
+        QUARK_SKEIN_MIX(4, 3, r15);                                                              \
+    } while (0)
+
+#define QUARK_SKEIN_8(s)                                                                   \
+    do {                                                                                   \
+        QUARK_SKEIN_INJECT(s);                                                             \
+        QUARK_SKEIN_ROUNDS(46, 36, 19, 37, 33, 27, 14, 42, 17, 49, 36, 39, 44, 9, 54, 56); \
+        QUARK_SKEIN_INJECT(s + 1);                                                         \
+        QUARK_SKEIN_ROUNDS(39, 30, 34, 24, 13, 50, 10, 17, 25, 29, 39, 43, 8, 35, 56, 22); \
+    } while (0)
+
+/** One UBI block: h = Threefish-512(key h, tweak t0/t1)(m) ^ m */
+template <typename V>
+QUARK_INLINE void qskein_ubi(V h[8], const V m[8], uint64_t t0, uint64_t t1)
+{
+    const uint64_t t[3] = {t0, t1, t0 ^ t1};
+    V k[9], p[8];
+    k[8] = V() + 0x1BD11BDAA9FC1A22ULL;
+    for (int i = 0; i < 8; i++) {
+        k[i] = h[i];
+        k[8] = k[8] ^ h[i];
+        p[i] = m[i];
+    }
+    QUARK_SKEIN_8(0);
+    QUARK_SKEIN_8(2);
+    QUARK_SKEIN_8(4);
+    QUARK_SKEIN_8(6);
+    QUARK_SKEIN_8(8);
+    QUARK_SKEIN_8(10);
+    QUARK_SKEIN_8(12);
+    QUARK_SKEIN_8(14);
+    QUARK_SKEIN_8(16);
+    QUARK_SKEIN_INJECT(18);
+    for (int i = 0; i < 8; i++)
+        h[i] = p[i] ^ m[i];
+}
+
+#undef QUARK_SKEIN_8
+#undef QUARK_SKEIN_ROUNDS
+#undef QUARK_SKEIN_MIX
+#undef QUARK_SKEIN_INJECT
+
+template <typename V>
+QUARK_INLINE void qskein512(const V in[8], V out[8])
+{
+    V zero[8];
+    for (int i = 0; i < 8; i++) {
+        out[i] = V() + QUARK_SKEIN_IV[i];
+        zero[i] = V();
+    }
+    qskein_ubi(out, in, 64, (uint64_t)480 << 55);
+    qskein_ubi(out, zero, 8, (uint64_t)510 << 55);
+}
+
+/* JH-512, 64-byte input (bitsliced 64-bit variant of the sph code) */
+
+#define QUARK_JH_C(x) (((x) >> 56) | (((x) >> 40) & 0xFF00ULL) | (((x) >> 24) & 0xFF0000ULL) | \
+                       (((x) >> 8) & 0xFF000000ULL) | (((x) << 8) & 0xFF00000000ULL) |          \
+                       (((x) << 24) & 0xFF0000000000ULL) | (((x) << 40) & 0xFF000000000000ULL) | ((x) << 56))
+
+static const uint64_t QUARK_JH_IV[16] = {
+    QUARK_JH_C(0x6fd14b963e00aa17ULL), QUARK_JH_C(0x636a2e057a15d543ULL),
+    QUARK_JH_C(0x8a225e8d0c97ef0bULL), QUARK_JH_C(0xe9341259f2b3c361ULL),
+    QUARK_JH_C(0x891da0c1536f801eULL), QUARK_JH_C(0x2aa9056bea2b6d80ULL),
+    QUARK_JH_C(0x588eccdb2075baa6ULL), QUARK_JH_C(0xa90f3a76baf83bf7ULL),
+    QUARK_JH_C(0x0169e60541e34a69ULL), QUARK_JH_C(0x46b58a8e2e6fe65aULL),
+    QUARK_JH_C(0x1047a7d0c1843c24ULL), QUARK_JH_C(0x3b6e71b12d5ac199ULL),
+    QUARK_JH_C(0xcf57f6ec9db1f856ULL), QUARK_JH_C(0xa706887c5716b156ULL),
+    QUARK_JH_C(0xe3c2fcdfe68517fbULL), QUARK_JH_C(0x545a4678cc8cdd4bULL)};
+
+/** Round constants, four words per round (even hi/lo, odd hi/lo). */
+static const uint64_t QUARK_JH_RC[168] = {
+    QUARK_JH_C(0x72d5dea2df15f867ULL), QUARK_JH_C(0x7b84150ab7231557ULL),
+    QUARK_JH_C(0x81abd6904d5a87f6ULL), QUARK_JH_C(0x4e9f4fc5c3d12b40ULL),
+    QUARK_JH_C(0xea983ae05c45fa9cULL), QUARK_JH_C(0x03c5d29966b2999aULL),
+    QUARK_JH_C(0x660296b4f2bb538aULL), QUARK_JH_C(0xb556141a88dba231ULL),
+    QUARK_JH_C(0x03a35a5c9a190edbULL), QUARK_JH_C(0x403fb20a87c14410ULL),
+    QUARK_JH_C(0x1c051980849e951dULL), QUARK_JH_C(0x6f33ebad5ee7cddcULL),
+    QUARK_JH_C(0x10ba139202bf6b41ULL), QUARK_JH_C(0xdc786515f7bb27d0ULL),
+    QUARK_JH_C(0x0a2c813937aa7850ULL), QUARK_JH_C(0x3f1abfd2410091d3ULL),
+    QUARK_JH_C(0x422d5a0df6cc7e90ULL), QUARK_JH_C(0xdd629f9c92c097ceULL),
+    QUARK_JH_C(0x185ca70bc72b44acULL), QUARK_JH_C(0xd1df65d663c6fc23ULL),
+    QUARK_JH_C(0x976e6c039ee0b81aULL), QUARK_JH_C(0x2105457e446ceca8ULL),
+    QUARK_JH_C(0xeef103bb5d8e61faULL), QUARK_JH_C(0xfd9697b294838197ULL),
+    QUARK_JH_C(0x4a8e8537db03302fULL), QUARK_JH_C(0x2a678d2dfb9f6a95ULL),
+    QUARK_JH_C(0x8afe7381f8b8696cULL), QUARK_JH_C(0x8ac77246c07f4214ULL),
+    QUARK_JH_C(0xc5f4158fbdc75ec4ULL), QUARK_JH_C(0x75446fa78f11bb80ULL),
+    QUARK_JH_C(0x52de75b7aee488bcULL), QUARK_JH_C(0x82b8001e98a6a3f4ULL),
+    QUARK_JH_C(0x8ef48f33a9a36315ULL), QUARK_JH_C(0xaa5f5624d5b7f989ULL),
+    QUARK_JH_C(0xb6f1ed207c5ae0fdULL), QUARK_JH_C(0x36cae95a06422c36ULL),
+    QUARK_JH_C(0xce2935434efe983dULL), QUARK_JH_C(0x533af974739a4ba7ULL),
+    QUARK_JH_C(0xd0f51f596f4e8186ULL), QUARK_JH_C(0x0e9dad81afd85a9fULL),
+    QUARK_JH_C(0xa7050667ee34626aULL), QUARK_JH_C(0x8b0b28be6eb91727ULL),
+    QUARK_JH_C(0x47740726c680103fULL), QUARK_JH_C(0xe0a07e6fc67e487bULL),
+    QUARK_JH_C(0x0d550aa54af8a4c0ULL), QUARK_JH_C(0x91e3e79f978ef19eULL),
+    QUARK_JH_C(0x8676728150608dd4ULL), QUARK_JH_C(0x7e9e5a41f3e5b062ULL),
+    QUARK_JH_C(0xfc9f1fec4054207aULL), QUARK_JH_C(0xe3e41a00cef4c984ULL),
+    QUARK_JH_C(0x4fd794f59dfa95d8ULL), QUARK_JH_C(0x552e7e1124c354a5ULL),
+    QUARK_JH_C(0x5bdf7228bdfe6e28ULL), QUARK_JH_C(0x78f57fe20fa5c4b2ULL),
+    QUARK_JH_C(0x05897cefee49d32eULL), QUARK_JH_C(0x447e9385eb28597fULL),
+    QUARK_JH_C(0x705f6937b324314aULL), QUARK_JH_C(0x5e8628f11dd6e465ULL),
+    QUARK_JH_C(0xc71b770451b920e7ULL), QUARK_JH_C(0x74fe43e823d4878aULL),
+    QUARK_JH_C(0x7d29e8a3927694f2ULL), QUARK_JH_C(0xddcb7a099b30d9c1ULL),
+    QUARK_JH_C(0x1d1b30fb5bdc1be0ULL), QUARK_JH_C(0xda24494ff29c82bfULL),
+    QUARK_JH_C(0xa4e7ba31b470bfffULL), QUARK_JH_C(0x0d324405def8bc48ULL),
+    QUARK_JH_C(0x3baefc3253bbd339ULL), QUARK_JH_C(0x459fc3c1e0298ba0ULL),
+    QUARK_JH_C(0xe5c905fdf7ae090fULL), QUARK_JH_C(0x947034124290f134ULL),
+    QUARK_JH_C(0xa271b701e344ed95ULL), QUARK_JH_C(0xe93b8e364f2f984aULL),
+    QUARK_JH_C(0x88401d63a06cf615ULL), QUARK_JH_C(0x47c1444b8752afffULL),
+    QUARK_JH_C(0x7ebb4af1e20ac630ULL), QUARK_JH_C(0x4670b6c5cc6e8ce6ULL),
+    QUARK_JH_C(0xa4d5a456bd4fca00ULL), QUARK_JH_C(0xda9d844bc83e18aeULL),
+    QUARK_JH_C(0x7357ce453064d1adULL), QUARK_JH_C(0xe8a6ce68145c2567ULL),
+    QUARK_JH_C(0xa3da8cf2cb0ee116ULL), QUARK_JH_C(0x33e906589a94999aULL),
+    QUARK_JH_C(0x1f60b220c26f847bULL), QUARK_JH_C(0xd1ceac7fa0d18518ULL),
+    QUARK_JH_C(0x32595ba18ddd19d3ULL), QUARK_JH_C(0x509a1cc0aaa5b446ULL),
+    QUARK_JH_C(0x9f3d6367e4046bbaULL), QUARK_JH_C(0xf6ca19ab0b56ee7eULL),
+    QUARK_JH_C(0x1fb179eaa9282174ULL), QUARK_JH_C(0xe9bdf7353b3651eeULL),
+    QUARK_JH_C(0x1d57ac5a7550d376ULL), QUARK_JH_C(0x3a46c2fea37d7001ULL),
+    QUARK_JH_C(0xf735c1af98a4d842ULL), QUARK_JH_C(0x78edec209e6b6779ULL),
+    QUARK_JH_C(0x41836315ea3adba8ULL), QUARK_JH_C(0xfac33b4d32832c83ULL),
+    QUARK_JH_C(0xa7403b1f1c2747f3ULL), QUARK_JH_C(0x5940f034b72d769aULL),
+    QUARK_JH_C(0xe73e4e6cd2214ffdULL), QUARK_JH_C(0xb8fd8d39dc5759efULL),
+    QUARK_JH_C(0x8d9b0c492b49ebdaULL), QUARK_JH_C(0x5ba2d74968f3700dULL),
+    QUARK_JH_C(0x7d3baed07a8d5584ULL), QUARK_JH_C(0xf5a5e9f0e4f88e65ULL),
+    QUARK_JH_C(0xa0b8a2f436103b53ULL), QUARK_JH_C(0x0ca8079e753eec5aULL),
+    QUARK_JH_C(0x9168949256e8884fULL), QUARK_JH_C(0x5bb05c55f8babc4cULL),
+    QUARK_JH_C(0xe3bb3b99f387947bULL), QUARK_JH_C(0x75daf4d6726b1c5dULL),
+    QUARK_JH_C(0x64aeac28dc34b36dULL), QUARK_JH_C(0x6c34a550b828db71ULL),
+    QUARK_JH_C(0xf861e2f2108d512aULL), QUARK_JH_C(0xe3db643359dd75fcULL),
+    QUARK_JH_C(0x1cacbcf143ce3fa2ULL), QUARK_JH_C(0x67bbd13c02e843b0ULL),
+    QUARK_JH_C(0x330a5bca8829a175ULL), QUARK_JH_C(0x7f34194db416535cULL),
+    QUARK_JH_C(0x923b94c30e794d1eULL), QUARK_JH_C(0x797475d7b6eeaf3fULL),
+    QUARK_JH_C(0xeaa8d4f7be1a3921ULL), QUARK_JH_C(0x5cf47e094c232751ULL),
+    QUARK_JH_C(0x26a32453ba323cd2ULL), QUARK_JH_C(0x44a3174a6da6d5adULL),
+    QUARK_JH_C(0xb51d3ea6aff2c908ULL), QUARK_JH_C(0x83593d98916b3c56ULL),
+    QUARK_JH_C(0x4cf87ca17286604dULL), QUARK_JH_C(0x46e23ecc086ec7f6ULL),
+    QUARK_JH_C(0x2f9833b3b1bc765eULL), QUARK_JH_C(0x2bd666a5efc4e62aULL),
+    QUARK_JH_C(0x06f4b6e8bec1d436ULL), QUARK_JH_C(0x74ee8215bcef2163ULL),
+    QUARK_JH_C(0xfdc14e0df453c969ULL), QUARK_JH_C(0xa77d5ac406585826ULL),
+    QUARK_JH_C(0x7ec1141606e0fa16ULL), QUARK_JH_C(0x7e90af3d28639d3fULL),
+    QUARK_JH_C(0xd2c9f2e3009bd20cULL), QUARK_JH_C(0x5faace30b7d40c30ULL),
+    QUARK_JH_C(0x742a5116f2e03298ULL), QUARK_JH_C(0x0deb30d8e3cef89aULL),
+    QUARK_JH_C(0x4bc59e7bb5f17992ULL), QUARK_JH_C(0xff51e66e048668d3ULL),
+    QUARK_JH_C(0x9b234d57e6966731ULL), QUARK_JH_C(0xcce6a6f3170a7505ULL),
+    QUARK_JH_C(0xb17681d913326cceULL), QUARK_JH_C(0x3c175284f805a262ULL),
+    QUARK_JH_C(0xf42bcbb378471547ULL), QUARK_JH_C(0xff46548223936a48ULL),
+    QUARK_JH_C(0x38df58074e5e6565ULL), QUARK_JH_C(0xf2fc7c89fc86508eULL),
+    QUARK_JH_C(0x31702e44d00bca86ULL), QUARK_JH_C(0xf04009a23078474eULL),
+    QUARK_JH_C(0x65a0ee39d1f73883ULL), QUARK_JH_C(0xf75ee937e42c3abdULL),
+    QUARK_JH_C(0x2197b2260113f86fULL), QUARK_JH_C(0xa344edd1ef9fdee7ULL),
+    QUARK_JH_C(0x8ba0df15762592d9ULL), QUARK_JH_C(0x3c85f7f612dc42beULL),
+    QUARK_JH_C(0xd8a7ec7cab27b07eULL), QUARK_JH_C(0x538d7ddaaa3ea8deULL),
+    QUARK_JH_C(0xaa25ce93bd0269d8ULL), QUARK_JH_C(0x5af643fd1a7308f9ULL),
+    QUARK_JH_C(0xc05fefda174a19a5ULL), QUARK_JH_C(0x974d66334cfd216aULL),
+    QUARK_JH_C(0x35b49831db411570ULL), QUARK_JH_C(0xea1e0fbbedcd549bULL),
+    QUARK_JH_C(0x9ad063a151974072ULL), QUARK_JH_C(0xf6759dbf91476fe2ULL)};
+
+#undef QUARK_JH_C
+
+template <typename V>
+QUARK_INLINE void qjh_sb(V& x0, V& x1, V& x2, V& x3, uint64_t c)
+{
+    V tmp;
+    x3 = ~x3;
+    x0 = x0 ^ (c & ~x2);
+    tmp = c ^ (x0 & x1);
+    x0 = x0 ^ (x2 & x3);
+    x3 = x3 ^ (~x1 & x2);
+    x1 = x1 ^ (x0 & x2);
+    x2 = x2 ^ (x0 & ~x3);
+    x0 = x0 ^ (x1 | x3);
+    x3 = x3 ^ (x1 & x2);
+    x1 = x1 ^ (tmp & x0);
+    x2 = x2 ^ tmp;
+}
+
+template <typename V>
+QUARK_INLINE void qjh_lb(V& x0, V& x1, V& x2, V& x3, V& x4, V& x5, V& x6, V& x7)
+{
+    x4 = x4 ^ x1;
+    x5 = x5 ^ x2;
+    x6 = x6 ^ x3 ^ x0;
+    x7 = x7 ^ x0;
+    x0 = x0 ^ x5;
+    x1 = x1 ^ x6;
+    x2 = x2 ^ x7 ^ x4;
+    x3 = x3 ^ x4;
+}
+
+/** Swap adjacent n-bit groups of both halves of a 128-bit JH word (W0..W5 in sph). */
+template <typename V>
+QUARK_INLINE void qjh_wz(V& hi, V& lo, uint64_t c, int n)
+{
+    hi = ((hi >> n) & c) | ((hi & c) << n);
+    lo = ((lo >> n) & c) | ((lo & c) << n);
+}
+
+template <typename V>
+QUARK_INLINE void qjh_w6(V& hi, V& lo)
+{
+    V t = hi;
+    hi = lo;
+    lo = t;
+}
+
+#define QUARK_JH_WZ(c, n)                    \
+    do {                                     \
+        qjh_wz(h[2], h[3], c, n);            \
+        qjh_wz(h[6], h[7], c, n);            \
+        qjh_wz(h[10], h[11], c, n);          \
+        qjh_wz(h[14], h[15], c, n);          \
+    } while (0)
+
+#define QUARK_JH_W0 QUARK_JH_WZ(0x5555555555555555ULL, 1)
+#define QUARK_JH_W1 QUARK_JH_WZ(0x3333333333333333ULL, 2)
+#define QUARK_JH_W2 QUARK_JH_WZ(0x0F0F0F0F0F0F0F0FULL, 4)
+#define QUARK_JH_W3 QUARK_JH_WZ(0x00FF00FF00FF00FFULL, 8)
+#define QUARK_JH_W4 QUARK_JH_WZ(0x0000FFFF0000FFFFULL, 16)
+#define QUARK_JH_W5 QUARK_JH_WZ(0x00000000FFFFFFFFULL, 32)
+#define QUARK_JH_W6                          \
+    do {                                     \
+        qjh_w6(h[2], h[3]);                  \
+        qjh_w6(h[6], h[7]);                  \
+        qjh_w6(h[10], h[11]);                \
+        qjh_w6(h[14], h[15]);                \
+    } while (0)
+
+/** One round: h[2i] / h[2i+1] are the high / low halves of the sph state word hi. */
+#define QUARK_JH_SL(ro)                                                             \
+    do {                                                                            \
+        const uint64_t* c = QUARK_JH_RC + 4 * (r + ro);                             \
+        qjh_sb(h[0], h[4], h[8], h[12], c[0]);                                      \
+        qjh_sb(h[1], h[5], h[9], h[13], c[1]);                                      \
+        qjh_sb(h[2], h[6], h[10], h[14], c[2]);                                     \
+        qjh_sb(h[3], h[7], h[11], h[15], c[3]);                                     \
+        qjh_lb(h[0], h[4], h[8], h[12], h[2], h[6], h[10], h[14]);                  \
+        qjh_lb(h[1], h[5], h[9], h[13], h[3], h[7], h[11], h[15]);                  \
+        QUARK_JH_W##ro;                                                             \
+    } while (0)
+
+template <typename V>
+QUARK_INLINE void qjh_e8(V h[16])
+{
+    for (int r = 0; r < 42; r += 7) {
+        QUARK_JH_SL(0);
+        QUARK_JH_SL(1);
+        QUARK_JH_SL(2);
+        QUARK_JH_SL(3);
+        QUARK_JH_SL(4);
+        QUARK_JH_SL(5);
+        QUARK_JH_SL(6);
+    }
+}
+
+#undef QUARK_JH_SL
+#undef QUARK_JH_W6
+#undef QUARK_JH_W5
+#undef QUARK_JH_W4
+#undef QUARK_JH_W3
+#undef QUARK_JH_W2
+#undef QUARK_JH_W1
+#undef QUARK_JH_W0
+#undef QUARK_JH_WZ
+
+template <typename V>
+QUARK_INLINE void qjh512(const V in[8], V out[8])
+{
+    // The message fills the first block exactly; the second is the 0x80
+    // padding byte and the big-endian bit length (512) in its last word.
+    const uint64_t pad_len = 0x0002000000000000ULL;
+    V h[16];
+    for (int i = 0; i < 16; i++)
+        h[i] = V() + QUARK_JH_IV[i];
+
+    for (int i = 0; i < 8; i++)
+        h[i] = h[i] ^ in[i];
+    qjh_e8(h);
+    for (int i = 0; i < 8; i++)
+        h[8 + i] = h[8 + i] ^ in[i];
+
+    h[0] = h[0] ^ 0x80;
+    h[7] = h[7] ^ pad_len;
+    qjh_e8(h);
+    h[8] = h[8] ^ 0x80;
+    h[15] = h[15] ^ pad_len;
+
+    for (int i = 0; i < 8; i++)
+        out[i] = h[8 + i];
+}
+
+/* Groestl-512 has no bitsliced form here and runs per lane */
+
+/** Run sph groestl on the lanes selected by mask (all lanes if mask is null). */
+template <typename V, int W>
+QUARK_INLINE void qgroestl_lanes(const V in[8], V out[8], const V* mask)
+{
+    unsigned char bin[64], bout[64];
+    for (int k = 0; k < W; k++) {
+        if (mask && !(*mask)[k])
+            continue;
+        for (int i = 0; i < 8; i++)
+            WriteLE64(bin + 8 * i, in[i][k]);
+        quark_groestl512(bin, bout);
+        for (int i = 0; i < 8; i++)
+            out[i][k] = ReadLE64(bout + 8 * i);
+    }
+}
+
+template <typename V, int W>
+QUARK_INLINE bool qany(const V& mask)
+{
+    for (int k = 0; k < W; k++)
+        if (mask[k])
+            return true;
+    return false;
+}
+
+template <typename V, int W>
+QUARK_INLINE bool qall(const V& mask)
+{
+    for (int k = 0; k < W; k++)
+        if (!mask[k])
+            return false;
+    return true;
+}
+
+/** Quark chain over W lanes. input points at W inputs of N little-endian words each. */
+template <typename V, int W, int N>
+QUARK_INLINE void quark_lanes(const unsigned char* input, unsigned char* output)
+{
+    V m[N], h[8], a[8], b[8], mask;
+
+    for (int i = 0; i < N; i++)
+        for (int k = 0; k < W; k++)
+            m[i][k] = ReadLE64(input + k * N * 8 + 8 * i);
+
+    qblake512<V, N>(m, h);
+    qbmw512(h, a);
+
+    // groestl if bit set, skein otherwise
+    qbranch(a, mask);
+    if (!qall<V, W>(mask))
+        qskein512(a, b);
+    if (qany<V, W>(mask))
+        qgroestl_lanes<V, W>(a, b, &mask);
+
+    qgroestl_lanes<V, W>(b, h, NULL);
+    qjh512(h, a);
+
+    // blake if bit set, bmw otherwise
+    qbranch(a, mask);
+    if (qall<V, W>(mask)) {
+        qblake512<V, 8>(a, b);
+    } else if (!qany<V, W>(mask)) {
+        qbmw512(a, b);
+    } else {
+        qblake512<V, 8>(a, h);
+        qbmw512(a, b);
+        qselect(b, mask, h, b);
+    }
+
+    qkeccak512(b, h);
+    qskein512(h, a);
+
+    // keccak if bit set, jh otherwise
+    qbranch(a, mask);
+    if (qall<V, W>(mask)) {
+        qkeccak512(a, b);
+    } else if (!qany<V, W>(mask)) {
+        qjh512(a, b);
+    } else {
+        qkeccak512(a, h);
+        qjh512(a, b);
+        qselect(b, mask, h, b);
+    }
+
+    for (int k = 0; k < W; k++)
+        for (int i = 0; i < 4; i++)
+            WriteLE64(output + 32 * k + 8 * i, b[i][k]);
+}
+
+/** Multi-lane entry points; len must be 64 or 80 bytes. */
+static void quark_hash_2way(const unsigned char* input, size_t len, unsigned char* output)
+{
+    if (len == 80)
+        quark_lanes<quark_v2, 2, 10>(input, output);
+    else
+        quark_lanes<quark_v2, 2, 8>(input, output);
+}
+
+__attribute__((target("avx2"))) static void quark_hash_4way(const unsigned char* input, size_t len, unsigned char* output)
+{
+    if (len == 80)
+        quark_lanes<quark_v4, 4, 10>(input, output);
+    else
+        quark_lanes<quark_v4, 4, 8>(input, output);
+}
+
+#undef QUARK_INLINE
+
+QuarkBackend quark_detect_backend()
+{
+    unsigned int a, b, c, d;
+    asm volatile("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(1), "c"(0));
+    // AVX and OSXSAVE, then check that the OS saves the ymm registers
+    if ((c & ((1 << 28) | (1 << 27))) == ((1 << 28) | (1 << 27))) {
+        unsigned int xcr0_lo, xcr0_hi;
+        asm volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        if ((xcr0_lo & 6) == 6) {
+            asm volatile("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(7), "c"(0));
+            if (b & (1 << 5))
+                return QUARK_AVX2;
+        }
+    }
+    return QUARK_SSE2;
+}
+
+#else
+
+QuarkBackend quark_detect_backend()
+{
+    return QUARK_SCALAR;
+}
+
+#endif // __GNUC__ && __x86_64__
+
+/* ----------- Dispatch ------------------------------------------------------- */
+
+static QuarkBackend& quark_selected_backend()
+{
+    static QuarkBackend backend = quark_detect_backend();
+    return backend;
+}
+
+QuarkBackend quark_backend()
+{
+    return quark_selected_backend();
+}
+
+bool quark_set_backend(QuarkBackend backend)
+{
+    if (backend > quark_detect_backend())
+        return false;
+    quark_selected_backend() = backend;
+    return true;
+}
+
+const char* quark_backend_name(QuarkBackend backend)
+{
+    switch (backend) {
+    case QUARK_AVX2: return "avx2 4-way";
+    case QUARK_SSE2: return "sse2 2-way";
+    default: return "scalar";
+    }
+}
+
+void quark_hash_multi(const unsigned char* input, size_t len, size_t count, unsigned char* output)
+{
+    size_t i = 0;
+#ifdef HAVE_QUARK_MULTI
+    const QuarkBackend backend = quark_backend();
+    if (len == 64 || len == 80) {
+        if (backend >= QUARK_AVX2) {
+            for (; i + 4 <= count; i += 4)
+                quark_hash_4way(input + i * len, len, output + i * 32);
+        }
+        if (backend >= QUARK_SSE2) {
+            for (; i + 2 <= count; i += 2)
+                quark_hash_2way(input + i * len, len, output + i * 32);
+        }
+    }
+#endif
+    for (; i < count; i++)
+        quark_hash(input + i * len, len, output + i * 32);
+}
+
+bool quark_N_multi(void* input, const uint256& hashTarget, int* nHashesDone)
+{
+    static const int MAX_WAYS = 4;
+    unsigned char data[MAX_WAYS * 80];
+    unsigned char hash[MAX_WAYS * 32];
+    const int throughput = quark_backend();
+    const uint32_t n = ReadLE32((const unsigned char*)input + 76);
+
+    for (int i = 0; i < throughput; i++) {
+        memcpy(data + i * 80, input, 76);
+        WriteLE32(data + i * 80 + 76, n + i);
+    }
+    quark_hash_multi(data, 80, throughput, hash);
+    *nHashesDone = throughput;
+
+    for (int i = 0; i < throughput; i++) {
+        uint256 result;
+        memcpy(result.begin(), hash + i * 32, 32);
+        if (result <= hashTarget) {
+            WriteLE32((unsigned char*)input + 76, n + i);
+            return true;
+        }
+    }
+    return false;
+}
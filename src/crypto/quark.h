@@ -0,0 +1,54 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SIMPLICITY_CRYPTO_QUARK_H
+#define SIMPLICITY_CRYPTO_QUARK_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+class uint256;
+
+/**
+ * Multi-lane Quark engine.
+ *
+ * Hashes several inputs at once: blake, bmw, keccak, skein and jh run on all
+ * lanes together in SIMD registers, groestl runs per lane, and the three
+ * data-dependent branches of the chain are resolved with lane masks instead of
+ * per-header control flow. The widest backend the CPU supports is picked at
+ * runtime; the scalar backend is the sph reference chain.
+ */
+enum QuarkBackend {
+    QUARK_SCALAR = 1, //!< one input at a time through the sph reference code
+    QUARK_SSE2 = 2,   //!< two lanes per 128-bit vector
+    QUARK_AVX2 = 4,   //!< four lanes per 256-bit vector
+};
+
+/** Backend in use. Its value is the number of lanes hashed together. */
+QuarkBackend quark_backend();
+/** Select a backend (tests and benchmarks). Returns false if the CPU does not support it. */
+bool quark_set_backend(QuarkBackend backend);
+/** Best backend the running CPU supports. */
+QuarkBackend quark_detect_backend();
+/** Short name of a backend, for logging. */
+const char* quark_backend_name(QuarkBackend backend);
+
+/** Quark hash of a single input through the reference sph chain. */
+void quark_hash(const void* input, size_t len, unsigned char output[32]);
+
+/**
+ * Quark hash of count inputs of len bytes each, stored back to back at input.
+ * The 32-byte results are stored back to back at output. Only 64- and 80-byte
+ * inputs (digests and block headers) use the multi-lane kernels.
+ */
+void quark_hash_multi(const unsigned char* input, size_t len, size_t count, unsigned char* output);
+
+/**
+ * Mining helper mirroring scrypt_N_1_1_256_multi: hashes a batch of consecutive
+ * nonces of the 80-byte header at input. On success the winning nonce is written
+ * back into the header and true is returned. nHashesDone receives the batch size.
+ */
+bool quark_N_multi(void* input, const uint256& hashTarget, int* nHashesDone);
+
+#endif // SIMPLICITY_CRYPTO_QUARK_H
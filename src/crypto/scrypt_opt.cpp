@@ -34,6 +34,11 @@
 #include <inttypes.h>
 #include <stdio.h>
 
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 static bool HAVE_AVX2 = false;
 
 #if defined(__x86_64__)
@@ -860,14 +865,184 @@ bool scrypt_N_1_1_256_multi(void *input, uint256 hashTarget, int *nHashesDone, u
     return false;
 }
 
+/*
+ * Scratchpad pool. A scrypt² hash needs 128 MiB of scratchpad per lane, so
+ * buffers are kept and handed out again instead of being allocated for every
+ * header. Pages are placed on the NUMA node of the thread that first writes
+ * them, so a thread is given back the buffer it used last whenever possible.
+ * Buffers left idle are freed by scrypt_scratch_pool_trim.
+ */
+namespace {
+struct ScryptPoolEntry {
+    unsigned char *data;
+    size_t size;
+    std::thread::id owner;
+    std::chrono::steady_clock::time_point released;
+};
+
+std::mutex cs_scrypt_pool;
+std::vector<ScryptPoolEntry> vScryptPoolIdle;
+size_t nScryptPoolIdleBytes = 0;
+size_t nScryptPoolLimit = (size_t)512 << 20;
+}
+
+static size_t scrypt_scratch_size(int N, int ways)
+{
+    return (size_t)N * ways * 128 + 63;
+}
+
+ScryptScratchpad::ScryptScratchpad(int N, int ways) : data(NULL), size(scrypt_scratch_size(N, ways))
+{
+    const std::thread::id self = std::this_thread::get_id();
+    {
+        std::lock_guard<std::mutex> lock(cs_scrypt_pool);
+        int best = -1;
+        for (size_t i = 0; i < vScryptPoolIdle.size(); i++) {
+            if (vScryptPoolIdle[i].size != size)
+                continue;
+            best = i;
+            if (vScryptPoolIdle[i].owner == self)
+                break;
+        }
+        if (best >= 0) {
+            data = vScryptPoolIdle[best].data;
+            nScryptPoolIdleBytes -= size;
+            vScryptPoolIdle.erase(vScryptPoolIdle.begin() + best);
+            return;
+        }
+    }
+    data = (unsigned char *)malloc(size);
+}
+
+ScryptScratchpad::~ScryptScratchpad()
+{
+    if (!data)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(cs_scrypt_pool);
+        if (nScryptPoolIdleBytes + size <= nScryptPoolLimit) {
+            ScryptPoolEntry entry = {data, size, std::this_thread::get_id(), std::chrono::steady_clock::now()};
+            vScryptPoolIdle.push_back(entry);
+            nScryptPoolIdleBytes += size;
+            return;
+        }
+    }
+    free(data);
+}
+
+void scrypt_scratch_pool_limit(size_t nBytes)
+{
+    std::lock_guard<std::mutex> lock(cs_scrypt_pool);
+    nScryptPoolLimit = nBytes;
+    while (nScryptPoolIdleBytes > nScryptPoolLimit) {
+        free(vScryptPoolIdle.front().data);
+        nScryptPoolIdleBytes -= vScryptPoolIdle.front().size;
+        vScryptPoolIdle.erase(vScryptPoolIdle.begin());
+    }
+}
+
+void scrypt_scratch_pool_trim(int64_t nMaxIdleSeconds)
+{
+    const std::chrono::steady_clock::time_point cutoff = std::chrono::steady_clock::now() - std::chrono::seconds(nMaxIdleSeconds);
+    std::lock_guard<std::mutex> lock(cs_scrypt_pool);
+    for (size_t i = 0; i < vScryptPoolIdle.size();) {
+        if (vScryptPoolIdle[i].released <= cutoff) {
+            free(vScryptPoolIdle[i].data);
+            nScryptPoolIdleBytes -= vScryptPoolIdle[i].size;
+            vScryptPoolIdle.erase(vScryptPoolIdle.begin() + i);
+        } else {
+            i++;
+        }
+    }
+}
+
+int scrypt_batch_ways()
+{
+#if defined(HAVE_SCRYPT_6WAY)
+    if (HAVE_AVX2)
+        return 6;
+#endif
+#if defined(HAVE_SCRYPT_3WAY)
+    return 3;
+#else
+    return 1;
+#endif
+}
+
+/*
+ * Like the N-way kernels above, but every lane carries its own header and
+ * midstate. Only the memory-hard core is worth interleaving when verifying,
+ * so the PBKDF2 steps run one lane at a time.
+ */
+static void scrypt_N_1_1_256_lanes(const uint32_t *input,
+    uint32_t *output, const uint32_t *midstate, unsigned char *scratchpad, int N, int ways)
+{
+    uint32_t tstate[SCRYPT_BATCH_MAX_WAYS * 8], ostate[SCRYPT_BATCH_MAX_WAYS * 8];
+    uint32_t X[SCRYPT_BATCH_MAX_WAYS * 32] __attribute__((aligned(128)));
+    uint32_t *V;
+    int k;
+
+    V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~(uintptr_t)(63));
+
+    for (k = 0; k < ways; k++) {
+        memcpy(tstate + 8 * k, midstate + 8 * k, 32);
+        HMAC_SHA256_80_init(input + 20 * k, tstate + 8 * k, ostate + 8 * k);
+        PBKDF2_SHA256_80_128(tstate + 8 * k, ostate + 8 * k, input + 20 * k, X + 32 * k);
+    }
+
+#if defined(HAVE_SCRYPT_6WAY)
+    if (ways == 6)
+        scrypt_core_6way(X, V, N);
+    else
+#endif
+#if defined(HAVE_SCRYPT_3WAY)
+    if (ways == 3)
+        scrypt_core_3way(X, V, N);
+    else
+#endif
+        for (k = 0; k < ways; k++)
+            scrypt_core(X + 32 * k, V, N);
+
+    for (k = 0; k < ways; k++)
+        PBKDF2_SHA256_128_32(tstate + 8 * k, ostate + 8 * k, X + 32 * k, output + 8 * k);
+}
+
+bool scryptHashBatch(const void *input, char *output, int count, int N)
+{
+    const int ways = scrypt_batch_ways();
+    uint32_t data[SCRYPT_BATCH_MAX_WAYS * 20];
+    uint32_t midstate[SCRYPT_BATCH_MAX_WAYS * 8];
+    uint32_t dhash[SCRYPT_BATCH_MAX_WAYS * 8];
+    ScryptScratchpad scratch(N, ways);
+
+    memset(output, 0, (size_t)count * 32);
+    if (!scratch.get())
+        return false;
+
+    for (int i = 0; i < count; i += ways) {
+        const int n = (count - i < ways) ? count - i : ways;
+        for (int k = 0; k < ways; k++) {
+            // a short final batch repeats its last header in the spare lanes
+            const uint32_t *header = (const uint32_t *)input + 20 * (i + (k < n ? k : n - 1));
+            for (int j = 0; j < 20; j++)
+                data[20 * k + j] = be32dec(&header[j]);
+            sha256_init(midstate + 8 * k);
+            sha256_transform(midstate + 8 * k, data + 20 * k, 0);
+        }
+        scrypt_N_1_1_256_lanes(data, dhash, midstate, scratch.get(), N, ways);
+        memcpy(output + 32 * i, dhash, 32 * n);
+    }
+    return true;
+}
+
 bool scryptHash(const void *input, char *output, int N)
 {
     uint32_t midstate[8];
     uint32_t data[20];
-    unsigned char *scratchbuf = scrypt_buffer_alloc(N, false);
+    ScryptScratchpad scratch(N, 1);
 
     memset(output, 0, 32);
-    if (!scratchbuf)
+    if (!scratch.get())
         return false;
 
     for (int i = 0; i < 20; i++)
@@ -876,8 +1051,7 @@ bool scryptHash(const void *input, char *output, int N)
     sha256_init(midstate);
     sha256_transform(midstate, data, 0);
 
-    scrypt_N_1_1_256(data, (uint32_t*)output, midstate, scratchbuf, N);
+    scrypt_N_1_1_256(data, (uint32_t*)output, midstate, scratch.get(), N);
 
-    free(scratchbuf);
     return true;
 }
\ No newline at end of file
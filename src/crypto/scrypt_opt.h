@@ -24,6 +24,43 @@
 bool scrypt_N_1_1_256_multi(void *input, uint256 hashTarget, int *nHashesDone, unsigned char *scratchbuf, int N);
 
 bool scryptHash(const void *input, char *output, int N);
+
+/** Upper bound of scrypt_batch_ways(). */
+#define SCRYPT_BATCH_MAX_WAYS 6
+/** Number of headers scryptHashBatch interleaves on this CPU (6, 3 or 1). */
+int scrypt_batch_ways();
+/**
+ * Hash count 80-byte headers stored back to back at input, scrypt_batch_ways()
+ * of them at a time through one interleaved core. Each header has its own
+ * midstate, unlike scrypt_N_1_1_256_multi which hashes nonces of one header.
+ * The 32-byte results are stored back to back at output.
+ */
+bool scryptHashBatch(const void *input, char *output, int count, int N);
+
+/**
+ * Scratchpad for ways lanes of scrypt with parameter N, borrowed from a
+ * process-wide pool for the lifetime of the object. get() is NULL if the
+ * allocation failed.
+ */
+class ScryptScratchpad
+{
+public:
+    ScryptScratchpad(int N, int ways);
+    ~ScryptScratchpad();
+    unsigned char *get() const { return data; }
+
+private:
+    ScryptScratchpad(const ScryptScratchpad&);
+    ScryptScratchpad& operator=(const ScryptScratchpad&);
+
+    unsigned char *data;
+    size_t size;
+};
+
+/** Upper bound on the idle scratchpad memory the pool keeps for reuse. */
+void scrypt_scratch_pool_limit(size_t nBytes);
+/** Free the scratchpads that have been idle for nMaxIdleSeconds or longer, all of them for 0. */
+void scrypt_scratch_pool_trim(int64_t nMaxIdleSeconds);
 extern unsigned char *scrypt_buffer_alloc(int N, bool multiWay = true);
 extern "C" void scrypt_core(uint32_t *X, uint32_t *V, int N);
 void sha256_init(uint32_t *state);
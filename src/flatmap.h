@@ -0,0 +1,364 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_FLATMAP_H
+#define BITCOIN_FLATMAP_H
+
+#include "memusage.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <iterator>
+#include <new>
+#include <stddef.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Allocator of fixed-size nodes. Nodes are carved out of chunks that double
+ * in size, and freed nodes are recycled through a free list, so allocating
+ * is a pointer bump or pop and neighbouring entries share cache lines. A
+ * node never moves; all chunks go back to the heap at once in Clear().
+ */
+template <typename T>
+class CNodePool
+{
+private:
+    union Node {
+        Node* pNext;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type data;
+    };
+
+    enum {
+        MIN_CHUNK_NODES = 64,
+        MAX_CHUNK_NODES = 16384
+    };
+
+    std::vector<std::pair<Node*, size_t> > vChunks; //chunk, number of nodes in it
+    Node* pFree;
+    size_t nUsedInChunk; //nodes handed out of the last chunk
+    size_t nChunkUsage;
+
+public:
+    CNodePool() : pFree(NULL), nUsedInChunk(0), nChunkUsage(0) {}
+    CNodePool(const CNodePool&) = delete;
+    CNodePool& operator=(const CNodePool&) = delete;
+    ~CNodePool() { Clear(); }
+
+    void* Allocate()
+    {
+        if (pFree) {
+            Node* node = pFree;
+            pFree = node->pNext;
+            return node;
+        }
+        if (vChunks.empty() || nUsedInChunk == vChunks.back().second) {
+            size_t nNodes = vChunks.empty() ? (size_t)MIN_CHUNK_NODES : std::min<size_t>(MAX_CHUNK_NODES, vChunks.back().second * 2);
+            vChunks.reserve(vChunks.size() + 1);
+            vChunks.emplace_back(new Node[nNodes], nNodes);
+            nUsedInChunk = 0;
+            nChunkUsage += memusage::MallocUsage(nNodes * sizeof(Node));
+        }
+        return &vChunks.back().first[nUsedInChunk++];
+    }
+
+    void Free(void* p)
+    {
+        Node* node = static_cast<Node*>(p);
+        node->pNext = pFree;
+        pFree = node;
+    }
+
+    //! Release every chunk; the nodes must have been destroyed already
+    void Clear()
+    {
+        for (auto& chunk : vChunks)
+            delete[] chunk.first;
+        std::vector<std::pair<Node*, size_t> >().swap(vChunks);
+        pFree = NULL;
+        nUsedInChunk = 0;
+        nChunkUsage = 0;
+    }
+
+    size_t DynamicMemoryUsage() const
+    {
+        return nChunkUsage + memusage::DynamicUsage(vChunks);
+    }
+
+    void swap(CNodePool& other)
+    {
+        vChunks.swap(other.vChunks);
+        std::swap(pFree, other.pFree);
+        std::swap(nUsedInChunk, other.nUsedInChunk);
+        std::swap(nChunkUsage, other.nChunkUsage);
+    }
+};
+
+/**
+ * Hash map with open addressing and linear probing. The slot array only
+ * holds the full hash and a pointer to the entry, and the entries live in a
+ * CNodePool. A lookup therefore touches one or two cache lines of slots
+ * before the entry itself, and with the hash compared first the keys of
+ * other entries are almost never read.
+ *
+ * Unlike std::unordered_map, inserting may invalidate iterators, but the
+ * entries keep their address: references and pointers to them stay valid
+ * until they are erased, and an iterator still dereferences to its entry
+ * and can still be erased after a rehash. Erased slots are marked rather
+ * than emptied, so erasing at an iterator does not move other entries and
+ * the usual erase(it++) loop visits every entry once.
+ */
+template <typename K, typename T, typename Hash>
+class CFlatHashMap
+{
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+    typedef size_t size_type;
+
+private:
+    struct Slot {
+        size_t nHash;
+        value_type* p; //!< NULL for an empty (nHash 0) or erased (nHash 1) slot
+    };
+
+    enum {
+        MIN_SLOTS = 16
+    };
+
+    Hash hasher;
+    std::vector<Slot> vSlots; //!< power of two in size, at most 3/4 in use or erased
+    size_t nSize;
+    size_t nErased;
+    CNodePool<value_type> pool;
+
+    template <typename V>
+    class IteratorBase : public std::iterator<std::forward_iterator_tag, V>
+    {
+    private:
+        friend class CFlatHashMap;
+        template <typename W>
+        friend class IteratorBase;
+
+        const std::vector<Slot>* pslots;
+        size_t nSlot;
+        value_type* p;
+
+        IteratorBase(const std::vector<Slot>* pslotsIn, size_t nSlotIn) : pslots(pslotsIn), nSlot(nSlotIn) { Skip(); }
+
+        void Skip()
+        {
+            while (nSlot < pslots->size() && !(*pslots)[nSlot].p)
+                nSlot++;
+            p = nSlot < pslots->size() ? (*pslots)[nSlot].p : NULL;
+        }
+
+    public:
+        IteratorBase() : pslots(NULL), nSlot(0), p(NULL) {}
+
+        //! iterator converts to const_iterator
+        template <typename W, typename = typename std::enable_if<std::is_const<V>::value && !std::is_const<W>::value>::type>
+        IteratorBase(const IteratorBase<W>& it) : pslots(it.pslots), nSlot(it.nSlot), p(it.p)
+        {
+        }
+
+        V& operator*() const { return *p; }
+        V* operator->() const { return p; }
+        IteratorBase& operator++()
+        {
+            nSlot++;
+            Skip();
+            return *this;
+        }
+        IteratorBase operator++(int)
+        {
+            IteratorBase ret = *this;
+            ++*this;
+            return ret;
+        }
+        bool operator==(const IteratorBase& it) const { return p == it.p; }
+        bool operator!=(const IteratorBase& it) const { return p != it.p; }
+    };
+
+    //! 0 and 1 mark the empty and erased slots
+    size_t HashOf(const K& key) const
+    {
+        size_t nHash = hasher(key);
+        return nHash < 2 ? nHash + 2 : nHash;
+    }
+
+    //! Slot of key, or vSlots.size() if it is not in the map
+    size_t FindSlot(const K& key, size_t nHash) const
+    {
+        if (vSlots.empty())
+            return 0;
+        const size_t nMask = vSlots.size() - 1;
+        for (size_t i = nHash & nMask;; i = (i + 1) & nMask) {
+            const Slot& slot = vSlots[i];
+            if (slot.p) {
+                if (slot.nHash == nHash && slot.p->first == key)
+                    return i;
+            } else if (slot.nHash == 0) {
+                return vSlots.size();
+            }
+        }
+    }
+
+    //! First slot that is not in use on the probe sequence of nHash
+    size_t FreeSlot(size_t nHash) const
+    {
+        const size_t nMask = vSlots.size() - 1;
+        size_t i = nHash & nMask;
+        while (vSlots[i].p)
+            i = (i + 1) & nMask;
+        return i;
+    }
+
+    //! Size the slots for nMinSize entries at half load, and drop the erased slots
+    void Rehash(size_t nMinSize)
+    {
+        size_t nSlots = MIN_SLOTS;
+        while (nMinSize * 2 > nSlots)
+            nSlots *= 2;
+        std::vector<Slot> vOld(nSlots, Slot());
+        vOld.swap(vSlots);
+        nErased = 0;
+        for (const Slot& slot : vOld) {
+            if (slot.p)
+                vSlots[FreeSlot(slot.nHash)] = slot;
+        }
+    }
+
+    void EraseSlot(size_t i)
+    {
+        Slot& slot = vSlots[i];
+        slot.p->~value_type();
+        pool.Free(slot.p);
+        slot.p = NULL;
+        nSize--;
+        // No probe sequence continues past an empty successor, so the slot
+        // can be emptied rather than marked
+        if (!vSlots[(i + 1) & (vSlots.size() - 1)].p && vSlots[(i + 1) & (vSlots.size() - 1)].nHash == 0) {
+            slot.nHash = 0;
+        } else {
+            slot.nHash = 1;
+            nErased++;
+        }
+    }
+
+public:
+    typedef IteratorBase<value_type> iterator;
+    typedef IteratorBase<const value_type> const_iterator;
+
+    CFlatHashMap() : nSize(0), nErased(0) {}
+    CFlatHashMap(const CFlatHashMap&) = delete;
+    CFlatHashMap& operator=(const CFlatHashMap&) = delete;
+    ~CFlatHashMap() { clear(); }
+
+    iterator begin() { return iterator(&vSlots, 0); }
+    const_iterator begin() const { return const_iterator(&vSlots, 0); }
+    iterator end() { return iterator(); }
+    const_iterator end() const { return const_iterator(); }
+
+    size_type size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator find(const K& key)
+    {
+        size_t i = FindSlot(key, HashOf(key));
+        return i < vSlots.size() ? iterator(&vSlots, i) : end();
+    }
+
+    const_iterator find(const K& key) const
+    {
+        size_t i = FindSlot(key, HashOf(key));
+        return i < vSlots.size() ? const_iterator(&vSlots, i) : end();
+    }
+
+    size_type count(const K& key) const
+    {
+        return FindSlot(key, HashOf(key)) < vSlots.size() ? 1 : 0;
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value)
+    {
+        const size_t nHash = HashOf(value.first);
+        size_t i = FindSlot(value.first, nHash);
+        if (i < vSlots.size())
+            return std::make_pair(iterator(&vSlots, i), false);
+
+        if ((nSize + nErased + 1) * 4 > vSlots.size() * 3)
+            Rehash(nSize + 1);
+        i = FreeSlot(nHash);
+        void* p = pool.Allocate();
+        try {
+            vSlots[i].p = new (p) value_type(value);
+        } catch (...) {
+            pool.Free(p);
+            throw;
+        }
+        if (vSlots[i].nHash == 1)
+            nErased--;
+        vSlots[i].nHash = nHash;
+        nSize++;
+        return std::make_pair(iterator(&vSlots, i), true);
+    }
+
+    T& operator[](const K& key)
+    {
+        iterator it = find(key);
+        if (it != end())
+            return it->second;
+        return insert(value_type(key, T())).first->second;
+    }
+
+    void erase(const_iterator it)
+    {
+        size_t i = it.nSlot;
+        if (i >= vSlots.size() || vSlots[i].p != it.p)
+            i = FindSlot(it.p->first, HashOf(it.p->first)); // rehashed since
+        assert(i < vSlots.size());
+        EraseSlot(i);
+    }
+
+    size_type erase(const K& key)
+    {
+        size_t i = FindSlot(key, HashOf(key));
+        if (i == vSlots.size())
+            return 0;
+        EraseSlot(i);
+        return 1;
+    }
+
+    void clear()
+    {
+        for (Slot& slot : vSlots) {
+            if (slot.p)
+                slot.p->~value_type();
+        }
+        std::vector<Slot>().swap(vSlots);
+        pool.Clear();
+        nSize = 0;
+        nErased = 0;
+    }
+
+    void swap(CFlatHashMap& other)
+    {
+        std::swap(hasher, other.hasher);
+        vSlots.swap(other.vSlots);
+        std::swap(nSize, other.nSize);
+        std::swap(nErased, other.nErased);
+        pool.swap(other.pool);
+    }
+
+    //! Heap memory of the slots and the entry nodes, not counting what the entries own
+    size_t DynamicMemoryUsage() const
+    {
+        return memusage::DynamicUsage(vSlots) + pool.DynamicMemoryUsage();
+    }
+};
+
+#endif // BITCOIN_FLATMAP_H
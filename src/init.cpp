@@ -17,7 +17,10 @@
 #include "addrman.h"
 #include "amount.h"
 #include "checkpoints.h"
+#include "collateralindex.h"
 #include "compat/sanity.h"
+#include "crypto/quark.h"
+#include "crypto/scrypt_opt.h"
 #include "httpserver.h"
 #include "httprpc.h"
 #include "invalid.h"
@@ -30,6 +33,7 @@
 #include "miner.h"
 #include "net.h"
 #include "rpc/server.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
 #include "scheduler.h"
 #include "spork.h"
@@ -47,6 +51,7 @@
 #include "wallet/db.h"
 #include "wallet/wallet.h"
 #include "wallet/walletdb.h"
+#include "zspl/witnessstore.h"
 
 #endif
 
@@ -218,6 +223,16 @@ void PrepareShutdown()
     threadGroup.interrupt_all();
     threadGroup.join_all();
 
+#ifdef ENABLE_WALLET
+    // The witness worker reads the chain and the zerocoin database, stop it
+    // before they go away
+    if (pwitnessStore) {
+        UnregisterValidationInterface(pwitnessStore);
+        delete pwitnessStore;
+        pwitnessStore = NULL;
+    }
+#endif
+
     if (fFeeEstimatesInitialized) {
         boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
         CAutoFile est_fileout(fopen(est_path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
@@ -402,8 +417,11 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-maxreorg=<n>", strprintf(_("Set the Maximum reorg depth (default: %u)"), Params(CBaseChainParams::MAIN).MaxReorganizationDepth()));
+    strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
+    strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-scryptscratchmb=<n>", strprintf(_("Maximum memory in megabytes for scrypt² proof-of-work scratchpads during header sync (default: %u)"), DEFAULT_SCRYPT_SCRATCH_MB));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), "simplicityd.pid"));
 #endif
@@ -526,9 +544,15 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-logips", strprintf(_("Include IP addresses in debug output (default: %u)"), 0));
     strUsage += HelpMessageOpt("-logtimestamps", strprintf(_("Prepend debug output with timestamp (default: %u)"), 1));
     if (GetBoolArg("-help-debug", false)) {
+        strUsage += HelpMessageOpt("-limitancestorcount=<n>", strprintf("Do not accept transactions if number of in-mempool ancestors is <n> or more (default: %u)", DEFAULT_ANCESTOR_LIMIT));
+        strUsage += HelpMessageOpt("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT));
+        strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
+        strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf(_("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default:%u)"), 15));
         strUsage += HelpMessageOpt("-relaypriority", strprintf(_("Require high priority for relaying free or low-fee transactions (default:%u)"), 1));
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf(_("Limit size of signature cache to <n> entries (default: %u)"), 50000));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", _("Limit size of signature cache to <n> entries, unless -sigcachesize is given"));
+        strUsage += HelpMessageOpt("-sigcachesize=<n>", strprintf(_("Limit size of signature cache to <n> MiB (default: %u)"), DEFAULT_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxzspendcachesize=<n>", strprintf(_("Limit size of the verified zerocoin spend cache to <n> entries (default: %u)"), DEFAULT_MAX_ZSPEND_CACHE_SIZE));
     }
     strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in SPL/Kb) smaller than this are considered zero fee for relaying (default: %s)"), FormatMoney(::minRelayTxFee.GetFeePerK())));
@@ -674,6 +698,7 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
     // -reindex
     if (fReindex) {
         CImportingNow imp;
+        int64_t nStart = GetTimeMillis();
         int nFile = 0;
         while (true) {
             CDiskBlockPos pos(nFile, 0);
@@ -688,6 +713,8 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         }
         pblocktree->WriteReindexing(false);
         fReindex = false;
+        ClearPendingPoWHashes();
+        LogPrintf("Reindexing finished, %dms\n", GetTimeMillis() - nStart);
         LogPrintf("Reindexing finished\n");
         // To avoid ending up in a situation without genesis block, re-try initializing (no-op if reindexing worked):
         InitBlockIndex();
@@ -960,6 +987,15 @@ bool AppInit2()
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    // mempool limits
+    int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    int64_t nMempoolSizeMin = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000 * 40;
+    if (nMempoolSizeMax < 0 || nMempoolSizeMax < nMempoolSizeMin)
+        return InitError(strprintf(_("-maxmempool must be at least %d MB"), (nMempoolSizeMin + 999999) / 1000000));
+
+    nScryptScratchBytes = (size_t)std::max<int64_t>(GetArg("-scryptscratchmb", DEFAULT_SCRYPT_SCRATCH_MB), 128) << 20;
+    scrypt_scratch_pool_limit(nScryptScratchBytes);
+
     setvbuf(stdout, NULL, _IOLBF, 0); /// ***TODO*** do we still need this after -printtoconsole is gone?
 
     // Staking needs a CWallet instance, so make sure wallet is enabled
@@ -1086,6 +1122,7 @@ bool AppInit2()
 #ifdef ENABLE_WALLET
     LogPrintf("Using BerkeleyDB version %s\n", DbEnv::version(0, 0, 0));
 #endif
+    LogPrintf("Using %s Quark hashing\n", quark_backend_name(quark_backend()));
     if (!fLogTimestamps)
         LogPrintf("Startup time: %s\n", DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()));
     LogPrintf("Default data directory %s\n", GetDefaultDataDir().string());
@@ -1094,10 +1131,15 @@ bool AppInit2()
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
+    InitSignatureCache();
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        for (int i = 0; i < nScriptCheckThreads - 1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadZerocoinSpendCheck);
+            threadGroup.create_thread(&ThreadMessageSignatureCheck);
+            threadGroup.create_thread(&ThreadAccumulateCheck);
+        }
     }
 
     if (mapArgs.count("-sporkkey")) // spork priv key
@@ -1109,6 +1151,7 @@ bool AppInit2()
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    scheduler.scheduleEvery(boost::bind(&scrypt_scratch_pool_trim, SCRYPT_SCRATCH_IDLE_SECONDS), SCRYPT_SCRATCH_IDLE_SECONDS);
 
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
@@ -1433,7 +1476,7 @@ bool AppInit2()
     nTotalCache -= nBlockTreeDBCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    nCoinCacheUsage = nTotalCache; // the rest for the in-memory coins cache
 
     bool fLoaded = false;
     while (!fLoaded && !ShutdownRequested()) {
@@ -1454,6 +1497,13 @@ bool AppInit2()
                 delete zerocoinDB;
                 delete pSporkDB;
 
+                // Carry the PoW hashes of the block tree over a reindex, they only depend on the headers
+                std::vector<std::pair<uint256, uint256> > vPoWHashes;
+                if (fReindex) {
+                    CBlockTreeDB blocktreeOld(0, false, false);
+                    blocktreeOld.ReadPoWHashes(vPoWHashes);
+                }
+
                 //Simplicity specific: zerocoin and spork DB's
                 zerocoinDB = new CZerocoinDB(0, false, fReindex);
                 pSporkDB = new CSporkDB(0, false, false);
@@ -1463,8 +1513,13 @@ bool AppInit2()
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
-                if (fReindex)
+                if (fReindex) {
                     pblocktree->WriteReindexing(true);
+                    CachePoWHashes(vPoWHashes);
+                }
+
+                if (!pcoinsdbview->Upgrade(strLoadError))
+                    break;
 
                 // End loop if shutdown was requested
                 if (ShutdownRequested()) break;
@@ -1565,11 +1620,13 @@ bool AppInit2()
                     }
 
                     // Zerocoin must check at level 4
+                    const int64_t verify_start_time = GetTimeMillis();
                     if (!CVerifyDB().VerifyDB(pcoinsdbview, 4, GetArg("-checkblocks", 100))) { //MIN_BLOCKS_TO_KEEP
                         strLoadError = _("Corrupted block database detected");
                         fVerifyingBlocks = false;
                         break;
                     }
+                    LogPrintf(" verify blocks %15dms\n", GetTimeMillis() - verify_start_time);
                 }
             } catch (std::exception& e) {
                 if (fDebug) LogPrintf("%s\n", e.what());
@@ -1610,6 +1667,22 @@ bool AppInit2()
         return false;
     }
 
+    // Load the masternode collateral index from the coins of the tip
+    uiInterface.InitMessage(_("Loading collateral index..."));
+    {
+        const int64_t nStart = GetTimeMillis();
+        LOCK(cs_main);
+        FlushStateToDisk();
+        collateralIndex.Clear();
+        if (!pcoinsdbview->ForEachOutput([](const COutPoint& out, const CTxOut& txout, int nHeight) { collateralIndex.Add(out, txout.nValue, nHeight); })) {
+            if (ShutdownRequested())
+                return false;
+            return InitError(_("Error loading collateral index"));
+        }
+        collateralIndex.SetBestHeight(chainActive.Height());
+        LogPrintf(" collateral index %15dms, %u outputs\n", GetTimeMillis() - nStart, (unsigned int)collateralIndex.Size());
+    }
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1757,6 +1830,10 @@ bool AppInit2()
         pwalletMain->zsplTracker->Init();
         zwalletMain->LoadMintPoolFromDB();
         zwalletMain->SyncWithChain();
+
+        // Keep the witnesses of the zSPL mints up to date as blocks connect
+        pwitnessStore = new CWitnessStore(0);
+        RegisterValidationInterface(pwitnessStore);
     }  // (!fDisableWallet)
 #else  // ENABLE_WALLET
     LogPrintf("No wallet compiled in!\n");
@@ -1964,7 +2041,9 @@ bool AppInit2()
     if (GetBoolArg("-listenonion", DEFAULT_LISTEN_ONION))
         StartTorControl(threadGroup);
 
-    StartNode(threadGroup, scheduler);
+    std::string strNodeError;
+    if (!StartNode(threadGroup, scheduler, strNodeError))
+        return InitError(strNodeError);
 
     if (nLocalServices & NODE_BLOOM_LIGHT_ZC) {
         // Run a thread to compute witnesses
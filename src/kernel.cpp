@@ -8,6 +8,8 @@
 
 #include "db.h"
 #include "kernel.h"
+#include "crypto/common.h"
+#include "crypto/scrypt_opt.h"
 #include "script/interpreter.h"
 #include "timedata.h"
 #include "util.h"
@@ -15,6 +17,11 @@
 #include "utilmoneystr.h"
 #include "zsplchain.h"
 
+#include <atomic>
+#include <limits>
+
+#include <boost/thread.hpp>
+
 // v1 modifier interval.
 static const int64_t OLD_MODIFIER_INTERVAL = 2087; //60
 
@@ -397,6 +404,313 @@ bool Stake(const CBlockIndex* pindexPrev, CStakeInput* stakeInput, unsigned int
     return fSuccess;
 }
 
+CStakeKernelPrefix::CStakeKernelPrefix() : nTailSize(0), nSize(0), bnTarget(0)
+{
+    sha256_init(midstate);
+    memset(tail, 0, sizeof(tail));
+}
+
+CStakeKernelPrefix::CStakeKernelPrefix(const CDataStream& ssPrefix, const uint256& bnTargetIn) : bnTarget(bnTargetIn)
+{
+    const unsigned char* data = (const unsigned char*)&ssPrefix.begin()[0];
+    nSize = ssPrefix.size();
+    sha256_init(midstate);
+    size_t nHashed = 0;
+    for (; nHashed + 64 <= nSize; nHashed += 64) {
+        uint32_t block[16];
+        memcpy(block, data + nHashed, 64);
+        sha256_transform(midstate, block, 1);
+    }
+    nTailSize = nSize - nHashed;
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, data + nHashed, nTailSize);
+}
+
+/** Final blocks of the first SHA-256 of a kernel: the tail, the time and the padding */
+static void GetKernelFinalBlocks(const CStakeKernelPrefix& prefix, unsigned int nTimeTx, unsigned char blocks[128])
+{
+    memset(blocks, 0, 128);
+    memcpy(blocks, prefix.tail, prefix.nTailSize);
+    WriteLE32(blocks + prefix.nTailSize, nTimeTx);
+    blocks[prefix.nTailSize + 4] = 0x80;
+    WriteBE64(blocks + 64 * prefix.GetFinalBlocks() - 8, (prefix.nSize + 4) << 3);
+}
+
+/** The second SHA-256 of a kernel: the first digest, padded, in host order */
+static void GetKernelSecondBlock(const uint32_t digest[8], uint32_t block[16])
+{
+    memcpy(block, digest, 32);
+    block[8] = 0x80000000;
+    memset(block + 9, 0, 6 * 4);
+    block[15] = 256;
+}
+
+uint256 CStakeKernelPrefix::GetHash(unsigned int nTimeTx) const
+{
+    uint32_t blocks[32];
+    GetKernelFinalBlocks(*this, nTimeTx, (unsigned char*)blocks);
+    uint32_t state[8];
+    memcpy(state, midstate, 32);
+    for (int b = 0; b < GetFinalBlocks(); b++)
+        sha256_transform(state, blocks + 16 * b, 1);
+
+    uint32_t block[16];
+    GetKernelSecondBlock(state, block);
+    sha256_init(state);
+    sha256_transform(state, block, 0);
+
+    uint256 hash;
+    for (int i = 0; i < 8; i++)
+        WriteBE32(hash.begin() + 4 * i, state[i]);
+    return hash;
+}
+
+int StakeKernelLanes()
+{
+#if defined(HAVE_SHA256_4WAY)
+    static const int nLanes = sha256_use_4way() ? 4 : 1;
+    return nLanes;
+#else
+    return 1;
+#endif
+}
+
+/** Hash nCount (at most StakeKernelLanes()) kernels with the same number of final blocks at once */
+static void HashStakeKernels(const CStakeKernelPrefix* const* vPrefix, const unsigned int* vTime, int nCount, uint256* vHash)
+{
+#if defined(HAVE_SHA256_4WAY)
+    if (StakeKernelLanes() == 4) {
+        // Lane j of word i is at [4 * i + j]; unused lanes hash copies of the first kernel
+        alignas(16) uint32_t state[8 * 4];
+        alignas(16) uint32_t data[16 * 4];
+        uint32_t blocks[4][32];
+        for (int j = 0; j < 4; j++) {
+            int n = j < nCount ? j : 0;
+            GetKernelFinalBlocks(*vPrefix[n], vTime[n], (unsigned char*)blocks[j]);
+            for (int i = 0; i < 8; i++)
+                state[4 * i + j] = vPrefix[n]->midstate[i];
+        }
+        for (int b = 0; b < vPrefix[0]->GetFinalBlocks(); b++) {
+            for (int i = 0; i < 16; i++)
+                for (int j = 0; j < 4; j++)
+                    data[4 * i + j] = blocks[j][16 * b + i];
+            sha256_transform_4way(state, data, 1);
+        }
+
+        uint32_t init[8];
+        sha256_init(init);
+        for (int i = 0; i < 8; i++) {
+            for (int j = 0; j < 4; j++) {
+                data[4 * i + j] = state[4 * i + j];
+                state[4 * i + j] = init[i];
+            }
+        }
+        for (int i = 8; i < 16; i++)
+            for (int j = 0; j < 4; j++)
+                data[4 * i + j] = i == 8 ? 0x80000000 : (i == 15 ? 256 : 0);
+        sha256_transform_4way(state, data, 0);
+
+        for (int j = 0; j < nCount; j++)
+            for (int i = 0; i < 8; i++)
+                WriteBE32(vHash[j].begin() + 4 * i, state[4 * i + j]);
+        return;
+    }
+#endif
+    for (int j = 0; j < nCount; j++)
+        vHash[j] = vPrefix[j]->GetHash(vTime[j]);
+}
+
+//! Prefixes a search thread takes at a time
+static const size_t STAKE_SEARCH_RUN = 16;
+
+bool SearchStakeKernels(const std::vector<CStakeKernelPrefix>& vPrefixes, unsigned int nTimeFirst, unsigned int nTimeLast, int nThreads,
+                        size_t& nFound, unsigned int& nTimeFound, uint64_t* pnHashes, const std::function<bool()>& fInterrupt)
+{
+    const size_t NONE = std::numeric_limits<size_t>::max();
+    std::atomic<size_t> nNext(0);
+    std::atomic<size_t> nBest(NONE);
+    std::atomic<uint64_t> nHashes(0);
+    std::atomic<bool> fInterrupted(false);
+    // earliest hit of each prefix, written only by the thread that took its run
+    std::vector<unsigned int> vTimeHit(vPrefixes.size(), 0);
+
+    auto work = [&]() {
+        const int nLanes = StakeKernelLanes();
+        // kernels waiting for a free lane, by number of final blocks
+        std::vector<const CStakeKernelPrefix*> vPendingPrefix[2];
+        std::vector<unsigned int> vPendingTime[2];
+        std::vector<size_t> vPendingIndex[2];
+        uint256 vHash[4];
+
+        auto flush = [&](int b) {
+            if (vPendingPrefix[b].empty())
+                return;
+            HashStakeKernels(&vPendingPrefix[b][0], &vPendingTime[b][0], vPendingPrefix[b].size(), vHash);
+            nHashes += vPendingPrefix[b].size();
+            for (size_t j = 0; j < vPendingPrefix[b].size(); j++) {
+                size_t i = vPendingIndex[b][j];
+                if (vHash[j] >= vPendingPrefix[b][j]->bnTarget)
+                    continue;
+                if (!vTimeHit[i] || vPendingTime[b][j] < vTimeHit[i])
+                    vTimeHit[i] = vPendingTime[b][j];
+                size_t nBestNow = nBest;
+                while (i < nBestNow && !nBest.compare_exchange_weak(nBestNow, i)) {}
+            }
+            vPendingPrefix[b].clear();
+            vPendingTime[b].clear();
+            vPendingIndex[b].clear();
+        };
+
+        size_t nFirst;
+        while ((nFirst = nNext.fetch_add(STAKE_SEARCH_RUN)) < vPrefixes.size() && nFirst < nBest) {
+            if (fInterrupted || (fInterrupt && fInterrupt())) {
+                fInterrupted = true;
+                break;
+            }
+            size_t nLast = std::min(vPrefixes.size(), nFirst + STAKE_SEARCH_RUN);
+            for (size_t i = nFirst; i < nLast && i < nBest; i++) {
+                const CStakeKernelPrefix& prefix = vPrefixes[i];
+                int b = prefix.GetFinalBlocks() - 1;
+                // times go out in increasing order, so the first hit of a prefix is its earliest
+                for (uint64_t nTime = nTimeFirst; nTime <= nTimeLast && !vTimeHit[i]; nTime++) {
+                    vPendingPrefix[b].push_back(&prefix);
+                    vPendingTime[b].push_back(nTime);
+                    vPendingIndex[b].push_back(i);
+                    if ((int)vPendingPrefix[b].size() == nLanes)
+                        flush(b);
+                }
+            }
+            flush(0);
+            flush(1);
+        }
+    };
+
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads - 1; i++)
+        threads.create_thread(work);
+    work();
+    threads.join_all();
+
+    if (pnHashes)
+        *pnHashes = nHashes;
+    if (fInterrupted || nBest == NONE)
+        return false;
+    nFound = nBest;
+    nTimeFound = vTimeHit[nFound];
+    return true;
+}
+
+/** Kernel prefix data of a stake input, valid for one tip */
+struct CStakeKernelCacheEntry {
+    bool fValid;
+    int nHeightBlockFrom;
+    unsigned int nTimeBlockFrom;
+    CStakeKernelPrefix prefix;
+};
+
+static CCriticalSection cs_stakeKernelCache;
+static uint256 hashStakeKernelCacheTip;
+static std::map<uint256, CStakeKernelCacheEntry> mapStakeKernelCache; //hash of the stake uniqueness, prefix data
+
+/** Look up or build the kernel prefix of a stake input for the tip pindexPrev */
+static const CStakeKernelCacheEntry& GetStakeKernelCacheEntry(const CBlockIndex* pindexPrev, CStakeInput* stake)
+{
+    AssertLockHeld(cs_stakeKernelCache);
+    const CDataStream ssUniqueID = stake->GetUniqueness();
+    const uint256 hashUniqueID = Hash(ssUniqueID.begin(), ssUniqueID.end());
+    auto it = mapStakeKernelCache.find(hashUniqueID);
+    if (it != mapStakeKernelCache.end())
+        return it->second;
+
+    CStakeKernelCacheEntry& entry = mapStakeKernelCache[hashUniqueID];
+    entry.fValid = false;
+    CBlockIndex* pindexFrom = stake->GetIndexFrom();
+    if (!pindexFrom || pindexFrom->nHeight < 1)
+        return entry;
+    entry.nHeightBlockFrom = pindexFrom->nHeight;
+    entry.nTimeBlockFrom = pindexFrom->nTime;
+
+    // The same stream GetHashProofOfStake hashes, without nTimeTx
+    CDataStream ss(SER_GETHASH, 0);
+    if (!Params().IsStakeModifierV2(pindexPrev->nHeight + 1)) {
+        uint64_t nStakeModifier = 0;
+        if (!stake->GetModifier(nStakeModifier))
+            return entry;
+        ss << nStakeModifier;
+    } else {
+        ss << pindexPrev->nStakeModifierV2;
+    }
+    ss << entry.nTimeBlockFrom << ssUniqueID;
+    entry.prefix = CStakeKernelPrefix(ss, 0);
+    entry.fValid = true;
+    return entry;
+}
+
+bool StakeInputs(const CBlockIndex* pindexPrev, const std::vector<CStakeInput*>& vInputs, unsigned int nBits, unsigned int& nTimeTx, uint256& hashProofOfStake, size_t& nFound)
+{
+    if (CBlockHeader::CURRENT_VERSION == Params().WALLET_UPGRADE_VERSION() && chainActive.Height() + 1 < Params().WALLET_UPGRADE_BLOCK() && Params().NetworkID() == CBaseChainParams::MAIN)
+        return error("%s : INFO: staking on new wallet disabled until block %d", __func__, Params().WALLET_UPGRADE_BLOCK()); // Do not stake until the upgrade block
+
+    const int prevHeight = pindexPrev->nHeight;
+    const unsigned int nHashDrift = 60;
+    const unsigned int maxTime = std::min(nTimeTx + nHashDrift, Params().MaxFutureBlockTime(GetAdjustedTime(), true));
+    if (maxTime < nTimeTx)
+        return false;
+
+    uint256 bnTargetBase;
+    bnTargetBase.SetCompact(nBits);
+
+    // Prefixes of the inputs that are old enough, built once per tip
+    int64_t nTimeStart = GetTimeMicros();
+    std::vector<CStakeKernelPrefix> vPrefixes;
+    std::vector<size_t> vInputIndex;
+    {
+        LOCK(cs_stakeKernelCache);
+        if (hashStakeKernelCacheTip != pindexPrev->GetBlockHash()) {
+            mapStakeKernelCache.clear();
+            hashStakeKernelCacheTip = pindexPrev->GetBlockHash();
+        }
+        for (size_t i = 0; i < vInputs.size(); i++) {
+            const CStakeKernelCacheEntry& entry = GetStakeKernelCacheEntry(pindexPrev, vInputs[i]);
+            if (!entry.fValid)
+                continue;
+            // check for maturity (min age/depth) requirements
+            if (!Params().HasStakeMinAgeOrDepth(prevHeight + 1, nTimeTx, entry.nHeightBlockFrom, entry.nTimeBlockFrom)) {
+                LogPrint("staking", "%s : min age violation - height=%d - nTimeTx=%d, nTimeBlockFrom=%d, nHeightBlockFrom=%d\n",
+                    __func__, prevHeight + 1, nTimeTx, entry.nTimeBlockFrom, entry.nHeightBlockFrom);
+                continue;
+            }
+            vPrefixes.push_back(entry.prefix);
+            vPrefixes.back().bnTarget = bnTargetBase * (uint256(vInputs[i]->GetValue()) / 100);
+            vInputIndex.push_back(i);
+        }
+    }
+    int64_t nTimePrefixes = GetTimeMicros();
+
+    size_t nPrefixFound = 0;
+    unsigned int nTimeFound = 0;
+    uint64_t nHashes = 0;
+    bool fSuccess = SearchStakeKernels(vPrefixes, nTimeTx, maxTime, std::max(nScriptCheckThreads, 1), nPrefixFound, nTimeFound, &nHashes,
+        [prevHeight]() { return chainActive.Height() != prevHeight; });
+    int64_t nTimeSearch = GetTimeMicros();
+    LogPrint("staking", "%s : %u inputs, %u kernels hashed (%d lanes), prefixes %.2fms, search %.2fms\n", __func__, vPrefixes.size(), nHashes,
+        StakeKernelLanes(), 0.001 * (nTimePrefixes - nTimeStart), 0.001 * (nTimeSearch - nTimePrefixes));
+
+    // Recheck the kernel through the reference path, which also logs it
+    if (fSuccess) {
+        nFound = vInputIndex[nPrefixFound];
+        if (CheckStakeKernelHash(pindexPrev, nBits, vInputs[nFound], nTimeFound, hashProofOfStake)) {
+            nTimeTx = nTimeFound;
+        } else {
+            fSuccess = error("%s : kernel found at %d does not check", __func__, nTimeFound);
+        }
+    }
+
+    mapHashedBlocks.clear();
+    mapHashedBlocks[chainActive.Tip()->nHeight] = GetTime(); //store a time stamp of when we last hashed on this block
+    return fSuccess;
+}
+
 bool ContextualCheckZerocoinStake(int nPreviousBlockHeight, CStakeInput* stake)
 {
     if (nPreviousBlockHeight < Params().Zerocoin_Block_V2_Start())
@@ -10,6 +10,8 @@
 #include "main.h"
 #include "stakeinput.h"
 
+#include <functional>
+
 
 // MODIFIER_INTERVAL: time to elapse before new modifier is computed
 static const unsigned int MODIFIER_INTERVAL = 60;
@@ -23,6 +25,46 @@ bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int
 bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
 uint256 ComputeStakeModifier(const CBlockIndex* pindexPrev, const uint256& kernel);
 bool Stake(const CBlockIndex* pindexPrev, CStakeInput* stakeInput, unsigned int nBits, unsigned int& nTimeTx, uint256& hashProofOfStake);
+// Search the hash drift window of many stake inputs at once. Finds the same kernel as calling
+// Stake() on each input in turn: the first input with a hit (nFound), at its earliest time.
+bool StakeInputs(const CBlockIndex* pindexPrev, const std::vector<CStakeInput*>& vInputs, unsigned int nBits, unsigned int& nTimeTx, uint256& hashProofOfStake, size_t& nFound);
+
+/**
+ * The part of a kernel hash that does not depend on the coinstake time: the
+ * stake modifier, the time of the block the input is from and the input's
+ * uniqueness. It is hashed once; each time tried only hashes the last one or
+ * two blocks of the first SHA-256 and the second SHA-256.
+ */
+class CStakeKernelPrefix
+{
+public:
+    uint32_t midstate[8];     //!< SHA-256 state after the full 64-byte blocks of the prefix
+    unsigned char tail[64];   //!< the prefix bytes after those blocks
+    unsigned int nTailSize;
+    uint64_t nSize;           //!< length of the whole prefix
+    uint256 bnTarget;         //!< weighted target of the input
+
+    CStakeKernelPrefix();
+    CStakeKernelPrefix(const CDataStream& ssPrefix, const uint256& bnTargetIn);
+
+    //! Number of 64-byte blocks hashed per time: the tail, the time and the padding
+    int GetFinalBlocks() const { return nTailSize + 4 + 1 + 8 <= 64 ? 1 : 2; }
+    //! Kernel hash at nTimeTx, the same as Hash() of the prefix followed by nTimeTx
+    uint256 GetHash(unsigned int nTimeTx) const;
+};
+
+// Number of kernels the SHA-256 engine hashes together on this CPU (4 with SSE2 or NEON, else 1)
+int StakeKernelLanes();
+
+/**
+ * Hash every prefix at every time from nTimeFirst to nTimeLast, on nThreads
+ * threads taking runs of prefixes. nFound is set to the first prefix with a
+ * kernel under its target and nTimeFound to the earliest such time; prefixes
+ * after a hit are abandoned. Returns false if none hit or fInterrupt returned
+ * true. pnHashes receives the number of kernels hashed.
+ */
+bool SearchStakeKernels(const std::vector<CStakeKernelPrefix>& vPrefixes, unsigned int nTimeFirst, unsigned int nTimeLast, int nThreads,
+                        size_t& nFound, unsigned int& nTimeFound, uint64_t* pnHashes = NULL, const std::function<bool()>& fInterrupt = std::function<bool()>());
 
 // Initialize the stake input object
 bool initStakeInput(const CBlock block, std::unique_ptr<CStakeInput>& stake, int nPreviousBlockHeight);
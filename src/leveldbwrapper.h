@@ -168,6 +168,31 @@ public:
     {
         return pdb->NewIterator(iteroptions);
     }
+
+    //! Iterator over a consistent view of the database, from GetSnapshot()
+    leveldb::Iterator* NewIterator(const leveldb::Snapshot* snapshot) const
+    {
+        leveldb::ReadOptions options = iteroptions;
+        options.snapshot = snapshot;
+        return pdb->NewIterator(options);
+    }
+
+    //! The database as it is now, until ReleaseSnapshot()
+    const leveldb::Snapshot* GetSnapshot() const
+    {
+        return pdb->GetSnapshot();
+    }
+
+    void ReleaseSnapshot(const leveldb::Snapshot* snapshot) const
+    {
+        pdb->ReleaseSnapshot(snapshot);
+    }
+
+    //! Iterator for lookups; unlike NewIterator() it keeps what it reads in the block cache
+    leveldb::Iterator* NewLookupIterator() const
+    {
+        return pdb->NewIterator(readoptions);
+    }
 };
 
 #endif // BITCOIN_LEVELDBWRAPPER_H
@@ -43,7 +43,29 @@ Accumulator::Accumulator(const ZerocoinParams* p, const CoinDenomination d, cons
 
 void Accumulator::increment(const CBigNum& bnValue) {
     // Compute new accumulator = "old accumulator"^{element} mod N
-    this->value = this->value.pow_mod(bnValue, this->params->accumulatorModulus);
+    // Both are public, so the exponentiation does not need to run in constant time
+    this->value = this->value.pow_mod_public(bnValue, this->params->accumulatorModulus);
+}
+
+void Accumulator::increment(const std::vector<CBigNum>& vValues) {
+    if (vValues.empty())
+        return;
+
+    // Product tree: multiply neighbours level by level, so the operands of
+    // each multiplication stay about the same size
+    std::vector<CBigNum> vLevel(vValues);
+    while (vLevel.size() > 1) {
+        std::vector<CBigNum> vNext;
+        vNext.reserve((vLevel.size() + 1) / 2);
+        for (size_t i = 0; i + 1 < vLevel.size(); i += 2)
+            vNext.emplace_back(vLevel[i] * vLevel[i + 1]);
+        if (vLevel.size() % 2)
+            vNext.emplace_back(vLevel.back());
+        vLevel.swap(vNext);
+    }
+
+    // "old accumulator"^{e1}^{e2}... = "old accumulator"^{e1*e2*...} mod N
+    increment(vLevel[0]);
 }
 
 void Accumulator::accumulate(const PublicCoin& coin) {
@@ -70,6 +92,34 @@ void Accumulator::accumulate(const PublicCoin& coin) {
     }
 }
 
+void Accumulator::accumulate(const std::vector<PublicCoin>& coins) {
+    // Make sure we're initialized
+    if(!(this->value)) {
+        std::cout << "Accumulator is not initialized" << "\n";
+        throw std::runtime_error("Accumulator is not initialized");
+    }
+
+    std::vector<CBigNum> vValues;
+    vValues.reserve(coins.size());
+    for (const PublicCoin& coin : coins) {
+        if(this->denomination != coin.getDenomination()) {
+            std::cout << "Wrong denomination for coin. Expected coins of denomination: ";
+            std::cout << this->denomination;
+            std::cout << ". Instead, got a coin of denomination: ";
+            std::cout << coin.getDenomination();
+            std::cout << "\n";
+            throw std::runtime_error("Wrong denomination for coin");
+        }
+
+        if(!coin.validate()) {
+            std::cout << "Coin not valid\n";
+            throw std::runtime_error("Coin is not valid");
+        }
+        vValues.emplace_back(coin.getValue());
+    }
+    increment(vValues);
+}
+
 CoinDenomination Accumulator::getDenomination() const {
     return this->denomination;
 }
@@ -63,6 +63,26 @@ public:
     void accumulate(const PublicCoin &coin);
     void increment(const CBigNum& bnValue);
 
+    /**
+     * Accumulate several coins at once. Validates the coins prior to
+     * accumulation.
+     *
+     * @param coins   The PublicCoins to accumulate.
+     *
+     * @throw        Zerocoin exception if a coin is not valid.
+     *
+     **/
+    void accumulate(const std::vector<PublicCoin>& coins);
+
+    /**
+     * Raise the accumulator to the product of the values, multiplied
+     * pairwise first, in a single exponentiation. Same result as
+     * incrementing by each value in turn.
+     *
+     * @param vValues the coin values to add
+     */
+    void increment(const std::vector<CBigNum>& vValues);
+
     CoinDenomination getDenomination() const;
     /** Get the accumulator result
      *
@@ -145,6 +145,14 @@ public:
      */
     CBigNum pow_mod(const CBigNum& e, const CBigNum& m) const;
 
+    /**
+     * modular exponentiation without the constant-time guarantee of pow_mod.
+     * Only for public operands, such as accumulator values and pubcoins.
+     * @param e exponent
+     * @param m modulus
+     */
+    CBigNum pow_mod_public(const CBigNum& e, const CBigNum& m) const;
+
     /**
     * Calculates the inverse of this element mod m.
     * i.e. i such this*i = 1 mod m
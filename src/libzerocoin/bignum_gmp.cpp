@@ -245,6 +245,13 @@ CBigNum CBigNum::pow_mod(const CBigNum& e, const CBigNum& m) const
     return ret;
 }
 
+CBigNum CBigNum::pow_mod_public(const CBigNum& e, const CBigNum& m) const
+{
+    CBigNum ret;
+    mpz_powm (ret.bn, bn, e.bn, m.bn);
+    return ret;
+}
+
 /**
 * Calculates the inverse of this element mod m.
 * i.e. i such this*i = 1 mod m
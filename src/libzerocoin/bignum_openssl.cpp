@@ -373,6 +373,12 @@ CBigNum CBigNum::pow_mod(const CBigNum& e, const CBigNum& m) const
     return ret;
 }
 
+CBigNum CBigNum::pow_mod_public(const CBigNum& e, const CBigNum& m) const
+{
+    // BN_mod_exp only runs in constant time for operands flagged BN_FLG_CONSTTIME
+    return pow_mod(e, m);
+}
+
 /**
 * Calculates the inverse of this element mod m.
 * i.e. i such this*i = 1 mod m
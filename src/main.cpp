@@ -17,8 +17,11 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "collateralindex.h"
 #include "init.h"
 #include "kernel.h"
+#include "memusage.h"
+#include "mappedfile.h"
 #include "masternode-budget.h"
 #include "masternode-payments.h"
 #include "masternodeman.h"
@@ -62,6 +65,20 @@
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+
+/**
+ * PoW hashes of headers that passed CheckProofOfWork but have no block index
+ * entry yet. AddToBlockIndex moves them into CBlockIndex::hashProofOfWork, from
+ * where they are persisted with the block tree. Bounded, the oldest entries
+ * going first, except while reindexing when it also holds the hashes taken
+ * over from the old block tree. Each entry carries its sequence number in
+ * mapPendingPoWAge.
+ */
+static boost::unordered_map<uint256, std::pair<uint256, uint64_t>, BlockHasher> mapPendingPoWHash;
+static std::map<uint64_t, uint256> mapPendingPoWAge;
+static uint64_t nPendingPoWSequence = 0;
+static const unsigned int MAX_PENDING_POW_HASHES = 50000;
+
 //std::map<uint256, uint256> mapProofOfStake;
 std::map<unsigned int, unsigned int> mapHashedBlocks;
 CChain chainActive;
@@ -76,7 +93,7 @@ bool fTxIndex = true;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 bool fVerifyingBlocks = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fAlerts = DEFAULT_ALERTS;
 bool fClearSpendCache = false;
 
@@ -1005,6 +1022,23 @@ int GetInputAge(CTxIn& vin)
     }
 }
 
+int GetCollateralAge(const COutPoint& outpoint, CAmount& nValue)
+{
+    int nAge = collateralIndex.GetAge(outpoint, nValue);
+    LOCK(mempool.cs);
+    if (mempool.mapNextTx.count(outpoint))
+        return -1;
+    if (nAge >= 0)
+        return nAge;
+
+    // A collateral not yet confirmed, or back in the mempool after a reorg
+    CTransaction tx;
+    if (!mempool.lookup(outpoint.hash, tx) || outpoint.n >= tx.vout.size() || !CCollateralIndex::IsCollateralAmount(tx.vout[outpoint.n].nValue))
+        return -1;
+    nValue = tx.vout[outpoint.n].nValue;
+    return 0;
+}
+
 int GetIXConfirmations(uint256 nTXHash)
 {
     int sigs = 0;
@@ -1184,7 +1218,89 @@ bool ContextualCheckZerocoinSpendNoSerialCheck(const CTransaction& tx, const lib
     return true;
 }
 
-bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state)
+namespace {
+/**
+ * Valid zerocoin spend cache, to avoid verifying the proofs of a spend twice
+ * (once when accepted into memory pool, and again when its block arrives).
+ * Entries are keyed by a hash of the spend input, the transaction outputs it
+ * signs and what its proofs were checked against: the accumulator value for
+ * a private spend, the mint output for a public one.
+ */
+class CZerocoinSpendCache
+{
+private:
+    std::set<uint256> setValid;
+    boost::shared_mutex cs_spendcache;
+
+public:
+    bool Get(const uint256& hash)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_spendcache);
+        return setValid.count(hash) != 0;
+    }
+
+    void Set(const uint256& hash)
+    {
+        int64_t nMaxCacheSize = GetArg("-maxzspendcachesize", DEFAULT_MAX_ZSPEND_CACHE_SIZE);
+        if (nMaxCacheSize <= 0) return;
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_spendcache);
+
+        while (static_cast<int64_t>(setValid.size()) >= nMaxCacheSize) {
+            // Evict a random entry, as the signature cache does
+            std::set<uint256>::iterator it = setValid.lower_bound(GetRandHash());
+            if (it == setValid.end())
+                it = setValid.begin();
+            setValid.erase(it);
+        }
+        setValid.insert(hash);
+    }
+};
+
+CZerocoinSpendCache zerocoinSpendCache;
+} // anon namespace
+
+static uint256 PrivateSpendCacheKey(const CTxIn& txin, const uint256& hashTxOut, const CBigNum& bnAccumulatorValue, bool fV1Params)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << 'v' << txin << hashTxOut << bnAccumulatorValue << fV1Params;
+    return ss.GetHash();
+}
+
+static uint256 PublicSpendCacheKey(const CTransaction& tx, const CTxIn& txin, const uint256& hashTxOut, const CTxOut& prevOut)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << 'p' << txin << hashTxOut << tx.nVersion << tx.nLockTime << prevOut;
+    return ss.GetHash();
+}
+
+bool CZerocoinSpendCheck::operator()()
+{
+    if (ptxTo) {
+        libzerocoin::ZerocoinParams* params = Params().Zerocoin_Params(false);
+        PublicCoinSpend ret(params);
+        if (!ZSPLModule::validateInput(ptxTo->vin[nIn], prevOut, *ptxTo, ret))
+            return error("CheckZerocoinSpend(): public zerocoin spend did not verify");
+    } else {
+        //Check that the coin has been accumulated
+        if (!spend->Verify(*accumulator))
+            return error("CheckZerocoinSpend(): zerocoin spend did not verify");
+    }
+    zerocoinSpendCache.Set(hashCache);
+    return true;
+}
+
+static CCheckQueue<CZerocoinSpendCheck> zerocoincheckqueue(4, MAX_SCRIPTCHECK_THREADS);
+//! Held by the single user of zerocoincheckqueue; CheckBlock runs on several threads
+static CCriticalSection cs_zerocoincheckqueue;
+
+void ThreadZerocoinSpendCheck()
+{
+    RenameThread("simplicity-zspendch");
+    zerocoincheckqueue.Thread();
+}
+
+bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvSpendChecks)
 {
     //max needed non-mint outputs should be 2 - one for redemption address and a possible 2nd for change
     if (tx.vout.size() > 2) {
@@ -1208,7 +1324,8 @@ bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidati
     bool fValidated = false;
     std::set<CBigNum> serials;
     CAmount nTotalRedeemed = 0;
-    for (const CTxIn& txin : tx.vin) {
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        const CTxIn& txin = tx.vin[i];
 
         //only check txin that is a zcspend
         bool isPublicSpend = txin.IsZerocoinPublicSpend();
@@ -1244,10 +1361,15 @@ bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidati
             return state.DoS(100, error("Zerocoinspend does not use the same txout that was used in the SoK"));
 
         if (isPublicSpend) {
-            libzerocoin::ZerocoinParams* params = Params().Zerocoin_Params(false);
-            PublicCoinSpend ret(params);
-            if (!ZSPLModule::validateInput(txin, prevOut, tx, ret)){
-                return state.DoS(100, error("CheckZerocoinSpend(): public zerocoin spend did not verify"));
+            uint256 hashCache = PublicSpendCacheKey(tx, txin, hashTxOut, prevOut);
+            if (!zerocoinSpendCache.Get(hashCache)) {
+                CZerocoinSpendCheck check(tx, i, prevOut, hashCache);
+                if (pvSpendChecks) {
+                    pvSpendChecks->push_back(CZerocoinSpendCheck());
+                    check.swap(pvSpendChecks->back());
+                } else if (!check()) {
+                    return state.DoS(100, error("CheckZerocoinSpend(): public zerocoin spend did not verify"));
+                }
             }
         } else
             // Skip signature verification during initial block download
@@ -1259,12 +1381,19 @@ bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidati
                     return state.DoS(100, error("%s: Zerocoinspend could not find accumulator associated with checksum %s", __func__, HexStr(BEGIN(nChecksum), END(nChecksum))));
                 }
 
-                libzerocoin::Accumulator accumulator(Params().Zerocoin_Params(chainActive.Height() < Params().Zerocoin_Block_V2_Start()),
-                                        newSpend.getDenomination(), bnAccumulatorValue);
-
-                //Check that the coin has been accumulated
-                if(!newSpend.Verify(accumulator))
+                bool fV1Params = chainActive.Height() < Params().Zerocoin_Block_V2_Start();
+                uint256 hashCache = PrivateSpendCacheKey(txin, hashTxOut, bnAccumulatorValue, fV1Params);
+                if (!zerocoinSpendCache.Get(hashCache)) {
+                    libzerocoin::Accumulator accumulator(Params().Zerocoin_Params(fV1Params),
+                                            newSpend.getDenomination(), bnAccumulatorValue);
+                    CZerocoinSpendCheck check(newSpend, accumulator, hashCache);
+                    if (pvSpendChecks) {
+                        pvSpendChecks->push_back(CZerocoinSpendCheck());
+                        check.swap(pvSpendChecks->back());
+                    } else if (!check()) {
                         return state.DoS(100, error("CheckZerocoinSpend(): zerocoin spend did not verify"));
+                    }
+                }
             }
 
         if (serials.count(newSpend.getCoinSerialNumber()))
@@ -1284,7 +1413,7 @@ bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidati
     return fValidated;
 }
 
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state)
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvSpendChecks)
 {
     // Basic checks that don't depend on any context
     if (tx.vin.empty())
@@ -1380,7 +1509,7 @@ bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fReject
 
             // Do not require signature verification if this is initial sync and a block over 24 hours old
             bool fVerifySignature = !IsInitialBlockDownload() && (GetTime() - chainActive.Tip()->GetBlockTime() < (60*60*24));
-            if (!CheckZerocoinSpend(tx, fVerifySignature, state))
+            if (!CheckZerocoinSpend(tx, fVerifySignature, state, pvSpendChecks))
                 return state.DoS(100, error("CheckTransaction() : invalid zerocoin spend"));
         }
     }
@@ -1479,6 +1608,15 @@ std::string FormatStateMessage(const CValidationState &state)
         state.GetRejectCode());
 }
 
+static void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+{
+    int expired = pool.Expire(GetTime() - age);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    pool.TrimToSize(limit);
+}
+
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
 {
     AssertLockHeld(cs_main);
@@ -1737,6 +1875,23 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                     __func__, hash.ToString(), nFees, ::minRelayTxFee.GetFee(nSize) * 10000);
         }
 
+        // A full pool only takes transactions that pay more than what it evicted
+        if (!hasZcSpendInputs && !mapObfuscationBroadcastTxes.count(hash)) {
+            CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+            if (mempoolRejectFee > 0 && nFees < mempoolRejectFee)
+                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
+        }
+
+        // Calculate in-mempool ancestors, up to a limit.
+        CTxMemPool::setEntries setAncestors;
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+        std::string errString;
+        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString))
+            return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true)) {
@@ -1758,7 +1913,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         }
 
         // Store transaction in memory
-        pool.addUnchecked(hash, entry);
+        pool.addUnchecked(hash, entry, setAncestors);
+
+        // Trim the pool, and tell the sender if this one did not stay
+        LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     SyncWithWallets(tx, nullptr);
@@ -1982,6 +2142,43 @@ bool GetOutput(const uint256& hash, unsigned int index, CValidationState& state,
     return true;
 }
 
+static CMappedFileCache mappedBlockFiles(MAX_MAPPED_BLOCK_FILES);
+
+/**
+ * The record at pos in a block or undo file, with nTrailer more bytes after
+ * it, from a map of the file. The record is found by the magic and size that
+ * are written ahead of it. Only the files left for a newer one are mapped:
+ * they are not truncated any more, and an undo file that still grows is
+ * mapped again once a record is past the end of its map. Returns NULL, for
+ * the caller to read the file instead, if there is no such map.
+ */
+static std::shared_ptr<const CMappedFile> MapDiskRecord(const CDiskBlockPos& pos, const char* prefix, unsigned int nTrailer, const char*& pbegin, const char*& pend)
+{
+    static const unsigned int nHeaderSize = MESSAGE_START_SIZE + sizeof(unsigned int);
+    {
+        LOCK(cs_LastBlockFile);
+        if (pos.IsNull() || pos.nFile >= nLastBlockFile || pos.nPos < nHeaderSize)
+            return std::shared_ptr<const CMappedFile>();
+    }
+
+    const boost::filesystem::path path = GetBlockPosFilename(pos, prefix);
+    std::shared_ptr<const CMappedFile> pfile = mappedBlockFiles.Get(path, pos.nPos);
+    if (!pfile)
+        return pfile;
+    const unsigned char* pheader = (const unsigned char*)pfile->data() + pos.nPos - nHeaderSize;
+    if (memcmp(pheader, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+        return std::shared_ptr<const CMappedFile>();
+    const uint64_t nEnd = (uint64_t)pos.nPos + ReadLE32(pheader + MESSAGE_START_SIZE) + nTrailer;
+    if (nEnd > pfile->size()) {
+        pfile = mappedBlockFiles.Get(path, nEnd);
+        if (!pfile)
+            return pfile;
+    }
+    pbegin = pfile->data() + pos.nPos;
+    pend = pfile->data() + nEnd;
+    return pfile;
+}
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock, bool fAllowSlow, CBlockIndex* blockIndex)
 {
@@ -1997,14 +2194,23 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
         if (fTxIndex) {
             CDiskTxPos postx;
             if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
                 CBlockHeader header;
                 try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
+                    const char *pbegin, *pend;
+                    std::shared_ptr<const CMappedFile> pfile = MapDiskRecord(postx, "blk", 0, pbegin, pend);
+                    if (pfile) {
+                        CMemoryReader reader(pbegin, pend, SER_DISK, CLIENT_VERSION);
+                        reader >> header;
+                        reader.ignore(postx.nTxOffset);
+                        reader >> txOut;
+                    } else {
+                        CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+                        if (file.IsNull())
+                            return error("%s: OpenBlockFile failed", __func__);
+                        file >> header;
+                        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                        file >> txOut;
+                    }
                 } catch (std::exception& e) {
                     return error("%s : Deserialize or I/O error - %s", __func__, e.what());
                 }
@@ -2074,18 +2280,22 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+static bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, uint256 hashPoW)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk : OpenBlockFile failed");
-
-    // Read block
+    // Read block, from the map of the file or else from the file
     try {
-        filein >> block;
+        const char *pbegin, *pend;
+        std::shared_ptr<const CMappedFile> pfile = MapDiskRecord(pos, "blk", 0, pbegin, pend);
+        if (pfile) {
+            CMemoryReader(pbegin, pend, SER_DISK, CLIENT_VERSION) >> block;
+        } else {
+            CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("ReadBlockFromDisk : OpenBlockFile failed");
+            filein >> block;
+        }
     } catch (std::exception& e) {
         return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
@@ -2095,15 +2305,21 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 
     // Check the header
     // treat PoW and PoS blocks the same - don't waste time on redundant PoW checks that won't catch invalid PoS blocks anyway
-    if (block.IsProofOfWork() && CBlockHeader::GetAlgo(block.nVersion) != POW_SCRYPT_SQUARED && !CheckProofOfWork(&block))
+    if (block.IsProofOfWork() && CBlockHeader::GetAlgo(block.nVersion) != POW_SCRYPT_SQUARED && !CheckProofOfWork(&block, hashPoW))
         return error("ReadBlockFromDisk : Errors in block header");
 
     return true;
 }
 
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+{
+    return ReadBlockFromDisk(block, pos, uint256());
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
+    // The hash comparison below ties the header read to the index entry, so its cached PoW hash applies
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), pindex->hashProofOfWork))
         return false;
     if (block.GetHash() != pindex->GetBlockHash()) {
         LogPrintf("%s : block=%s index=%s\n", __func__, block.GetHash().GetHex(), pindex->GetBlockHash().GetHex());
@@ -2112,6 +2328,95 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+/**
+ * Blocks recently read without deserializing them, most recently used first.
+ * Peers syncing from us ask for the same blocks at about the same time, so a
+ * few megabytes answer most of their requests.
+ */
+class CRawBlockCache
+{
+private:
+    typedef std::list<std::pair<uint256, CRawBlockRef> > list_type;
+
+    CCriticalSection cs;
+    list_type listBlocks;
+    boost::unordered_map<uint256, list_type::iterator, BlockHasher> mapBlocks;
+    size_t nSize;
+
+public:
+    CRawBlockCache() : nSize(0) {}
+
+    CRawBlockRef Get(const uint256& hash)
+    {
+        LOCK(cs);
+        auto it = mapBlocks.find(hash);
+        if (it == mapBlocks.end())
+            return CRawBlockRef();
+        listBlocks.splice(listBlocks.begin(), listBlocks, it->second);
+        return it->second->second;
+    }
+
+    void Put(const uint256& hash, const CRawBlockRef& pblock)
+    {
+        if (pblock->size() > MAX_RAW_BLOCK_CACHE_SIZE)
+            return;
+        LOCK(cs);
+        if (mapBlocks.count(hash))
+            return;
+        listBlocks.emplace_front(hash, pblock);
+        mapBlocks.emplace(hash, listBlocks.begin());
+        nSize += pblock->size();
+        while (nSize > MAX_RAW_BLOCK_CACHE_SIZE) {
+            nSize -= listBlocks.back().second->size();
+            mapBlocks.erase(listBlocks.back().first);
+            listBlocks.pop_back();
+        }
+    }
+};
+
+static CRawBlockCache rawBlockCache;
+
+bool ReadRawBlockFromDisk(CRawBlockRef& pblock, const CBlockIndex* pindex)
+{
+    const uint256 hash = pindex->GetBlockHash();
+    pblock = rawBlockCache.Get(hash);
+    if (pblock)
+        return true;
+
+    const CDiskBlockPos pos = pindex->GetBlockPos();
+    const char *pbegin, *pend;
+    std::shared_ptr<const CMappedFile> pfile = MapDiskRecord(pos, "blk", 0, pbegin, pend);
+    if (pfile) {
+        pblock = std::make_shared<std::vector<char> >(pbegin, pend);
+        rawBlockCache.Put(hash, pblock);
+        return true;
+    }
+
+    // The block follows the network magic and its size, as WriteBlockToDisk put them
+    if (pos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("%s : no block at file %d, position %u", __func__, pos.nFile, pos.nPos);
+    CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - MESSAGE_START_SIZE - sizeof(unsigned int)), true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("ReadRawBlockFromDisk : OpenBlockFile failed");
+
+    std::shared_ptr<std::vector<char> > pvch;
+    try {
+        unsigned char pchMessageStart[MESSAGE_START_SIZE];
+        unsigned int nSize;
+        filein >> FLATDATA(pchMessageStart) >> nSize;
+        if (memcmp(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0 || nSize < 80 || nSize > MAX_BLOCK_SIZE_CURRENT)
+            return error("%s : no block at file %d, position %u", __func__, pos.nFile, pos.nPos);
+        pvch = std::make_shared<std::vector<char> >(nSize);
+        filein.read(pvch->data(), nSize);
+    } catch (std::exception& e) {
+        return error("%s : I/O error - %s", __func__, e.what());
+    }
+
+    pblock = pvch;
+    rawBlockCache.Put(hash, pblock);
+    return true;
+}
+
 
 double ConvertBitsToDouble(unsigned int nBits)
 {
@@ -2338,6 +2643,8 @@ void Misbehaving(NodeId pnode, int howmuch)
     if (howmuch == 0)
         return;
 
+    // Not every caller holds cs_main, the masternode and budget handlers do not
+    LOCK(cs_main);
     CNodeState* state = State(pnode);
     if (state == NULL)
         return;
@@ -2741,6 +3048,9 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
             if(!EraseAccumulatorValues(nCheckpoint, pindex->pprev->nAccumulatorCheckpoint))
                 return error("DisconnectBlock(): failed to erase checkpoint");
         }
+
+        if (!zerocoinDB->EraseBlockPubcoins(pindex->nHeight))
+            return error("DisconnectBlock(): failed to erase indexed mints");
     }
 
     if (pfClean) {
@@ -2756,6 +3066,10 @@ void static FlushBlockFile(bool fFinalize = false)
     LOCK(cs_LastBlockFile);
 
     CDiskBlockPos posOld(nLastBlockFile, 0);
+    if (fFinalize) {
+        mappedBlockFiles.Erase(GetBlockPosFilename(posOld, "blk"));
+        mappedBlockFiles.Erase(GetBlockPosFilename(posOld, "rev"));
+    }
 
     FILE* fileOld = OpenBlockFile(posOld);
     if (fileOld) {
@@ -2776,7 +3090,7 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128, MAX_SCRIPTCHECK_THREADS);
 
 void ThreadScriptCheck()
 {
@@ -2784,54 +3098,110 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
-void RecalculateZSPLMinted()
+//! Number of consecutive heights a rebuild thread takes at a time
+static const size_t REBUILD_RANGE_SIZE = 100;
+
+/**
+ * Run fn(i, vBlocks[i]) for every block of vBlocks, on the calling thread and
+ * nScriptCheckThreads - 1 helpers. The threads take ranges of consecutive
+ * heights, so the block files are read mostly sequentially, and store their
+ * results by index for the caller to merge in height order. The calling thread
+ * reports the progress. fn must not take cs_main, which the caller may hold.
+ */
+template <typename Fn>
+static bool ParallelForEachBlock(const std::vector<CBlockIndex*>& vBlocks, const std::string& strProgress, Fn fn)
 {
-    CBlockIndex *pindex = chainActive[Params().Zerocoin_StartHeight()];
-    uiInterface.ShowProgress(_("Recalculating minted zSPL..."), 0);
-    while (true) {
-        // Log Message and feedback message every 1000 blocks
-        if (pindex->nHeight % 1000 == 0) {
-            LogPrintf("%s : block %d...\n", __func__, pindex->nHeight);
-            int percent = std::max(1, std::min(99, (int)((double)(pindex->nHeight - Params().Zerocoin_StartHeight()) * 100 / (chainActive.Height() - Params().Zerocoin_StartHeight()))));
-            uiInterface.ShowProgress(_("Recalculating minted zSPL..."), percent);
+    std::atomic<size_t> nNext(0);
+    std::atomic<size_t> nDone(0);
+    std::atomic<bool> fFailed(false);
+    auto work = [&](bool fMaster) {
+        try {
+            size_t nFirst;
+            while (!fFailed && (nFirst = nNext.fetch_add(REBUILD_RANGE_SIZE)) < vBlocks.size()) {
+                size_t nLast = std::min(vBlocks.size(), nFirst + REBUILD_RANGE_SIZE);
+                for (size_t i = nFirst; i < nLast && !fFailed; i++) {
+                    if (ShutdownRequested() || !fn(i, vBlocks[i]))
+                        fFailed = true;
+                }
+                size_t nDoneNow = (nDone += nLast - nFirst);
+                if (fMaster) {
+                    LogPrint("bench", "%s : %u of %u blocks\n", strProgress, nDoneNow, vBlocks.size());
+                    uiInterface.ShowProgress(strProgress, std::max(1, std::min(99, (int)(nDoneNow * 100 / vBlocks.size()))));
+                }
+            }
+        } catch (const std::exception& e) {
+            LogPrintf("%s : %s\n", __func__, e.what());
+            fFailed = true;
         }
+    };
 
-        //overwrite possibly wrong vMintsInBlock data
-        CBlock block;
-        assert(ReadBlockFromDisk(block, pindex));
+    boost::thread_group threads;
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        threads.create_thread([&work]() { work(false); });
+    work(true);
+    threads.join_all();
+    return !fFailed;
+}
 
-        std::list<CZerocoinMint> listMints;
-        BlockToZerocoinMintList(block, listMints, true);
+//! Active chain blocks from nHeightStart up to the tip
+static std::vector<CBlockIndex*> GetActiveBlocksFrom(int nHeightStart)
+{
+    std::vector<CBlockIndex*> vBlocks;
+    for (int nHeight = nHeightStart; nHeight <= chainActive.Height(); nHeight++)
+        vBlocks.emplace_back(chainActive[nHeight]);
+    return vBlocks;
+}
 
-        std::vector<libzerocoin::CoinDenomination> vDenomsBefore = pindex->vMintDenominationsInBlock;
-        pindex->vMintDenominationsInBlock.clear();
-        for (auto mint : listMints)
-            pindex->vMintDenominationsInBlock.emplace_back(mint.GetDenomination());
+void RecalculateZSPLMinted()
+{
+    const std::string strProgress = _("Recalculating minted zSPL...");
+    uiInterface.ShowProgress(strProgress, 0);
+    std::vector<CBlockIndex*> vBlocks = GetActiveBlocksFrom(Params().Zerocoin_StartHeight());
+    LogPrintf("%s : %u blocks from %d\n", __func__, vBlocks.size(), Params().Zerocoin_StartHeight());
+
+    // Collect the mints of each block from the pubcoin index, in parallel
+    std::vector<std::vector<libzerocoin::CoinDenomination> > vMintDenoms(vBlocks.size());
+    bool fDone = ParallelForEachBlock(vBlocks, strProgress, [&vMintDenoms](size_t i, const CBlockIndex* pindex) {
+        std::list<libzerocoin::PublicCoin> listPubcoins;
+        if (!BlockIndexToPubcoinList(pindex, listPubcoins, true))
+            return error("RecalculateZSPLMinted : failed to get the mints of block %d", pindex->nHeight);
+        for (const libzerocoin::PublicCoin& pubcoin : listPubcoins)
+            vMintDenoms[i].emplace_back(pubcoin.getDenomination());
+        return true;
+    });
 
-        if (pindex->nHeight < chainActive.Height())
-            pindex = chainActive.Next(pindex);
-        else
-            break;
+    //overwrite possibly wrong vMintsInBlock data
+    if (fDone) {
+        for (size_t i = 0; i < vBlocks.size(); i++)
+            vBlocks[i]->vMintDenominationsInBlock.swap(vMintDenoms[i]);
     }
     uiInterface.ShowProgress("", 100);
 }
 
 void RecalculateZSPLSpent()
 {
-    CBlockIndex* pindex = chainActive[Params().Zerocoin_StartHeight()];
-    uiInterface.ShowProgress(_("Recalculating spent zSPL..."), 0);
-    while (true) {
-        if (pindex->nHeight % 1000 == 0) {
-            LogPrintf("%s : block %d...\n", __func__, pindex->nHeight);
-            int percent = std::max(1, std::min(99, (int)((double)(pindex->nHeight - Params().Zerocoin_StartHeight()) * 100 / (chainActive.Height() - Params().Zerocoin_StartHeight()))));
-            uiInterface.ShowProgress(_("Recalculating spent zSPL..."), percent);
-        }
-
-        //Rewrite zSPL supply
+    const std::string strProgress = _("Recalculating spent zSPL...");
+    uiInterface.ShowProgress(strProgress, 0);
+    std::vector<CBlockIndex*> vBlocks = GetActiveBlocksFrom(Params().Zerocoin_StartHeight());
+    LogPrintf("%s : %u blocks from %d\n", __func__, vBlocks.size(), Params().Zerocoin_StartHeight());
+
+    // Read the blocks and collect their spends in parallel
+    std::vector<std::list<libzerocoin::CoinDenomination> > vDenomsSpent(vBlocks.size());
+    bool fDone = ParallelForEachBlock(vBlocks, strProgress, [&vDenomsSpent](size_t i, const CBlockIndex* pindex) {
         CBlock block;
-        assert(ReadBlockFromDisk(block, pindex));
+        if (!ReadBlockFromDisk(block, pindex))
+            return error("RecalculateZSPLSpent : failed to read block %d", pindex->nHeight);
+        vDenomsSpent[i] = ZerocoinSpendListFromBlock(block, true);
+        return true;
+    });
+    if (!fDone) {
+        uiInterface.ShowProgress("", 100);
+        return;
+    }
 
-        std::list<libzerocoin::CoinDenomination> listDenomsSpent = ZerocoinSpendListFromBlock(block, true);
+    // The supply of each block builds on the previous one: merge in height order
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        CBlockIndex* pindex = vBlocks[i];
 
         //Reset the supply to previous block
         pindex->mapZerocoinSupply = pindex->pprev->mapZerocoinSupply;
@@ -2843,70 +3213,104 @@ void RecalculateZSPLSpent()
         }
 
         //Remove spends from zSPL supply
-        for (auto denom : listDenomsSpent)
+        for (auto denom : vDenomsSpent[i])
             pindex->mapZerocoinSupply.at(denom)--;
 
         //Rewrite money supply
-        assert(pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)));
-
-        if (pindex->nHeight < chainActive.Height())
-            pindex = chainActive.Next(pindex);
-        else
+        if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex))) {
+            error("%s : failed to write block index %d", __func__, pindex->nHeight);
             break;
+        }
     }
     uiInterface.ShowProgress("", 100);
 }
 
+/** Value a block adds to the money supply, and the inputs only the transaction index can value */
+struct CBlockSupplyDelta {
+    CAmount nValueIn;
+    CAmount nValueOut;
+    std::vector<COutPoint> vUnresolved;
+
+    CBlockSupplyDelta() : nValueIn(0), nValueOut(0) {}
+};
+
 bool RecalculateSPLSupply(int nHeightStart)
 {
     if (nHeightStart > chainActive.Height())
         return false;
 
-    CBlockIndex* pindex = chainActive[nHeightStart];
-    CAmount nSupplyPrev = pindex->pprev->nMoneySupply;
-    // if (nHeightStart == Params().Zerocoin_StartHeight())
-        // nSupplyPrev = CAmount(5449796547496199);
-
-    uiInterface.ShowProgress(_("Recalculating SPL supply..."), 0);
-    while (true) {
-        if (pindex->nHeight % 1000 == 0) {
-            LogPrintf("%s : block %d...\n", __func__, pindex->nHeight);
-            int percent = std::max(1, std::min(99, (int)((double)((pindex->nHeight - nHeightStart) * 100) / (chainActive.Height() - nHeightStart))));
-            uiInterface.ShowProgress(_("Recalculating SPL supply..."), percent);
-        }
+    const std::string strProgress = _("Recalculating SPL supply...");
+    uiInterface.ShowProgress(strProgress, 0);
+    std::vector<CBlockIndex*> vBlocks = GetActiveBlocksFrom(nHeightStart);
+    LogPrintf("%s : %u blocks from %d\n", __func__, vBlocks.size(), nHeightStart);
 
+    // Value the inputs of each block from its undo data, in parallel. Inputs
+    // without undo data (those of zerocoin spend transactions) are left for
+    // GetTransaction below, which takes cs_main.
+    std::vector<CBlockSupplyDelta> vDeltas(vBlocks.size());
+    bool fDone = ParallelForEachBlock(vBlocks, strProgress, [&vDeltas](size_t i, const CBlockIndex* pindex) {
         CBlock block;
-        assert(ReadBlockFromDisk(block, pindex));
-
-        CAmount nValueIn = 0;
-        CAmount nValueOut = 0;
-        for (const CTransaction& tx : block.vtx) {
-            for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        if (!ReadBlockFromDisk(block, pindex))
+            return error("RecalculateSPLSupply : failed to read block %d", pindex->nHeight);
+
+        CBlockUndo blockUndo;
+        bool fUndo = !pindex->GetUndoPos().IsNull() && blockUndo.ReadFromDisk(pindex->GetUndoPos(), pindex->pprev->GetBlockHash()) &&
+                     blockUndo.vtxundo.size() + 1 == block.vtx.size();
+
+        CBlockSupplyDelta& delta = vDeltas[i];
+        for (unsigned int n = 0; n < block.vtx.size(); n++) {
+            const CTransaction& tx = block.vtx[n];
+            const CTxUndo* ptxundo = fUndo && n > 0 ? &blockUndo.vtxundo[n - 1] : NULL;
+            if (ptxundo && ptxundo->vprevout.size() != tx.vin.size())
+                ptxundo = NULL;
+            for (unsigned int j = 0; j < tx.vin.size(); j++) {
                 if (tx.IsCoinBase())
                     break;
 
-                if (tx.vin[i].IsZerocoinSpend()) {
-                    nValueIn += tx.vin[i].nSequence * COIN;
+                if (tx.vin[j].IsZerocoinSpend()) {
+                    delta.nValueIn += tx.vin[j].nSequence * COIN;
                     continue;
                 }
 
-                COutPoint prevout = tx.vin[i].prevout;
-                CTransaction txPrev;
-                uint256 hashBlock;
-                assert(GetTransaction(prevout.hash, txPrev, hashBlock, true));
-                nValueIn += txPrev.vout[prevout.n].nValue;
+                if (ptxundo)
+                    delta.nValueIn += ptxundo->vprevout[j].txout.nValue;
+                else
+                    delta.vUnresolved.emplace_back(tx.vin[j].prevout);
             }
 
-            for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                if (i == 0 && tx.IsCoinStake())
+            for (unsigned int j = 0; j < tx.vout.size(); j++) {
+                if (j == 0 && tx.IsCoinStake())
                     continue;
 
-                nValueOut += tx.vout[i].nValue;
+                delta.nValueOut += tx.vout[j].nValue;
+            }
+        }
+        return true;
+    });
+    if (!fDone) {
+        uiInterface.ShowProgress("", 100);
+        return false;
+    }
+
+    // Rewrite the money supply in height order
+    CAmount nSupplyPrev = vBlocks[0]->pprev->nMoneySupply;
+    // if (nHeightStart == Params().Zerocoin_StartHeight())
+        // nSupplyPrev = CAmount(5449796547496199);
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        CBlockIndex* pindex = vBlocks[i];
+        CBlockSupplyDelta& delta = vDeltas[i];
+        for (const COutPoint& prevout : delta.vUnresolved) {
+            CTransaction txPrev;
+            uint256 hashBlock;
+            if (!GetTransaction(prevout.hash, txPrev, hashBlock, true)) {
+                uiInterface.ShowProgress("", 100);
+                return error("%s : failed to find input %s of block %d", __func__, prevout.ToString(), pindex->nHeight);
             }
+            delta.nValueIn += txPrev.vout[prevout.n].nValue;
         }
 
         // Rewrite money supply
-        pindex->nMoneySupply = nSupplyPrev + nValueOut - nValueIn;
+        pindex->nMoneySupply = nSupplyPrev + delta.nValueOut - delta.nValueIn;
         nSupplyPrev = pindex->nMoneySupply;
 
         // Add fraudulent funds to the supply and remove any recovered funds.
@@ -2921,12 +3325,10 @@ bool RecalculateSPLSupply(int nHeightStart)
             LogPrintf("%s : Removing locked from supply - %s : supply=%s\n", __func__, FormatMoney(nLocked), FormatMoney(pindex->nMoneySupply));
         }
 
-        assert(pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)));
-
-        if (pindex->nHeight < chainActive.Height())
-            pindex = chainActive.Next(pindex);
-        else
-            break;
+        if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex))) {
+            uiInterface.ShowProgress("", 100);
+            return error("%s : failed to write block index %d", __func__, pindex->nHeight);
+        }
     }
     uiInterface.ShowProgress("", 100);
     return true;
@@ -2936,46 +3338,80 @@ bool ReindexAccumulators(std::list<uint256>& listMissingCheckpoints, std::string
 {
     // Simplicity: recalculate Accumulator Checkpoints that failed to database properly
     if (!listMissingCheckpoints.empty()) {
-        uiInterface.ShowProgress(_("Calculating missing accumulators..."), 0);
+        const std::string strProgress = _("Calculating missing accumulators...");
+        uiInterface.ShowProgress(strProgress, 0);
         LogPrintf("%s : finding missing checkpoints\n", __func__);
 
         //search the chain to see when zerocoin started
         int nZerocoinStart = Params().Zerocoin_Block_V2_Start();
 
-        // find each checkpoint that is missing
-        CBlockIndex* pindex = chainActive[nZerocoinStart];
-        while (pindex) {
-            uiInterface.ShowProgress(_("Calculating missing accumulators..."), std::max(1, std::min(99, (int)((double)(pindex->nHeight - nZerocoinStart) / (double)(chainActive.Height() - nZerocoinStart) * 100))));
+        // find each checkpoint that is missing, by iterating through the blockchain beginning with the first zerocoin block
+        std::vector<CBlockIndex*> vCheckpoints;
+        std::set<uint256> setFound;
+        for (CBlockIndex* pindex = chainActive[nZerocoinStart]; pindex; pindex = chainActive.Next(pindex)) {
+            if (pindex->nAccumulatorCheckpoint == pindex->pprev->nAccumulatorCheckpoint || setFound.count(pindex->nAccumulatorCheckpoint))
+                continue;
+            if (find(listMissingCheckpoints.begin(), listMissingCheckpoints.end(), pindex->nAccumulatorCheckpoint) != listMissingCheckpoints.end()) {
+                vCheckpoints.emplace_back(pindex);
+                setFound.insert(pindex->nAccumulatorCheckpoint);
+            }
+        }
 
+        // Index the mints of the blocks the checkpoints accumulate (height - 20 through height - 11) in parallel
+        std::vector<CBlockIndex*> vBlocks;
+        for (const CBlockIndex* pindexCheckpoint : vCheckpoints) {
+            int nHeightFirst = std::max(Params().Zerocoin_StartHeight(), pindexCheckpoint->nHeight - 20);
+            if (!vBlocks.empty())
+                nHeightFirst = std::max(nHeightFirst, vBlocks.back()->nHeight + 1);
+            for (int nHeight = nHeightFirst; nHeight < pindexCheckpoint->nHeight - 10; nHeight++)
+                vBlocks.emplace_back(chainActive[nHeight]);
+        }
+        LogPrintf("%s : %u missing checkpoints, indexing the mints of %u blocks\n", __func__, vCheckpoints.size(), vBlocks.size());
+        bool fIndexed = ParallelForEachBlock(vBlocks, strProgress, [](size_t i, const CBlockIndex* pindex) {
+            std::list<libzerocoin::PublicCoin> listPubcoins;
+            return BlockIndexToPubcoinList(pindex, listPubcoins, false);
+        });
+        if (!fIndexed) {
+            uiInterface.ShowProgress("", 100);
             if (ShutdownRequested())
                 return false;
+            strError = _("Failed to calculate accumulator checkpoint");
+            return error("%s: %s", __func__, strError);
+        }
 
-            // find checkpoints by iterating through the blockchain beginning with the first zerocoin block
-            if (pindex->nAccumulatorCheckpoint != pindex->pprev->nAccumulatorCheckpoint) {
-                if (find(listMissingCheckpoints.begin(), listMissingCheckpoints.end(), pindex->nAccumulatorCheckpoint) != listMissingCheckpoints.end()) {
-                    uint256 nCheckpointCalculated = 0;
-                    AccumulatorMap mapAccumulators(Params().Zerocoin_Params(false));
-                    if (!CalculateAccumulatorCheckpoint(pindex->nHeight, nCheckpointCalculated, mapAccumulators)) {
-                        // GetCheckpoint could have terminated due to a shutdown request. Check this here.
-                        if (ShutdownRequested())
-                            break;
-                        strError = _("Failed to calculate accumulator checkpoint");
-                        return error("%s: %s", __func__, strError);
-                    }
+        // Each checkpoint starts from the values the previous one databased, so these
+        // run in height order; the denominations are accumulated concurrently
+        for (size_t i = 0; i < vCheckpoints.size(); i++) {
+            CBlockIndex* pindex = vCheckpoints[i];
+            uiInterface.ShowProgress(strProgress, std::max(1, std::min(99, (int)((i + 1) * 100 / vCheckpoints.size()))));
 
-                    //check that the calculated checkpoint is what is in the index.
-                    if (nCheckpointCalculated != pindex->nAccumulatorCheckpoint) {
-                        LogPrintf("%s : height=%d calculated_checkpoint=%s actual=%s\n", __func__, pindex->nHeight, nCheckpointCalculated.GetHex(), pindex->nAccumulatorCheckpoint.GetHex());
-                        strError = _("Calculated accumulator checkpoint is not what is recorded by block index");
-                        return error("%s: %s", __func__, strError);
-                    }
+            if (ShutdownRequested()) {
+                uiInterface.ShowProgress("", 100);
+                return false;
+            }
 
-                    DatabaseChecksums(mapAccumulators);
-                    auto it = find(listMissingCheckpoints.begin(), listMissingCheckpoints.end(), pindex->nAccumulatorCheckpoint);
-                    listMissingCheckpoints.erase(it);
-                }
+            uint256 nCheckpointCalculated = 0;
+            AccumulatorMap mapAccumulators(Params().Zerocoin_Params(false));
+            if (!CalculateAccumulatorCheckpoint(pindex->nHeight, nCheckpointCalculated, mapAccumulators)) {
+                // GetCheckpoint could have terminated due to a shutdown request. Check this here.
+                if (ShutdownRequested())
+                    break;
+                uiInterface.ShowProgress("", 100);
+                strError = _("Failed to calculate accumulator checkpoint");
+                return error("%s: %s", __func__, strError);
             }
-            pindex = chainActive.Next(pindex);
+
+            //check that the calculated checkpoint is what is in the index.
+            if (nCheckpointCalculated != pindex->nAccumulatorCheckpoint) {
+                LogPrintf("%s : height=%d calculated_checkpoint=%s actual=%s\n", __func__, pindex->nHeight, nCheckpointCalculated.GetHex(), pindex->nAccumulatorCheckpoint.GetHex());
+                uiInterface.ShowProgress("", 100);
+                strError = _("Calculated accumulator checkpoint is not what is recorded by block index");
+                return error("%s: %s", __func__, strError);
+            }
+
+            DatabaseChecksums(mapAccumulators);
+            auto it = find(listMissingCheckpoints.begin(), listMissingCheckpoints.end(), pindex->nAccumulatorCheckpoint);
+            listMissingCheckpoints.erase(it);
         }
         uiInterface.ShowProgress("", 100);
     }
@@ -3427,6 +3863,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // Flush spend/mint info to disk
     if (!zerocoinDB->WriteCoinSpendBatch(vSpends)) return state.Abort(("Failed to record coin serials to database"));
     if (!zerocoinDB->WriteCoinMintBatch(vMints)) return state.Abort(("Failed to record new mints to database"));
+    if (pindex->nHeight >= Params().Zerocoin_StartHeight()) {
+        // A block with a mint output that does not convert is left out of the
+        // index, BlockIndexToPubcoinList then reads it from disk as before
+        std::vector<CIndexedPubcoin> vIndexedPubcoins;
+        if (BlockToIndexedPubcoins(block, vIndexedPubcoins) && !zerocoinDB->WriteBlockPubcoins(pindex->nHeight, pindex->GetBlockHash(), vIndexedPubcoins))
+            return state.Abort(("Failed to index block mints in database"));
+    }
 
     //Record accumulator checksums
     //DatabaseChecksums(mapAccumulators);
@@ -3483,7 +3926,7 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
     static int64_t nLastWrite = 0;
     try {
         if ((mode == FLUSH_STATE_ALWAYS) ||
-            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) ||
             (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
             // Typical CCoins structures on disk are around 100 bytes in size.
             // Pushing a new one to the database can cause it to be written
@@ -3515,6 +3958,10 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
             // Finally flush the chainstate (which may refer to block index entries).
             if (!pcoinsTip->Flush())
                 return state.Abort("Failed to write to coin database");
+            // The coin database writes in the background; a full cache only
+            // waits for the previous write, the other flushes for their own.
+            if (mode != FLUSH_STATE_IF_NEEDED && !pcoinsTip->Sync())
+                return state.Abort("Failed to write to coin database");
             // Update best block in wallet (so we can detect restored wallets).
             if (mode != FLUSH_STATE_IF_NEEDED) {
                 GetMainSignals().SetBestChain(chainActive.GetLocator());
@@ -3569,10 +4016,10 @@ void static UpdateTip(CBlockIndex* pindexNew)
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d version=%d type=%i  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d version=%d type=%i  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
         chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), chainActive.Tip()->nVersion, chainActive.Tip()->nVersion >= Params().WALLET_UPGRADE_VERSION() ? CBlockHeader::GetAlgo(chainActive.Tip()->nVersion) : chainActive.Tip()->IsProofOfWork(),
         log(chainActive.Tip()->nChainWork.getdouble()) / log(2.0), (unsigned long)chainActive.Tip()->nChainTx, DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-        Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+        Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -3614,6 +4061,7 @@ bool static DisconnectTip(CValidationState &state) {
             return error("DisconnectTip() : DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
     }
+    collateralIndex.DisconnectBlock(block, pindexDelete->nHeight, *pcoinsTip);
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
@@ -3685,6 +4133,7 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
     }
+    collateralIndex.ConnectBlock(*pblock, pindexNew->nHeight);
     int64_t nTime4 = GetTimeMicros();
     nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
@@ -4136,6 +4585,12 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
+    boost::unordered_map<uint256, std::pair<uint256, uint64_t>, BlockHasher>::iterator itPoW = mapPendingPoWHash.find(hash);
+    if (itPoW != mapPendingPoWHash.end()) {
+        pindexNew->hashProofOfWork = itPoW->second.first;
+        mapPendingPoWAge.erase(itPoW->second.second);
+        mapPendingPoWHash.erase(itPoW);
+    }
     BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
 
     pindexNew->phashBlock = &((*mi).first);
@@ -4308,20 +4763,92 @@ bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigne
     return true;
 }
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
+/** Whether CheckBlockHeader verifies the proof of work of a header; older scrypt² headers are only checked when verifying or reindexing */
+static bool IsHeaderPoWChecked(const CBlockHeader& block)
 {
     static int64_t nBlockCheckTime = 0;
 
     if (nBlockCheckTime == 0)
         nBlockCheckTime = GetTime() - (2 * 24 * 60 * 60); // check the past 2 days worth of headers
 
+    return (fVerifyingBlocks || fReindex || block.nTime >= nBlockCheckTime || CBlockHeader::GetAlgo(block.nVersion) != POW_SCRYPT_SQUARED) && block.IsProofOfWork();
+}
+
+static void AddPendingPoWHash(const uint256& hashBlock, const uint256& hashPoW)
+{
+    AssertLockHeld(cs_main);
+    std::pair<uint256, uint64_t>& entry = mapPendingPoWHash[hashBlock];
+    if (entry.second != 0)
+        mapPendingPoWAge.erase(entry.second);
+    entry.first = hashPoW;
+    entry.second = ++nPendingPoWSequence;
+    mapPendingPoWAge[entry.second] = hashBlock;
+}
+
+static void CachePoWHash(const uint256& hashBlock, const uint256& hashPoW)
+{
+    AssertLockHeld(cs_main);
+    if (mapBlockIndex.count(hashBlock))
+        return;
+    while (!fReindex && mapPendingPoWHash.size() >= MAX_PENDING_POW_HASHES) {
+        std::map<uint64_t, uint256>::iterator itOldest = mapPendingPoWAge.begin();
+        mapPendingPoWHash.erase(itOldest->second);
+        mapPendingPoWAge.erase(itOldest);
+    }
+    AddPendingPoWHash(hashBlock, hashPoW);
+}
+
+void CachePoWHashes(const std::vector<std::pair<uint256, uint256> >& vHashes)
+{
+    LOCK(cs_main);
+    for (const std::pair<uint256, uint256>& hashes : vHashes)
+        AddPendingPoWHash(hashes.first, hashes.second);
+    LogPrintf("%s : %u cached proof-of-work hashes kept for reindexing\n", __func__, vHashes.size());
+}
+
+void ClearPendingPoWHashes()
+{
+    LOCK(cs_main);
+    mapPendingPoWHash.clear();
+    mapPendingPoWAge.clear();
+}
+
+/** Cached PoW hash of a header, 0 if it has not been checked before */
+static uint256 GetCachedPoWHash(const uint256& hashBlock)
+{
+    AssertLockHeld(cs_main);
+    BlockMap::const_iterator mi = mapBlockIndex.find(hashBlock);
+    if (mi != mapBlockIndex.end())
+        return mi->second->hashProofOfWork;
+    boost::unordered_map<uint256, std::pair<uint256, uint64_t>, BlockHasher>::const_iterator it = mapPendingPoWHash.find(hashBlock);
+    if (it != mapPendingPoWHash.end())
+        return it->second.first;
+    return uint256();
+}
+
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
+{
     if (block.nVersion >= Params().WALLET_UPGRADE_VERSION() && CBlockHeader::GetAlgo(block.nVersion) == -1)
         return state.DoS(100, error("%s : block %s has an invalid type", __func__, block.GetHash().GetHex()));
 
     // Check proof of work matches claimed amount
-    if ((fVerifyingBlocks || fReindex || block.nTime >= nBlockCheckTime || CBlockHeader::GetAlgo(block.nVersion) != POW_SCRYPT_SQUARED) && fCheckPOW && block.IsProofOfWork() && !CheckProofOfWork(&block))
-        return state.DoS(50, error("%s : proof of work failed", __func__),
-            REJECT_INVALID, "high-hash");
+    if (fCheckPOW && IsHeaderPoWChecked(block)) {
+        // The hash itself is computed without cs_main
+        uint256 hashBlock = block.GetHash();
+        uint256 hashPoW;
+        {
+            LOCK(cs_main);
+            hashPoW = GetCachedPoWHash(hashBlock);
+        }
+        bool fCached = hashPoW != 0;
+        if (!CheckProofOfWork(&block, hashPoW))
+            return state.DoS(50, error("%s : proof of work failed", __func__),
+                REJECT_INVALID, "high-hash");
+        if (!fCached && hashPoW != 0) {
+            LOCK(cs_main);
+            CachePoWHash(hashBlock, hashPoW);
+        }
+    }
 
     return true;
 }
@@ -4355,8 +4882,8 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         return state.Invalid(error("%s : block timestamp too far in the future", __func__),
             REJECT_INVALID, "time-too-new");
 
-    // Check the merkle root.
-    if (fCheckMerkleRoot) {
+    // Check the merkle root, unless the block import already did.
+    if (fCheckMerkleRoot && !block.IsMerkleChecked()) {
         bool mutated;
         uint256 hashMerkleRoot2 = block.BuildMerkleTree(&mutated);
         if (block.hashMerkleRoot != hashMerkleRoot2)
@@ -4460,12 +4987,20 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     std::vector<CBigNum> vBlockSerials;
     // TODO: Check if this is ok... blockHeight is always the tip or should we look for the prevHash and get the height?
     // int blockHeight = chainActive.Height() + 1;
+
+    // Zerocoin spend proofs go to the zerocoin check queue, unless another
+    // thread is checking a block with it; then they are verified inline.
+    TRY_LOCK(cs_zerocoincheckqueue, fSpendQueue);
+    const bool fParallelSpends = fSpendQueue && nScriptCheckThreads;
+    CCheckQueueControl<CZerocoinSpendCheck> control(fParallelSpends ? &zerocoincheckqueue : NULL);
     for (const CTransaction& tx : block.vtx) {
         if (tx.nVersion < 3 && block.nVersion >= Params().WALLET_UPGRADE_VERSION())
             return state.DoS(100, error("%s : Transaction %s has invalid version %d", __func__, tx.GetHash().ToString(), tx.nVersion),
                 REJECT_INVALID, "bad-txns-version");
-        if (!CheckTransaction(tx, fZerocoinActive, nHeight >= Params().Zerocoin_Block_EnforceSerialRange(), state))
+        std::vector<CZerocoinSpendCheck> vSpendChecks;
+        if (!CheckTransaction(tx, fZerocoinActive, nHeight >= Params().Zerocoin_Block_EnforceSerialRange(), state, fParallelSpends ? &vSpendChecks : NULL))
             return error("%s : CheckTransaction of %s failed with %s", __func__, tx.GetHash().ToString(), FormatStateMessage(state));
+        control.Add(vSpendChecks);
 
         // double check that there are no double spent zSPL spends in this block
         if (tx.HasZerocoinSpendInputs()) {
@@ -4491,6 +5026,8 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
             }
         }
     }
+    if (!control.Wait())
+        return state.DoS(100, error("%s : invalid zerocoin spend", __func__));
 
 
     unsigned int nSigOps = 0;
@@ -5133,6 +5670,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
         nCheckDepth = chainActive.Height();
     nCheckLevel = std::max(0, std::min(4, nCheckLevel));
     LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
+    const int64_t nTimeStart = GetTimeMicros();
     CCoinsViewCache coins(coinsview);
     CBlockIndex* pindexState = chainActive.Tip();
     CBlockIndex* pindexFailure = NULL;
@@ -5161,7 +5699,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -5194,6 +5732,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
     }
 
     LogPrintf("No coin database inconsistencies in last %i blocks (%i transactions)\n", chainActive.Height() - pindexState->nHeight, nGoodTransactions);
+    LogPrint("bench", "    - Verify %i blocks at level %i: %.2fs (%u block files mapped)\n", nCheckDepth, nCheckLevel, 0.000001 * (GetTimeMicros() - nTimeStart), mappedBlockFiles.Size());
 
     return true;
 }
@@ -5212,6 +5751,8 @@ void UnloadBlockIndex()
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
+    mappedBlockFiles.Clear();
+    collateralIndex.Clear();
     nBlockSequenceId = 1;
     mapBlockSource.clear();
     mapBlocksInFlight.clear();
@@ -5220,6 +5761,8 @@ void UnloadBlockIndex()
     setDirtyFileInfo.clear();
     mapNodeState.clear();
     recentRejects.reset(NULL);
+    mapPendingPoWHash.clear();
+    mapPendingPoWAge.clear();
 
     for (BlockMap::value_type& entry : mapBlockIndex) {
         delete entry.second;
@@ -5279,20 +5822,190 @@ bool InitBlockIndex() {
 }
 
 
-bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
+namespace {
+/** A block record of a block file on its way through the import pipeline */
+struct CImportRecord {
+    enum Stage { READ, PARSED, HASHED };
+
+    uint64_t nSeq;
+    Stage stage;
+    bool fHavePos;
+    CDiskBlockPos pos;
+    size_t nBytes;                  //!< counted against the budget: serialized size, then memory of the parsed block
+    CDataStream ssData;             //!< serialized block, released once parsed
+    std::shared_ptr<CBlock> pblock; //!< null if the record did not deserialize
+    uint256 hash;
+    uint256 hashPoW;                //!< PoW hash checked by the hashing stage, 0 if not checked there
+
+    CImportRecord() : nSeq(0), stage(READ), fHavePos(false), nBytes(0), ssData(SER_DISK, CLIENT_VERSION) {}
+};
+
+/**
+ * Hand-off between the stages of LoadExternalBlockFile. A reader thread scans
+ * the file for block records, a pool of -par workers deserializes them and
+ * checks their merkle roots, a hashing thread checks the proof of work of
+ * consecutive runs of blocks with CheckProofOfWorkBatch, and the calling
+ * thread connects the blocks in file order. Records stay in flight until the
+ * connect stage releases them; the reader waits while they exceed the byte
+ * budget.
+ */
+class CBlockImportPipeline
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::map<uint64_t, std::unique_ptr<CImportRecord> > mapRecords;
+    std::deque<CImportRecord*> queueRead;
+    uint64_t nNextSeq;
+    uint64_t nHashSeq;
+    uint64_t nConnectSeq;
+    size_t nBytesInFlight;
+    const size_t nMaxBytesInFlight;
+    bool fReaderDone;
+    bool fStop;
+
+    //! Whether the record with sequence number nSeq has reached stage
+    bool Reached(uint64_t nSeq, CImportRecord::Stage stage) const
+    {
+        std::map<uint64_t, std::unique_ptr<CImportRecord> >::const_iterator it = mapRecords.find(nSeq);
+        return it != mapRecords.end() && it->second->stage >= stage;
+    }
 
-    int nLoaded = 0;
+    //! Whether a stage waiting for the record nSeq will not get it
+    bool Drained(uint64_t nSeq) const
+    {
+        return fStop || (fReaderDone && nSeq == nNextSeq);
+    }
+
+public:
+    explicit CBlockImportPipeline(size_t nMaxBytesInFlightIn) : nNextSeq(0), nHashSeq(0), nConnectSeq(0), nBytesInFlight(0), nMaxBytesInFlight(nMaxBytesInFlightIn), fReaderDone(false), fStop(false) {}
+
+    /** Reader: queue a record for the workers. Returns false once the pipeline is stopped. */
+    bool Push(std::unique_ptr<CImportRecord> record)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fStop && nBytesInFlight > 0 && nBytesInFlight + record->nBytes > nMaxBytesInFlight)
+            cond.wait(lock);
+        if (fStop)
+            return false;
+        record->nSeq = nNextSeq++;
+        record->stage = CImportRecord::READ;
+        nBytesInFlight += record->nBytes;
+        queueRead.push_back(record.get());
+        mapRecords[record->nSeq] = std::move(record);
+        cond.notify_all();
+        return true;
+    }
+
+    void ReaderDone()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fReaderDone = true;
+        cond.notify_all();
+    }
+
+    /** Workers: next record to deserialize, null when there are no more */
+    CImportRecord* PopRead()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fStop && !fReaderDone && queueRead.empty())
+            cond.wait(lock);
+        if (fStop || queueRead.empty())
+            return NULL;
+        CImportRecord* record = queueRead.front();
+        queueRead.pop_front();
+        return record;
+    }
+
+    /** Workers: the record is parsed into nUsage bytes of memory, which replace its serialized size in the budget */
+    void Parsed(CImportRecord* record, size_t nUsage)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nBytesInFlight = nBytesInFlight - record->nBytes + nUsage;
+        record->nBytes = nUsage;
+        record->stage = CImportRecord::PARSED;
+        cond.notify_all();
+    }
+
+    /** Hashing stage: the next run of consecutive parsed records, false when there are no more */
+    bool TakeParsed(std::vector<CImportRecord*>& vRecords, size_t nMax)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!Drained(nHashSeq) && !Reached(nHashSeq, CImportRecord::PARSED))
+            cond.wait(lock);
+        vRecords.clear();
+        while (!fStop && vRecords.size() < nMax && Reached(nHashSeq, CImportRecord::PARSED))
+            vRecords.push_back(mapRecords[nHashSeq++].get());
+        return !vRecords.empty();
+    }
+
+    void Hashed(const std::vector<CImportRecord*>& vRecords)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        for (CImportRecord* record : vRecords)
+            record->stage = CImportRecord::HASHED;
+        cond.notify_all();
+    }
+
+    /** Connect stage: the next record in file order, null when there are no more */
+    std::unique_ptr<CImportRecord> PopHashed()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!Drained(nConnectSeq) && !Reached(nConnectSeq, CImportRecord::HASHED))
+            cond.wait(lock);
+        std::unique_ptr<CImportRecord> record;
+        if (fStop || !Reached(nConnectSeq, CImportRecord::HASHED))
+            return record;
+        std::map<uint64_t, std::unique_ptr<CImportRecord> >::iterator it = mapRecords.find(nConnectSeq++);
+        record = std::move(it->second);
+        mapRecords.erase(it);
+        nBytesInFlight -= record->nBytes;
+        cond.notify_all();
+        return record;
+    }
+
+    void Stop()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+        cond.notify_all();
+    }
+};
+
+/** Stops the pipeline and joins its threads however the connect stage is left */
+class CBlockImportThreads
+{
+private:
+    CBlockImportPipeline& pipeline;
+
+public:
+    boost::thread_group threads;
+
+    explicit CBlockImportThreads(CBlockImportPipeline& pipelineIn) : pipeline(pipelineIn) {}
+    ~CBlockImportThreads()
+    {
+        pipeline.Stop();
+        threads.join_all();
+    }
+};
+
+/** A block whose parent was not known yet when it was read, kept in memory or by its position on disk */
+struct CImportUnknownParent {
+    size_t nBytes;
+    bool fHavePos;
+    CDiskBlockPos pos;
+    std::shared_ptr<CBlock> pblock;
+};
+} // anon namespace
+
+/** Reader stage: scan the file for block records and queue their bytes */
+static void ImportReadBlocks(CBlockImportPipeline& pipeline, FILE* fileIn, const CDiskBlockPos* dbp)
+{
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2 * MAX_BLOCK_SIZE_CURRENT, MAX_BLOCK_SIZE_CURRENT + 8, SER_DISK, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
         while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
-
             blkdat.SetPos(nRewind);
             nRewind++; // start one byte further next time, in case of failure
             blkdat.SetLimit(); // remove former limit
@@ -5314,30 +6027,152 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
                 break;
             }
             try {
-                // read block
+                // read the block record; the workers deserialize it. A record that
+                // turns out not to deserialize is skipped as a whole.
                 uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
+                std::unique_ptr<CImportRecord> record(new CImportRecord());
+                record->fHavePos = dbp != NULL;
+                if (dbp) {
+                    record->pos = *dbp;
+                    record->pos.nPos = nBlockPos;
+                }
+                record->nBytes = nSize;
+                record->ssData.resize(nSize);
                 blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
+                blkdat.read(&record->ssData[0], nSize);
                 nRewind = blkdat.GetPos();
+                if (!pipeline.Push(std::move(record)))
+                    break;
+            } catch (std::exception& e) {
+                LogPrintf("%s : Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+    } catch (std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
+    pipeline.ReaderDone();
+}
+
+/** Heap memory of a parsed block: its transactions with their inputs, outputs and scripts, and its merkle tree */
+static size_t BlockUsage(const CBlock& block)
+{
+    size_t nUsage = sizeof(CBlock) + memusage::DynamicUsage(block.vtx) + memusage::DynamicUsage(block.vMerkleTree) + memusage::DynamicUsage(block.vchBlockSig);
+    for (const CTransaction& tx : block.vtx) {
+        nUsage += memusage::DynamicUsage(tx.vin) + memusage::DynamicUsage(tx.vout);
+        for (const CTxIn& txin : tx.vin)
+            nUsage += memusage::DynamicUsage(*static_cast<const std::vector<unsigned char>*>(&txin.scriptSig));
+        for (const CTxOut& txout : tx.vout)
+            nUsage += memusage::DynamicUsage(*static_cast<const std::vector<unsigned char>*>(&txout.scriptPubKey));
+    }
+    return nUsage;
+}
+
+/** Worker stage: deserialize records and check their merkle roots ahead of CheckBlock */
+static void ImportParseBlocks(CBlockImportPipeline& pipeline)
+{
+    while (CImportRecord* record = pipeline.PopRead()) {
+        size_t nUsage = 0;
+        try {
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            record->ssData >> *pblock;
+            record->hash = pblock->GetHash();
+            bool fMutated;
+            // CheckBlock takes this result instead of building the tree again
+            if (pblock->BuildMerkleTree(&fMutated) == pblock->hashMerkleRoot && !fMutated)
+                pblock->fMerkleChecked = true;
+            else
+                LogPrint("reindex", "%s: block %s has a bad merkle root\n", __func__, record->hash.ToString());
+            nUsage = BlockUsage(*pblock);
+            record->pblock = pblock;
+        } catch (std::exception& e) {
+            LogPrintf("%s : Deserialize or I/O error - %s\n", __func__, e.what());
+        }
+        CDataStream ssEmpty(SER_DISK, CLIENT_VERSION);
+        std::swap(record->ssData, ssEmpty);
+        pipeline.Parsed(record, nUsage);
+    }
+}
+
+/** Hashing stage: check the proof of work of runs of blocks that CheckBlockHeader would hash */
+static void ImportHashBlocks(CBlockImportPipeline& pipeline)
+{
+    // enough headers to keep every scrypt² worker of the batch busy
+    const size_t nBatch = std::max(nScriptCheckThreads, 1) * 16;
+    std::vector<CImportRecord*> vRecords;
+    while (pipeline.TakeParsed(vRecords, nBatch)) {
+        std::vector<const CBlockHeader*> vHeaders;
+        {
+            LOCK(cs_main);
+            for (CImportRecord* record : vRecords) {
+                const CBlock* pblock = record->pblock.get();
+                bool fHash = pblock && IsHeaderPoWChecked(*pblock) && GetCachedPoWHash(record->hash) == 0;
+                vHeaders.push_back(fHash ? pblock : NULL);
+            }
+        }
+        std::vector<bool> vChecked;
+        std::vector<uint256> vHashPoW;
+        CheckProofOfWorkBatch(vHeaders, vChecked, &vHashPoW);
+        for (size_t i = 0; i < vRecords.size(); i++) {
+            if (vChecked[i])
+                vRecords[i]->hashPoW = vHashPoW[i];
+        }
+        pipeline.Hashed(vRecords);
+    }
+}
+
+bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
+{
+    // Blocks with unknown parent, kept in memory up to MAX_IMPORT_UNKNOWN_PARENT_BYTES
+    // and by disk position beyond that (only possible when reindexing)
+    static std::multimap<uint256, CImportUnknownParent> mapBlocksUnknownParent;
+    static size_t nUnknownParentBytes = 0;
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    CBlockImportPipeline pipeline(MAX_IMPORT_BYTES_IN_FLIGHT);
+    {
+        CBlockImportThreads threads(pipeline);
+        threads.threads.create_thread(boost::bind(&ImportReadBlocks, boost::ref(pipeline), fileIn, dbp));
+        for (int i = 0; i < std::max(nScriptCheckThreads, 1); i++)
+            threads.threads.create_thread(boost::bind(&ImportParseBlocks, boost::ref(pipeline)));
+        threads.threads.create_thread(boost::bind(&ImportHashBlocks, boost::ref(pipeline)));
+
+        while (std::unique_ptr<CImportRecord> record = pipeline.PopHashed()) {
+            boost::this_thread::interruption_point();
+
+            try {
+                if (!record->pblock)
+                    continue;
+                CBlock& block = *record->pblock;
+                CDiskBlockPos* pos = record->fHavePos ? &record->pos : NULL;
+                if (record->hashPoW != 0) {
+                    LOCK(cs_main);
+                    CachePoWHash(record->hash, record->hashPoW);
+                }
 
                 // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
+                uint256 hash = record->hash;
                 if (hash != Params().HashGenesisBlock() && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
                     LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
                             block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+                    CImportUnknownParent orphan;
+                    orphan.nBytes = record->nBytes;
+                    orphan.fHavePos = record->fHavePos;
+                    orphan.pos = record->pos;
+                    if (nUnknownParentBytes + record->nBytes <= MAX_IMPORT_UNKNOWN_PARENT_BYTES) {
+                        orphan.pblock = record->pblock;
+                        nUnknownParentBytes += record->nBytes;
+                    } else if (!orphan.fHavePos) {
+                        continue;
+                    }
+                    mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, orphan));
                     continue;
                 }
 
                 // process in case the block isn't known yet
                 if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
                     CValidationState state;
-                    if (ProcessNewBlock(state, NULL, &block, true, dbp))
+                    if (ProcessNewBlock(state, NULL, &block, true, pos))
                         nLoaded++;
                     if (state.IsError())
                         break;
@@ -5351,17 +6186,26 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
                 while (!queue.empty()) {
                     uint256 head = queue.front();
                     queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+                    std::pair<std::multimap<uint256, CImportUnknownParent>::iterator, std::multimap<uint256, CImportUnknownParent>::iterator> range = mapBlocksUnknownParent.equal_range(head);
                     while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second)) { // only call to ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
+                        std::multimap<uint256, CImportUnknownParent>::iterator it = range.first;
+                        CImportUnknownParent& orphan = it->second;
+                        std::shared_ptr<CBlock> pchild = orphan.pblock;
+                        if (pchild) {
+                            nUnknownParentBytes -= orphan.nBytes;
+                        } else {
+                            pchild = std::make_shared<CBlock>();
+                            if (!ReadBlockFromDisk(*pchild, orphan.pos)) // only call to ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+                                pchild.reset();
+                        }
+                        if (pchild) {
+                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, pchild->GetHash().ToString(),
                                 head.ToString());
                             CValidationState dummy;
-                            if (ProcessNewBlock(dummy, NULL, &block, true, &it->second))
+                            if (ProcessNewBlock(dummy, NULL, pchild.get(), true, orphan.fHavePos ? &orphan.pos : NULL))
                             {
                                 nLoaded++;
-                                queue.push_back(block.GetHash());
+                                queue.push_back(pchild->GetHash());
                             }
                         }
                         range.first++;
@@ -5372,8 +6216,6 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
                 LogPrintf("%s : Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
-    } catch (std::runtime_error& e) {
-        AbortNode(std::string("System error: ") + e.what());
     }
     if (nLoaded > 0)
         LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
@@ -5695,14 +6537,17 @@ void static ProcessGetData(CNode* pfrom)
                 }
                 // Don't send not-validated blocks
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
+                    if (inv.type == MSG_BLOCK) {
+                        // Send block from disk, as it is stored
+                        CRawBlockRef pblock;
+                        if (!ReadRawBlockFromDisk(pblock, (*mi).second))
+                            assert(!"cannot load block from disk");
+                        pfrom->PushMessage("block", CFlatData((void*)pblock->data(), (void*)(pblock->data() + pblock->size())));
+                    } else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
                             CMerkleBlock merkleBlock(block, *pfrom->pfilter);
@@ -5933,6 +6778,26 @@ void static ProcessGetData(CNode* pfrom)
 }
 
 bool fRequestedSporksIDB = false;
+
+/** Network messages handled by the masternode and budget managers, kept apart in the message statistics */
+enum MessageFamily {
+    MSG_FAMILY_NONE = -1,
+    MSG_FAMILY_MASTERNODE,
+    MSG_FAMILY_BUDGET,
+    MSG_FAMILY_COUNT
+};
+
+static const char* const MESSAGE_FAMILY_NAMES[MSG_FAMILY_COUNT] = {"masternode", "budget"};
+
+static int GetMessageFamily(const std::string& strCommand)
+{
+    if (strCommand == "mnb" || strCommand == "mnp" || strCommand == "mnw" || strCommand == "mnget" ||
+        strCommand == "dseg" || strCommand == "dsee" || strCommand == "dsee+" || strCommand == "dseep")
+        return MSG_FAMILY_MASTERNODE;
+    if (strCommand == "mnvs" || strCommand == "mprop" || strCommand == "mvote" || strCommand == "fbs" || strCommand == "fbvote")
+        return MSG_FAMILY_BUDGET;
+    return MSG_FAMILY_NONE;
+}
 bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     RandAddSeedPerfmon();
@@ -6540,9 +7405,55 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             //ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Hash the proof of work in batches before taking cs_main; headers the
+        // batches could not vouch for are checked one by one below. Only the
+        // run of headers that links to a known block is hashed, and hashing
+        // stops after the first batch with a failure, as the checks below
+        // stop at the first bad header.
+        std::vector<bool> vPoWChecked(headers.size(), false);
+        std::vector<uint256> vHashPoW(headers.size());
+        size_t nLinked = 0;
+        if (!headers.empty()) {
+            {
+                LOCK(cs_main);
+                if (mapBlockIndex.count(headers[0].hashPrevBlock))
+                    nLinked = 1;
+            }
+            while (nLinked > 0 && nLinked < headers.size() && headers[nLinked].hashPrevBlock == headers[nLinked - 1].GetHash())
+                nLinked++;
+        }
+        // enough headers to keep every scrypt² worker of a batch busy
+        const size_t nBatch = std::max(nScriptCheckThreads, 1) * 16;
+        for (size_t nFirst = 0; nFirst < nLinked; nFirst += nBatch) {
+            std::vector<const CBlockHeader*> vpHeaders;
+            for (size_t n = nFirst; n < std::min(nLinked, nFirst + nBatch); n++)
+                vpHeaders.push_back(IsHeaderPoWChecked(headers[n]) ? &headers[n] : nullptr);
+            std::vector<bool> vChecked;
+            std::vector<uint256> vHash;
+            CheckProofOfWorkBatch(vpHeaders, vChecked, &vHash);
+            bool fFailed = false;
+            for (size_t j = 0; j < vpHeaders.size(); j++) {
+                vPoWChecked[nFirst + j] = vChecked[j];
+                vHashPoW[nFirst + j] = vHash[j];
+                if (vpHeaders[j] && !vChecked[j])
+                    fFailed = true;
+            }
+            if (fFailed)
+                break;
+        }
+        // A short message is the end of header sync with this peer, the
+        // scratchpads are not needed until the next one
+        if (nCount < MAX_HEADERS_RESULTS)
+            scrypt_scratch_pool_trim(0);
+
         {
         LOCK(cs_main);
 
+        for (unsigned int n = 0; n < headers.size(); n++) {
+            if (vPoWChecked[n])
+                CachePoWHash(headers[n].GetHash(), vHashPoW[n]);
+        }
+
         if (nCount == 0) {
             // Nothing interesting. Stop asking this peers for more headers.
             return true;
@@ -6587,7 +7498,8 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
 
         CBlockIndex *pindexLast = nullptr;
 
-        for (const CBlock& header : headers) {
+        for (unsigned int n = 0; n < headers.size(); n++) {
+            const CBlock& header = headers[n];
             CValidationState state;
             if (pindexLast != nullptr && header.hashPrevBlock != pindexLast->GetBlockHash()) {
                 Misbehaving(pfrom->GetId(), 20);
@@ -6595,7 +7507,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
                 strError = "non-continuous headers sequence";
                 break;
             }
-            if (!AcceptBlockHeader(header, state, &pindexLast, nullptr, false)) {
+            if (!AcceptBlockHeader(header, state, &pindexLast, nullptr, vPoWChecked[n])) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -7016,13 +7928,20 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         }
     } else {
         //probably one the extensions
-        //obfuScationPool.ProcessMessageObfuscation(pfrom, strCommand, vRecv);
-        mnodeman.ProcessMessage(pfrom, strCommand, vRecv);
-        budget.ProcessMessage(pfrom, strCommand, vRecv);
-        masternodePayments.ProcessMessageMasternodePayments(pfrom, strCommand, vRecv);
-        ProcessMessageSwiftTX(pfrom, strCommand, vRecv);
-        ProcessSpork(pfrom, strCommand, vRecv);
-        masternodeSync.ProcessMessage(pfrom, strCommand, vRecv);
+        switch (GetMessageFamily(strCommand)) {
+        case MSG_FAMILY_MASTERNODE:
+            mnodeman.ProcessMessage(pfrom, strCommand, vRecv);
+            masternodePayments.ProcessMessageMasternodePayments(pfrom, strCommand, vRecv);
+            break;
+        case MSG_FAMILY_BUDGET:
+            budget.ProcessMessage(pfrom, strCommand, vRecv);
+            break;
+        default:
+            //obfuScationPool.ProcessMessageObfuscation(pfrom, strCommand, vRecv);
+            ProcessMessageSwiftTX(pfrom, strCommand, vRecv);
+            ProcessSpork(pfrom, strCommand, vRecv);
+            masternodeSync.ProcessMessage(pfrom, strCommand, vRecv);
+        }
     }
 
 
@@ -7046,6 +7965,92 @@ int ActiveProtocol()
     return MIN_PEER_PROTO_VERSION_BEFORE_ENFORCEMENT;
 }
 
+static CCriticalSection cs_messageStats;
+static std::map<std::string, CMessageStats> mapMessageStats;
+
+static void RecordMessageStats(const std::string& strCommand, int64_t nMicros)
+{
+    LOCK(cs_messageStats);
+    std::map<std::string, CMessageStats>::iterator it = mapMessageStats.find(strCommand);
+    if (it == mapMessageStats.end()) {
+        // Peers choose the commands, so only so many are kept apart
+        const int nFamily = GetMessageFamily(strCommand);
+        const std::string strKey = mapMessageStats.size() < MAX_MESSAGE_STATS_COMMANDS ? strCommand : "other";
+        it = mapMessageStats.insert(std::make_pair(strKey, CMessageStats())).first;
+        if (it->second.strFamily.empty())
+            it->second.strFamily = nFamily == MSG_FAMILY_NONE ? "main" : MESSAGE_FAMILY_NAMES[nFamily];
+    }
+    CMessageStats& stats = it->second;
+    stats.nCount++;
+    stats.nTotalMicros += nMicros;
+    stats.nMaxMicros = std::max(stats.nMaxMicros, nMicros);
+}
+
+/** ProcessMessage with the exceptions of a malformed message caught, timed for the message statistics */
+bool static ProcessMessageTimed(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived)
+{
+    const unsigned int nMessageSize = vRecv.size();
+    const int64_t nTimeStart = GetTimeMicros();
+    bool fRet = false;
+    try {
+        fRet = ProcessMessage(pfrom, strCommand, vRecv, nTimeReceived);
+        boost::this_thread::interruption_point();
+    } catch (std::ios_base::failure& e) {
+        pfrom->PushMessage("reject", strCommand, REJECT_MALFORMED, std::string("error parsing message"));
+        if (strstr(e.what(), "end of data")) {
+            // Allow exceptions from under-length message on vRecv
+            LogPrintf("%s(%s, %u bytes): Exception '%s' caught, normally caused by a message being shorter than its stated length\n", __func__, SanitizeString(strCommand), nMessageSize, e.what());
+        }
+        else if (strstr(e.what(), "size too large"))
+        {
+            // Allow exceptions from over-long size
+            LogPrintf("%s(%s, %u bytes): Exception '%s' caught\n", __func__, SanitizeString(strCommand), nMessageSize, e.what());
+        }
+        else
+        {
+            PrintExceptionContinue(&e, "ProcessMessages()");
+        }
+    }
+    catch (boost::thread_interrupted&) {
+        throw;
+    } catch (std::exception& e) {
+        PrintExceptionContinue(&e, "ProcessMessages()");
+    } catch (...) {
+        PrintExceptionContinue(NULL, "ProcessMessages()");
+    }
+    RecordMessageStats(SanitizeString(strCommand), GetTimeMicros() - nTimeStart);
+
+    if (!fRet)
+        LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
+    return fRet;
+}
+
+void GetMessageStats(std::map<std::string, CMessageStats>& mapStats)
+{
+    LOCK(cs_messageStats);
+    mapStats = mapMessageStats;
+}
+
+/**
+ * Verify the signatures of the masternode and budget messages among the complete
+ * messages from it on together, across the signature check threads, so their
+ * handlers find them in the signature cache. Returns the messages looked at.
+ */
+static unsigned int CheckMessageSignatures(std::deque<CNetMessage>::const_iterator it, std::deque<CNetMessage>::const_iterator end)
+{
+    std::vector<CMessageSignatureCheck> vChecks;
+    unsigned int nMessages = 0;
+    for (; it != end && it->complete() && nMessages < MAX_SIGNATURE_BATCH; ++it, ++nMessages) {
+        const std::string strCommand = it->hdr.GetCommand();
+        if (GetMessageFamily(strCommand) != MSG_FAMILY_NONE)
+            CollectMessageSignatures(strCommand, it->vRecv, vChecks);
+    }
+    // A lone signature is left to its handler
+    if (vChecks.size() > 1)
+        VerifyMessageSignatures(vChecks);
+    return nMessages;
+}
+
 // requires LOCK(cs_vRecvMsg)
 bool ProcessMessages(CNode* pfrom)
 {
@@ -7086,8 +8091,15 @@ bool ProcessMessages(CNode* pfrom)
         if (!msg.complete())
             break;
 
+        // A masternode or budget message has the signatures of the ones behind
+        // it checked in the same batch, unless it was part of an earlier batch
+        if (pfrom->nRecvMsgSigChecked == 0 && pfrom->nVersion != 0 && GetMessageFamily(msg.hdr.GetCommand()) != MSG_FAMILY_NONE)
+            pfrom->nRecvMsgSigChecked = CheckMessageSignatures(it, pfrom->vRecvMsg.end());
+
         // at this point, any failure means we can delete the current message
         it++;
+        if (pfrom->nRecvMsgSigChecked > 0)
+            pfrom->nRecvMsgSigChecked--;
 
         // Scan for message start
         if (memcmp(msg.hdr.pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0) {
@@ -7119,37 +8131,7 @@ bool ProcessMessages(CNode* pfrom)
         }
 
         // Process message
-        bool fRet = false;
-        try {
-            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
-            boost::this_thread::interruption_point();
-        } catch (std::ios_base::failure& e) {
-            pfrom->PushMessage("reject", strCommand, REJECT_MALFORMED, std::string("error parsing message"));
-            if (strstr(e.what(), "end of data")) {
-                // Allow exceptions from under-length message on vRecv
-                LogPrintf("%s(%s, %u bytes): Exception '%s' caught, normally caused by a message being shorter than its stated length\n", __func__, SanitizeString(strCommand), nMessageSize, e.what());
-            }
-            else if (strstr(e.what(), "size too large"))
-            {
-                // Allow exceptions from over-long size
-                LogPrintf("%s(%s, %u bytes): Exception '%s' caught\n", __func__, SanitizeString(strCommand), nMessageSize, e.what());
-            }
-            else
-            {
-                PrintExceptionContinue(&e, "ProcessMessages()");
-            }
-        }
-        catch (boost::thread_interrupted&) {
-            throw;
-        } catch (std::exception& e) {
-            PrintExceptionContinue(&e, "ProcessMessages()");
-        } catch (...) {
-            PrintExceptionContinue(NULL, "ProcessMessages()");
-        }
-
-        if (!fRet)
-            LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
-
+        ProcessMessageTimed(pfrom, strCommand, vRecv, msg.nTime);
         break;
     }
 
@@ -7552,16 +8534,20 @@ bool CBlockUndo::WriteToDisk(CDiskBlockPos& pos, const uint256& hashBlock)
 
 bool CBlockUndo::ReadFromDisk(const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("CBlockUndo::ReadFromDisk : OpenBlockFile failed");
-
-    // Read block
+    // Read block, from the map of the file or else from the file
     uint256 hashChecksum;
     try {
-        filein >> *this;
-        filein >> hashChecksum;
+        const char *pbegin, *pend;
+        std::shared_ptr<const CMappedFile> pfile = MapDiskRecord(pos, "rev", sizeof(hashChecksum), pbegin, pend);
+        if (pfile) {
+            CMemoryReader(pbegin, pend, SER_DISK, CLIENT_VERSION) >> *this >> hashChecksum;
+        } else {
+            CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("CBlockUndo::ReadFromDisk : OpenBlockFile failed");
+            filein >> *this;
+            filein >> hashChecksum;
+        }
     } catch (std::exception& e) {
         return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
@@ -35,6 +35,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -53,6 +54,7 @@ class CSporkDB;
 class CBloomFilter;
 class CInv;
 class CScriptCheck;
+class CZerocoinSpendCheck;
 class CValidationInterface;
 class CValidationState;
 
@@ -66,6 +68,18 @@ static const unsigned int DEFAULT_BLOCK_MAX_SIZE = MAX_BLOCK_SIZE_CURRENT / 4;
 static const unsigned int DEFAULT_BLOCK_MIN_SIZE = 0;
 /** Default for -blockprioritysize, maximum space for zero/low-fee transactions **/
 static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 50000;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for accepting alerts from the P2P network. */
 static const bool DEFAULT_ALERTS = true;
 /** The maximum size for transactions we're willing to relay/mine */
@@ -79,6 +93,8 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 /** The maximum number of sigops we're willing to relay/mine in a single tx */
 static const unsigned int MAX_TX_SIGOPS_CURRENT = MAX_BLOCK_SIGOPS_CURRENT / 5;
 static const unsigned int MAX_TX_SIGOPS_LEGACY = MAX_BLOCK_SIGOPS_LEGACY / 5;
+/** Default for -maxzspendcachesize, maximum number of verified zerocoin spends remembered */
+static const unsigned int DEFAULT_MAX_ZSPEND_CACHE_SIZE = 10000;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
 /** The maximum size of a blk?????.dat file (since 0.8) */
@@ -88,6 +104,11 @@ static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
+/** Memory budget of block records read ahead of the connect stage when importing block files */
+static const size_t MAX_IMPORT_BYTES_IN_FLIGHT = 256 * 1024 * 1024;
+/** Memory budget of out-of-order blocks kept in memory while importing block files */
+static const size_t MAX_IMPORT_UNKNOWN_PARENT_BYTES = 64 * 1024 * 1024;
+
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
@@ -132,6 +153,11 @@ static const unsigned int DEFAULT_HEADER_SPAM_FILTER_MAX_SIZE = 100;
 /** Default for -headerspamfiltermaxavg, maximum average size of an index occurrence in the header spam filter */
 static const unsigned int DEFAULT_HEADER_SPAM_FILTER_MAX_AVG = 10;
 
+/** Received masternode and budget messages of a peer whose signatures are checked together, across the signature check threads */
+static const unsigned int MAX_SIGNATURE_BATCH = 64;
+/** Commands kept apart in the message statistics, the ones seen after that are counted as "other" */
+static const unsigned int MAX_MESSAGE_STATS_COMMANDS = 100;
+
 /** "reject" message codes */
 static const unsigned char REJECT_MALFORMED = 0x01;
 static const unsigned char REJECT_INVALID = 0x10;
@@ -169,7 +195,7 @@ extern int nScriptCheckThreads;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 extern int64_t nMaxTipAge;
@@ -195,12 +221,30 @@ extern CBlockIndex* pindexBestHeader;
 /**  */
 extern CLightWorker lightWorker;
 
+/** Block and undo files kept mapped into memory for reading, fewer where the address space is small */
+static const unsigned int MAX_MAPPED_BLOCK_FILES = sizeof(void*) >= 8 ? 64 : 4;
+/** Bytes of recently served blocks kept for the peers that ask for them next */
+static const unsigned int MAX_RAW_BLOCK_CACHE_SIZE = 16 * 1000 * 1000;
+
 /** Minimum disk space required - used in CheckDiskSpace() */
 static const uint64_t nMinDiskSpace = 52428800;
 
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
 static const unsigned int MIN_BLOCKS_TO_KEEP = 2160; // number of blocks in 2 days
 
+/** Time spent processing one network command */
+struct CMessageStats {
+    std::string strFamily;
+    uint64_t nCount;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+
+    CMessageStats() : nCount(0), nTotalMicros(0), nMaxMicros(0) {}
+};
+
+/** Processing time per network command */
+void GetMessageStats(std::map<std::string, CMessageStats>& mapStats);
+
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals& nodeSignals);
 /** Unregister a network node */
@@ -235,6 +279,10 @@ bool InitBlockIndex();
 bool LoadBlockIndex(std::string& strError);
 /** Unload database information */
 void UnloadBlockIndex();
+/** Hand PoW hashes of a block tree about to be wiped to the reindex, so its headers are not hashed again */
+void CachePoWHashes(const std::vector<std::pair<uint256, uint256> >& vHashes);
+/** Drop the PoW hashes of headers that never got a block index entry (end of reindex) */
+void ClearPendingPoWHashes();
 /** See whether the protocol update is enforced for connected nodes */
 int ActiveProtocol();
 /** Process protocol messages received from a given node */
@@ -248,6 +296,8 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the zerocoin spend checking thread */
+void ThreadZerocoinSpendCheck();
 
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
@@ -274,7 +324,7 @@ CBlockIndex* InsertBlockIndex(uint256 hash);
 bool AbortNode(const std::string& msg, const std::string& userMessage = "");
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats);
-/** Increase a node's misbehavior score. */
+/** Increase a node's misbehavior score. Takes cs_main. */
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
@@ -286,6 +336,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool isDSTX = false, bool ignoreFees = false);
 
 int GetInputAge(CTxIn& vin);
+/**
+ * Confirmations of an unspent masternode collateral and its value, 0 while it
+ * is in the mempool, -1 if it is spent, in a block or the mempool, or unknown.
+ * Answered from the collateral index and the mempool, without cs_main.
+ */
+int GetCollateralAge(const COutPoint& outpoint, CAmount& nValue);
 bool GetCoinAge(const CTransaction& tx, unsigned int nTxTime, int nBestHeight, uint64_t& nCoinAge);
 int GetIXConfirmations(uint256 nTXHash);
 
@@ -375,9 +431,14 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
 void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight);
 
 /** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state);
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvSpendChecks = NULL);
 bool CheckZerocoinMint(const uint256& txHash, const CTxOut& txout, CValidationState& state, bool fCheckOnly = false);
-bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state);
+/**
+ * Context-free checks of the zerocoin spend inputs of tx. If pvSpendChecks is
+ * given, the proof verifications not found in the spend verification cache are
+ * appended to it instead of being run.
+ */
+bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvSpendChecks = NULL);
 bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::CoinSpend* spend, CBlockIndex* pindex, const uint256& hashBlock);
 bool ContextualCheckZerocoinSpendNoSerialCheck(const CTransaction& tx, const libzerocoin::CoinSpend* spend, CBlockIndex* pindex, const uint256& hashBlock);
 bool IsTransactionInChain(const uint256& txId, int& nHeightTx, CTransaction& tx);
@@ -461,11 +522,55 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the proof verification of one zerocoin spend input,
+ * the expensive part of CheckZerocoinSpend. Successful checks are remembered
+ * in the spend verification cache under hashCache.
+ * Note that a public spend check stores a reference to the spending transaction
+ */
+class CZerocoinSpendCheck
+{
+private:
+    std::shared_ptr<const libzerocoin::CoinSpend> spend;   //!< private spend and
+    std::shared_ptr<const libzerocoin::Accumulator> accumulator; //!< the accumulator it proves membership of
+    const CTransaction* ptxTo;                             //!< public spend input
+    unsigned int nIn;
+    CTxOut prevOut;
+    uint256 hashCache;
+
+public:
+    CZerocoinSpendCheck() : ptxTo(0), nIn(0) {}
+    CZerocoinSpendCheck(const libzerocoin::CoinSpend& spendIn, const libzerocoin::Accumulator& accumulatorIn, const uint256& hashCacheIn) :
+        spend(std::make_shared<libzerocoin::CoinSpend>(spendIn)), accumulator(std::make_shared<libzerocoin::Accumulator>(accumulatorIn)),
+        ptxTo(0), nIn(0), hashCache(hashCacheIn) { }
+    CZerocoinSpendCheck(const CTransaction& txToIn, unsigned int nInIn, const CTxOut& prevOutIn, const uint256& hashCacheIn) :
+        ptxTo(&txToIn), nIn(nInIn), prevOut(prevOutIn), hashCache(hashCacheIn) { }
+
+    bool operator()();
+
+    void swap(CZerocoinSpendCheck& check) {
+        spend.swap(check.spend);
+        accumulator.swap(check.accumulator);
+        std::swap(ptxTo, check.ptxTo);
+        std::swap(nIn, check.nIn);
+        std::swap(prevOut, check.prevOut);
+        std::swap(hashCache, check.hashCache);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** A block as it is stored on disk, which is also how it goes over the wire */
+typedef std::shared_ptr<const std::vector<char> > CRawBlockRef;
+/**
+ * Read the block of an index entry without deserializing it. The index entry
+ * is trusted to point at the block, so neither its hash nor its proof of work
+ * is checked again. Recently read blocks are kept in a small cache.
+ */
+bool ReadRawBlockFromDisk(CRawBlockRef& pblock, const CBlockIndex* pindex);
 
 
 /** Functions for validating blocks and updating the block tree */
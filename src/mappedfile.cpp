@@ -0,0 +1,98 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mappedfile.h"
+
+#include <limits>
+#include <stdint.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap((void*)pdata, nSize);
+#endif
+}
+
+std::shared_ptr<const CMappedFile> CMappedFile::Open(const boost::filesystem::path& path)
+{
+#ifdef WIN32
+    return std::shared_ptr<const CMappedFile>();
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return std::shared_ptr<const CMappedFile>();
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && (uint64_t)st.st_size <= std::numeric_limits<size_t>::max())
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The map stays valid without the descriptor
+    close(fd);
+    if (p == MAP_FAILED)
+        return std::shared_ptr<const CMappedFile>();
+    return std::shared_ptr<const CMappedFile>(new CMappedFile((const char*)p, st.st_size));
+#endif
+}
+
+std::shared_ptr<const CMappedFile> CMappedFileCache::Get(const boost::filesystem::path& path, size_t nMinSize)
+{
+    if (nMaxFiles == 0)
+        return std::shared_ptr<const CMappedFile>();
+
+    const std::string strPath = path.string();
+    LOCK(cs);
+    std::map<std::string, list_type::iterator>::iterator it = mapFiles.find(strPath);
+    if (it != mapFiles.end()) {
+        listFiles.splice(listFiles.begin(), listFiles, it->second);
+        if (it->second->second->size() >= nMinSize)
+            return it->second->second;
+    }
+
+    std::shared_ptr<const CMappedFile> pfile = CMappedFile::Open(path);
+    if (!pfile)
+        return pfile;
+    if (it != mapFiles.end()) {
+        // Readers still holding the old map keep it alive until they are done
+        it->second->second = pfile;
+    } else {
+        listFiles.emplace_front(strPath, pfile);
+        mapFiles.emplace(strPath, listFiles.begin());
+        if (listFiles.size() > nMaxFiles) {
+            mapFiles.erase(listFiles.back().first);
+            listFiles.pop_back();
+        }
+    }
+    if (pfile->size() < nMinSize)
+        return std::shared_ptr<const CMappedFile>();
+    return pfile;
+}
+
+void CMappedFileCache::Erase(const boost::filesystem::path& path)
+{
+    LOCK(cs);
+    std::map<std::string, list_type::iterator>::iterator it = mapFiles.find(path.string());
+    if (it == mapFiles.end())
+        return;
+    listFiles.erase(it->second);
+    mapFiles.erase(it);
+}
+
+void CMappedFileCache::Clear()
+{
+    LOCK(cs);
+    mapFiles.clear();
+    listFiles.clear();
+}
+
+size_t CMappedFileCache::Size() const
+{
+    LOCK(cs);
+    return listFiles.size();
+}
@@ -0,0 +1,68 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MAPPEDFILE_H
+#define BITCOIN_MAPPEDFILE_H
+
+#include "sync.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <stddef.h>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+/**
+ * A file mapped read-only into memory, as large as the file was when it was
+ * mapped. It is unmapped when the last reference to it goes, so a reader
+ * holding one can deserialize straight out of it while the cache moves on.
+ */
+class CMappedFile
+{
+private:
+    const char* pdata;
+    size_t nSize;
+
+    CMappedFile(const char* pdataIn, size_t nSizeIn) : pdata(pdataIn), nSize(nSizeIn) {}
+
+public:
+    CMappedFile(const CMappedFile&) = delete;
+    CMappedFile& operator=(const CMappedFile&) = delete;
+    ~CMappedFile();
+
+    //! NULL if the file cannot be mapped, is empty, or mapping is not supported here
+    static std::shared_ptr<const CMappedFile> Open(const boost::filesystem::path& path);
+
+    const char* data() const { return pdata; }
+    size_t size() const { return nSize; }
+};
+
+/**
+ * The most recently used maps of a set of files, at most nMaxFiles of them.
+ * A file that grew past the bytes a reader needs is mapped again.
+ */
+class CMappedFileCache
+{
+private:
+    typedef std::list<std::pair<std::string, std::shared_ptr<const CMappedFile> > > list_type;
+
+    mutable CCriticalSection cs;
+    list_type listFiles; //!< most recently used first
+    std::map<std::string, list_type::iterator> mapFiles;
+    size_t nMaxFiles;
+
+public:
+    explicit CMappedFileCache(size_t nMaxFilesIn) : nMaxFiles(nMaxFilesIn) {}
+
+    //! A map of path holding at least nMinSize bytes, NULL if there is none
+    std::shared_ptr<const CMappedFile> Get(const boost::filesystem::path& path, size_t nMinSize);
+    //! Drop the map of path, as it is about to change other than by growing
+    void Erase(const boost::filesystem::path& path);
+    void Clear();
+    size_t Size() const;
+};
+
+#endif // BITCOIN_MAPPEDFILE_H
@@ -72,6 +72,7 @@ public:
 
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool SignatureValid(bool fSignatureCheck);
+    std::string GetStrMessage() const { return vin.prevout.ToStringShort() + nProposalHash.ToString() + std::to_string(nVote) + std::to_string(nTime); }
     void Relay();
 
     std::string GetVoteString()
@@ -124,6 +125,7 @@ public:
 
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool SignatureValid(bool fSignatureCheck);
+    std::string GetStrMessage() const { return vin.prevout.ToStringShort() + nBudgetHash.ToString() + std::to_string(nTime); }
     void Relay();
 
     uint256 GetHash()
@@ -215,6 +215,7 @@ public:
     }
 
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
+    std::string GetStrMessage() const { return vinMasternode.prevout.ToStringShort() + std::to_string(nBlockHeight) + payee.ToString(); }
     bool IsValid(CNode* pnode, std::string& strError);
     bool SignatureValid();
     void Relay();
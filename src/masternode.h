@@ -61,6 +61,7 @@ public:
     bool CheckAndUpdate(int& nDos, bool fRequireEnabled = true, bool fCheckSigTimeOnly = false, bool fSkipCheckPingTimeAndRelay = false);
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool VerifySignature(CPubKey& pubKeyMasternode, int &nDos);
+    std::string GetStrMessage() const { return vin.ToString() + blockHash.ToString() + std::to_string(sigTime); }
     void Relay();
 
     uint256 GetHash()
@@ -203,6 +204,8 @@ public:
     }
 
     uint256 CalculateScore(int mod = 1, int64_t nBlockHeight = 0);
+    //! Score against a block hash and the hash of it, which are the same for every masternode at a height
+    uint256 CalculateScore(const uint256& hashBlock, const uint256& hashOfHashBlock) const;
 
     ADD_SERIALIZE_METHODS;
 
@@ -274,7 +277,8 @@ public:
             return 0;
 
         if (cacheInputAge == 0) {
-            cacheInputAge = GetInputAge(vin);
+            CAmount nValue;
+            cacheInputAge = GetCollateralAge(vin.prevout, nValue);
             cacheInputAgeBlock = chain_tip->nHeight;
         }
 
@@ -25,22 +25,6 @@ struct CompareLastPaid {
     }
 };
 
-struct CompareScoreTxIn {
-    bool operator()(const std::pair<int64_t, CTxIn>& t1,
-        const std::pair<int64_t, CTxIn>& t2) const
-    {
-        return t1.first < t2.first;
-    }
-};
-
-struct CompareScoreMN {
-    bool operator()(const std::pair<int64_t, CMasternode>& t1,
-        const std::pair<int64_t, CMasternode>& t2) const
-    {
-        return t1.first < t2.first;
-    }
-};
-
 //
 // CMasternodeDB
 //
@@ -195,27 +179,7 @@ void DumpMasternodes()
 CMasternodeMan::CMasternodeMan()
 {
     nDsqCount = 0;
-}
-
-CValidationState CMasternodeMan::GetInputCheckingTx(const CTxIn& vin, CMutableTransaction& tx)
-{
-    CValidationState state;
-    CAmount          deposit;
-
-    if (!CMasternode::IsDepositCoins(vin, deposit)) {
-        state.Invalid(false, 0, "MN input checking tx: invalid vin amount");
-        return state;
-    }
-
-    CMutableTransaction chk_tx;
-
-    chk_tx.vin.push_back(vin);
-//    chk_tx.vout.push_back(CTxOut(9999.99 * COIN, obfuScationPool.collateralPubKey));
-    chk_tx.vout.push_back(CTxOut(deposit - 0.01 * COIN, obfuScationPool.collateralPubKey));
-
-    tx = chk_tx;
-
-    return state;
+    nListVersion = 0;
 }
 
 bool CMasternodeMan::Add(const CMasternode& mn)
@@ -229,6 +193,7 @@ bool CMasternodeMan::Add(const CMasternode& mn)
     if (pmn == NULL) {
         LogPrint("masternode", "CMasternodeMan: Adding new Masternode %s - %i now\n", mn.vin.prevout.hash.ToString(), size() + 1);
         vMasternodes.push_back(mn);
+        nListVersion++;
         return true;
     }
 
@@ -299,6 +264,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
             }
 
             it = vMasternodes.erase(it);
+            nListVersion++;
         } else {
             ++it;
         }
@@ -380,6 +346,7 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    nListVersion++;
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -574,6 +541,17 @@ CMasternode* CMasternodeMan::Find(const CTxIn& vin)
 }
 
 
+bool CMasternodeMan::GetMasternodePubKey(const CTxIn& vin, CPubKey& pubKeyMasternode)
+{
+    LOCK(cs);
+
+    CMasternode* pmn = Find(vin);
+    if (pmn == nullptr)
+        return false;
+    pubKeyMasternode = pmn->pubKeyMasternode;
+    return true;
+}
+
 CMasternode* CMasternodeMan::Find(const CPubKey& pubKeyMasternode)
 {
     LOCK(cs);
@@ -646,6 +624,9 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
     //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
     //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
     //  -- (chance per block * chances before IsScheduled will fire)
+    const CScoreTable* ptable = GetScoreTable(nBlockHeight - 100);
+    if (!ptable) return nullptr;
+
     int nTenthNetwork = nMnCount / 10;
     int nCountTenth = 0;
     uint256 nHigh = 0;
@@ -653,7 +634,7 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
         CMasternode* pmn = Find(s.second);
         if (!pmn) continue;
 
-        uint256 n = pmn->CalculateScore(1, nBlockHeight - 100);
+        uint256 n = ptable->mapScores.find(pmn->vin.prevout)->second;
         if (n > nHigh) {
             nHigh = n;
             pBestMasternode = pmn;
@@ -729,46 +710,89 @@ CMasternode* CMasternodeMan::GetCurrentMasterNode(unsigned mnlevel, int mod, int
     return winner;
 }
 
-int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+const CMasternodeMan::CScoreTable* CMasternodeMan::GetScoreTable(int64_t nBlockHeight)
 {
-    std::vector<std::pair<int64_t, CTxIn> > vecMasternodeScores;
-    int64_t nMasternode_Min_Age = GetSporkValue(SPORK_20_MN_WINNER_MINIMUM_AGE);
-    int64_t nMasternode_Age = 0;
+    AssertLockHeld(cs);
 
     //make sure we know about this block
     uint256 hash = 0;
-    if (!GetBlockHash(hash, nBlockHeight)) return -1;
+    if (chainActive.Tip() == NULL || !GetBlockHash(hash, nBlockHeight)) return nullptr;
 
-    // scan for winner
-    for (CMasternode& mn : vMasternodes) {
-        if (mn.protocolVersion < minProtocol) {
-            LogPrint("masternode","Skipping Masternode with obsolete version %d\n", mn.protocolVersion);
-            continue;                                                       // Skip obsolete versions
-        }
+    std::map<int64_t, CScoreTable>::iterator mi = mapScoreTables.find(nBlockHeight);
+    if (mi == mapScoreTables.end()) {
+        if (mapScoreTables.size() >= MAX_SCORE_TABLES)
+            mapScoreTables.erase(mapScoreTables.begin());
+        mi = mapScoreTables.insert(std::make_pair(nBlockHeight, CScoreTable())).first;
+    }
+    CScoreTable& table = mi->second;
+    if (table.hashBlock != hash) {
+        table.mapScores.clear();
+        table.hashBlock = hash;
+        table.fValid = false;
+    }
+    if (table.fValid && table.nListVersion == nListVersion)
+        return &table;
+
+    // Only masternodes new to the table are hashed, the order is sorted again
+    int64_t nTimeStart = GetTimeMicros();
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << hash;
+    const uint256 hash2 = ss.GetHash();
+
+    std::map<COutPoint, uint256> mapScores;
+    table.vRanked.clear();
+    table.vRanked.reserve(vMasternodes.size());
+    for (size_t i = 0; i < vMasternodes.size(); i++) {
+        const COutPoint& out = vMasternodes[i].vin.prevout;
+        std::map<COutPoint, uint256>::const_iterator it = table.mapScores.find(out);
+        const uint256 n = it != table.mapScores.end() ? it->second : vMasternodes[i].CalculateScore(hash, hash2);
+        mapScores.insert(mapScores.end(), std::make_pair(out, n));
+        table.vRanked.push_back(std::make_pair(n.GetCompact(false), i));
+    }
+    // best first, equal compact scores in collateral order
+    const std::vector<CMasternode>& vmn = vMasternodes;
+    std::sort(table.vRanked.begin(), table.vRanked.end(), [&vmn](const std::pair<int64_t, size_t>& a, const std::pair<int64_t, size_t>& b) {
+        if (a.first != b.first) return a.first > b.first;
+        return vmn[a.second].vin.prevout < vmn[b.second].vin.prevout;
+    });
+    table.mapScores.swap(mapScores);
+    table.nListVersion = nListVersion;
+    table.fValid = true;
+    LogPrint("masternode", "CMasternodeMan::GetScoreTable - height %d, %u masternodes, %.2fms\n", nBlockHeight, (unsigned int)vMasternodes.size(), 0.001 * (GetTimeMicros() - nTimeStart));
+    return &table;
+}
 
-        if (IsSporkActive(SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT)) {
-            nMasternode_Age = GetAdjustedTime() - mn.sigTime;
-            if ((nMasternode_Age) < nMasternode_Min_Age) {
-                if (fDebug) LogPrint("masternode","Skipping just activated Masternode. Age: %ld - %s\n", nMasternode_Age, mn.vin.prevout.hash.ToString());
-                continue;                                                   // Skip masternodes younger than (default) 1 hour
-            }
-        }
-        if (fOnlyActive) {
-            mn.Check();
-            if (!mn.IsEnabled(false)) continue;
-        }
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
+void CMasternodeMan::UpdateScoreTables(int nHeight)
+{
+    LOCK(cs);
+    // ProcessBlock votes for ten blocks ahead and ranks a hundred blocks before that
+    GetScoreTable(nHeight + 10 - 100);
+    // SwiftX locks rank at the height they are made at
+    GetScoreTable(nHeight);
+}
 
-        vecMasternodeScores.push_back(std::make_pair(n2, mn.vin));
-    }
+int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+{
+    const bool fCheckAge = IsSporkActive(SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT);
+    const int64_t nMasternode_Min_Age = GetSporkValue(SPORK_20_MN_WINNER_MINIMUM_AGE);
+    const int64_t nNow = GetAdjustedTime();
 
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
+    LOCK(cs);
+    const CScoreTable* ptable = GetScoreTable(nBlockHeight);
+    if (!ptable) return -1;
 
+    // count the eligible masternodes down the table until vin
     int rank = 0;
-    for (PAIRTYPE(int64_t, CTxIn) & s : vecMasternodeScores) {
+    for (const std::pair<int64_t, size_t>& s : ptable->vRanked) {
+        CMasternode& mn = vMasternodes[s.second];
+        if (mn.protocolVersion < minProtocol) continue;                      // Skip obsolete versions
+        if (fCheckAge && nNow - mn.sigTime < nMasternode_Min_Age) continue; // Skip masternodes younger than (default) 1 hour
+        if (fOnlyActive) {
+            mn.Check();
+            if (!mn.IsEnabled(false)) continue;
+        }
         rank++;
-        if (s.second.prevout == vin.prevout) {
+        if (mn.vin.prevout == vin.prevout) {
             return rank;
         }
     }
@@ -778,66 +802,51 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
 
 std::vector<std::pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t nBlockHeight, int minProtocol)
 {
-    std::vector<std::pair<int64_t, CMasternode> > vecMasternodeScores;
     std::vector<std::pair<int, CMasternode> > vecMasternodeRanks;
+    std::vector<CMasternode*> vecDisabled;
 
-    //make sure we know about this block
-    uint256 hash = 0;
-    if (!GetBlockHash(hash, nBlockHeight)) return vecMasternodeRanks;
+    LOCK(cs);
+    const CScoreTable* ptable = GetScoreTable(nBlockHeight);
+    if (!ptable) return vecMasternodeRanks;
 
-    // scan for winner
-    for (CMasternode& mn : vMasternodes) {
+    int rank = 0;
+    for (const std::pair<int64_t, size_t>& s : ptable->vRanked) {
+        CMasternode& mn = vMasternodes[s.second];
         mn.Check();
 
         if (mn.protocolVersion < minProtocol) continue;
 
+        // disabled masternodes rank last
         if (!mn.IsEnabled(false)) {
-            vecMasternodeScores.push_back(std::make_pair(9999, mn));
+            vecDisabled.push_back(&mn);
             continue;
         }
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(n2, mn));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
-
-    int rank = 0;
-    for (PAIRTYPE(int64_t, CMasternode) & s : vecMasternodeScores) {
-        rank++;
-        vecMasternodeRanks.push_back(std::make_pair(rank, s.second));
+        vecMasternodeRanks.push_back(std::make_pair(++rank, mn));
     }
+    for (CMasternode* pmn : vecDisabled)
+        vecMasternodeRanks.push_back(std::make_pair(++rank, *pmn));
 
     return vecMasternodeRanks;
 }
 
 CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<std::pair<int64_t, CTxIn> > vecMasternodeScores;
+    LOCK(cs);
+    const CScoreTable* ptable = GetScoreTable(nBlockHeight);
+    if (!ptable) return nullptr;
 
-    // scan for winner
-    for (CMasternode& mn : vMasternodes) {
+    int rank = 0;
+    for (const std::pair<int64_t, size_t>& s : ptable->vRanked) {
+        CMasternode& mn = vMasternodes[s.second];
         if (mn.protocolVersion < minProtocol) continue;
         if (fOnlyActive) {
             mn.Check();
             if (!mn.IsEnabled(false)) continue;
         }
-
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(n2, mn.vin));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
-
-    int rank = 0;
-    for (PAIRTYPE(int64_t, CTxIn) & s : vecMasternodeScores) {
         rank++;
         if (rank == nRank) {
-            return Find(s.second);
+            return &mn;
         }
     }
 
@@ -1077,7 +1086,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         }
 
         std::string errorMessage = "";
-        if (!obfuScationSigner.VerifyMessage(pubkey, vchSig, strMessage, errorMessage)) {
+        if (!obfuScationSigner.VerifyMessage(pubkey, vchSig, strMessage, errorMessage, SIG_MASTERNODE_BROADCAST)) {
             LogPrintf("CMasternodeMan::ProcessMessage() : dsee - Got bad Masternode address signature\n");
             Misbehaving(pfrom->GetId(), 100);
             return;
@@ -1153,21 +1162,11 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         // make sure it's still unspent
         //  - this is checked later by .check() in many places and by ThreadCheckObfuScationPool()
 
-        CValidationState state;
-        CMutableTransaction tx = CMutableTransaction();
-        CTxOut vout = CTxOut((GetMNCollateral(chainActive.Height())-0.01) * COIN, obfuScationPool.collateralPubKey);
-        tx.vin.push_back(vin);
-        tx.vout.push_back(vout);
-
-        bool fAcceptable = false;
-        {
-            TRY_LOCK(cs_main, lockMain);
-            if (!lockMain) return;
-            fAcceptable = AcceptableInputs(mempool, state, CTransaction(tx), false, nullptr, false, false, true);
-        }
+        CAmount deposit = 0;
+        const int nAge = GetCollateralAge(vin.prevout, deposit);
 
-        if (fAcceptable) {
-            if (GetInputAge(vin) < MASTERNODE_MIN_CONFIRMATIONS) {
+        if (nAge >= 0 && CMasternode::IsDepositCoins(deposit)) {
+            if (nAge < MASTERNODE_MIN_CONFIRMATIONS) {
                 LogPrintf("CMasternodeMan::ProcessMessage() : dsee - Input must have least %d confirmations\n", MASTERNODE_MIN_CONFIRMATIONS);
                 Misbehaving(pfrom->GetId(), 20);
                 return;
@@ -1175,18 +1174,11 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
             // verify that sig time is legit in past
             // should be at least not earlier than block when 200000 SPL tx got MASTERNODE_MIN_CONFIRMATIONS
-            uint256 hashBlock = 0;
-            CTransaction tx2;
-            GetTransaction(vin.prevout.hash, tx2, hashBlock, true);
-            BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
-            if (mi != mapBlockIndex.end() && (*mi).second) {
-                CBlockIndex* pMNIndex = (*mi).second;                                                        // block for 10000 SPL tx -> 1 confirmation
-                CBlockIndex* pConfIndex = chainActive[pMNIndex->nHeight + MASTERNODE_MIN_CONFIRMATIONS - 1]; // block where tx got MASTERNODE_MIN_CONFIRMATIONS
-                if (pConfIndex->GetBlockTime() > sigTime) {
-                    LogPrint("masternode","mnb - Bad sigTime %d for Masternode %s (%i conf block is at %d)\n",
-                        sigTime, vin.prevout.hash.ToString(), MASTERNODE_MIN_CONFIRMATIONS, pConfIndex->GetBlockTime());
-                    return;
-                }
+            CBlockIndex* pConfIndex = chainActive[chainActive.Height() - nAge + MASTERNODE_MIN_CONFIRMATIONS]; // block where tx got MASTERNODE_MIN_CONFIRMATIONS
+            if (pConfIndex && pConfIndex->GetBlockTime() > sigTime) {
+                LogPrint("masternode","mnb - Bad sigTime %d for Masternode %s (%i conf block is at %d)\n",
+                    sigTime, vin.prevout.hash.ToString(), MASTERNODE_MIN_CONFIRMATIONS, pConfIndex->GetBlockTime());
+                return;
             }
 
             // use this as a peer
@@ -1198,9 +1190,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
             mn.vin = vin;
             mn.pubKeyCollateralAddress = pubkey;
             mn.sig = vchSig;
-            CAmount deposit = 0 * COIN;
-            if (CMasternode::IsDepositCoins(mn.vin, deposit))
-                mn.deposit = deposit;
+            mn.deposit = deposit;
             mn.sigTime = sigTime;
             mn.pubKeyMasternode = pubkey2;
             mn.protocolVersion = protocolVersion;
@@ -1225,14 +1215,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
                 }
             }
         } else {
-            LogPrint("masternode","dsee - Rejected Masternode entry %s\n", vin.prevout.hash.ToString());
-
-            int nDoS = 0;
-            if (state.IsInvalid(nDoS)) {
-                LogPrint("masternode","dsee - %s from %i %s was not accepted into the memory pool\n", tx.GetHash().ToString().c_str(), pfrom->GetId(), pfrom->cleanSubVer.c_str());
-                if (nDoS > 0)
-                    Misbehaving(pfrom->GetId(), nDoS);
-            }
+            LogPrint("masternode","dsee - Rejected Masternode entry %s, input spent or not a collateral\n", vin.prevout.hash.ToString());
         }
     }
 
@@ -1299,7 +1282,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
                 std::string strMessage = pmn->addr.ToString() + std::to_string(sigTime) + std::to_string(stop);
 
                 std::string errorMessage = "";
-                if (!obfuScationSigner.VerifyMessage(pmn->pubKeyMasternode, vchSig, strMessage, errorMessage)) {
+                if (!obfuScationSigner.VerifyMessage(pmn->pubKeyMasternode, vchSig, strMessage, errorMessage, SIG_MASTERNODE_PING)) {
                     LogPrint("masternode","dseep - Got bad Masternode address signature %s \n", vin.prevout.hash.ToString());
                     //Misbehaving(pfrom->GetId(), 100);
                     return;
@@ -1340,6 +1323,7 @@ void CMasternodeMan::Remove(CTxIn vin)
         if ((*it).vin == vin) {
             LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
             vMasternodes.erase(it);
+            nListVersion++;
             break;
         }
         ++it;
@@ -18,6 +18,9 @@
 
 #define MASTERNODES_DSEG_SECONDS (3 * 60 * 60)
 
+/** Heights whose masternode scores are kept */
+static const unsigned int MAX_SCORE_TABLES = 16;
+
 class CMasternodeMan;
 
 extern CMasternodeMan mnodeman;
@@ -69,6 +72,26 @@ private:
     // who we asked for the winning Masternode list and the last time
     std::map<CNetAddr, int64_t> mWeAskedForWinnerMasternodeList;
 
+    /** Scores of the masternodes at one height, valid until a masternode is added or removed */
+    struct CScoreTable {
+        uint256 hashBlock;
+        unsigned int nListVersion;
+        bool fValid;
+        //! compact score and position in vMasternodes, best first
+        std::vector<std::pair<int64_t, size_t> > vRanked;
+        //! scores by collateral, carried over when the table is rebuilt
+        std::map<COutPoint, uint256> mapScores;
+
+        CScoreTable() : nListVersion(0), fValid(false) {}
+    };
+    // score tables by height, at most MAX_SCORE_TABLES of them
+    std::map<int64_t, CScoreTable> mapScoreTables;
+    // changed whenever vMasternodes gains or loses an entry
+    unsigned int nListVersion;
+
+    /// Score table of nBlockHeight for the current list, NULL if the block is unknown; needs cs
+    const CScoreTable* GetScoreTable(int64_t nBlockHeight);
+
 public:
     // Keep track of all broadcasts I've seen
     std::map<uint256, CMasternodeBroadcast> mapSeenMasternodeBroadcast;
@@ -85,6 +108,8 @@ public:
     {
         LOCK(cs);
         READWRITE(vMasternodes);
+        if (ser_action.ForRead())
+            nListVersion++;
         READWRITE(mAskedUsForMasternodeList);
         READWRITE(mWeAskedForMasternodeList);
         READWRITE(mWeAskedForMasternodeListEntry);
@@ -99,8 +124,6 @@ public:
     CMasternodeMan();
     CMasternodeMan(CMasternodeMan& other);
 
-    static CValidationState GetInputCheckingTx(const CTxIn& vin, CMutableTransaction&);
-
     /// Add an entry
     bool Add(const CMasternode& mn);
 
@@ -130,6 +153,9 @@ public:
     CMasternode* Find(const CPubKey& pubKeyMasternode);
     CMasternode* Find(const CService& service);
 
+    /// Copy the key of an entry, which another thread may remove once cs is released
+    bool GetMasternodePubKey(const CTxIn& vin, CPubKey& pubKeyMasternode);
+
     /// Find an entry in the masternode list that is next to be paid
     CMasternode* GetNextMasternodeInQueueForPayment(int nBlockHeight, unsigned mnlevel, bool fFilterSigTime, unsigned& nCount);
 
@@ -149,6 +175,9 @@ public:
     int GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol = 0, bool fOnlyActive = true);
     CMasternode* GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol = 0, bool fOnlyActive = true);
 
+    /// Score the masternodes at the heights that payment and SwiftX votes on the block after nHeight rank at
+    void UpdateScoreTables(int nHeight);
+
     void ProcessMasternodeConnections();
 
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
@@ -0,0 +1,61 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MEMUSAGE_H
+#define BITCOIN_MEMUSAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <vector>
+
+namespace memusage
+{
+/**
+ * Compute the total memory used by allocating alloc bytes, the way the
+ * usual mallocs round it: a word of overhead, then 16 bytes granularity
+ * on 64-bit and 8 on 32-bit systems.
+ */
+static inline size_t MallocUsage(size_t alloc)
+{
+    if (alloc == 0)
+        return 0;
+    if (sizeof(void*) == 8)
+        return ((alloc + 31) >> 4) << 4;
+    return ((alloc + 15) >> 3) << 3;
+}
+
+/** Heap memory owned by a vector, not counting what its elements own */
+template <typename X>
+static inline size_t DynamicUsage(const std::vector<X>& v)
+{
+    return MallocUsage(v.capacity() * sizeof(X));
+}
+
+/** Heap memory of the nodes of a std::set, each a value behind a colour and three links */
+template <typename X, typename Y>
+static inline size_t DynamicUsage(const std::set<X, Y>& s)
+{
+    return MallocUsage(sizeof(X) + 4 * sizeof(void*)) * s.size();
+}
+
+/** Heap memory of the nodes of a std::map, not counting what the keys and values own */
+template <typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const std::map<X, Y, Z>& m)
+{
+    return MallocUsage(sizeof(std::pair<const X, Y>) + 4 * sizeof(void*)) * m.size();
+}
+
+/** Heap memory of one more node in a std::set or std::map of values of size nValueSize */
+static inline size_t IncrementalTreeUsage(size_t nValueSize)
+{
+    return MallocUsage(nValueSize + 4 * sizeof(void*));
+}
+
+} // namespace memusage
+
+#endif // BITCOIN_MEMUSAGE_H
@@ -9,6 +9,7 @@
 #include "miner.h"
 
 #include "amount.h"
+#include "crypto/quark.h"
 #include "hash.h"
 #include "main.h"
 #include "masternode-sync.h"
@@ -31,8 +32,14 @@
 #include "zsplchain.h"
 
 
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+#include <boost/multi_index/identity.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index_container.hpp>
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -42,23 +49,78 @@
 
 //
 // Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
+// transactions in the memory pool. Transactions are selected as packages:
+// a transaction with the ancestors that are not in the block yet, in the
+// order of the fee rate of the whole package, so a high fee child pays for
+// its parents. The mempool keeps the ancestor state of every entry; once
+// some ancestors are in the block, the remaining state of their
+// descendants is tracked here in a CTxMemPoolModifiedEntry.
 //
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    std::set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
+struct CTxMemPoolModifiedEntry {
+    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
+    {
+        iter = entry;
+        nSizeWithAncestors = entry->GetSizeWithAncestors();
+        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
+    }
+
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+};
+
+/** Orders modified entries by the fee rate of their remaining package, highest first */
+struct CompareModifiedEntry {
+    bool operator()(const CTxMemPoolModifiedEntry& a, const CTxMemPoolModifiedEntry& b) const
+    {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2)
+            return CTxMemPool::CompareIteratorByHash()(a.iter, b.iter);
+        return f1 > f2;
+    }
+};
+
+/** Ancestors come before their descendants when sorted by ancestor count */
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator()(const CTxMemPoolModifiedEntry& entry) const { return entry.iter; }
+};
 
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CTxMemPool::CompareIteratorByHash>,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::tag<ancestor_score>,
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry> > >
+    indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
+
+struct update_for_parent_inclusion {
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+    void operator()(CTxMemPoolModifiedEntry& e)
     {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
     }
+
+    CTxMemPool::txiter iter;
 };
 
 unsigned int nCreateBlockAlgo = POW_QUARK;
@@ -66,28 +128,457 @@ uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 int64_t nLastCoinStakeSearchInterval = 0;
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
+/** Take the entries just added to the block out of the package state of their descendants */
+static void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx)
 {
-    bool byFee;
+    for (const CTxMemPool::txiter it : alreadyAdded) {
+        CTxMemPool::setEntries descendants;
+        mempool.CalculateDescendants(it, descendants);
+        for (CTxMemPool::txiter desc : descendants) {
+            if (alreadyAdded.count(desc))
+                continue;
+            modtxiter mit = mapModifiedTx.find(desc);
+            if (mit == mapModifiedTx.end())
+                mit = mapModifiedTx.insert(CTxMemPoolModifiedEntry(desc)).first;
+            mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
+        }
+    }
+}
 
-public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) {}
+/** Whether a zerocoin spend is already in the chain, or spends a serial that is invalid or already in the block */
+static bool IsZerocoinSpendConflicting(const CTransaction& tx, const std::vector<CBigNum>& vBlockSerials, std::vector<CBigNum>& vTxSerials)
+{
+    int nHeightTx = 0;
+    if (IsTransactionInChain(tx.GetHash(), nHeightTx))
+        return true;
+
+    for (const CTxIn& txIn : tx.vin) {
+        bool isPublicSpend = txIn.IsZerocoinPublicSpend();
+        if (!txIn.IsZerocoinSpend() && !isPublicSpend)
+            continue;
+
+        CBigNum bnSerial;
+        bool fValidSerial;
+        if (isPublicSpend) {
+            libzerocoin::ZerocoinParams* params = Params().Zerocoin_Params(false);
+            PublicCoinSpend publicSpend(params);
+            CValidationState state;
+            if (!ZSPLModule::ParseZerocoinPublicSpend(txIn, tx, state, publicSpend))
+                throw std::runtime_error("Invalid public spend parse");
+            bnSerial = publicSpend.getCoinSerialNumber();
+            bool fUseV1Params = libzerocoin::ExtractVersionFromSerial(bnSerial) < libzerocoin::PrivateCoin::PUBKEY_VERSION;
+            fValidSerial = publicSpend.HasValidSerial(Params().Zerocoin_Params(fUseV1Params));
+        } else {
+            libzerocoin::CoinSpend spend = TxInToZerocoinSpend(txIn);
+            bnSerial = spend.getCoinSerialNumber();
+            bool fUseV1Params = libzerocoin::ExtractVersionFromSerial(bnSerial) < libzerocoin::PrivateCoin::PUBKEY_VERSION;
+            fValidSerial = spend.HasValidSerial(Params().Zerocoin_Params(fUseV1Params));
+        }
 
-    bool operator()(const TxPriority& a, const TxPriority& b)
-    {
-        if (byFee) {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
+        if (!fValidSerial)
+            return true;
+        if (std::count(vBlockSerials.begin(), vBlockSerials.end(), bnSerial))
+            return true;
+        if (std::count(vTxSerials.begin(), vTxSerials.end(), bnSerial))
+            return true;
+        vTxSerials.emplace_back(bnSerial);
+    }
+    return false;
+}
+
+void CBlockTemplateBuilder::Clear()
+{
+    vSelected.clear();
+    setSelected.clear();
+    vBlockSerials.clear();
+    pview.reset(new CCoinsViewCache(pcoinsTip));
+    nBlockSize = 1000;
+    nBlockSigOps = 100;
+    minPackageRate = CFeeRate(std::numeric_limits<CAmount>::max());
+}
+
+bool CBlockTemplateBuilder::TestTransaction(const CTransaction& tx, CCoinsViewCache& viewTx, unsigned int& nTxSigOps, CAmount& nTxFees, bool fCheckScripts) const
+{
+    if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
+        return false;
+    if (!fZerocoinAllowed && tx.ContainsZerocoins())
+        return false;
+    if (!viewTx.HaveInputs(tx))
+        return false;
+    for (const CTxIn& txin : tx.vin) {
+        //Check for invalid/fraudulent inputs. They shouldn't make it through mempool, but check anyways.
+        if (!txin.IsZerocoinSpend() && !txin.IsZerocoinPublicSpend() && invalid_out::ContainsOutPoint(txin.prevout)) {
+            LogPrintf("%s : found invalid input %s in tx %s", __func__, txin.prevout.ToString(), tx.GetHash().ToString());
+            return false;
+        }
+    }
+
+    nTxSigOps = GetLegacySigOpCount(tx) + GetP2SHSigOpCount(tx, viewTx);
+    nTxFees = viewTx.GetValueIn(tx) - tx.GetValueOut();
+
+    // Note that flags: we don't want to set mempool/IsStandard()
+    // policy here, but we still have to ensure that the block we
+    // create only contains transactions that are valid in new blocks.
+    // Without fCheckScripts the input maturity, values and fee are
+    // still checked.
+    CValidationState state;
+    if (!CheckInputs(tx, state, viewTx, fCheckScripts, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        return false;
+
+    CTxUndo txundo;
+    UpdateCoins(tx, state, viewTx, txundo, nHeight);
+    return true;
+}
+
+void CBlockTemplateBuilder::Select(const CTxMemPoolEntry& entry, unsigned int nTxSigOps, CAmount nTxFees, const std::vector<CBigNum>& vSerials)
+{
+    CSelectedTx selected;
+    selected.hash = entry.GetTx().GetHash();
+    selected.nSigOps = nTxSigOps;
+    selected.nFees = nTxFees;
+    selected.vSerials = vSerials;
+    vSelected.push_back(selected);
+    setSelected.insert(selected.hash);
+    vBlockSerials.insert(vBlockSerials.end(), vSerials.begin(), vSerials.end());
+    nBlockSize += entry.GetTxSize();
+    nBlockSigOps += nTxSigOps;
+}
+
+bool CBlockTemplateBuilder::AddZerocoinSpend(CTxMemPool::txiter iter)
+{
+    if (nBlockSize + iter->GetTxSize() >= nBlockMaxSize)
+        return false;
+
+    std::vector<CBigNum> vTxSerials;
+    CCoinsViewCache viewTx(pview.get());
+    unsigned int nTxSigOps;
+    CAmount nTxFees;
+    if (IsZerocoinSpendConflicting(iter->GetTx(), vBlockSerials, vTxSerials) ||
+        !TestTransaction(iter->GetTx(), viewTx, nTxSigOps, nTxFees, true) ||
+        nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS_CURRENT)
+        return false;
+    viewTx.Flush();
+    Select(*iter, nTxSigOps, nTxFees, vTxSerials);
+    return true;
+}
+
+bool CBlockTemplateBuilder::AddPackage(CTxMemPool::txiter iter, uint64_t nPackageSize, CAmount nPackageFees, CTxMemPool::setEntries& added)
+{
+    CTxMemPool::setEntries ancestors;
+    std::string dummy;
+    mempool.CalculateMemPoolAncestors(*iter, ancestors, std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max(),
+        std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max(), dummy, false);
+    ancestors.insert(iter);
+    std::vector<CTxMemPool::txiter> vPackage;
+    for (CTxMemPool::txiter it : ancestors) {
+        if (!setSelected.count(it->GetTx().GetHash()))
+            vPackage.push_back(it);
+    }
+    std::sort(vPackage.begin(), vPackage.end(), CompareTxIterByAncestorCount());
+
+    // Test the package on a view of its own
+    CCoinsViewCache viewPackage(pview.get());
+    std::vector<std::pair<unsigned int, CAmount> > vSigOpsAndFees;
+    unsigned int nPackageSigOps = 0;
+    for (CTxMemPool::txiter it : vPackage) {
+        unsigned int nTxSigOps;
+        CAmount nTxFees;
+        if (it->GetTx().HasZerocoinSpendInputs() || !TestTransaction(it->GetTx(), viewPackage, nTxSigOps, nTxFees, true))
+            return false;
+        nPackageSigOps += nTxSigOps;
+        vSigOpsAndFees.emplace_back(nTxSigOps, nTxFees);
+    }
+    if (nBlockSigOps + nPackageSigOps >= MAX_BLOCK_SIGOPS_CURRENT)
+        return false;
+
+    viewPackage.Flush();
+    for (size_t i = 0; i < vPackage.size(); i++) {
+        Select(*vPackage[i], vSigOpsAndFees[i].first, vSigOpsAndFees[i].second, std::vector<CBigNum>());
+        added.insert(vPackage[i]);
+    }
+    minPackageRate = std::min(minPackageRate, CFeeRate(nPackageFees, nPackageSize));
+    return true;
+}
+
+void CBlockTemplateBuilder::Fill()
+{
+    CTxMemPool::setEntries failedTx;
+    if (fZerocoinAllowed) {
+        const auto& byTime = mempool.mapTx.get<entry_time>();
+        for (auto mi = byTime.begin(); mi != byTime.end(); ++mi) {
+            if (mi->GetTx().HasZerocoinSpendInputs() && !setSelected.count(mi->GetTx().GetHash()))
+                AddZerocoinSpend(mempool.mapTx.project<0>(mi));
+        }
+    }
+
+    // mapTx's ancestor_score index has the packages with none of their
+    // ancestors selected, mapModifiedTx those that have some already
+    CTxMemPool::setEntries inBlock;
+    for (const CSelectedTx& selected : vSelected)
+        inBlock.insert(mempool.mapTx.find(selected.hash));
+    indexed_modified_transaction_set mapModifiedTx;
+    UpdatePackagesForAdded(inBlock, mapModifiedTx);
+
+    const auto& byScore = mempool.mapTx.get<ancestor_score>();
+    auto mi = byScore.begin();
+    int nConsecutiveFailed = 0;
+    while (mi != byScore.end() || !mapModifiedTx.empty()) {
+        if (mi != byScore.end()) {
+            CTxMemPool::txiter it = mempool.mapTx.project<0>(mi);
+            if (inBlock.count(it) || failedTx.count(it) || mapModifiedTx.count(it)) {
+                ++mi;
+                continue;
+            }
+        }
+
+        // The better of the next package from mapTx and from mapModifiedTx
+        CTxMemPool::txiter iter;
+        bool fUsingModified = false;
+        modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
+        if (mi == byScore.end()) {
+            iter = modit->iter;
+            fUsingModified = true;
         } else {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
+            iter = mempool.mapTx.project<0>(mi);
+            if (modit != mapModifiedTx.get<ancestor_score>().end() &&
+                CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                ++mi;
+            }
+        }
+        assert(!inBlock.count(iter));
+
+        uint64_t nPackageSize = fUsingModified ? modit->nSizeWithAncestors : iter->GetSizeWithAncestors();
+        CAmount nPackageFees = fUsingModified ? modit->nModFeesWithAncestors : iter->GetModFeesWithAncestors();
+        if (fUsingModified)
+            mapModifiedTx.get<ancestor_score>().erase(modit);
+
+        // Everything from here on pays less: stop once past the free area
+        if (CFeeRate(nPackageFees, nPackageSize) < ::minRelayTxFee && nBlockSize + nPackageSize >= nBlockFreeSize)
+            break;
+
+        if (nBlockSize + nPackageSize >= nBlockMaxSize) {
+            failedTx.insert(iter);
+            // Give up once the block is close to full
+            if (++nConsecutiveFailed > 1000 && nBlockSize > nBlockMaxSize - 4000)
+                break;
+            continue;
+        }
+
+        CTxMemPool::setEntries added;
+        if (!AddPackage(iter, nPackageSize, nPackageFees, added)) {
+            failedTx.insert(iter);
+            ++nConsecutiveFailed;
+            continue;
+        }
+        nConsecutiveFailed = 0;
+
+        for (CTxMemPool::txiter it : added) {
+            mapModifiedTx.erase(it);
+            inBlock.insert(it);
         }
+        UpdatePackagesForAdded(added, mapModifiedTx);
     }
-};
+}
+
+void CBlockTemplateBuilder::Replay()
+{
+    std::vector<CSelectedTx> vOld;
+    vOld.swap(vSelected);
+    CFeeRate minRate = minPackageRate;
+    Clear();
+    minPackageRate = minRate;
+
+    for (const CSelectedTx& selected : vOld) {
+        CTxMemPool::txiter it = mempool.mapTx.find(selected.hash);
+        if (it == mempool.mapTx.end())
+            continue;
+        const CTransaction& tx = it->GetTx();
+        std::vector<CBigNum> vTxSerials;
+        if (tx.HasZerocoinSpendInputs() && IsZerocoinSpendConflicting(tx, vBlockSerials, vTxSerials))
+            continue;
+        unsigned int nTxSigOps;
+        CAmount nTxFees;
+        if (!TestTransaction(tx, *pview, nTxSigOps, nTxFees, false))
+            continue;
+        Select(*it, nTxSigOps, nTxFees, vTxSerials);
+    }
+}
+
+bool CBlockTemplateBuilder::AddNew()
+{
+    const auto& byTime = mempool.mapTx.get<entry_time>();
+    CTxMemPoolEntry entryFrom(CTransaction(), 0, nLastEntryTime, 0, 0);
+    std::vector<CTxMemPool::txiter> vNew;
+    for (auto mi = byTime.lower_bound(entryFrom); mi != byTime.end(); ++mi) {
+        if (!setSelected.count(mi->GetTx().GetHash()))
+            vNew.push_back(mempool.mapTx.project<0>(mi));
+    }
+    if (!byTime.empty())
+        nLastEntryTime = std::max(nLastEntryTime, byTime.rbegin()->GetTime());
+
+    // Parents first, so that a child finds them selected
+    std::sort(vNew.begin(), vNew.end(), CompareTxIterByAncestorCount());
+    for (CTxMemPool::txiter iter : vNew) {
+        if (setSelected.count(iter->GetTx().GetHash()))
+            continue;
+        if (iter->GetTx().HasZerocoinSpendInputs()) {
+            if (fZerocoinAllowed && !AddZerocoinSpend(iter) && nBlockSize + iter->GetTxSize() >= nBlockMaxSize)
+                return false;
+            continue;
+        }
+
+        uint64_t nPackageSize = 0;
+        CAmount nPackageFees = 0;
+        CTxMemPool::setEntries ancestors;
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*iter, ancestors, std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max(),
+            std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max(), dummy, false);
+        ancestors.insert(iter);
+        for (CTxMemPool::txiter it : ancestors) {
+            if (!setSelected.count(it->GetTx().GetHash())) {
+                nPackageSize += it->GetTxSize();
+                nPackageFees += it->GetModifiedFee();
+            }
+        }
+
+        CFeeRate packageRate(nPackageFees, nPackageSize);
+        if (packageRate < ::minRelayTxFee && nBlockSize + nPackageSize >= nBlockFreeSize)
+            continue;
+        if (nBlockSize + nPackageSize >= nBlockMaxSize) {
+            // It pays more than what is in the block: choose again
+            if (minPackageRate < packageRate)
+                return false;
+            continue;
+        }
+        CTxMemPool::setEntries added;
+        AddPackage(iter, nPackageSize, nPackageFees, added);
+    }
+    return true;
+}
+
+bool CBlockTemplateBuilder::Update(const CBlockIndex* pindexPrev, bool fZerocoinAllowedIn, unsigned int nBlockMaxSizeIn, unsigned int nBlockFreeSizeIn)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+
+    bool fRebuild = fInvalidated.exchange(false) || !pview || fZerocoinAllowedIn != fZerocoinAllowed ||
+                    nBlockMaxSizeIn != nBlockMaxSize || nBlockFreeSizeIn != nBlockFreeSize;
+    fZerocoinAllowed = fZerocoinAllowedIn;
+    nBlockMaxSize = nBlockMaxSizeIn;
+    nBlockFreeSize = nBlockFreeSizeIn;
+    nHeight = pindexPrev->nHeight + 1;
+
+    if (!fRebuild && hashTip != pindexPrev->GetBlockHash()) {
+        hashTip = pindexPrev->GetBlockHash();
+        Replay();
+        Fill();
+        nLastEntryTime = mempool.mapTx.empty() ? 0 : mempool.mapTx.get<entry_time>().rbegin()->GetTime();
+        return false;
+    }
+
+    if (!fRebuild) {
+        for (const CSelectedTx& selected : vSelected) {
+            if (!mempool.mapTx.count(selected.hash)) {
+                Replay();
+                break;
+            }
+        }
+        fRebuild = !AddNew();
+    }
+
+    if (fRebuild) {
+        hashTip = pindexPrev->GetBlockHash();
+        Clear();
+        Fill();
+        nLastEntryTime = mempool.mapTx.empty() ? 0 : mempool.mapTx.get<entry_time>().rbegin()->GetTime();
+    }
+    return fRebuild;
+}
+
+CAmount CBlockTemplateBuilder::AppendTo(CBlockTemplate& blocktemplate, bool fPrintPriority) const
+{
+    CAmount nFees = 0;
+    for (const CSelectedTx& selected : vSelected) {
+        CTxMemPool::txiter it = mempool.mapTx.find(selected.hash);
+        blocktemplate.block.vtx.push_back(it->GetTx());
+        blocktemplate.vTxFees.push_back(selected.nFees);
+        blocktemplate.vTxSigOps.push_back(selected.nSigOps);
+        nFees += selected.nFees;
+
+        if (fPrintPriority) {
+            LogPrintf("fee %s txid %s\n",
+                CFeeRate(it->GetModifiedFee(), it->GetTxSize()).ToString(), selected.hash.ToString());
+        }
+    }
+    return nFees;
+}
+
+unsigned int CBlockTemplateBuilder::RemoveInvalid()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+
+    CCoinsViewCache view(pcoinsTip);
+    std::vector<CBigNum> vSerials;
+    std::vector<CTransaction> vInvalid;
+    for (const CSelectedTx& selected : vSelected) {
+        CTxMemPool::txiter it = mempool.mapTx.find(selected.hash);
+        if (it == mempool.mapTx.end())
+            continue;
+        const CTransaction& tx = it->GetTx();
+        std::vector<CBigNum> vTxSerials;
+        CCoinsViewCache viewTx(&view);
+        unsigned int nTxSigOps;
+        CAmount nTxFees;
+        if ((tx.HasZerocoinSpendInputs() && IsZerocoinSpendConflicting(tx, vSerials, vTxSerials)) ||
+            !TestTransaction(tx, viewTx, nTxSigOps, nTxFees, true)) {
+            vInvalid.push_back(tx);
+            continue;
+        }
+        viewTx.Flush();
+        vSerials.insert(vSerials.end(), vTxSerials.begin(), vTxSerials.end());
+    }
+
+    for (const CTransaction& tx : vInvalid) {
+        LogPrintf("%s : removing %s from the mempool\n", __func__, tx.GetHash().ToString());
+        std::list<CTransaction> removed;
+        mempool.remove(tx, removed, true);
+    }
+    fInvalidated = true;
+    return vInvalid.size();
+}
+
+void CBlockTemplateBuilder::RecordLatency(int64_t nMicros, bool fRebuilt)
+{
+    LOCK(csStats);
+    stats.nTemplates++;
+    if (fRebuilt)
+        stats.nRebuilds++;
+    stats.nLastMicros = nMicros;
+    stats.nTotalMicros += nMicros;
+    stats.nMaxMicros = std::max(stats.nMaxMicros, nMicros);
+}
+
+CBlockTemplateStats CBlockTemplateBuilder::GetStats() const
+{
+    LOCK(csStats);
+    return stats;
+}
+
+static CBlockTemplateBuilder templateBuilder;
+
+void InvalidateBlockTemplate()
+{
+    templateBuilder.Invalidate();
+}
+
+CBlockTemplateStats GetBlockTemplateStats()
+{
+    return templateBuilder.GetStats();
+}
 
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev, bool fProofOfStake)
 {
@@ -200,263 +691,18 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 
         CBlockIndex* pindexPrev = chainActive.Tip();
         const int nHeight = pindexPrev->nHeight + 1;
-        CCoinsViewCache view(pcoinsTip);
-
-        // Priority order to process transactions
-        std::list<COrphan> vOrphan; // list memory doesn't move
-        std::map<uint256, std::vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        std::vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (std::map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight)) {
-                continue;
-            }
-            if ((!fZerocoinActive || GetAdjustedTime() > GetSporkValue(SPORK_16_ZEROCOIN_MAINTENANCE_MODE)) && tx.ContainsZerocoins()) {
-                continue;
-            }
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            uint256 txid = tx.GetHash();
-            bool hasZerocoinSpends = tx.HasZerocoinSpendInputs();
-            if (hasZerocoinSpends)
-                nTotalIn = tx.GetZerocoinSpent();
-
-            for (const CTxIn& txin : tx.vin) {
-                //zerocoinspend has special vin
-                if (hasZerocoinSpends) {
-                    //Give a high priority to zerocoinspends to get into the next block
-                    //Priority = (age^6+100000)*amount - gives higher priority to zspls that have been in mempool long
-                    //and higher priority to zspls that are large in value
-                    int64_t nTimeSeen = GetAdjustedTime();
-                    double nConfs = 100000;
-
-                    auto it = mapZerocoinspends.find(txid);
-                    if (it != mapZerocoinspends.end()) {
-                        nTimeSeen = it->second;
-                    } else {
-                        //for some reason not in map, add it
-                        mapZerocoinspends[txid] = nTimeSeen;
-                    }
-
-                    double nTimePriority = std::pow(GetAdjustedTime() - nTimeSeen, 6);
-
-                    // zSPL spends can have very large priority, use non-overflowing safe functions
-                    dPriority = double_safe_addition(dPriority, (nTimePriority * nConfs));
-                    dPriority = double_safe_multiplication(dPriority, nTotalIn);
-
-                    continue;
-                }
-
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-
-                //Check for invalid/fraudulent inputs. They shouldn't make it through mempool, but check anyways.
-                if (invalid_out::ContainsOutPoint(txin.prevout)) {
-                    LogPrintf("%s : found invalid input %s in tx %s", __func__, txin.prevout.ToString(), tx.GetHash().ToString());
-                    fMissingInputs = true;
-                    break;
-                }
-
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                // zSPL spends can have very large priority, use non-overflowing safe functions
-                dPriority = double_safe_addition(dPriority, ((double)nValueIn * nConf));
-
-            }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
-
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
-        }
-
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        std::vector<CBigNum> vBlockSerials;
-        std::vector<CBigNum> vTxSerials;
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
+        const int64_t nTimeStart = GetTimeMicros();
+        const bool fZerocoinAllowed = fZerocoinActive && GetAdjustedTime() <= GetSporkValue(SPORK_16_ZEROCOIN_MAINTENANCE_MODE);
 
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (!tx.HasZerocoinSpendInputs() && fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
+        // Below the priority size low fee packages still get in, as free
+        // transactions did when the block was filled by priority
+        const unsigned int nBlockFreeSize = std::max(nBlockMinSize, nBlockPrioritySize);
 
-            if (!view.HaveInputs(tx))
-                continue;
-
-            // double check that there are no double spent zSPL spends in this block or tx
-            if (tx.HasZerocoinSpendInputs()) {
-                int nHeightTx = 0;
-                if (IsTransactionInChain(tx.GetHash(), nHeightTx))
-                    continue;
-
-                bool fDoubleSerial = false;
-                for (const CTxIn& txIn : tx.vin) {
-                    bool isPublicSpend = txIn.IsZerocoinPublicSpend();
-                    if (txIn.IsZerocoinSpend() || isPublicSpend) {
-                        libzerocoin::CoinSpend* spend;
-                        if (isPublicSpend) {
-                            libzerocoin::ZerocoinParams* params = Params().Zerocoin_Params(false);
-                            PublicCoinSpend publicSpend(params);
-                            CValidationState state;
-                            if (!ZSPLModule::ParseZerocoinPublicSpend(txIn, tx, state, publicSpend)){
-                                throw std::runtime_error("Invalid public spend parse");
-                            }
-                            spend = &publicSpend;
-                        } else {
-                            libzerocoin::CoinSpend spendObj = TxInToZerocoinSpend(txIn);
-                            spend = &spendObj;
-                        }
-
-                        bool fUseV1Params = libzerocoin::ExtractVersionFromSerial(spend->getCoinSerialNumber()) < libzerocoin::PrivateCoin::PUBKEY_VERSION;
-                        if (!spend->HasValidSerial(Params().Zerocoin_Params(fUseV1Params)))
-                            fDoubleSerial = true;
-                        if (std::count(vBlockSerials.begin(), vBlockSerials.end(), spend->getCoinSerialNumber()))
-                            fDoubleSerial = true;
-                        if (std::count(vTxSerials.begin(), vTxSerials.end(), spend->getCoinSerialNumber()))
-                            fDoubleSerial = true;
-                        if (fDoubleSerial)
-                            break;
-                        vTxSerials.emplace_back(spend->getCoinSerialNumber());
-                    }
-                }
-                //This zSPL serial has already been included in the block, do not add this tx.
-                if (fDoubleSerial)
-                    continue;
-            }
-
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
-
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-                continue;
-
-            CTxUndo txundo;
-            UpdateCoins(tx, state, view, txundo, nHeight);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            for (const CBigNum& bnSerial : vTxSerials)
-                vBlockSerials.emplace_back(bnSerial);
-
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                for (COrphan* porphan : mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
+        const bool fRebuilt = templateBuilder.Update(pindexPrev, fZerocoinAllowed, nBlockMaxSize, nBlockFreeSize);
+        nFees = templateBuilder.AppendTo(*pblocktemplate, GetBoolArg("-printpriority", false));
+        const uint64_t nBlockTx = templateBuilder.Size();
+        const uint64_t nBlockSize = templateBuilder.BlockSize();
+        const int64_t nTimeSelect = GetTimeMicros();
 
         if (!fProofOfStake) {
             CAmount nBlockValue = GetBlockValue(nHeight, false, 0);
@@ -545,10 +791,15 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
         CValidationState state;
         if (!TestBlockValidity(state, *pblock, pindexPrev, false, false)) {
             LogPrintf("CreateNewBlock() : TestBlockValidity failed\n");
-            mempool.clear();
+            templateBuilder.RemoveInvalid();
             return NULL;
         }
 
+        const int64_t nTimeEnd = GetTimeMicros();
+        templateBuilder.RecordLatency(nTimeEnd - nTimeStart, fRebuilt);
+        LogPrint("bench", "CreateNewBlock(): %u txs %s, selected in %.2fms, template in %.2fms\n", nBlockTx,
+            fRebuilt ? "selected anew" : "updated", 0.001 * (nTimeSelect - nTimeStart), 0.001 * (nTimeEnd - nTimeStart));
+
 //        if (pblock->IsZerocoinStake()) {
 //            CWalletTx wtx(pwalletMain, pblock->vtx[1]);
 //            pwalletMain->AddToWallet(wtx);
@@ -793,14 +1044,15 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
                         runs++;
                     }
                 } else {
-                    uint256 hash;
+                    // Hash consecutive nonces in batches as wide as the Quark backend
+                    int nBatchHashes = 0;
                     while (true) {
-                        hash = pblock->GetPoWHash();
-                        if (hash <= hashTarget) {
+                        int nHashes = 0;
+                        if (quark_N_multi(BEGIN(pblock->nVersion), hashTarget, &nHashes)) {
                             // Found a solution
                             SetThreadPriority(THREAD_PRIORITY_NORMAL);
                             LogPrintf("%s:\n", __func__);
-                            LogPrintf("proof-of-work found\n   hash: %s\n target: %s\n  nonce: %i\n", hash.GetHex(), hashTarget.GetHex(), pblock->nNonce);
+                            LogPrintf("proof-of-work found\n   hash: %s\n target: %s\n  nonce: %i\n", pblock->GetPoWHash().GetHex(), hashTarget.GetHex(), pblock->nNonce);
                             ProcessBlockFound(pblock, *pwallet, reservekey);
                             SetThreadPriority(THREAD_PRIORITY_LOWEST);
 
@@ -811,9 +1063,10 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
 
                             break;
                         }
-                        pblock->nNonce += 1;
-                        nHashesDone += 1;
-                        if ((pblock->nNonce & 0xFF) == 0)
+                        pblock->nNonce += nHashes;
+                        nHashesDone += nHashes;
+                        nBatchHashes += nHashes;
+                        if (nBatchHashes >= 0x100)
                             break;
                     }
                 }
@@ -8,7 +8,18 @@
 #ifndef BITCOIN_MINER_H
 #define BITCOIN_MINER_H
 
+#include "amount.h"
+#include "coins.h"
+#include "libzerocoin/bignum.h"
+#include "sync.h"
+#include "txmempool.h"
+#include "uint256.h"
+
+#include <atomic>
+#include <memory>
+#include <set>
 #include <stdint.h>
+#include <vector>
 
 class CBlock;
 class CBlockHeader;
@@ -21,12 +32,121 @@ extern unsigned int nCreateBlockAlgo;
 
 struct CBlockTemplate;
 
+/** How long CreateNewBlock took to produce templates, from the locks to the validity check */
+struct CBlockTemplateStats {
+    uint64_t nTemplates;
+    uint64_t nRebuilds; //! templates whose transactions were selected anew
+    int64_t nLastMicros;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+
+    CBlockTemplateStats() : nTemplates(0), nRebuilds(0), nLastMicros(0), nTotalMicros(0), nMaxMicros(0) {}
+};
+
+/**
+ * Keeps the transactions selected for the next block from one call of
+ * CreateNewBlock to the next, so that a template only costs what changed
+ * since the last one:
+ *
+ * - Transactions that entered the pool since (found through the entry_time
+ *   index) are added as packages while there is room.
+ * - Selected transactions that left the pool are dropped, with everything
+ *   in the selection that spends them.
+ * - A new tip replays the selection on the new coins view without running
+ *   the scripts again, as they do not depend on the tip, and then fills
+ *   the room left by what the block took. Inputs, values and fees are
+ *   still checked, so a transaction the tip made invalid is dropped.
+ *
+ * The selection is made anew when a package that did not fit pays more
+ * than the least paying one selected, when the block limits change, or
+ * after a fee delta changed the order of the pool.
+ */
+class CBlockTemplateBuilder
+{
+private:
+    struct CSelectedTx {
+        uint256 hash;
+        unsigned int nSigOps;
+        CAmount nFees;
+        std::vector<CBigNum> vSerials;
+    };
+
+    std::atomic<bool> fInvalidated;
+
+    mutable CCriticalSection csStats;
+    CBlockTemplateStats stats;
+
+    // The selection, under cs_main and mempool.cs
+    uint256 hashTip;
+    int nHeight;
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockFreeSize;
+    bool fZerocoinAllowed;
+    int64_t nLastEntryTime;
+    std::vector<CSelectedTx> vSelected;
+    std::set<uint256> setSelected;
+    std::vector<CBigNum> vBlockSerials;
+    std::unique_ptr<CCoinsViewCache> pview; //! pcoinsTip with the selection applied
+    uint64_t nBlockSize;
+    unsigned int nBlockSigOps;
+    CFeeRate minPackageRate; //! lowest fee rate of the packages selected
+
+    void Clear();
+
+    /** Check a transaction against the block on top of viewTx, and apply it there */
+    bool TestTransaction(const CTransaction& tx, CCoinsViewCache& viewTx, unsigned int& nTxSigOps, CAmount& nTxFees, bool fCheckScripts) const;
+
+    void Select(const CTxMemPoolEntry& entry, unsigned int nTxSigOps, CAmount nTxFees, const std::vector<CBigNum>& vSerials);
+
+    bool AddZerocoinSpend(CTxMemPool::txiter iter);
+
+    /** Add iter with its ancestors not selected yet, all or nothing; the caller checked the size */
+    bool AddPackage(CTxMemPool::txiter iter, uint64_t nPackageSize, CAmount nPackageFees, CTxMemPool::setEntries& added);
+
+    /** Fill the room left in the block: zerocoin spends oldest first, then packages by ancestor fee rate */
+    void Fill();
+
+    /** Apply the selection again on a fresh view, dropping what is no longer valid on top of the tip */
+    void Replay();
+
+    /** Add the transactions that entered the pool since the last update; false if the selection should be made anew */
+    bool AddNew();
+
+public:
+    CBlockTemplateBuilder() : fInvalidated(true), nHeight(0), nBlockMaxSize(0), nBlockFreeSize(0), fZerocoinAllowed(false), nLastEntryTime(0), nBlockSize(0), nBlockSigOps(0) {}
+
+    void Invalidate()
+    {
+        fInvalidated = true;
+    }
+
+    /** Bring the selection up to date for a block on top of pindexPrev; returns whether it was made anew */
+    bool Update(const CBlockIndex* pindexPrev, bool fZerocoinAllowedIn, unsigned int nBlockMaxSizeIn, unsigned int nBlockFreeSizeIn);
+
+    /** Append the selection to the block; returns the fees it pays */
+    CAmount AppendTo(CBlockTemplate& blocktemplate, bool fPrintPriority) const;
+
+    /** Remove the selected transactions that are not valid on top of the tip from the pool, with their descendants; returns how many */
+    unsigned int RemoveInvalid();
+
+    size_t Size() const { return vSelected.size(); }
+    uint64_t BlockSize() const { return nBlockSize; }
+
+    void RecordLatency(int64_t nMicros, bool fRebuilt);
+
+    CBlockTemplateStats GetStats() const;
+};
+
 /** Generate a new block, without valid proof-of-work */
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet, bool fProofOfStake);
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 /** Check mined block */
 void UpdateTime(CBlockHeader* block, const CBlockIndex* pindexPrev, bool fProofOfStake);
+/** Make the next template select its transactions anew, e.g. after a fee delta */
+void InvalidateBlockTemplate();
+/** Latency of the templates created so far */
+CBlockTemplateStats GetBlockTemplateStats();
 
 #ifdef ENABLE_WALLET
     /** Run the miner threads */
@@ -0,0 +1,58 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "muhash.h"
+
+#include "crypto/sha256.h"
+#include "hash.h"
+
+#include <vector>
+
+static const size_t MUHASH_BYTES = 384;
+
+const CBigNum& CMuHash3072::Modulus()
+{
+    static const CBigNum bnModulus = CBigNum(2).pow(3072) - 1103717;
+    return bnModulus;
+}
+
+CBigNum CMuHash3072::ToNum(const unsigned char* data, size_t len)
+{
+    // Stretch the SHA256 of the element to 3072 bits by hashing it with a counter
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(hash);
+    std::vector<unsigned char> vch(MUHASH_BYTES + 1, 0); // little endian, the last byte keeps it positive
+    for (unsigned char i = 0; i < MUHASH_BYTES / CSHA256::OUTPUT_SIZE; i++)
+        CSHA256().Write(hash, sizeof(hash)).Write(&i, 1).Finalize(&vch[i * CSHA256::OUTPUT_SIZE]);
+    return CBigNum(vch);
+}
+
+CMuHash3072::CMuHash3072() : numerator(1), denominator(1)
+{
+}
+
+void CMuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator = numerator.mul_mod(ToNum(data, len), Modulus());
+}
+
+void CMuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator = denominator.mul_mod(ToNum(data, len), Modulus());
+}
+
+CMuHash3072& CMuHash3072::operator*=(const CMuHash3072& other)
+{
+    numerator = numerator.mul_mod(other.numerator, Modulus());
+    denominator = denominator.mul_mod(other.denominator, Modulus());
+    return *this;
+}
+
+uint256 CMuHash3072::Finalize() const
+{
+    CBigNum bnValue = numerator.mul_mod(denominator.inverse(Modulus()), Modulus());
+    std::vector<unsigned char> vch = bnValue.getvch();
+    vch.resize(MUHASH_BYTES + 1, 0);
+    return Hash(vch.begin(), vch.end() - 1);
+}
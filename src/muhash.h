@@ -0,0 +1,43 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MUHASH_H
+#define BITCOIN_MUHASH_H
+
+#include "libzerocoin/bignum.h"
+#include "uint256.h"
+
+#include <stddef.h>
+
+/**
+ * Hash of a set of byte strings that does not depend on the order they
+ * were added in. Each element maps to a number modulo the prime
+ * 2^3072 - 1103717 and the set hashes to the product of its elements, so
+ * the hashes of disjoint sets combine with a multiplication, and an element
+ * is taken out again by dividing it out. Removed elements are collected in
+ * a denominator, so that only Finalize() computes an inverse.
+ */
+class CMuHash3072
+{
+private:
+    CBigNum numerator;
+    CBigNum denominator;
+
+    static const CBigNum& Modulus();
+    static CBigNum ToNum(const unsigned char* data, size_t len);
+
+public:
+    //! The hash of the empty set
+    CMuHash3072();
+
+    void Insert(const unsigned char* data, size_t len);
+    void Remove(const unsigned char* data, size_t len);
+
+    //! Combine with the hash of a disjoint set, or of changes to this one
+    CMuHash3072& operator*=(const CMuHash3072& other);
+
+    uint256 Finalize() const;
+};
+
+#endif // BITCOIN_MUHASH_H
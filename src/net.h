@@ -88,7 +88,7 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 void MapPort(bool fUseUPnP);
 unsigned short GetListenPort();
 bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhitelisted = false);
-void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
+bool StartNode(boost::thread_group& threadGroup, CScheduler& scheduler, std::string& strError);
 bool StopNode();
 void SocketSendData(CNode *pnode);
 
@@ -328,6 +328,8 @@ public:
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    //! Leading messages of vRecvMsg whose signatures were already checked as a batch, requires cs_vRecvMsg
+    unsigned int nRecvMsgSigChecked;
     uint64_t nRecvBytes;
     int nRecvVersion;
 
@@ -376,6 +378,7 @@ protected:
     static bool setBannedIsDirty;
 
     std::vector<std::string> vecRequestsFulfilled; //keep track of what client has asked for
+    CCriticalSection cs_vecRequestsFulfilled;
 
     // Whitelisted ranges. Any node connecting from these is automatically
     // whitelisted (as well as those connecting to whitelisted binds).
@@ -743,6 +746,7 @@ public:
 
     bool HasFulfilledRequest(std::string strRequest)
     {
+        LOCK(cs_vecRequestsFulfilled);
         for (std::string& type : vecRequestsFulfilled) {
             if (type == strRequest) return true;
         }
@@ -751,6 +755,7 @@ public:
 
     void ClearFulfilledRequest(std::string strRequest)
     {
+        LOCK(cs_vecRequestsFulfilled);
         std::vector<std::string>::iterator it = vecRequestsFulfilled.begin();
         while (it != vecRequestsFulfilled.end()) {
             if ((*it) == strRequest) {
@@ -763,6 +768,7 @@ public:
 
     void FulfilledRequest(std::string strRequest)
     {
+        LOCK(cs_vecRequestsFulfilled);
         if (HasFulfilledRequest(strRequest)) return;
         vecRequestsFulfilled.push_back(strRequest);
     }
@@ -4,10 +4,13 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "obfuscation.h"
+#include "checkqueue.h"
 #include "coincontrol.h"
 #include "init.h"
 #include "main.h"
+#include "masternode-budget.h"
 #include "masternodeman.h"
+#include "script/sigcache.h"
 #include "script/sign.h"
 #include "swifttx.h"
 #include "guiinterface.h"
@@ -18,6 +21,7 @@
 #include <boost/foreach.hpp>
 
 #include <algorithm>
+#include <atomic>
 #include <boost/assign/list_of.hpp>
 #include <openssl/rand.h>
 
@@ -587,14 +591,70 @@ bool CObfuScationSigner::SignMessage(std::string strMessage, std::string& errorM
     return true;
 }
 
-bool CObfuScationSigner::VerifyMessage(CPubKey pubkey, std::vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage)
+namespace {
+//! Bytes of valid message signatures remembered, 32 each
+const size_t MESSAGE_SIG_CACHE_SIZE = 4 << 20;
+
+const char* const MESSAGE_SIGNATURE_TYPE_NAMES[SIG_TYPE_COUNT] = {"mnb", "mnp", "mnw", "mvote", "fbvote", "txlvote", "other"};
+
+struct CSignatureCounters {
+    std::atomic<uint64_t> nVerified;
+    std::atomic<uint64_t> nCached;
+    std::atomic<uint64_t> nFailed;
+    std::atomic<int64_t> nMicros;
+};
+CSignatureCounters signatureCounters[SIG_TYPE_COUNT];
+
+CSignatureCache& GetMessageSignatureCache()
+{
+    static CSignatureCache messageSignatureCache(MESSAGE_SIG_CACHE_SIZE);
+    return messageSignatureCache;
+}
+
+CCheckQueue<CMessageSignatureCheck> signaturecheckqueue(16, MAX_SCRIPTCHECK_THREADS);
+//! The queue takes one batch at a time, the message family threads take turns
+boost::mutex mutexSignatureQueue;
+} // anon namespace
+
+const char* MessageSignatureTypeName(MessageSignatureType type)
+{
+    return type < SIG_TYPE_COUNT ? MESSAGE_SIGNATURE_TYPE_NAMES[type] : "";
+}
+
+void GetMessageSignatureStats(std::vector<CMessageSignatureStats>& vStats)
+{
+    vStats.assign(SIG_TYPE_COUNT, CMessageSignatureStats());
+    for (int i = 0; i < SIG_TYPE_COUNT; i++) {
+        vStats[i].nVerified = signatureCounters[i].nVerified;
+        vStats[i].nCached = signatureCounters[i].nCached;
+        vStats[i].nFailed = signatureCounters[i].nFailed;
+        vStats[i].nMicros = signatureCounters[i].nMicros;
+    }
+}
+
+bool CObfuScationSigner::VerifyMessage(CPubKey pubkey, std::vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage, MessageSignatureType type)
 {
     CHashWriter ss(SER_GETHASH, 0);
     ss << strMessageMagic;
     ss << strMessage;
+    const uint256 hash = ss.GetHash();
+
+    // The same message relayed by several peers is recovered once
+    CSignatureCache& cache = GetMessageSignatureCache();
+    CSignatureCounters& counters = signatureCounters[type < SIG_TYPE_COUNT ? type : SIG_OTHER];
+    const uint256 entry = cache.ComputeEntry(hash, vchSig, pubkey);
+    if (cache.Contains(entry)) {
+        counters.nCached++;
+        return true;
+    }
 
+    int64_t nTimeStart = GetTimeMicros();
     CPubKey pubkey2;
-    if (!pubkey2.RecoverCompact(ss.GetHash(), vchSig)) {
+    bool fRecovered = pubkey2.RecoverCompact(hash, vchSig);
+    counters.nVerified++;
+    counters.nMicros += GetTimeMicros() - nTimeStart;
+    if (!fRecovered) {
+        counters.nFailed++;
         errorMessage = _("Error recovering public key.");
         return false;
     }
@@ -602,7 +662,101 @@ bool CObfuScationSigner::VerifyMessage(CPubKey pubkey, std::vector<unsigned char
     if (fDebug && pubkey2.GetID() != pubkey.GetID())
         LogPrintf("CObfuScationSigner::VerifyMessage -- keys don't match: %s %s\n", pubkey2.GetID().ToString(), pubkey.GetID().ToString());
 
-    return (pubkey2.GetID() == pubkey.GetID());
+    if (pubkey2.GetID() != pubkey.GetID()) {
+        counters.nFailed++;
+        return false;
+    }
+    cache.Insert(entry);
+    return true;
+}
+
+bool CMessageSignatureCheck::operator()()
+{
+    std::string errorMessage;
+    for (const std::string& strMessage : vMessages) {
+        if (obfuScationSigner.VerifyMessage(pubkey, vchSig, strMessage, errorMessage, type))
+            break;
+    }
+    return true;
+}
+
+void CMessageSignatureCheck::swap(CMessageSignatureCheck& check)
+{
+    std::swap(pubkey, check.pubkey);
+    vchSig.swap(check.vchSig);
+    vMessages.swap(check.vMessages);
+    std::swap(type, check.type);
+}
+
+namespace {
+void AddSignatureCheck(std::vector<CMessageSignatureCheck>& vChecks, const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, MessageSignatureType type, const std::string& strMessage)
+{
+    vChecks.emplace_back();
+    CMessageSignatureCheck& check = vChecks.back();
+    check.pubkey = pubkey;
+    check.vchSig = vchSig;
+    check.type = type;
+    check.vMessages.push_back(strMessage);
+}
+} // anon namespace
+
+void CollectMessageSignatures(const std::string& strCommand, const CDataStream& vRecv, std::vector<CMessageSignatureCheck>& vChecks)
+{
+    CDataStream ss(vRecv);
+    CPubKey pubKeyMasternode;
+    try {
+        if (strCommand == "mnb") {
+            CMasternodeBroadcast mnb;
+            ss >> mnb;
+            AddSignatureCheck(vChecks, mnb.pubKeyCollateralAddress, mnb.sig, SIG_MASTERNODE_BROADCAST, mnb.GetNewStrMessage());
+            vChecks.back().vMessages.push_back(mnb.GetOldStrMessage());
+            if (!(mnb.lastPing == CMasternodePing()))
+                AddSignatureCheck(vChecks, mnb.pubKeyMasternode, mnb.lastPing.vchSig, SIG_MASTERNODE_PING, mnb.lastPing.GetStrMessage());
+        } else if (strCommand == "mnp") {
+            CMasternodePing mnp;
+            ss >> mnp;
+            if (mnodeman.GetMasternodePubKey(mnp.vin, pubKeyMasternode))
+                AddSignatureCheck(vChecks, pubKeyMasternode, mnp.vchSig, SIG_MASTERNODE_PING, mnp.GetStrMessage());
+        } else if (strCommand == "mnw") {
+            CMasternodePaymentWinner winner;
+            ss >> winner;
+            if (mnodeman.GetMasternodePubKey(winner.vinMasternode, pubKeyMasternode))
+                AddSignatureCheck(vChecks, pubKeyMasternode, winner.vchSig, SIG_PAYMENT_WINNER, winner.GetStrMessage());
+        } else if (strCommand == "mvote") {
+            CBudgetVote vote;
+            ss >> vote;
+            if (mnodeman.GetMasternodePubKey(vote.vin, pubKeyMasternode))
+                AddSignatureCheck(vChecks, pubKeyMasternode, vote.vchSig, SIG_BUDGET_VOTE, vote.GetStrMessage());
+        } else if (strCommand == "fbvote") {
+            CFinalizedBudgetVote vote;
+            ss >> vote;
+            if (mnodeman.GetMasternodePubKey(vote.vin, pubKeyMasternode))
+                AddSignatureCheck(vChecks, pubKeyMasternode, vote.vchSig, SIG_FINALIZED_BUDGET_VOTE, vote.GetStrMessage());
+        }
+    } catch (const std::exception& e) {
+        // a malformed message is for its handler to deal with
+    }
+}
+
+void VerifyMessageSignatures(std::vector<CMessageSignatureCheck>& vChecks)
+{
+    if (vChecks.empty())
+        return;
+    if (nScriptCheckThreads <= 1 || vChecks.size() == 1) {
+        for (CMessageSignatureCheck& check : vChecks)
+            check();
+        return;
+    }
+    boost::unique_lock<boost::mutex> lock(mutexSignatureQueue);
+    CCheckQueueControl<CMessageSignatureCheck> control(&signaturecheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
+void ThreadMessageSignatureCheck()
+{
+    RenameThread("simplicity-msgsig");
+    signaturecheckqueue.Thread();
 }
 
 bool CObfuscationQueue::Sign()
@@ -675,6 +829,7 @@ void ThreadCheckObfuScationPool()
     RenameThread("simplicity-obfuscation");
 
     unsigned int c = 0;
+    int nLastScoredHeight = -1;
 
     while (true) {
         MilliSleep(1000);
@@ -686,6 +841,13 @@ void ThreadCheckObfuScationPool()
         if (masternodeSync.IsBlockchainSynced()) {
             c++;
 
+            // score the masternodes for the votes on a new tip here rather than on the message threads
+            int nHeight = chainActive.Height();
+            if (nHeight != nLastScoredHeight) {
+                mnodeman.UpdateScoreTables(nHeight);
+                nLastScoredHeight = nHeight;
+            }
+
             // check if we should activate or ping every few minutes,
             // start right after sync is considered to be done
             if (c % MASTERNODE_PING_SECONDS == 1) activeMasternode.ManageStatus();
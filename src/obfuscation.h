@@ -198,6 +198,32 @@ public:
     int64_t sigTime;
 };
 
+/** Kinds of signed masternode messages, whose signature checks are counted apart */
+enum MessageSignatureType {
+    SIG_MASTERNODE_BROADCAST,
+    SIG_MASTERNODE_PING,
+    SIG_PAYMENT_WINNER,
+    SIG_BUDGET_VOTE,
+    SIG_FINALIZED_BUDGET_VOTE,
+    SIG_SWIFTTX_VOTE,
+    SIG_OTHER,
+    SIG_TYPE_COUNT
+};
+
+/** Signature checks of one kind of message since startup */
+struct CMessageSignatureStats {
+    uint64_t nVerified; //!< signatures recovered
+    uint64_t nCached;   //!< found valid in the cache
+    uint64_t nFailed;   //!< recovered to another key, or not at all
+    int64_t nMicros;    //!< time spent recovering
+
+    CMessageSignatureStats() : nVerified(0), nCached(0), nFailed(0), nMicros(0) {}
+};
+
+/** Name of a message signature type, as getmessagestats reports it */
+const char* MessageSignatureTypeName(MessageSignatureType type);
+void GetMessageSignatureStats(std::vector<CMessageSignatureStats>& vStats);
+
 /** Helper object for signing and checking signatures
  */
 class CObfuScationSigner
@@ -211,10 +237,36 @@ public:
     bool SetKey(std::string strSecret, std::string& errorMessage, CKey& key, CPubKey& pubkey);
     /// Sign the message, returns true if successful
     bool SignMessage(std::string strMessage, std::string& errorMessage, std::vector<unsigned char>& vchSig, CKey key);
-    /// Verify the message, returns true if succcessful
-    bool VerifyMessage(CPubKey pubkey, std::vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage);
+    /// Verify the message, returns true if succcessful; valid signatures are cached
+    bool VerifyMessage(CPubKey pubkey, std::vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage, MessageSignatureType type = SIG_OTHER);
+};
+
+/**
+ * The signature of a queued message, checked ahead of its handler so that
+ * the handler finds it in the cache. The first of vMessages that the
+ * signature is valid for ends the check; an invalid one is left for the
+ * handler to reject.
+ */
+class CMessageSignatureCheck
+{
+public:
+    CPubKey pubkey;
+    std::vector<unsigned char> vchSig;
+    std::vector<std::string> vMessages;
+    MessageSignatureType type;
+
+    CMessageSignatureCheck() : type(SIG_OTHER) {}
+
+    bool operator()();
+    void swap(CMessageSignatureCheck& check);
 };
 
+/// Add the checks of the signatures a masternode, payment or budget message carries
+void CollectMessageSignatures(const std::string& strCommand, const CDataStream& vRecv, std::vector<CMessageSignatureCheck>& vChecks);
+/// Run checks on the signature check threads and wait for them
+void VerifyMessageSignatures(std::vector<CMessageSignatureCheck>& vChecks);
+void ThreadMessageSignatureCheck();
+
 /** Used to keep track of current status of Obfuscation pool
  */
 class CObfuscationPool
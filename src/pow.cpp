@@ -10,13 +10,18 @@
 
 #include "chain.h"
 #include "chainparams.h"
+#include "crypto/quark.h"
+#include "crypto/scrypt_opt.h"
 #include "main.h"
 #include "primitives/block.h"
 #include "uint256.h"
 #include "util.h"
 
+#include <atomic>
 #include <math.h>
 
+#include <boost/thread.hpp>
+
 const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfStake)
 {
     while (pindex && pindex->pprev && (pindex->IsProofOfStake() != fProofOfStake))
@@ -116,6 +121,12 @@ unsigned int GetLegacyNextWorkRequired(const CBlockIndex* pindexLast, const CBlo
 }
 
 bool CheckProofOfWork(const CBlockHeader* pblock)
+{
+    uint256 hashPoW;
+    return CheckProofOfWork(pblock, hashPoW);
+}
+
+bool CheckProofOfWork(const CBlockHeader* pblock, uint256& hashPoW)
 {
     bool fNegative;
     bool fOverflow;
@@ -125,6 +136,8 @@ bool CheckProofOfWork(const CBlockHeader* pblock)
         return true;
 
     int algo = CBlockHeader::GetAlgo(pblock->nVersion);
+    if (pblock->nVersion >= Params().WALLET_UPGRADE_VERSION() && algo == -1)
+        return error("CheckProofOfWork() : unknown algorithm in version %d", pblock->nVersion);
     bnTarget.SetCompact(pblock->nBits, &fNegative, &fOverflow);
 
     // Check range
@@ -137,7 +150,9 @@ bool CheckProofOfWork(const CBlockHeader* pblock)
     }
 
     // Check proof of work matches claimed amount
-    if (pblock->GetPoWHash() > bnTarget) {
+    if (hashPoW == 0)
+        hashPoW = pblock->GetPoWHash();
+    if (hashPoW > bnTarget) {
         if (Params().MineBlocksOnDemand())
             return false;
         else if (pblock->GetHash() == Params().HashGenesisBlock() && Params().NetworkID() == CBaseChainParams::MAIN) {
@@ -150,6 +165,124 @@ bool CheckProofOfWork(const CBlockHeader* pblock)
     return true;
 }
 
+size_t nScryptScratchBytes = (size_t)DEFAULT_SCRYPT_SCRATCH_MB << 20;
+
+/** Proof-of-work hashes of a set of 80-byte headers sharing one algorithm. */
+struct PoWBatch {
+    std::vector<size_t> vIndex;
+    std::vector<uint256> vTarget;
+    std::vector<unsigned char> vData;
+    std::vector<unsigned char> vHash;
+    std::vector<bool> vHashed;
+
+    void Add(size_t i, const uint256& bnTarget, const CBlockHeader* pblock)
+    {
+        vIndex.push_back(i);
+        vTarget.push_back(bnTarget);
+        vData.insert(vData.end(), BEGIN(pblock->nVersion), END(pblock->nNonce));
+    }
+};
+
+static void HashQuarkBatch(PoWBatch& batch)
+{
+    const size_t count = batch.vIndex.size();
+    batch.vHash.resize(count * 32);
+    quark_hash_multi(batch.vData.data(), 80, count, batch.vHash.data());
+    batch.vHashed.assign(count, true);
+}
+
+/**
+ * scrypt² headers are hashed scrypt_batch_ways() at a time per worker. The
+ * number of workers follows -par, but is capped so that their scratchpads
+ * stay within -scryptscratchmb.
+ */
+static void HashScryptSquaredBatch(PoWBatch& batch)
+{
+    static const int N = 1048576;
+    const int count = batch.vIndex.size();
+    const int ways = scrypt_batch_ways();
+    const int nChunks = (count + ways - 1) / ways;
+    const size_t nScratch = (size_t)N * 128 * ways;
+    int nThreads = std::max(nScriptCheckThreads, 1);
+    nThreads = std::min<int64_t>(nThreads, std::max<int64_t>(nScryptScratchBytes / nScratch, 1));
+    nThreads = std::min(nThreads, nChunks);
+
+    batch.vHash.resize(count * 32);
+    std::vector<char> vChunkOk(nChunks, false);
+    std::atomic<int> nNext(0);
+    auto worker = [&]() {
+        for (int c = nNext++; c < nChunks; c = nNext++) {
+            const int nFirst = c * ways;
+            vChunkOk[c] = scryptHashBatch(&batch.vData[nFirst * 80], (char*)&batch.vHash[nFirst * 32], std::min(ways, count - nFirst), N);
+        }
+    };
+
+    boost::thread_group threadGroup;
+    for (int i = 1; i < nThreads; i++)
+        threadGroup.create_thread(worker);
+    worker();
+    threadGroup.join_all();
+
+    batch.vHashed.resize(count);
+    for (int j = 0; j < count; j++)
+        batch.vHashed[j] = vChunkOk[j / ways];
+}
+
+void CheckProofOfWorkBatch(const std::vector<const CBlockHeader*>& vHeaders, std::vector<bool>& vChecked, std::vector<uint256>* pvHashPoW)
+{
+    vChecked.assign(vHeaders.size(), false);
+    if (pvHashPoW)
+        pvHashPoW->assign(vHeaders.size(), uint256());
+    if (Params().SkipProofOfWorkCheck())
+        return;
+
+    PoWBatch quark, scrypt;
+    for (size_t i = 0; i < vHeaders.size(); i++) {
+        const CBlockHeader* pblock = vHeaders[i];
+        if (!pblock || !pblock->IsProofOfWork())
+            continue;
+
+        // Headers from the network reach here before CheckBlockHeader has
+        // looked at their algorithm, an unknown one is left for it to reject
+        int algo = CBlockHeader::GetAlgo(pblock->nVersion);
+        if (pblock->nVersion >= Params().WALLET_UPGRADE_VERSION() && algo == -1)
+            continue;
+
+        bool fNegative;
+        bool fOverflow;
+        uint256 bnTarget;
+        bnTarget.SetCompact(pblock->nBits, &fNegative, &fOverflow);
+        if (fNegative || bnTarget == 0 || fOverflow || bnTarget > Params().ProofOfWorkLimit(pblock->nVersion >= Params().WALLET_UPGRADE_VERSION() ? algo : POW_QUARK))
+            continue;
+
+        if (algo == POW_SCRYPT_SQUARED) {
+            // CheckProofOfWork lets these through without hashing
+            if (pblock->nTime < Params().BadScryptDiffTimeEnd() && pblock->nTime >= Params().BadScryptDiffTimeStart())
+                continue;
+            scrypt.Add(i, bnTarget, pblock);
+        } else {
+            quark.Add(i, bnTarget, pblock);
+        }
+    }
+
+    if (!quark.vIndex.empty())
+        HashQuarkBatch(quark);
+    if (!scrypt.vIndex.empty())
+        HashScryptSquaredBatch(scrypt);
+
+    for (const PoWBatch* batch : {&quark, &scrypt}) {
+        for (size_t j = 0; j < batch->vIndex.size(); j++) {
+            uint256 hash;
+            memcpy(hash.begin(), &batch->vHash[j * 32], 32);
+            if (batch->vHashed[j] && hash != 0 && hash <= batch->vTarget[j]) {
+                vChecked[batch->vIndex[j]] = true;
+                if (pvHashPoW)
+                    (*pvHashPoW)[batch->vIndex[j]] = hash;
+            }
+        }
+    }
+}
+
 uint256 GetBlockProof(const CBlockIndex& block)
 {
     uint256 bnTarget;
@@ -9,13 +9,21 @@
 #ifndef BITCOIN_POW_H
 #define BITCOIN_POW_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <vector>
 
 class CBlockHeader;
 class CBlockIndex;
 class uint256;
 class arith_uint256;
 
+/** Default for -scryptscratchmb, the scratchpad memory budget of batched scrypt² checks */
+static const int DEFAULT_SCRYPT_SCRATCH_MB = 512;
+/** Seconds a scrypt² scratchpad may stay idle in the pool before it is freed */
+static const int64_t SCRYPT_SCRATCH_IDLE_SECONDS = 60;
+extern size_t nScryptScratchBytes;
+
 // Define difficulty retarget algorithms
 enum DiffMode {
     DIFF_DEFAULT = 0, // Default to invalid 0
@@ -29,6 +37,22 @@ unsigned int GetLegacyNextWorkRequired(const CBlockIndex* pindexLast, const CBlo
 
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
 bool CheckProofOfWork(const CBlockHeader* pblock/*, uint256 hash, unsigned int nBits*/);
+/**
+ * Same, with a cached PoW hash: a non-zero hashPoW is taken as the header's
+ * PoW hash instead of hashing it again. Otherwise the hash is computed and
+ * returned in hashPoW (it stays 0 when the check did not need it).
+ */
+bool CheckProofOfWork(const CBlockHeader* pblock, uint256& hashPoW);
+/**
+ * Batch form of CheckProofOfWork for header sync. Quark headers are hashed
+ * together through the multi-lane engine, scrypt² headers through the
+ * interleaved scrypt kernels on -par worker threads. vChecked[i] is set only
+ * when header i is known to satisfy its nBits. Null entries are skipped.
+ * Headers left unset (out of range, failing, or proof of stake) must still go
+ * through CheckProofOfWork for the usual error handling. If pvHashPoW is
+ * given, it receives the PoW hash of every checked header.
+ */
+void CheckProofOfWorkBatch(const std::vector<const CBlockHeader*>& vHeaders, std::vector<bool>& vChecked, std::vector<uint256>* pvHashPoW = NULL);
 uint256 GetBlockProof(const CBlockIndex& block);
 
 #endif // BITCOIN_POW_H
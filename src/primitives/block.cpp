@@ -69,6 +69,7 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
        known ways of changing the transactions without affecting the merkle
        root.
     */
+    fMerkleChecked = false;
     vMerkleTree.clear();
     vMerkleTree.reserve(vtx.size() * 2 + 16); // Safe upper bound for the number of total nodes.
     for (std::vector<CTransaction>::const_iterator it(vtx.begin()); it != vtx.end(); ++it)
@@ -95,6 +96,23 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
     return (vMerkleTree.empty() ? uint256() : vMerkleTree.back());
 }
 
+bool CBlock::IsMerkleChecked() const
+{
+    if (!fMerkleChecked || vtx.empty())
+        return false;
+    size_t nTreeSize = 0;
+    for (size_t nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+        nTreeSize += nSize;
+    if (vMerkleTree.size() != nTreeSize + 1 || vMerkleTree.back() != hashMerkleRoot)
+        return false;
+    // the transaction hashes are cached, comparing the leaves costs no hashing
+    for (size_t i = 0; i < vtx.size(); i++) {
+        if (vMerkleTree[i] != vtx[i].GetHash())
+            return false;
+    }
+    return true;
+}
+
 std::vector<uint256> CBlock::GetMerkleBranch(int nIndex) const
 {
     if (vMerkleTree.empty())
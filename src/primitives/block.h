@@ -157,6 +157,7 @@ public:
     // memory only
     mutable CScript payee;
     mutable std::vector<uint256> vMerkleTree;
+    mutable bool fMerkleChecked; //!< vMerkleTree was built and matches hashMerkleRoot without mutation, see IsMerkleChecked()
 
     CBlock()
     {
@@ -184,6 +185,7 @@ public:
         CBlockHeader::SetNull();
         vtx.clear();
         vMerkleTree.clear();
+        fMerkleChecked = false;
         payee = CScript();
         vchBlockSig.clear();
     }
@@ -215,6 +217,11 @@ public:
     // merkle root).
     uint256 BuildMerkleTree(bool* mutated = NULL) const;
 
+    // Whether fMerkleChecked still holds. The flag is copied with the block,
+    // so it only counts while vMerkleTree is the tree of vtx as it is now and
+    // its root is hashMerkleRoot.
+    bool IsMerkleChecked() const;
+
     std::vector<uint256> GetMerkleBranch(int nIndex) const;
     static uint256 CheckMerkleBranch(uint256 hash, const std::vector<uint256>& vMerkleBranch, int nIndex);
     std::string ToString() const;
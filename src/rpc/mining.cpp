@@ -298,6 +298,13 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
             "  \"pooledtx\": n              (numeric) The size of the mem pool\n"
             "  \"testnet\": true|false      (boolean) If using testnet or not\n"
             "  \"chain\": \"xxxx\",         (string) current network name as defined in BIP70 (main, test, regtest)\n"
+            "  \"templates\": {             (json object) Block templates created by this node\n"
+            "    \"count\": n,              (numeric) Number of templates created\n"
+            "    \"rebuilds\": n,           (numeric) Number of them whose transactions were selected anew\n"
+            "    \"lastms\": n,             (numeric) Time the last template took, in milliseconds\n"
+            "    \"averagems\": n,          (numeric) Average time a template took, in milliseconds\n"
+            "    \"maxms\": n               (numeric) Longest time a template took, in milliseconds\n"
+            "  }\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -316,6 +323,15 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("pooledtx", (uint64_t)mempool.size()));
     obj.push_back(Pair("testnet", Params().TestnetToBeDeprecatedFieldRPC()));
     obj.push_back(Pair("chain", Params().NetworkIDString()));
+
+    CBlockTemplateStats stats = GetBlockTemplateStats();
+    UniValue templates(UniValue::VOBJ);
+    templates.push_back(Pair("count", stats.nTemplates));
+    templates.push_back(Pair("rebuilds", stats.nRebuilds));
+    templates.push_back(Pair("lastms", 0.001 * stats.nLastMicros));
+    templates.push_back(Pair("averagems", stats.nTemplates ? 0.001 * stats.nTotalMicros / stats.nTemplates : 0.0));
+    templates.push_back(Pair("maxms", 0.001 * stats.nMaxMicros));
+    obj.push_back(Pair("templates", templates));
 #ifdef ENABLE_WALLET
     obj.push_back(Pair("generate", getgenerate(params, false)));
     obj.push_back(Pair("hashespersec", gethashespersec(params, false)));
@@ -353,6 +369,7 @@ UniValue prioritisetransaction(const UniValue& params, bool fHelp)
     CAmount nAmount = params[2].get_int64();
 
     mempool.PrioritiseTransaction(hash, params[0].get_str(), params[1].get_real(), nAmount);
+    InvalidateBlockTemplate();
     return true;
 }
 
@@ -11,6 +11,7 @@
 #include "main.h"
 #include "net.h"
 #include "netbase.h"
+#include "obfuscation.h"
 #include "protocol.h"
 #include "sync.h"
 #include "timedata.h"
@@ -366,6 +367,73 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     return obj;
 }
 
+UniValue getmessagestats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 0)
+        throw std::runtime_error(
+            "getmessagestats\n"
+            "\nReturns the time spent processing each network command since startup.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"commands\": {          (json object) processing time per command\n"
+            "    \"command\": {\n"
+            "      \"family\": \"xxxx\",  (string) main, or the masternode or budget manager that handles it\n"
+            "      \"count\": n,        (numeric) messages processed\n"
+            "      \"totalms\": n,      (numeric) time spent processing them, in milliseconds\n"
+            "      \"averagems\": n,    (numeric) average time per message, in milliseconds\n"
+            "      \"maxms\": n         (numeric) longest time for one message, in milliseconds\n"
+            "    },\n"
+            "    ...\n"
+            "  },\n"
+            "  \"signatures\": {        (json object) masternode message signature checks per message type\n"
+            "    \"type\": {\n"
+            "      \"verified\": n,     (numeric) signatures verified\n"
+            "      \"cached\": n,       (numeric) signatures found already verified in the cache\n"
+            "      \"failed\": n,       (numeric) signatures that did not verify\n"
+            "      \"totalms\": n       (numeric) time spent verifying, in milliseconds\n"
+            "    },\n"
+            "    ...\n"
+            "  }\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getmessagestats", "") + HelpExampleRpc("getmessagestats", ""));
+
+    std::map<std::string, CMessageStats> mapStats;
+    GetMessageStats(mapStats);
+
+    UniValue commands(UniValue::VOBJ);
+    for (const auto& it : mapStats) {
+        const CMessageStats& stats = it.second;
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("family", stats.strFamily));
+        obj.push_back(Pair("count", stats.nCount));
+        obj.push_back(Pair("totalms", 0.001 * stats.nTotalMicros));
+        obj.push_back(Pair("averagems", stats.nCount ? 0.001 * stats.nTotalMicros / stats.nCount : 0.0));
+        obj.push_back(Pair("maxms", 0.001 * stats.nMaxMicros));
+        commands.push_back(Pair(it.first, obj));
+    }
+
+    std::vector<CMessageSignatureStats> vSignatureStats;
+    GetMessageSignatureStats(vSignatureStats);
+    UniValue signatures(UniValue::VOBJ);
+    for (int i = 0; i < SIG_TYPE_COUNT; i++) {
+        const CMessageSignatureStats& stats = vSignatureStats[i];
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("verified", stats.nVerified));
+        obj.push_back(Pair("cached", stats.nCached));
+        obj.push_back(Pair("failed", stats.nFailed));
+        obj.push_back(Pair("totalms", 0.001 * stats.nMicros));
+        signatures.push_back(Pair(MessageSignatureTypeName((MessageSignatureType)i), obj));
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("commands", commands));
+    obj.push_back(Pair("signatures", signatures));
+    return obj;
+}
+
 static UniValue GetNetworksInfo()
 {
     UniValue networks(UniValue::VARR);
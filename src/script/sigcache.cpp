@@ -10,79 +10,167 @@
 #include "uint256.h"
 #include "util.h"
 
+#include <string.h>
+
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
 
 namespace {
+//! The words of an entry; never all zero, which marks an empty slot
+void LoadEntry(const uint256& entry, uint64_t* w)
+{
+    memcpy(w, entry.begin(), 32);
+    w[3] |= 1;
+}
+
+//! -sigcachesize in bytes, or -maxsigcachesize as the number of entries it used to be
+int64_t GetSignatureCacheBytes()
+{
+    if (mapArgs.count("-maxsigcachesize") && !mapArgs.count("-sigcachesize")) {
+        int64_t nEntries = std::max<int64_t>(0, std::min((MAX_SIG_CACHE_SIZE << 20) / (int64_t)sizeof(uint256), GetArg("-maxsigcachesize", 0)));
+        LogPrintf("Using -maxsigcachesize=%d as a number of signatures, set -sigcachesize to size the cache in MiB\n", nEntries);
+        return nEntries * (int64_t)sizeof(uint256);
+    }
+    return std::max<int64_t>(0, std::min(MAX_SIG_CACHE_SIZE, GetArg("-sigcachesize", DEFAULT_SIG_CACHE_SIZE))) << 20;
+}
+
+CSignatureCache& GetSignatureCache()
+{
+    static CSignatureCache signatureCache(GetSignatureCacheBytes());
+    return signatureCache;
+}
+} // anon namespace
+
+CSignatureCache::CSignatureCache(size_t nBytes) : nBucketMask(0), nSlots(0)
+{
+    // Hash the salt as a whole SHA256 block, so only the midstate is copied per entry
+    uint256 nonce = GetRandHash();
+    hasherSalted.Write(nonce.begin(), 32).Write(nonce.begin(), 32);
+
+    size_t nBuckets = 1;
+    while (nBuckets * 2 * SHARDS * BUCKET_SLOTS * sizeof(Slot) <= nBytes)
+        nBuckets *= 2;
+    if (nBuckets * SHARDS * BUCKET_SLOTS * sizeof(Slot) > nBytes)
+        return;
+    // All zero is an empty slot: calloc leaves the pages to the system until
+    // they are written, so a large cache costs only what it holds
+    pslots.reset(static_cast<Slot*>(calloc(nBuckets * SHARDS * BUCKET_SLOTS, sizeof(Slot))));
+    if (!pslots)
+        return;
+    nBucketMask = nBuckets - 1;
+    nSlots = nBuckets * SHARDS * BUCKET_SLOTS;
+    for (Shard& shard : shards)
+        shard.nSequence.store(0, std::memory_order_relaxed);
+}
+
+uint256 CSignatureCache::ComputeEntry(const uint256& sighash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey) const
+{
+    uint256 entry;
+    CSHA256(hasherSalted).Write(sighash.begin(), 32).Write(vchSig.data(), vchSig.size()).Write(pubkey.begin(), pubkey.size()).Finalize(entry.begin());
+    return entry;
+}
+
+CSignatureCache::Slot* CSignatureCache::Bucket(const uint64_t* w, int nWhich) const
+{
+    // The entry is a salted hash: its low bits pick the shard, and two other words the buckets
+    size_t nShard = w[0] & (SHARDS - 1);
+    size_t nBucket = (nWhich ? w[1] : w[0] >> SHARD_BITS) & nBucketMask;
+    return &pslots[(nShard * (nBucketMask + 1) + nBucket) * BUCKET_SLOTS];
+}
 
-/**
- * Valid signature cache, to avoid doing expensive ECDSA signature checking
- * twice for every transaction (once when accepted into memory pool, and
- * again when accepted into the block chain)
- */
-class CSignatureCache
+bool CSignatureCache::Match(const Slot* bucket, const uint64_t* w)
 {
-private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
-
-public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
-    {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
+    for (int i = 0; i < BUCKET_SLOTS; i++) {
+        const Slot& slot = bucket[i];
+        if (slot.w[0].load(std::memory_order_relaxed) == w[0] && slot.w[1].load(std::memory_order_relaxed) == w[1] &&
+            slot.w[2].load(std::memory_order_relaxed) == w[2] && slot.w[3].load(std::memory_order_relaxed) == w[3])
             return true;
-        return false;
     }
+    return false;
+}
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
-    {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::set<sigdata_type>::iterator it = setValid.lower_bound(sigdata_type(randomHash));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+bool CSignatureCache::Contains(const uint256& entry) const
+{
+    if (!nSlots)
+        return false;
+    uint64_t w[4];
+    LoadEntry(entry, w);
+    const Shard& shard = shards[w[0] & (SHARDS - 1)];
+    const Slot* bucket0 = Bucket(w, 0);
+    const Slot* bucket1 = Bucket(w, 1);
+    while (true) {
+        uint32_t nSequence = shard.nSequence.load(std::memory_order_acquire);
+        if (nSequence & 1) {
+            // an insert is moving entries around in this shard
+            boost::this_thread::yield();
+            continue;
         }
+        bool fFound = Match(bucket0, w) || Match(bucket1, w);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (shard.nSequence.load(std::memory_order_relaxed) == nSequence)
+            return fFound;
+    }
+}
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+void CSignatureCache::Insert(const uint256& entry)
+{
+    if (!nSlots)
+        return;
+    uint64_t w[4];
+    LoadEntry(entry, w);
+    Shard& shard = shards[w[0] & (SHARDS - 1)];
+    boost::unique_lock<boost::mutex> lock(shard.mutex);
+    if (Match(Bucket(w, 0), w) || Match(Bucket(w, 1), w))
+        return;
+
+    const uint32_t nSequence = shard.nSequence.load(std::memory_order_relaxed);
+    shard.nSequence.store(nSequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    int nWhich = 0;
+    for (int nMove = 0; nMove <= MAX_MOVES; nMove++) {
+        // An empty slot in either bucket ends it
+        for (int nBucket = 0; nBucket < 2; nBucket++) {
+            Slot* bucket = Bucket(w, nBucket);
+            for (int i = 0; i < BUCKET_SLOTS; i++) {
+                if (bucket[i].w[3].load(std::memory_order_relaxed) == 0) {
+                    for (int j = 0; j < 4; j++)
+                        bucket[i].w[j].store(w[j], std::memory_order_relaxed);
+                    shard.nSequence.store(nSequence + 2, std::memory_order_release);
+                    return;
+                }
+            }
+        }
+        // Otherwise take the place of an entry, which moves to its other bucket
+        Slot& slot = Bucket(w, nWhich)[(w[2] + nMove) % BUCKET_SLOTS];
+        uint64_t wOld[4];
+        for (int j = 0; j < 4; j++) {
+            wOld[j] = slot.w[j].load(std::memory_order_relaxed);
+            slot.w[j].store(w[j], std::memory_order_relaxed);
+        }
+        nWhich = Bucket(wOld, 0) == Bucket(w, nWhich) ? 1 : 0;
+        memcpy(w, wOld, sizeof(w));
     }
-};
+    // The entry moved out last is dropped
+    shard.nSequence.store(nSequence + 2, std::memory_order_release);
+}
 
+void InitSignatureCache()
+{
+    const CSignatureCache& cache = GetSignatureCache();
+    LogPrintf("Using %u MiB for the signature cache, room for %u signatures\n", (unsigned int)((cache.Slots() * 32) >> 20), (unsigned int)cache.Slots());
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
+    CSignatureCache& signatureCache = GetSignatureCache();
+    uint256 entry = signatureCache.ComputeEntry(sighash, vchSig, pubkey);
 
-    if (signatureCache.Get(sighash, vchSig, pubkey))
+    if (signatureCache.Contains(entry))
         return true;
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
 
     if (store)
-        signatureCache.Set(sighash, vchSig, pubkey);
+        signatureCache.Insert(entry);
     return true;
 }
@@ -6,12 +6,96 @@
 #ifndef BITCOIN_SCRIPT_SIGCACHE_H
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
+#include "crypto/sha256.h"
 #include "script/interpreter.h"
+#include "uint256.h"
 
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <stdlib.h>
 #include <vector>
 
+#include <boost/thread/mutex.hpp>
+
+//! -sigcachesize default (MiB)
+static const int64_t DEFAULT_SIG_CACHE_SIZE = 32;
+//! max. -sigcachesize (MiB)
+static const int64_t MAX_SIG_CACHE_SIZE = 16384;
+
 class CPubKey;
 
+/**
+ * Valid signature cache, to avoid doing expensive ECDSA signature checking
+ * twice for every transaction (once when accepted into memory pool, and
+ * again when accepted into the block chain).
+ *
+ * A signature is cached as a salted SHA256 of (signature hash, signature,
+ * public key), 32 bytes in a table allocated once. The table comes zeroed
+ * from the system, which only backs its pages as entries are first written
+ * to them. It is split into
+ * shards, and each entry can sit in either of two buckets of four slots in
+ * its shard, chosen by its hash (bucketized cuckoo hashing). An insert
+ * into a full pair of buckets moves an entry to its other bucket, and after
+ * a few moves drops one; the salt keeps others from choosing what is
+ * dropped.
+ *
+ * Lookups take no lock. Inserts lock their shard and make its sequence
+ * number odd while they move entries; a lookup that saw the sequence change
+ * looks again.
+ */
+class CSignatureCache
+{
+private:
+    //! An entry as four words, which lookups load without a lock
+    struct Slot {
+        std::atomic<uint64_t> w[4];
+    };
+
+    struct alignas(64) Shard {
+        std::atomic<uint32_t> nSequence; //!< odd while an insert moves entries
+        boost::mutex mutex;              //!< taken by inserts
+    };
+
+    enum {
+        SHARD_BITS = 6,
+        SHARDS = 1 << SHARD_BITS,
+        BUCKET_SLOTS = 4,
+        MAX_MOVES = 64
+    };
+
+    struct FreeSlots {
+        void operator()(Slot* p) const { free(p); }
+    };
+
+    CSHA256 hasherSalted;
+    Shard shards[SHARDS];
+    std::unique_ptr<Slot[], FreeSlots> pslots;
+    size_t nBucketMask; //!< buckets per shard, minus one
+    size_t nSlots;
+
+    Slot* Bucket(const uint64_t* w, int nWhich) const;
+    static bool Match(const Slot* bucket, const uint64_t* w);
+
+public:
+    //! A cache of at most nBytes; 0 caches nothing
+    explicit CSignatureCache(size_t nBytes);
+    CSignatureCache(const CSignatureCache&) = delete;
+    CSignatureCache& operator=(const CSignatureCache&) = delete;
+
+    //! The salted hash a signature is cached under
+    uint256 ComputeEntry(const uint256& sighash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey) const;
+
+    bool Contains(const uint256& entry) const;
+    void Insert(const uint256& entry);
+
+    //! Number of entries the cache can hold
+    size_t Slots() const { return nSlots; }
+};
+
+//! Size the signature cache by -sigcachesize before the script check threads start
+void InitSignatureCache();
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
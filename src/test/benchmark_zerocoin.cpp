@@ -19,12 +19,28 @@
 #include <exception>
 #include <cstdlib>
 #include <sys/time.h>
+#include <atomic>
+#include <set>
+#include <boost/thread.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
+#include <boost/unordered_map.hpp>
 #include "streams.h"
 #include "libzerocoin/ParamGeneration.h"
 #include "libzerocoin/Denominations.h"
 #include "libzerocoin/Coin.h"
 #include "libzerocoin/CoinSpend.h"
 #include "libzerocoin/Accumulator.h"
+#include "checkqueue.h"
+#include "coins.h"
+#include "crypto/quark.h"
+#include "hash.h"
+#include "kernel.h"
+#include "memusage.h"
+#include "pubkey.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "script/standard.h"
+#include "utiltime.h"
 #include "test_simplicity.h"
 
 
@@ -279,6 +295,66 @@ Testb_Accumulator()
     return true;
 }
 
+bool
+Testb_BatchAccumulate()
+{
+    // This test assumes a list of coins were generated during
+    // the Testb_MintCoin() test.
+    if (ggCoins[0] == NULL) {
+        return false;
+    }
+    try {
+        std::vector<libzerocoin::PublicCoin> vCoins;
+        std::vector<CBigNum> vValues;
+        for (uint32_t i = 0; i < TESTS_COINS_TO_ACCUMULATE; i++) {
+            vCoins.push_back(ggCoins[i]->getPublicCoin());
+            vValues.push_back(ggCoins[i]->getPublicCoin().getValue());
+        }
+
+        // One constant-time exponentiation per coin, the way increment used to accumulate
+        libzerocoin::Accumulator accLoop(&gg_Params->accumulatorParams, libzerocoin::CoinDenomination::ZQ_ONE);
+        CBigNum bnLoop = accLoop.getValue();
+        timer.start();
+        for (uint32_t i = 0; i < TESTS_COINS_TO_ACCUMULATE; i++) {
+            bnLoop = bnLoop.pow_mod(vValues[i], gg_Params->accumulatorParams.accumulatorModulus);
+        }
+        timer.stop();
+        int nLoop = timer.duration();
+
+        // One public exponentiation per coin
+        libzerocoin::Accumulator accSingle(&gg_Params->accumulatorParams, libzerocoin::CoinDenomination::ZQ_ONE);
+        timer.start();
+        for (uint32_t i = 0; i < TESTS_COINS_TO_ACCUMULATE; i++) {
+            accSingle.increment(vValues[i]);
+        }
+        timer.stop();
+        int nSingle = timer.duration();
+
+        // Product tree and a single exponentiation
+        libzerocoin::Accumulator accBatch(&gg_Params->accumulatorParams, libzerocoin::CoinDenomination::ZQ_ONE);
+        timer.start();
+        accBatch.increment(vValues);
+        timer.stop();
+        int nBatch = timer.duration();
+
+        // Same, with the coins validated first
+        libzerocoin::Accumulator accBatchValidated(&gg_Params->accumulatorParams, libzerocoin::CoinDenomination::ZQ_ONE);
+        accBatchValidated.accumulate(vCoins);
+
+        std::cout << "\tBATCH ACCUMULATE ELAPSED TIME (" << TESTS_COINS_TO_ACCUMULATE << " coins):\n\t\tPer-coin pow_mod: " << nLoop << " ms\n\t\tPer-coin increment: " << nSingle << " ms\n\t\tBatched increment: " << nBatch << " ms" << std::endl;
+
+        if (accSingle.getValue() != bnLoop || accBatch.getValue() != bnLoop || accBatchValidated.getValue() != bnLoop) {
+            std::cout << "Batched accumulator doesn't match" << std::endl;
+            return false;
+        }
+    } catch (std::runtime_error e) {
+        std::cout << e.what() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
 bool
 Testb_MintCoin()
 {
@@ -386,6 +462,7 @@ Testb_RunAllTests()
     gLogTestResult("parameter generation is correct", Testb_ParamGen);
     gLogTestResult("coins can be minted", Testb_MintCoin);
     gLogTestResult("the accumulator works", Testb_Accumulator);
+    gLogTestResult("coins can be accumulated in a batch", Testb_BatchAccumulate);
     gLogTestResult("a minted coin can be spent", Testb_MintAndSpend);
 
     // Summarize test results
@@ -412,3 +489,472 @@ BOOST_AUTO_TEST_CASE(benchmark_test)
 }
 BOOST_AUTO_TEST_SUITE_END()
 
+//////////
+// Node benchmarks: throughput of the parallel code paths against the ones they replaced
+//////////
+
+namespace {
+/**
+ * The check queue CCheckQueue replaced: one mutex, two condition variables
+ * and a shared LIFO vector. Kept here as the baseline of the benchmark.
+ */
+template <typename T>
+class CSharedCheckQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
+    boost::condition_variable condMaster;
+    std::vector<T> queue;
+    int nIdle;
+    int nTotal;
+    bool fAllOk;
+    unsigned int nTodo;
+    bool fQuit;
+    unsigned int nBatchSize;
+
+    bool Loop(bool fMaster = false)
+    {
+        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        unsigned int nNow = 0;
+        bool fOk = true;
+        do {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (nNow) {
+                    fAllOk &= fOk;
+                    nTodo -= nNow;
+                    if (nTodo == 0 && !fMaster)
+                        condMaster.notify_one();
+                } else {
+                    nTotal++;
+                }
+                while (queue.empty()) {
+                    if ((fMaster || fQuit) && nTodo == 0) {
+                        nTotal--;
+                        bool fRet = fAllOk;
+                        if (fMaster)
+                            fAllOk = true;
+                        return fRet;
+                    }
+                    nIdle++;
+                    cond.wait(lock);
+                    nIdle--;
+                }
+                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
+                vChecks.resize(nNow);
+                for (unsigned int i = 0; i < nNow; i++) {
+                    vChecks[i].swap(queue.back());
+                    queue.pop_back();
+                }
+                fOk = fAllOk;
+            }
+            for (T& check : vChecks)
+                if (fOk)
+                    fOk = check();
+            vChecks.clear();
+        } while (true);
+    }
+
+public:
+    CSharedCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+
+    void Thread() { Loop(); }
+    bool Wait() { return Loop(true); }
+
+    void Add(std::vector<T>& vChecks)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        for (T& check : vChecks) {
+            queue.push_back(T());
+            check.swap(queue.back());
+        }
+        nTodo += vChecks.size();
+        if (vChecks.size() == 1)
+            condWorker.notify_one();
+        else if (vChecks.size() > 1)
+            condWorker.notify_all();
+    }
+};
+
+/** Check that hashes a few hundred bytes, about the cost of a cached signature check */
+struct CHashCheck {
+    std::atomic<int>* pnRun;
+    uint256 seed;
+    bool fResult;
+
+    CHashCheck() : pnRun(NULL), fResult(true) {}
+    CHashCheck(std::atomic<int>* pnRunIn, const uint256& seedIn, bool fResultIn) : pnRun(pnRunIn), seed(seedIn), fResult(fResultIn) {}
+
+    bool operator()()
+    {
+        uint256 hash = seed;
+        for (int i = 0; i < 8; i++)
+            hash = Hash(hash.begin(), hash.end());
+        if (pnRun)
+            (*pnRun)++;
+        return fResult && hash != 0;
+    }
+
+    void swap(CHashCheck& check)
+    {
+        std::swap(pnRun, check.pnRun);
+        std::swap(seed, check.seed);
+        std::swap(fResult, check.fResult);
+    }
+};
+
+/** Push nTx transactions of nInputs checks each, the way ConnectBlock does, and wait */
+template <typename Queue>
+bool RunCheckQueueBlock(Queue& queue, int nTx, int nInputs)
+{
+    for (int i = 0; i < nTx; i++) {
+        std::vector<CHashCheck> vChecks;
+        for (int j = 0; j < nInputs; j++)
+            vChecks.push_back(CHashCheck(NULL, uint256(i * nInputs + j + 1), true));
+        queue.Add(vChecks);
+    }
+    return queue.Wait();
+}
+
+/** Wall-clock time of nBlocks blocks through a queue with nThreads threads, the master included */
+template <typename Queue>
+int64_t TimeCheckQueueBlocks(int nThreads, int nBlocks)
+{
+    Queue queue(128);
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads - 1; i++)
+        threads.create_thread(boost::bind(&Queue::Thread, &queue));
+    int64_t nStart = GetTimeMicros();
+    for (int n = 0; n < nBlocks; n++)
+        BOOST_CHECK(RunCheckQueueBlock(queue, 1000, 4));
+    int64_t nElapsed = GetTimeMicros() - nStart;
+    threads.interrupt_all();
+    threads.join_all();
+    return nElapsed;
+}
+/** Kernel prefix of an SPL stake the way GetHashProofOfStake streams it, with a v2 modifier */
+CDataStream GetSplKernelPrefix(const uint256& nStakeModifierV2, unsigned int nTimeBlockFrom, const uint256& txid, unsigned int n)
+{
+    CDataStream ssUniqueID(SER_NETWORK, 0);
+    ssUniqueID << n << txid;
+    CDataStream ss(SER_GETHASH, 0);
+    ss << nStakeModifierV2 << nTimeBlockFrom << ssUniqueID;
+    return ss;
+}
+/** The map CCoinsMap was before, for comparison */
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsNodeMap;
+
+size_t MapUsage(const CCoinsMap& map)
+{
+    return map.DynamicMemoryUsage();
+}
+
+//! A node holds the entry, the next pointer and the hash, and the buckets are one pointer each
+size_t MapUsage(const CCoinsNodeMap& map)
+{
+    return map.size() * memusage::MallocUsage(sizeof(CCoinsNodeMap::value_type) + 2 * sizeof(void*)) + memusage::MallocUsage(map.bucket_count() * sizeof(void*));
+}
+
+//! A txid out of insecure_rand, so that the benchmark times the map rather than the RNG
+uint256 InsecureRandTxid()
+{
+    uint256 txid;
+    for (uint32_t* p = (uint32_t*)txid.begin(); p < (uint32_t*)txid.end(); p++)
+        *p = insecure_rand();
+    return txid;
+}
+
+/**
+ * Connect nBlocks blocks of nTxPerBlock transactions, each spending one
+ * output and creating two pay-to-pubkey-hash outputs, on a coins map the
+ * way CCoinsViewCache does it, and flush it every nFlushInterval blocks.
+ * Returns the time taken; nPeakUsage gets the largest map plus coins usage.
+ */
+template <typename Map>
+int64_t ReplayCoinsBlocks(int nBlocks, int nTxPerBlock, int nFlushInterval, size_t& nPeakUsage)
+{
+    Map map;
+    std::vector<COutPoint> vUnspent;
+    size_t nCoinsUsage = 0;
+    CScript script = GetScriptForDestination(CKeyID(uint160(insecure_rand())));
+    nPeakUsage = 0;
+
+    // Funding outputs, as if fetched from the database
+    for (int i = 0; i < 10 * nTxPerBlock; i++) {
+        uint256 txid = InsecureRandTxid();
+        CCoinsCacheEntry& entry = map.insert(std::make_pair(txid, CCoinsCacheEntry())).first->second;
+        entry.coins.vout.assign(2, CTxOut(COIN, script));
+        nCoinsUsage += entry.coins.DynamicMemoryUsage();
+        vUnspent.emplace_back(txid, 0);
+        vUnspent.emplace_back(txid, 1);
+    }
+
+    int64_t nStart = GetTimeMicros();
+    for (int nBlock = 0; nBlock < nBlocks; nBlock++) {
+        for (int nTx = 0; nTx < nTxPerBlock; nTx++) {
+            {
+                size_t nPick = insecure_rand() % vUnspent.size();
+                COutPoint prevout = vUnspent[nPick];
+                vUnspent[nPick] = vUnspent.back();
+                vUnspent.pop_back();
+
+                typename Map::iterator it = map.find(prevout.hash);
+                if (it == map.end()) {
+                    // flushed since: fetch it again
+                    it = map.insert(std::make_pair(prevout.hash, CCoinsCacheEntry())).first;
+                    it->second.coins.vout.assign(2, CTxOut(COIN, script));
+                    it->second.coins.vout[1 - prevout.n].SetNull();
+                    nCoinsUsage += it->second.coins.DynamicMemoryUsage();
+                }
+                nCoinsUsage -= it->second.coins.DynamicMemoryUsage();
+                it->second.coins.Spend(prevout.n);
+                it->second.flags |= CCoinsCacheEntry::DIRTY;
+                if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned())
+                    map.erase(it);
+                else
+                    nCoinsUsage += it->second.coins.DynamicMemoryUsage();
+            }
+            uint256 txid = InsecureRandTxid();
+            CCoinsCacheEntry& entry = map[txid];
+            entry.coins.vout.assign(2, CTxOut(COIN, script));
+            entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+            nCoinsUsage += entry.coins.DynamicMemoryUsage();
+            vUnspent.emplace_back(txid, 0);
+            vUnspent.emplace_back(txid, 1);
+        }
+        nPeakUsage = std::max(nPeakUsage, MapUsage(map) + nCoinsUsage);
+
+        if (nBlock % nFlushInterval == nFlushInterval - 1) {
+            // BatchWrite to the database
+            for (typename Map::iterator it = map.begin(); it != map.end();)
+                map.erase(it++);
+            map.clear();
+            nCoinsUsage = 0;
+        }
+    }
+    return GetTimeMicros() - nStart;
+}
+/** What a signature check is cached by */
+struct CSigData {
+    uint256 sighash;
+    std::vector<unsigned char> vchSig;
+    CPubKey pubkey;
+};
+
+CSigData GetRandSigData()
+{
+    CSigData data;
+    data.sighash = GetRandHash();
+    data.vchSig.resize(72);
+    GetRandBytes(data.vchSig.data(), data.vchSig.size());
+    unsigned char vchPubKey[33];
+    GetRandBytes(vchPubKey, sizeof(vchPubKey));
+    vchPubKey[0] = 2;
+    data.pubkey.Set(vchPubKey, vchPubKey + sizeof(vchPubKey));
+    return data;
+}
+
+/**
+ * The signature cache CSignatureCache replaced: a set of whole signatures
+ * behind a reader/writer lock, with a random entry evicted per insert once
+ * full. Kept here as the baseline of the benchmark.
+ */
+class CSetSignatureCache
+{
+private:
+    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
+    std::set<sigdata_type> setValid;
+    boost::shared_mutex cs_sigcache;
+    size_t nMaxCacheSize;
+
+public:
+    CSetSignatureCache(size_t nMaxCacheSizeIn) : nMaxCacheSize(nMaxCacheSizeIn) {}
+
+    bool Lookup(const CSigData& data)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        return setValid.count(sigdata_type(data.sighash, data.vchSig, data.pubkey)) != 0;
+    }
+
+    void Add(const CSigData& data)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        while (setValid.size() > nMaxCacheSize) {
+            std::set<sigdata_type>::iterator it = setValid.lower_bound(sigdata_type(GetRandHash()));
+            if (it == setValid.end())
+                it = setValid.begin();
+            setValid.erase(*it);
+        }
+        setValid.insert(sigdata_type(data.sighash, data.vchSig, data.pubkey));
+    }
+};
+
+/** CSignatureCache the way CachingTransactionSignatureChecker uses it */
+class CHashSignatureCache
+{
+private:
+    CSignatureCache cache;
+
+public:
+    CHashSignatureCache(size_t nBytes) : cache(nBytes) {}
+
+    bool Lookup(const CSigData& data) { return cache.Contains(cache.ComputeEntry(data.sighash, data.vchSig, data.pubkey)); }
+    void Add(const CSigData& data) { cache.Insert(cache.ComputeEntry(data.sighash, data.vchSig, data.pubkey)); }
+};
+
+/** Check of one input of a block: a hit, or for a transaction not seen before a miss and an insert */
+template <typename Cache>
+struct CCacheCheck {
+    Cache* pcache;
+    const CSigData* pdata;
+
+    CCacheCheck() : pcache(NULL), pdata(NULL) {}
+    CCacheCheck(Cache* pcacheIn, const CSigData* pdataIn) : pcache(pcacheIn), pdata(pdataIn) {}
+
+    bool operator()()
+    {
+        if (!pcache->Lookup(*pdata))
+            pcache->Add(*pdata);
+        return true;
+    }
+
+    void swap(CCacheCheck& check)
+    {
+        std::swap(pcache, check.pcache);
+        std::swap(pdata, check.pdata);
+    }
+};
+
+/** Blocks of 1000 transactions with 4 inputs each, nine in ten of them in the cache already */
+template <typename Cache>
+int64_t TimeSigCacheBlocks(Cache& cache, int nThreads, const std::vector<CSigData>& vData)
+{
+    typedef CCheckQueue<CCacheCheck<Cache> > Queue;
+    for (size_t i = 0; i < vData.size(); i++)
+        if (i % 10)
+            cache.Add(vData[i]);
+
+    Queue queue(128);
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads - 1; i++)
+        threads.create_thread(boost::bind(&Queue::Thread, &queue));
+    int64_t nStart = GetTimeMicros();
+    for (size_t nBlock = 0; nBlock < vData.size(); nBlock += 4000) {
+        for (size_t i = nBlock; i < std::min(vData.size(), nBlock + 4000); i += 4) {
+            std::vector<CCacheCheck<Cache> > vChecks;
+            for (size_t j = i; j < i + 4 && j < vData.size(); j++)
+                vChecks.push_back(CCacheCheck<Cache>(&cache, &vData[j]));
+            queue.Add(vChecks);
+        }
+        BOOST_CHECK(queue.Wait());
+    }
+    int64_t nElapsed = GetTimeMicros() - nStart;
+    threads.interrupt_all();
+    threads.join_all();
+    return nElapsed;
+}
+} // anon namespace
+
+BOOST_FIXTURE_TEST_SUITE(benchmark_node, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(benchmark_quark_headers)
+{
+    // One full headers message through each Quark backend the CPU supports
+    const QuarkBackend best = quark_detect_backend();
+    const size_t count = 2000;
+    std::vector<unsigned char> data(80 * count);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (unsigned char)(i * 131 + (i >> 7) * 17);
+    std::vector<unsigned char> out(32 * count);
+    for (int b = QUARK_SCALAR; b <= QUARK_AVX2; b <<= 1) {
+        if (!quark_set_backend((QuarkBackend)b))
+            continue;
+        int64_t nStart = GetTimeMicros();
+        quark_hash_multi(data.data(), 80, count, out.data());
+        int64_t nElapsed = std::max<int64_t>(GetTimeMicros() - nStart, 1);
+        std::cout << "Quark " << quark_backend_name((QuarkBackend)b) << ": " << count * 1000000 / nElapsed << " headers/s" << std::endl;
+    }
+    quark_set_backend(best);
+}
+
+BOOST_AUTO_TEST_CASE(benchmark_checkqueue)
+{
+    // Wall-clock time of blocks of 1000 transactions with 4 inputs each,
+    // through the shared-vector queue and the work-stealing one
+    const int nBlocks = 5;
+    for (int nThreads = 2; nThreads <= 32; nThreads *= 2) {
+        int64_t nShared = TimeCheckQueueBlocks<CSharedCheckQueue<CHashCheck> >(nThreads, nBlocks);
+        int64_t nStealing = TimeCheckQueueBlocks<CCheckQueue<CHashCheck> >(nThreads, nBlocks);
+        std::cout << "check queue, " << nThreads << " threads: shared " << nShared / nBlocks << " us/block, work-stealing " << nStealing / nBlocks << " us/block" << std::endl;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(benchmark_stake_kernels)
+{
+    // Kernels checked per second over the drift window of 5000 inputs that never hit,
+    // one stream per kernel as Stake() used to, and through the prefix engine
+    const unsigned int nTimeFirst = 1500000000, nTimeLast = nTimeFirst + 60;
+    std::vector<CDataStream> vStreams;
+    std::vector<CStakeKernelPrefix> vPrefixes;
+    for (int i = 0; i < 5000; i++) {
+        vStreams.push_back(GetSplKernelPrefix(GetRandHash(), 1400000000 + i, GetRandHash(), i));
+        vPrefixes.push_back(CStakeKernelPrefix(vStreams.back(), 0));
+    }
+    const double nKernels = vPrefixes.size() * (nTimeLast - nTimeFirst + 1);
+
+    int64_t nStart = GetTimeMicros();
+    uint256 hashAll;
+    for (const CDataStream& ssPrefix : vStreams) {
+        for (unsigned int nTime = nTimeFirst; nTime <= nTimeLast; nTime++) {
+            CDataStream ss(ssPrefix);
+            ss << nTime;
+            hashAll ^= Hash(ss.begin(), ss.end());
+        }
+    }
+    int64_t nStream = GetTimeMicros() - nStart;
+    std::cout << "stake kernels, stream per kernel: " << (int64_t)(nKernels * 1000000 / std::max<int64_t>(nStream, 1)) << " kernels/s" << std::endl;
+
+    for (int nThreads = 1; nThreads <= 8; nThreads *= 2) {
+        size_t nFound;
+        unsigned int nTimeFound;
+        uint64_t nHashes = 0;
+        nStart = GetTimeMicros();
+        BOOST_CHECK(!SearchStakeKernels(vPrefixes, nTimeFirst, nTimeLast, nThreads, nFound, nTimeFound, &nHashes));
+        int64_t nEngine = GetTimeMicros() - nStart;
+        BOOST_CHECK_EQUAL(nHashes, (uint64_t)nKernels);
+        std::cout << "stake kernels, " << StakeKernelLanes() << " lanes, " << nThreads << " threads: " << (int64_t)(nKernels * 1000000 / std::max<int64_t>(nEngine, 1)) << " kernels/s" << std::endl;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(benchmark_coins_map)
+{
+    // Blocks of 2000 transactions with a flush every 50 blocks, on the
+    // node-based map CCoinsMap used to be and on the flat one
+    const int nBlocks = 200, nTxPerBlock = 2000, nFlushInterval = 50;
+    size_t nNodeUsage, nFlatUsage;
+    int64_t nNode = ReplayCoinsBlocks<CCoinsNodeMap>(nBlocks, nTxPerBlock, nFlushInterval, nNodeUsage);
+    int64_t nFlat = ReplayCoinsBlocks<CCoinsMap>(nBlocks, nTxPerBlock, nFlushInterval, nFlatUsage);
+    std::cout << "coins map, boost::unordered_map: " << nNode / nBlocks << " us/block, peak " << (nNodeUsage >> 10) << " KiB" << std::endl;
+    std::cout << "coins map, flat: " << nFlat / nBlocks << " us/block, peak " << (nFlatUsage >> 10) << " KiB" << std::endl;
+}
+
+BOOST_AUTO_TEST_CASE(benchmark_sigcache)
+{
+    // Wall-clock time of blocks of cached signature checks at full script check width,
+    // through the set cache and the sharded one
+    std::vector<CSigData> vData;
+    for (int i = 0; i < 40000; i++)
+        vData.push_back(GetRandSigData());
+    for (int nThreads = 2; nThreads <= 32; nThreads *= 2) {
+        CSetSignatureCache cacheSet(50000);
+        CHashSignatureCache cacheHash(DEFAULT_SIG_CACHE_SIZE << 20);
+        int64_t nSet = TimeSigCacheBlocks(cacheSet, nThreads, vData);
+        int64_t nHash = TimeSigCacheBlocks(cacheHash, nThreads, vData);
+        std::cout << "signature cache, " << nThreads << " threads: set " << nSet / 10 << " us/block, sharded " << nHash / 10 << " us/block" << std::endl;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,143 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+#include "miner.h"
+#include "random.h"
+#include "txmempool.h"
+#include "utiltime.h"
+#include "test/test_simplicity.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blocktemplate_tests, TestingSetup)
+
+namespace {
+const unsigned int BLOCK_MAX_SIZE = 100000;
+const unsigned int BLOCK_FREE_SIZE = 10000;
+
+/** An output of nValue in the chain, spendable by anyone */
+uint256 AddCoins(CAmount nValue)
+{
+    uint256 hash = GetRandHash();
+    CCoinsModifier coins = pcoinsTip->ModifyCoins(hash);
+    coins->nVersion = 1;
+    coins->nHeight = 0;
+    coins->vout.resize(1);
+    coins->vout[0] = CTxOut(nValue, CScript() << OP_TRUE);
+    return hash;
+}
+
+/** A transaction spending prevout to one output of nValue, added to the pool with nFee */
+CTransaction AddTx(const COutPoint& prevout, CAmount nValue, CAmount nFee)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prevout;
+    tx.vout.resize(1);
+    tx.vout[0] = CTxOut(nValue, CScript() << OP_TRUE);
+    mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, nFee, GetTime(), 0.0, chainActive.Height()));
+    return tx;
+}
+
+std::vector<uint256> Selection(const CBlockTemplateBuilder& builder)
+{
+    CBlockTemplate blocktemplate;
+    builder.AppendTo(blocktemplate, false);
+    std::vector<uint256> vHashes;
+    for (const CTransaction& tx : blocktemplate.block.vtx)
+        vHashes.push_back(tx.GetHash());
+    return vHashes;
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(blocktemplate_update)
+{
+    LOCK2(cs_main, mempool.cs);
+    CBlockTemplateBuilder builder;
+
+    // A parent with its child, selected parent first
+    CTransaction txParent = AddTx(COutPoint(AddCoins(10 * COIN), 0), 9 * COIN, COIN);
+    CTransaction txChild = AddTx(COutPoint(txParent.GetHash(), 0), 8 * COIN, COIN);
+    BOOST_CHECK(builder.Update(chainActive.Tip(), false, BLOCK_MAX_SIZE, BLOCK_FREE_SIZE));
+    std::vector<uint256> vHashes = Selection(builder);
+    BOOST_CHECK_EQUAL(vHashes.size(), 2);
+    BOOST_CHECK(vHashes[0] == txParent.GetHash());
+    BOOST_CHECK(vHashes[1] == txChild.GetHash());
+
+    // A new transaction is added to the selection as it stands
+    CTransaction txOther = AddTx(COutPoint(AddCoins(10 * COIN), 0), 9 * COIN, COIN);
+    BOOST_CHECK(!builder.Update(chainActive.Tip(), false, BLOCK_MAX_SIZE, BLOCK_FREE_SIZE));
+    BOOST_CHECK_EQUAL(builder.Size(), 3);
+
+    // One leaving the pool takes what spends it along
+    std::list<CTransaction> removed;
+    mempool.remove(txParent, removed, false);
+    BOOST_CHECK(!builder.Update(chainActive.Tip(), false, BLOCK_MAX_SIZE, BLOCK_FREE_SIZE));
+    vHashes = Selection(builder);
+    BOOST_CHECK_EQUAL(vHashes.size(), 1);
+    BOOST_CHECK(vHashes[0] == txOther.GetHash());
+
+    // Changed limits select anew
+    BOOST_CHECK(builder.Update(chainActive.Tip(), false, BLOCK_MAX_SIZE / 2, BLOCK_FREE_SIZE));
+    BOOST_CHECK_EQUAL(builder.Size(), 1);
+
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(blocktemplate_replay)
+{
+    LOCK2(cs_main, mempool.cs);
+    CBlockTemplateBuilder builder;
+
+    uint256 hashCoins = AddCoins(10 * COIN);
+    CTransaction tx = AddTx(COutPoint(hashCoins, 0), 9 * COIN, COIN);
+    CTransaction txChild = AddTx(COutPoint(tx.GetHash(), 0), 8 * COIN, COIN);
+    CTransaction txOther = AddTx(COutPoint(AddCoins(10 * COIN), 0), 9 * COIN, COIN);
+    BOOST_CHECK(builder.Update(chainActive.Tip(), false, BLOCK_MAX_SIZE, BLOCK_FREE_SIZE));
+    BOOST_CHECK_EQUAL(builder.Size(), 3);
+
+    // Under a new tip the input pays less than the transaction spends: the
+    // replay, which does not run the scripts, still drops it with its child
+    pcoinsTip->ModifyCoins(hashCoins)->vout[0].nValue = COIN;
+    uint256 hashTip = GetRandHash();
+    CBlockIndex indexTip;
+    indexTip.nHeight = chainActive.Height();
+    indexTip.phashBlock = &hashTip;
+    BOOST_CHECK(!builder.Update(&indexTip, false, BLOCK_MAX_SIZE, BLOCK_FREE_SIZE));
+    std::vector<uint256> vHashes = Selection(builder);
+    BOOST_CHECK_EQUAL(vHashes.size(), 1);
+    BOOST_CHECK(vHashes[0] == txOther.GetHash());
+    BOOST_CHECK(mempool.exists(tx.GetHash()));
+
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(blocktemplate_remove_invalid)
+{
+    LOCK2(cs_main, mempool.cs);
+    CBlockTemplateBuilder builder;
+
+    uint256 hashCoins = AddCoins(10 * COIN);
+    CTransaction tx = AddTx(COutPoint(hashCoins, 0), 9 * COIN, COIN);
+    CTransaction txChild = AddTx(COutPoint(tx.GetHash(), 0), 8 * COIN, COIN);
+    CTransaction txOther = AddTx(COutPoint(AddCoins(10 * COIN), 0), 9 * COIN, COIN);
+    BOOST_CHECK(builder.Update(chainActive.Tip(), false, BLOCK_MAX_SIZE, BLOCK_FREE_SIZE));
+    BOOST_CHECK_EQUAL(builder.Size(), 3);
+
+    // A block that fails its checks only costs the pool what is invalid in it
+    pcoinsTip->ModifyCoins(hashCoins)->vout[0].nValue = COIN;
+    BOOST_CHECK_EQUAL(builder.RemoveInvalid(), 2);
+    BOOST_CHECK(!mempool.exists(tx.GetHash()));
+    BOOST_CHECK(!mempool.exists(txChild.GetHash()));
+    BOOST_CHECK(mempool.exists(txOther.GetHash()));
+
+    // and the next template is selected anew
+    BOOST_CHECK(builder.Update(chainActive.Tip(), false, BLOCK_MAX_SIZE, BLOCK_FREE_SIZE));
+    BOOST_CHECK_EQUAL(builder.Size(), 1);
+
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,110 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "hash.h"
+#include "test/test_simplicity.h"
+
+#include <atomic>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+namespace {
+/** Check that hashes a few hundred bytes, about the cost of a cached signature check */
+struct CHashCheck {
+    std::atomic<int>* pnRun;
+    uint256 seed;
+    bool fResult;
+
+    CHashCheck() : pnRun(NULL), fResult(true) {}
+    CHashCheck(std::atomic<int>* pnRunIn, const uint256& seedIn, bool fResultIn) : pnRun(pnRunIn), seed(seedIn), fResult(fResultIn) {}
+
+    bool operator()()
+    {
+        uint256 hash = seed;
+        for (int i = 0; i < 8; i++)
+            hash = Hash(hash.begin(), hash.end());
+        if (pnRun)
+            (*pnRun)++;
+        return fResult && hash != 0;
+    }
+
+    void swap(CHashCheck& check)
+    {
+        std::swap(pnRun, check.pnRun);
+        std::swap(seed, check.seed);
+        std::swap(fResult, check.fResult);
+    }
+};
+
+/** Push nTx transactions of nInputs checks each, the way ConnectBlock does, and wait */
+bool RunBlock(CCheckQueue<CHashCheck>& queue, int nTx, int nInputs, std::atomic<int>* pnRun, int nFailAt = -1)
+{
+    for (int i = 0; i < nTx; i++) {
+        std::vector<CHashCheck> vChecks;
+        for (int j = 0; j < nInputs; j++)
+            vChecks.push_back(CHashCheck(pnRun, uint256(i * nInputs + j + 1), i * nInputs + j != nFailAt));
+        queue.Add(vChecks);
+    }
+    return queue.Wait();
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(checkqueue_results)
+{
+    CCheckQueue<CHashCheck> queue(128);
+    boost::thread_group threads;
+    for (int i = 0; i < 3; i++)
+        threads.create_thread(boost::bind(&CCheckQueue<CHashCheck>::Thread, &queue));
+
+    for (int round = 0; round < 20; round++) {
+        std::atomic<int> nRun(0);
+        {
+            CCheckQueueControl<CHashCheck> control(&queue);
+            for (int i = 0; i < 50; i++) {
+                std::vector<CHashCheck> vChecks;
+                for (int j = 0; j < round; j++)
+                    vChecks.push_back(CHashCheck(&nRun, uint256(i * 100 + j + 1), true));
+                control.Add(vChecks);
+            }
+            BOOST_CHECK(control.Wait());
+        }
+        BOOST_CHECK_EQUAL(nRun, 50 * round);
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_cancel)
+{
+    CCheckQueue<CHashCheck> queue(16);
+    boost::thread_group threads;
+    for (int i = 0; i < 3; i++)
+        threads.create_thread(boost::bind(&CCheckQueue<CHashCheck>::Thread, &queue));
+
+    // A failure near the start cancels most of the block
+    std::atomic<int> nRun(0);
+    BOOST_CHECK(!RunBlock(queue, 1000, 20, &nRun, 5));
+    BOOST_CHECK(nRun < 20000);
+    BOOST_CHECK(queue.IsIdle());
+
+    // and the queue is usable again afterwards
+    nRun = 0;
+    BOOST_CHECK(RunBlock(queue, 100, 3, &nRun));
+    BOOST_CHECK_EQUAL(nRun, 300);
+
+    // A failure in the last check is still reported
+    BOOST_CHECK(!RunBlock(queue, 100, 3, NULL, 299));
+    BOOST_CHECK(queue.IsIdle());
+
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -59,6 +59,96 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+//! Whether a and b have the same unspent outputs
+bool SameOutputs(const CCoins& a, const CCoins& b)
+{
+    for (unsigned int i = 0; i < std::max(a.vout.size(), b.vout.size()); i++) {
+        bool fA = i < a.vout.size() && !a.vout[i].IsNull();
+        bool fB = i < b.vout.size() && !b.vout[i].IsNull();
+        if (fA != fB || (fA && a.vout[i] != b.vout[i]))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * A view that keeps every output apart and writes only the outputs the
+ * flags and spent lists of the entries point at, the way CCoinsViewDB does.
+ */
+class CCoinsViewOutputsTest : public CCoinsView
+{
+    uint256 hashBestBlock_;
+    std::map<COutPoint, std::pair<CCoins, CTxOut> > map_; // metadata of the transaction, output
+
+public:
+    bool GetCoins(const uint256& txid, CCoins& coins) const
+    {
+        coins = CCoins();
+        for (std::map<COutPoint, std::pair<CCoins, CTxOut> >::const_iterator it = map_.lower_bound(COutPoint(txid, 0)); it != map_.end() && it->first.hash == txid; ++it) {
+            const CCoins& meta = it->second.first;
+            coins.fCoinBase = meta.fCoinBase;
+            coins.fCoinStake = meta.fCoinStake;
+            coins.nHeight = meta.nHeight;
+            coins.nVersion = meta.nVersion;
+            coins.vout.resize(it->first.n + 1);
+            coins.vout[it->first.n] = it->second.second;
+        }
+        return !coins.vout.empty();
+    }
+
+    bool HaveCoins(const uint256& txid) const
+    {
+        CCoins coins;
+        return GetCoins(txid, coins);
+    }
+
+    uint256 GetBestBlock() const { return hashBestBlock_; }
+
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+    {
+        for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); mapCoins.erase(it++)) {
+            const CCoinsCacheEntry& entry = it->second;
+            if (!(entry.flags & CCoinsCacheEntry::DIRTY))
+                continue;
+            if (!(entry.flags & CCoinsCacheEntry::FRESH)) {
+                // The entry kept the version the records were written from
+                CCoins coinsOld;
+                GetCoins(it->first, coinsOld);
+                BOOST_CHECK(SameOutputs(coinsOld, entry.coinsBefore));
+                for (uint32_t n : entry.vSpent)
+                    map_.erase(COutPoint(it->first, n));
+                if (!(entry.flags & CCoinsCacheEntry::ADDED))
+                    continue;
+            }
+            CCoins meta = entry.coins;
+            meta.vout.clear();
+            for (unsigned int i = 0; i < entry.coins.vout.size(); i++) {
+                if (!entry.coins.vout[i].IsNull())
+                    map_[COutPoint(it->first, i)] = std::make_pair(meta, entry.coins.vout[i]);
+            }
+        }
+        hashBestBlock_ = hashBlock;
+        return true;
+    }
+
+    bool GetStats(CCoinsStats& stats) const { return false; }
+};
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    //! The memory usage recomputed from every entry, to check the cached one against
+    size_t RecomputeUsage() const
+    {
+        size_t ret = cacheCoins.DynamicMemoryUsage();
+        for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end(); ++it)
+            ret += it->second.DynamicMemoryUsage();
+        return ret;
+    }
+};
 }
 
 BOOST_FIXTURE_TEST_SUITE(coins_tests, BasicTestingSetup)
@@ -90,8 +180,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -136,6 +226,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                     missed_an_entry = true;
                 }
             }
+            for (const CCoinsViewCacheTest* test : stack)
+                BOOST_CHECK_EQUAL(test->DynamicMemoryUsage(), test->RecomputeUsage());
         }
 
         if (insecure_rand() % 100 == 0) {
@@ -152,7 +244,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -176,4 +268,164 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+// Spend, create and restore (as disconnecting a block does) single outputs
+// through a stack of caches on top of CCoinsViewOutputsTest, and check that
+// the per-output writes leave it with the outputs the caches had.
+BOOST_AUTO_TEST_CASE(coins_output_writes_test)
+{
+    bool spent_an_output = false;
+    bool restored_an_output = false;
+    bool recreated_an_entry = false;
+
+    std::map<uint256, CCoins> result;  // the outputs there should be
+    std::map<uint256, CCoins> created; // all the outputs each transaction was created with
+    CCoinsViewOutputsTest base;
+    std::vector<CCoinsViewCacheTest*> stack;
+    stack.push_back(new CCoinsViewCacheTest(&base));
+
+    std::vector<uint256> txids(200);
+    for (uint256& txid : txids)
+        txid = GetRandHash();
+
+    for (unsigned int i = 0; i < 20000; i++) {
+        const uint256& txid = txids[insecure_rand() % txids.size()];
+        CCoins& coins = result[txid];
+        CCoins& full = created[txid];
+        {
+            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
+            BOOST_CHECK(coins == *entry);
+            unsigned int n = full.vout.empty() ? 0 : insecure_rand() % full.vout.size();
+            if (coins.IsPruned() && (full.vout.empty() || insecure_rand() % 2)) {
+                if (!full.vout.empty())
+                    recreated_an_entry = true;
+                full.nVersion = 1 + insecure_rand() % 2;
+                full.nHeight = insecure_rand() % 1000;
+                full.fCoinBase = insecure_rand() % 2;
+                full.vout.resize(1 + insecure_rand() % 4);
+                for (CTxOut& out : full.vout) {
+                    out.nValue = 1 + insecure_rand() % 1000;
+                    out.scriptPubKey = CScript() << insecure_rand();
+                }
+                coins = full;
+                *entry = full;
+            } else if (coins.IsAvailable(n)) {
+                coins.Spend(n);
+                entry->Spend(n);
+                spent_an_output = true;
+            } else {
+                // as ApplyTxInUndo puts the output back, with the metadata if it was pruned
+                for (CCoins* pcoins : {&coins, &*entry}) {
+                    if (pcoins->IsPruned()) {
+                        pcoins->fCoinBase = full.fCoinBase;
+                        pcoins->fCoinStake = full.fCoinStake;
+                        pcoins->nHeight = full.nHeight;
+                        pcoins->nVersion = full.nVersion;
+                    }
+                    if (pcoins->vout.size() <= n)
+                        pcoins->vout.resize(n + 1);
+                    pcoins->vout[n] = full.vout[n];
+                }
+                restored_an_output = true;
+            }
+        }
+
+        if (insecure_rand() % 50 == 0) {
+            if (stack.size() > 1 && insecure_rand() % 2 == 0) {
+                stack.back()->Flush();
+                delete stack.back();
+                stack.pop_back();
+            } else if (stack.size() < 3) {
+                stack.push_back(new CCoinsViewCacheTest(stack.back()));
+            } else {
+                stack.back()->Flush();
+            }
+        }
+
+        if (insecure_rand() % 2000 == 0 || i == 19999) {
+            // Write everything down, and read it back from the outputs alone
+            for (std::vector<CCoinsViewCacheTest*>::reverse_iterator it = stack.rbegin(); it != stack.rend(); ++it)
+                (*it)->Flush();
+            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); ++it) {
+                CCoins coins;
+                BOOST_CHECK_EQUAL(base.GetCoins(it->first, coins), !it->second.IsPruned());
+                BOOST_CHECK(coins == it->second);
+            }
+        }
+    }
+
+    while (stack.size() > 0) {
+        delete stack.back();
+        stack.pop_back();
+    }
+
+    BOOST_CHECK(spent_an_output);
+    BOOST_CHECK(restored_an_output);
+    BOOST_CHECK(recreated_an_entry);
+}
+
+BOOST_AUTO_TEST_CASE(coins_map_test)
+{
+    // Random inserts, lookups and erases against a std::map
+    CCoinsMap map;
+    std::map<uint256, int> result;
+    std::vector<uint256> txids(2000);
+    for (uint256& txid : txids)
+        txid = GetRandHash();
+
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < 5000; i++) {
+            const uint256& txid = txids[insecure_rand() % txids.size()];
+            switch (insecure_rand() % 3) {
+            case 0: {
+                bool fNew = map.insert(std::make_pair(txid, CCoinsCacheEntry())).second;
+                BOOST_CHECK_EQUAL(fNew, result.insert(std::make_pair(txid, 0)).second);
+                map[txid].coins.nHeight = ++result[txid];
+                break;
+            }
+            case 1:
+                BOOST_CHECK_EQUAL(map.erase(txid), result.erase(txid));
+                break;
+            default:
+                BOOST_CHECK_EQUAL(map.count(txid), result.count(txid));
+            }
+        }
+        BOOST_CHECK_EQUAL(map.size(), result.size());
+
+        // Entries keep their address while others are inserted
+        if (!map.empty()) {
+            CCoinsMap::iterator it = map.begin();
+            const CCoins* pcoins = &it->second.coins;
+            for (int i = 0; i < 1000; i++)
+                map[GetRandHash()];
+            BOOST_CHECK(&map.find(it->first)->second.coins == pcoins);
+            BOOST_CHECK(&it->second.coins == pcoins);
+            result.erase(it->first);
+            map.erase(it);
+            for (CCoinsMap::iterator it = map.begin(); it != map.end();) {
+                if (!result.count(it->first))
+                    map.erase(it++);
+                else
+                    ++it;
+            }
+        }
+
+        // Iterating while erasing every other entry visits all of them once
+        size_t nVisited = 0;
+        for (CCoinsMap::iterator it = map.begin(); it != map.end(); nVisited++) {
+            BOOST_CHECK_EQUAL(it->second.coins.nHeight, result[it->first]);
+            if (nVisited % 2) {
+                result.erase(it->first);
+                map.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+        BOOST_CHECK_EQUAL(map.size(), result.size());
+        BOOST_CHECK_EQUAL(nVisited, result.size() + nVisited / 2);
+    }
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK_EQUAL(map.DynamicMemoryUsage(), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,129 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "collateralindex.h"
+#include "coins.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "undo.h"
+#include "test/test_simplicity.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(collateralindex_tests, BasicTestingSetup)
+
+namespace {
+CMutableTransaction SpendTx(const COutPoint& prevout, const std::vector<CAmount>& vValues)
+{
+    CMutableTransaction tx;
+    tx.vin.push_back(CTxIn(prevout));
+    for (CAmount nValue : vValues)
+        tx.vout.push_back(CTxOut(nValue, CScript() << OP_TRUE));
+    return tx;
+}
+
+CBlock BlockOf(const std::vector<CMutableTransaction>& vtx)
+{
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << (int64_t)insecure_rand();
+    coinbase.vout.push_back(CTxOut(10000000 * COIN, CScript() << OP_TRUE));
+    block.vtx.push_back(coinbase);
+    for (const CMutableTransaction& tx : vtx)
+        block.vtx.push_back(tx);
+    return block;
+}
+
+/** Apply block to view at nHeight, as ConnectBlock does */
+void Connect(const CBlock& block, CCoinsViewCache& view, int nHeight, CBlockUndo& blockundo)
+{
+    CValidationState state;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        CTxUndo txundo;
+        UpdateCoins(block.vtx[i], state, view, txundo, nHeight);
+        if (i > 0)
+            blockundo.vtxundo.push_back(txundo);
+    }
+}
+
+/** Undo block in view, as DisconnectBlock does for spends of outputs that were not the last of their transaction */
+void Disconnect(const CBlock& block, CCoinsViewCache& view, const CBlockUndo& blockundo)
+{
+    for (unsigned int i = block.vtx.size(); i-- > 0;) {
+        const CTransaction& tx = block.vtx[i];
+        view.ModifyCoins(tx.GetHash())->Clear();
+        if (i == 0)
+            continue;
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            const CTxInUndo& undo = blockundo.vtxundo[i - 1].vprevout[j];
+            CCoinsModifier coins = view.ModifyCoins(tx.vin[j].prevout.hash);
+            if (undo.nHeight != 0)
+                coins->nHeight = undo.nHeight;
+            if (coins->vout.size() < tx.vin[j].prevout.n + 1)
+                coins->vout.resize(tx.vin[j].prevout.n + 1);
+            coins->vout[tx.vin[j].prevout.n] = undo.txout;
+        }
+    }
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(collateralindex_connect_disconnect)
+{
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+    CCollateralIndex index;
+    CAmount nValue;
+
+    BOOST_CHECK(CCollateralIndex::IsCollateralAmount(1000000 * COIN));
+    BOOST_CHECK(!CCollateralIndex::IsCollateralAmount(1000000 * COIN - 1));
+
+    // Block 1 pays a collateral, a non-collateral and a second collateral
+    CMutableTransaction txFund = SpendTx(COutPoint(GetRandHash(), 0), {1000000 * COIN, 5 * COIN, 10000000 * COIN});
+    CBlock block1 = BlockOf({txFund});
+    CBlockUndo undo1;
+    view.ModifyCoins(txFund.vin[0].prevout.hash)->vout.push_back(CTxOut(11000005 * COIN, CScript() << OP_TRUE));
+    Connect(block1, view, 1, undo1);
+    index.ConnectBlock(block1, 1);
+
+    const COutPoint outCollateral(txFund.GetHash(), 0);
+    BOOST_CHECK_EQUAL(index.GetAge(outCollateral, nValue), 1);
+    BOOST_CHECK_EQUAL(nValue, 1000000 * COIN);
+    BOOST_CHECK_EQUAL(index.GetAge(COutPoint(txFund.GetHash(), 1), nValue), -1);
+    BOOST_CHECK_EQUAL(index.GetAge(COutPoint(txFund.GetHash(), 2), nValue), 1);
+    // the coinbase pays a collateral amount too
+    BOOST_CHECK_EQUAL(index.Size(), 3U);
+
+    // Block 2 ages it, block 3 spends it and pays another collateral on
+    CBlock block2 = BlockOf({});
+    CBlockUndo undo2;
+    Connect(block2, view, 2, undo2);
+    index.ConnectBlock(block2, 2);
+    BOOST_CHECK_EQUAL(index.GetAge(outCollateral, nValue), 2);
+
+    CMutableTransaction txSpend = SpendTx(outCollateral, {1000000 * COIN});
+    CBlock block3 = BlockOf({txSpend});
+    CBlockUndo undo3;
+    Connect(block3, view, 3, undo3);
+    index.ConnectBlock(block3, 3);
+    BOOST_CHECK_EQUAL(index.GetAge(outCollateral, nValue), -1);
+    BOOST_CHECK_EQUAL(index.GetAge(COutPoint(txSpend.GetHash(), 0), nValue), 1);
+    BOOST_CHECK_EQUAL(index.GetAge(COutPoint(txFund.GetHash(), 2), nValue), 3);
+
+    // Disconnecting block 3 brings the spent collateral back at its height
+    Disconnect(block3, view, undo3);
+    index.DisconnectBlock(block3, 3, view);
+    BOOST_CHECK_EQUAL(index.GetAge(outCollateral, nValue), 2);
+    BOOST_CHECK_EQUAL(nValue, 1000000 * COIN);
+    BOOST_CHECK_EQUAL(index.GetAge(COutPoint(txSpend.GetHash(), 0), nValue), -1);
+    BOOST_CHECK_EQUAL(index.Size(), 4U);
+
+    index.Clear();
+    BOOST_CHECK_EQUAL(index.Size(), 0U);
+    BOOST_CHECK_EQUAL(index.GetAge(outCollateral, nValue), -1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
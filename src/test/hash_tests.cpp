@@ -3,6 +3,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "hash.h"
+#include "crypto/quark.h"
+#include "crypto/scrypt_opt.h"
 #include "utilstrencodings.h"
 #include "test/test_simplicity.h"
 
@@ -46,4 +48,64 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+static std::vector<unsigned char> QuarkTestInputs(size_t len, size_t count)
+{
+    std::vector<unsigned char> data(len * count);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (unsigned char)(i * 131 + (i >> 7) * 17);
+    return data;
+}
+
+BOOST_AUTO_TEST_CASE(quark_multi_lane)
+{
+    const QuarkBackend best = quark_detect_backend();
+    const size_t lengths[] = {64, 80, 88};
+    for (size_t len : lengths) {
+        // 23 inputs so every backend also runs its narrower and scalar tails
+        const size_t count = 23;
+        std::vector<unsigned char> data = QuarkTestInputs(len, count);
+        std::vector<unsigned char> out(32 * count);
+        for (int b = QUARK_SCALAR; b <= QUARK_AVX2; b <<= 1) {
+            if (!quark_set_backend((QuarkBackend)b))
+                continue;
+            quark_hash_multi(data.data(), len, count, out.data());
+            for (size_t i = 0; i < count; i++) {
+                const unsigned char* in = &data[i * len];
+                uint256 expected = HashQuark(in, in + len);
+                BOOST_CHECK_MESSAGE(memcmp(expected.begin(), &out[i * 32], 32) == 0,
+                    strprintf("%s: input %u of %u bytes", quark_backend_name((QuarkBackend)b), i, len));
+            }
+        }
+    }
+
+    // Mining helper: the returned nonce must hash below the target
+    std::vector<unsigned char> header = QuarkTestInputs(80, 1);
+    uint256 target = ~uint256(0) >> 4;
+    int nHashesDone = 0, nTotal = 0;
+    while (!quark_N_multi(header.data(), target, &nHashesDone)) {
+        nTotal += nHashesDone;
+        WriteLE32(&header[76], ReadLE32(&header[76]) + nHashesDone);
+        BOOST_REQUIRE(nTotal < 10000);
+    }
+    BOOST_CHECK(HashQuark(header.begin(), header.end()) <= target);
+
+    quark_set_backend(best);
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_batch)
+{
+    // Every count up to two full batches, so short final batches are covered
+    const int nMax = 2 * scrypt_batch_ways() + 1;
+    std::vector<unsigned char> data = QuarkTestInputs(80, nMax);
+    for (int count = 1; count <= nMax; count++) {
+        std::vector<unsigned char> out(32 * count);
+        BOOST_CHECK(scryptHashBatch(data.data(), (char*)out.data(), count, 1024));
+        for (int i = 0; i < count; i++) {
+            uint256 expected;
+            BOOST_CHECK(scryptHash(&data[80 * i], (char*)expected.begin(), 1024));
+            BOOST_CHECK(memcmp(expected.begin(), &out[32 * i], 32) == 0);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,111 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "hash.h"
+#include "kernel.h"
+#include "random.h"
+#include "streams.h"
+#include "test/test_simplicity.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(kernel_tests, BasicTestingSetup)
+
+namespace {
+/** Kernel prefix of an SPL stake the way GetHashProofOfStake streams it, with a v2 modifier */
+CDataStream GetSplKernelPrefix(const uint256& nStakeModifierV2, unsigned int nTimeBlockFrom, const uint256& txid, unsigned int n)
+{
+    CDataStream ssUniqueID(SER_NETWORK, 0);
+    ssUniqueID << n << txid;
+    CDataStream ss(SER_GETHASH, 0);
+    ss << nStakeModifierV2 << nTimeBlockFrom << ssUniqueID;
+    return ss;
+}
+
+/** Kernel hash through a fresh stream, as GetHashProofOfStake computes it */
+uint256 GetReferenceKernelHash(const CDataStream& ssPrefix, unsigned int nTimeTx)
+{
+    CDataStream ss(ssPrefix);
+    ss << nTimeTx;
+    return Hash(ss.begin(), ss.end());
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(kernel_prefix_hash)
+{
+    seed_insecure_rand(true);
+    // Every prefix length around the block boundaries, so the tail takes one or two blocks
+    for (unsigned int nSize = 0; nSize < 200; nSize++) {
+        CDataStream ss(SER_GETHASH, 0);
+        for (unsigned int i = 0; i < nSize; i++)
+            ss << (unsigned char)insecure_rand();
+        CStakeKernelPrefix prefix(ss, 0);
+        BOOST_CHECK_EQUAL(prefix.nSize, nSize);
+        for (unsigned int nTime = 1500000000; nTime < 1500000003; nTime++)
+            BOOST_CHECK(prefix.GetHash(nTime) == GetReferenceKernelHash(ss, nTime));
+    }
+
+    // The streams of real stake inputs: v1 modifier and zSPL uniqueness too
+    CDataStream ssZSpl(SER_GETHASH, 0);
+    CDataStream ssSerial(SER_GETHASH, 0);
+    ssSerial << GetRandHash();
+    ssZSpl << (uint64_t)insecure_rand() << (unsigned int)1500000000 << ssSerial;
+    BOOST_CHECK(CStakeKernelPrefix(ssZSpl, 0).GetHash(1500001234) == GetReferenceKernelHash(ssZSpl, 1500001234));
+    CDataStream ssSpl = GetSplKernelPrefix(GetRandHash(), 1500000000, GetRandHash(), 3);
+    BOOST_CHECK(CStakeKernelPrefix(ssSpl, 0).GetHash(1500001234) == GetReferenceKernelHash(ssSpl, 1500001234));
+}
+
+BOOST_AUTO_TEST_CASE(kernel_search)
+{
+    seed_insecure_rand(true);
+    // About one hit in 256 kernels: most inputs hit somewhere in the window
+    const uint256 bnTarget = ~uint256(0) >> 8;
+    const unsigned int nTimeFirst = 1500000000, nTimeLast = nTimeFirst + 60;
+    for (int nRound = 0; nRound < 8; nRound++) {
+        std::vector<CDataStream> vStreams;
+        std::vector<CStakeKernelPrefix> vPrefixes;
+        for (int i = 0; i < 50; i++) {
+            vStreams.push_back(GetSplKernelPrefix(GetRandHash(), 1400000000 + i, GetRandHash(), i));
+            // make the early inputs miss, so the hit is further in
+            vPrefixes.push_back(CStakeKernelPrefix(vStreams.back(), i < nRound * 5 ? uint256(0) : bnTarget));
+        }
+
+        // The reference: each input in turn, each time in turn
+        bool fRefFound = false;
+        size_t nRefFound = 0;
+        unsigned int nRefTime = 0;
+        for (size_t i = 0; i < vPrefixes.size() && !fRefFound; i++) {
+            for (unsigned int nTime = nTimeFirst; nTime <= nTimeLast; nTime++) {
+                if (GetReferenceKernelHash(vStreams[i], nTime) < vPrefixes[i].bnTarget) {
+                    fRefFound = true;
+                    nRefFound = i;
+                    nRefTime = nTime;
+                    break;
+                }
+            }
+        }
+
+        for (int nThreads = 1; nThreads <= 4; nThreads *= 2) {
+            size_t nFound = 0;
+            unsigned int nTimeFound = 0;
+            BOOST_CHECK_EQUAL(SearchStakeKernels(vPrefixes, nTimeFirst, nTimeLast, nThreads, nFound, nTimeFound), fRefFound);
+            if (fRefFound) {
+                BOOST_CHECK_EQUAL(nFound, nRefFound);
+                BOOST_CHECK_EQUAL(nTimeFound, nRefTime);
+            }
+        }
+    }
+
+    // Nothing under a zero target, and an interrupt stops the search
+    std::vector<CStakeKernelPrefix> vNone(20, CStakeKernelPrefix(GetSplKernelPrefix(GetRandHash(), 1400000000, GetRandHash(), 0), 0));
+    size_t nFound;
+    unsigned int nTimeFound;
+    uint64_t nHashes = 0;
+    BOOST_CHECK(!SearchStakeKernels(vNone, nTimeFirst, nTimeLast, 2, nFound, nTimeFound, &nHashes));
+    BOOST_CHECK_EQUAL(nHashes, 20 * 61);
+    vNone[19].bnTarget = ~uint256(0);
+    BOOST_CHECK(!SearchStakeKernels(vNone, nTimeFirst, nTimeLast, 2, nFound, nTimeFound, NULL, []() { return true; }));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -46,4 +46,23 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK(nSum == 4109975100000000ULL);
 }
 
+BOOST_AUTO_TEST_CASE(raw_block_read)
+{
+    // The genesis block is on disk since InitBlockIndex, stored as it goes over the wire
+    const CBlockIndex* pindex = chainActive.Genesis();
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, pindex));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+
+    CRawBlockRef pblock;
+    BOOST_CHECK(ReadRawBlockFromDisk(pblock, pindex));
+    BOOST_CHECK(pblock && std::vector<char>(ss.begin(), ss.end()) == *pblock);
+
+    // The second read is served from the cache
+    CRawBlockRef pblockCached;
+    BOOST_CHECK(ReadRawBlockFromDisk(pblockCached, pindex));
+    BOOST_CHECK(pblockCached == pblock);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,115 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "clientversion.h"
+#include "mappedfile.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "streams.h"
+#include "util.h"
+#include "test/test_simplicity.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(mappedfile_tests, BasicTestingSetup)
+
+namespace {
+CBlock RandomBlock(int nTransactions)
+{
+    CBlock block;
+    block.nVersion = 4;
+    block.hashPrevBlock = GetRandHash();
+    block.nTime = 1500000000 + insecure_rand() % 1000000;
+    for (int i = 0; i < nTransactions; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1 + insecure_rand() % 3);
+        for (CTxIn& txin : tx.vin) {
+            txin.prevout = COutPoint(GetRandHash(), insecure_rand() % 4);
+            txin.scriptSig = CScript() << std::vector<unsigned char>(72, 1) << std::vector<unsigned char>(33, 2);
+        }
+        tx.vout.resize(2);
+        for (CTxOut& txout : tx.vout) {
+            txout.nValue = insecure_rand();
+            txout.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 3) << OP_EQUALVERIFY << OP_CHECKSIG;
+        }
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+/** Blocks with the size ahead of each, at positions vPos, as WriteBlockToDisk lays them out */
+void WriteBlocks(const boost::filesystem::path& path, const std::vector<CBlock>& vBlocks, std::vector<unsigned int>& vPos)
+{
+    CAutoFile fileout(fopen(path.string().c_str(), "ab"), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!fileout.IsNull());
+    for (const CBlock& block : vBlocks) {
+        fileout << fileout.GetSerializeSize(block);
+        vPos.push_back(ftell(fileout.Get()));
+        fileout << block;
+    }
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(mappedfile_read)
+{
+    seed_insecure_rand(true);
+    const boost::filesystem::path path = GetTempPath() / strprintf("test_simplicity_map_%lu", (unsigned long)GetRand(1000000));
+    std::vector<CBlock> vBlocks;
+    for (int i = 0; i < 20; i++)
+        vBlocks.push_back(RandomBlock(1 + i));
+    std::vector<unsigned int> vPos;
+    WriteBlocks(path, vBlocks, vPos);
+
+    std::shared_ptr<const CMappedFile> pfile = CMappedFile::Open(path);
+#ifndef WIN32
+    BOOST_REQUIRE(pfile);
+    BOOST_CHECK_EQUAL(pfile->size(), boost::filesystem::file_size(path));
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        CBlock block;
+        CMemoryReader(pfile->data() + vPos[i], pfile->data() + pfile->size(), SER_DISK, CLIENT_VERSION) >> block;
+        BOOST_CHECK(block.GetHash() == vBlocks[i].GetHash());
+        BOOST_CHECK(block.hashMerkleRoot == block.BuildMerkleTree());
+    }
+
+    // A span cut short does not read past its end
+    CBlock block;
+    CMemoryReader reader(pfile->data() + vPos[5], pfile->data() + vPos[6] - 10, SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK_THROW(reader >> block, std::ios_base::failure);
+
+    // The cache maps a grown file again, while the old map stays readable
+    CMappedFileCache cache(2);
+    BOOST_CHECK(cache.Get(path, pfile->size()));
+    BOOST_CHECK(!cache.Get(path, pfile->size() + 1));
+    std::vector<CBlock> vMore(1, RandomBlock(5));
+    WriteBlocks(path, vMore, vPos);
+    std::shared_ptr<const CMappedFile> pgrown = cache.Get(path, vPos.back());
+    BOOST_REQUIRE(pgrown);
+    CMemoryReader(pgrown->data() + vPos.back(), pgrown->data() + pgrown->size(), SER_DISK, CLIENT_VERSION) >> block;
+    BOOST_CHECK(block.GetHash() == vMore[0].GetHash());
+    CMemoryReader(pfile->data() + vPos[0], pfile->data() + pfile->size(), SER_DISK, CLIENT_VERSION) >> block;
+    BOOST_CHECK(block.GetHash() == vBlocks[0].GetHash());
+
+    // and keeps no more than its bound
+    std::vector<boost::filesystem::path> vPaths;
+    for (int i = 0; i < 3; i++) {
+        vPaths.push_back(path.string() + strprintf(".%d", i));
+        boost::filesystem::copy_file(path, vPaths.back());
+        BOOST_CHECK(cache.Get(vPaths.back(), 1));
+    }
+    BOOST_CHECK_EQUAL(cache.Size(), 2U);
+    cache.Erase(vPaths.back());
+    BOOST_CHECK_EQUAL(cache.Size(), 1U);
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.Size(), 0U);
+    for (const boost::filesystem::path& p : vPaths)
+        boost::filesystem::remove(p);
+#else
+    BOOST_CHECK(!pfile);
+#endif
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,220 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+#include "masternode.h"
+#include "masternodeman.h"
+#include "random.h"
+#include "spork.h"
+#include "test/test_simplicity.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(masternodeman_tests, BasicTestingSetup)
+
+namespace {
+const int SCORE_HEIGHT = 180;
+const int PAYMENT_HEIGHT = 190;
+
+CMasternode MasternodeAt(const COutPoint& out, int64_t nPingAge)
+{
+    CMasternode mn;
+    mn.vin = CTxIn(out);
+    mn.deposit = 200000 * COIN;
+    // broadcast long enough ago to be enabled rather than active
+    mn.sigTime = GetAdjustedTime() - 2 * GetSporkValue(SPORK_20_MN_WINNER_MINIMUM_AGE);
+    mn.lastPing.vin = mn.vin;
+    mn.lastPing.blockHash = GetRandHash();
+    mn.lastPing.sigTime = GetAdjustedTime() - nPingAge;
+    mn.unitTest = true;
+    mn.cacheInputAge = 1000;
+    mn.cacheInputAgeBlock = chainActive.Height();
+    return mn;
+}
+
+CMasternode EnabledMasternode()
+{
+    return MasternodeAt(COutPoint(GetRandHash(), 0), 0);
+}
+
+int64_t CompactScore(const COutPoint& out, int nHeight)
+{
+    CMasternode mn;
+    mn.vin = CTxIn(out);
+    return mn.CalculateScore(1, nHeight).GetCompact(false);
+}
+
+/** Collaterals best first, by compact scores calculated afresh, equal scores in collateral order */
+std::vector<COutPoint> FreshRanking(CMasternodeMan& man, int nHeight)
+{
+    std::vector<std::pair<int64_t, COutPoint> > vScores;
+    for (const CMasternode& mn : man.GetFullMasternodeVector())
+        vScores.push_back(std::make_pair(CompactScore(mn.vin.prevout, nHeight), mn.vin.prevout));
+    std::sort(vScores.begin(), vScores.end(), [](const std::pair<int64_t, COutPoint>& a, const std::pair<int64_t, COutPoint>& b) {
+        if (a.first != b.first) return a.first > b.first;
+        return a.second < b.second;
+    });
+    std::vector<COutPoint> vRanking;
+    for (const std::pair<int64_t, COutPoint>& s : vScores)
+        vRanking.push_back(s.second);
+    return vRanking;
+}
+
+void CheckRanking(CMasternodeMan& man, int nHeight)
+{
+    const std::vector<COutPoint> vRanking = FreshRanking(man, nHeight);
+    BOOST_CHECK_EQUAL(vRanking.size(), (size_t)man.size());
+    for (size_t i = 0; i < vRanking.size(); i++) {
+        CMasternode* pmn = man.GetMasternodeByRank(i + 1, nHeight, 0, false);
+        BOOST_CHECK(pmn != nullptr && pmn->vin.prevout == vRanking[i]);
+        BOOST_CHECK_EQUAL(man.GetMasternodeRank(CTxIn(vRanking[i]), nHeight, 0, false), (int)i + 1);
+    }
+    BOOST_CHECK(man.GetMasternodeByRank(vRanking.size() + 1, nHeight, 0, false) == nullptr);
+}
+
+/** The masternode paid at nBlockHeight, picked afresh the way GetNextMasternodeInQueueForPayment does */
+COutPoint FreshNextInQueue(CMasternodeMan& man, int nBlockHeight)
+{
+    std::vector<std::pair<int64_t, COutPoint> > vLastPaid;
+    for (CMasternode& mn : man.GetFullMasternodeVector()) {
+        if (mn.IsEnabled(false))
+            vLastPaid.push_back(std::make_pair(mn.SecondsSincePayment(), mn.vin.prevout));
+    }
+    std::sort(vLastPaid.rbegin(), vLastPaid.rend());
+
+    const size_t nTenth = std::max<size_t>(man.CountEnabled(CMasternode::LevelValue::MIN) / 10, 1);
+    COutPoint best;
+    uint256 nHigh = 0;
+    for (size_t i = 0; i < nTenth && i < vLastPaid.size(); i++) {
+        CMasternode mn;
+        mn.vin = CTxIn(vLastPaid[i].second);
+        const uint256 n = mn.CalculateScore(1, nBlockHeight - 100);
+        if (n > nHigh) {
+            nHigh = n;
+            best = vLastPaid[i].second;
+        }
+    }
+    return best;
+}
+
+void CheckNextInQueue(CMasternodeMan& man, int nBlockHeight)
+{
+    unsigned nCount = 0;
+    CMasternode* pmn = man.GetNextMasternodeInQueueForPayment(nBlockHeight, CMasternode::LevelValue::MIN, false, nCount);
+    BOOST_CHECK(pmn != nullptr && pmn->vin.prevout == FreshNextInQueue(man, nBlockHeight));
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(score_table)
+{
+    // two branches that part at height 150
+    std::vector<uint256> vHashMain(200), vHashSide(50);
+    std::vector<CBlockIndex> vBlocksMain(200), vBlocksSide(50);
+    for (size_t i = 0; i < vBlocksMain.size(); i++) {
+        vHashMain[i] = GetRandHash();
+        vBlocksMain[i].nHeight = i;
+        vBlocksMain[i].pprev = i ? &vBlocksMain[i - 1] : NULL;
+        vBlocksMain[i].phashBlock = &vHashMain[i];
+    }
+    for (size_t i = 0; i < vBlocksSide.size(); i++) {
+        vHashSide[i] = GetRandHash();
+        vBlocksSide[i].nHeight = 150 + i;
+        vBlocksSide[i].pprev = i ? &vBlocksSide[i - 1] : &vBlocksMain[149];
+        vBlocksSide[i].phashBlock = &vHashSide[i];
+    }
+    chainActive.SetTip(&vBlocksMain.back());
+    mapCacheBlockHashes.clear();
+
+    CMasternodeMan man;
+    for (int i = 0; i < 30; i++)
+        BOOST_CHECK(man.Add(EnabledMasternode()));
+
+    // two collaterals whose compact scores are equal at SCORE_HEIGHT
+    std::map<int64_t, COutPoint> mapSeen;
+    COutPoint outTie1, outTie2;
+    while (outTie1.IsNull()) {
+        const COutPoint out(GetRandHash(), 0);
+        std::pair<std::map<int64_t, COutPoint>::iterator, bool> ret = mapSeen.insert(std::make_pair(CompactScore(out, SCORE_HEIGHT), out));
+        if (!ret.second) {
+            outTie1 = ret.first->second;
+            outTie2 = out;
+        }
+    }
+    // listed in the reverse of the order they rank in
+    if (outTie1 < outTie2)
+        std::swap(outTie1, outTie2);
+    BOOST_CHECK(man.Add(MasternodeAt(outTie1, 0)));
+    BOOST_CHECK(man.Add(MasternodeAt(outTie2, 0)));
+
+    // expired masternodes are disabled, one more is old enough to be removed
+    std::set<COutPoint> setDisabled;
+    for (int i = 0; i < 3; i++) {
+        const COutPoint out(GetRandHash(), 0);
+        BOOST_CHECK(man.Add(MasternodeAt(out, MASTERNODE_EXPIRATION_SECONDS + 60)));
+        setDisabled.insert(out);
+    }
+    const COutPoint outRemoved(GetRandHash(), 0);
+    BOOST_CHECK(man.Add(MasternodeAt(outRemoved, MASTERNODE_REMOVAL_SECONDS + 60)));
+    setDisabled.insert(outRemoved);
+
+    CheckRanking(man, SCORE_HEIGHT);
+    const std::vector<COutPoint> vRanking = FreshRanking(man, SCORE_HEIGHT);
+    const size_t nTie1 = std::find(vRanking.begin(), vRanking.end(), outTie1) - vRanking.begin();
+    const size_t nTie2 = std::find(vRanking.begin(), vRanking.end(), outTie2) - vRanking.begin();
+    BOOST_CHECK_EQUAL(nTie1, nTie2 + 1);
+    // the cached table gives the same answers again
+    CheckRanking(man, SCORE_HEIGHT);
+    CheckNextInQueue(man, PAYMENT_HEIGHT);
+
+    // disabled masternodes rank last, in score order
+    std::vector<COutPoint> vExpected;
+    for (const COutPoint& out : vRanking) {
+        if (!setDisabled.count(out))
+            vExpected.push_back(out);
+    }
+    for (const COutPoint& out : vRanking) {
+        if (setDisabled.count(out))
+            vExpected.push_back(out);
+    }
+    std::vector<std::pair<int, CMasternode> > vRanks = man.GetMasternodeRanks(SCORE_HEIGHT);
+    BOOST_CHECK_EQUAL(vRanks.size(), vExpected.size());
+    for (size_t i = 0; i < vRanks.size() && i < vExpected.size(); i++) {
+        BOOST_CHECK_EQUAL(vRanks[i].first, (int)i + 1);
+        BOOST_CHECK(vRanks[i].second.vin.prevout == vExpected[i]);
+    }
+
+    // the tables follow the list as masternodes come and go
+    BOOST_CHECK(man.Add(EnabledMasternode()));
+    CheckRanking(man, SCORE_HEIGHT);
+    CheckNextInQueue(man, PAYMENT_HEIGHT);
+
+    man.Remove(CTxIn(vExpected[0]));
+    CheckRanking(man, SCORE_HEIGHT);
+    CheckNextInQueue(man, PAYMENT_HEIGHT);
+
+    const int nSize = man.size();
+    man.CheckAndRemove();
+    BOOST_CHECK_EQUAL(man.size(), nSize - 1);
+    BOOST_CHECK_EQUAL(man.GetMasternodeRank(CTxIn(outRemoved), SCORE_HEIGHT, 0, false), -1);
+    CheckRanking(man, SCORE_HEIGHT);
+    CheckNextInQueue(man, PAYMENT_HEIGHT);
+
+    // a reorganization gives the heights past the fork other blocks, GetBlockHash
+    // keeps the hashes it looked up so those go as well
+    const std::vector<COutPoint> vRankingMain = FreshRanking(man, SCORE_HEIGHT);
+    chainActive.SetTip(&vBlocksSide.back());
+    mapCacheBlockHashes.clear();
+    BOOST_CHECK(FreshRanking(man, SCORE_HEIGHT) != vRankingMain);
+    CheckRanking(man, SCORE_HEIGHT);
+    CheckNextInQueue(man, PAYMENT_HEIGHT);
+
+    chainActive.SetTip(NULL);
+    mapCacheBlockHashes.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
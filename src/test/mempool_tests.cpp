@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "main.h"
+#include "random.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -99,4 +100,214 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+namespace {
+/** A transaction spending the given outputs into nOutputs outputs of nValue each */
+CMutableTransaction MakeTx(const std::vector<COutPoint>& vPrevouts, int nOutputs, CAmount nValue)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(vPrevouts.size());
+    for (size_t i = 0; i < vPrevouts.size(); i++) {
+        tx.vin[i].prevout = vPrevouts[i];
+        tx.vin[i].scriptSig = CScript() << OP_11;
+    }
+    tx.vout.resize(nOutputs);
+    for (int i = 0; i < nOutputs; i++) {
+        tx.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[i].nValue = nValue;
+    }
+    return tx;
+}
+
+const CTxMemPoolEntry& Entry(const CTxMemPool& pool, const CMutableTransaction& tx)
+{
+    return *pool.mapTx.find(tx.GetHash());
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(MempoolAncestorDescendantTest)
+{
+    // A parent with two children, both spent by one grandchild
+    CMutableTransaction txParent = MakeTx(std::vector<COutPoint>(1, COutPoint(GetRandHash(), 0)), 2, 10 * COIN);
+    CMutableTransaction txChild1 = MakeTx(std::vector<COutPoint>(1, COutPoint(txParent.GetHash(), 0)), 1, 5 * COIN);
+    CMutableTransaction txChild2 = MakeTx(std::vector<COutPoint>(1, COutPoint(txParent.GetHash(), 1)), 1, 5 * COIN);
+    std::vector<COutPoint> vPrevouts;
+    vPrevouts.push_back(COutPoint(txChild1.GetHash(), 0));
+    vPrevouts.push_back(COutPoint(txChild2.GetHash(), 0));
+    CMutableTransaction txGrandChild = MakeTx(vPrevouts, 1, 1 * COIN);
+
+    CTxMemPool pool(CFeeRate(0));
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000, 0, 0.0, 1));
+    pool.addUnchecked(txChild1.GetHash(), CTxMemPoolEntry(txChild1, 2000, 0, 0.0, 1));
+    pool.addUnchecked(txChild2.GetHash(), CTxMemPoolEntry(txChild2, 3000, 0, 0.0, 1));
+    pool.addUnchecked(txGrandChild.GetHash(), CTxMemPoolEntry(txGrandChild, 4000, 0, 0.0, 1));
+
+    const uint64_t nSizeParent = Entry(pool, txParent).GetTxSize();
+    const uint64_t nSizeChild1 = Entry(pool, txChild1).GetTxSize();
+    const uint64_t nSizeChild2 = Entry(pool, txChild2).GetTxSize();
+    const uint64_t nSizeGrandChild = Entry(pool, txGrandChild).GetTxSize();
+    const uint64_t nSizeAll = nSizeParent + nSizeChild1 + nSizeChild2 + nSizeGrandChild;
+
+    // The parent counts once in the grandchild's ancestors, though reached twice
+    BOOST_CHECK_EQUAL(Entry(pool, txParent).GetCountWithDescendants(), 4);
+    BOOST_CHECK_EQUAL(Entry(pool, txParent).GetSizeWithDescendants(), nSizeAll);
+    BOOST_CHECK_EQUAL(Entry(pool, txParent).GetModFeesWithDescendants(), 10000);
+    BOOST_CHECK_EQUAL(Entry(pool, txParent).GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(Entry(pool, txChild1).GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(Entry(pool, txChild1).GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(Entry(pool, txChild1).GetModFeesWithAncestors(), 3000);
+    BOOST_CHECK_EQUAL(Entry(pool, txGrandChild).GetCountWithAncestors(), 4);
+    BOOST_CHECK_EQUAL(Entry(pool, txGrandChild).GetSizeWithAncestors(), nSizeAll);
+    BOOST_CHECK_EQUAL(Entry(pool, txGrandChild).GetModFeesWithAncestors(), 10000);
+
+    // Prioritising a child moves the packages it is in
+    pool.PrioritiseTransaction(txChild2.GetHash(), txChild2.GetHash().ToString(), 0.0, 5000);
+    BOOST_CHECK_EQUAL(Entry(pool, txChild2).GetModifiedFee(), 8000);
+    BOOST_CHECK_EQUAL(Entry(pool, txParent).GetModFeesWithDescendants(), 15000);
+    BOOST_CHECK_EQUAL(Entry(pool, txGrandChild).GetModFeesWithAncestors(), 15000);
+    BOOST_CHECK_EQUAL(Entry(pool, txChild1).GetModFeesWithAncestors(), 3000);
+
+    // The ancestor limits count the entry itself
+    CMutableTransaction txGreatGrandChild = MakeTx(std::vector<COutPoint>(1, COutPoint(txGrandChild.GetHash(), 0)), 1, COIN / 2);
+    CTxMemPool::setEntries setAncestors;
+    std::string errString;
+    CTxMemPoolEntry entry(txGreatGrandChild, 1000, 0, 0.0, 1);
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(entry, setAncestors, 5, 1000000, 5, 1000000, errString));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 4);
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entry, setAncestors, 4, 1000000, 5, 1000000, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entry, setAncestors, 5, 1000000, 4, 1000000, errString));
+
+    // Mining the parent leaves the children as roots, with their own state
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(std::vector<CTransaction>(1, txParent), 2, conflicts);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    BOOST_CHECK_EQUAL(Entry(pool, txChild1).GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(Entry(pool, txChild1).GetSizeWithAncestors(), nSizeChild1);
+    BOOST_CHECK_EQUAL(Entry(pool, txGrandChild).GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(Entry(pool, txGrandChild).GetModFeesWithAncestors(), 14000);
+    BOOST_CHECK_EQUAL(Entry(pool, txChild2).GetCountWithDescendants(), 2);
+
+    // Removing a child without its descendants updates the grandchild
+    pool.remove(txChild1, conflicts, false);
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+    BOOST_CHECK_EQUAL(Entry(pool, txGrandChild).GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(Entry(pool, txGrandChild).GetSizeWithAncestors(), nSizeChild2 + nSizeGrandChild);
+
+    // A parent coming back in a reorg links up with the children already in the pool
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000, 0, 0.0, 1));
+    BOOST_CHECK_EQUAL(Entry(pool, txParent).GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(Entry(pool, txGrandChild).GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(Entry(pool, txChild2).GetModFeesWithAncestors(), 9000);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    // Three independent transactions of the same size and different fees,
+    // and a low fee parent with a high fee child
+    std::vector<CMutableTransaction> vtx;
+    const CAmount nFees[] = {1000, 5000, 3000, 100};
+    for (int i = 0; i < 4; i++) {
+        vtx.push_back(MakeTx(std::vector<COutPoint>(1, COutPoint(GetRandHash(), 0)), 1, COIN));
+        pool.addUnchecked(vtx[i].GetHash(), CTxMemPoolEntry(vtx[i], nFees[i], 10 - i, 0.0, 1));
+    }
+    CMutableTransaction txChild = MakeTx(std::vector<COutPoint>(1, COutPoint(vtx[3].GetHash(), 0)), 1, COIN / 2);
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 20000, 1, 0.0, 1));
+
+    // Eviction order: lowest descendant score first. The parent is rated with its child.
+    std::vector<uint256> vOrder;
+    for (const CTxMemPoolEntry& e : pool.mapTx.get<descendant_score>())
+        vOrder.push_back(e.GetTx().GetHash());
+    BOOST_CHECK(vOrder[0] == vtx[0].GetHash());
+    BOOST_CHECK(vOrder[1] == vtx[2].GetHash());
+    BOOST_CHECK(vOrder[2] == vtx[1].GetHash());
+
+    // Mining order: highest ancestor score first. The child is rated with its parent.
+    vOrder.clear();
+    for (const CTxMemPoolEntry& e : pool.mapTx.get<ancestor_score>())
+        vOrder.push_back(e.GetTx().GetHash());
+    BOOST_CHECK(vOrder[0] == txChild.GetHash());
+    BOOST_CHECK(vOrder[1] == vtx[1].GetHash());
+    BOOST_CHECK(vOrder[2] == vtx[2].GetHash());
+    BOOST_CHECK(vOrder[3] == vtx[0].GetHash());
+    BOOST_CHECK(vOrder[4] == vtx[3].GetHash());
+
+    // Expiry goes by entry time, and takes the descendants along
+    BOOST_CHECK_EQUAL(pool.Expire(8), 2);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    BOOST_CHECK(!pool.exists(vtx[3].GetHash()));
+    BOOST_CHECK(!pool.exists(txChild.GetHash()));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+
+    // Ten transactions of rising fee, the first with a child that pays
+    // more than its parent but not enough to lift it above the second
+    std::vector<CMutableTransaction> vtx;
+    for (int i = 0; i < 10; i++) {
+        vtx.push_back(MakeTx(std::vector<COutPoint>(1, COutPoint(GetRandHash(), 0)), 1, COIN));
+        pool.addUnchecked(vtx[i].GetHash(), CTxMemPoolEntry(vtx[i], 1000 * (i + 1), 0, 0.0, 1));
+    }
+    CMutableTransaction txChild = MakeTx(std::vector<COutPoint>(1, COutPoint(vtx[0].GetHash(), 0)), 1, COIN / 2);
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 1500, 0, 0.0, 1));
+    BOOST_CHECK_EQUAL(pool.GetMinFee(pool.DynamicMemoryUsage()).GetFeePerK(), 0);
+
+    // Within the limit nothing goes
+    size_t nUsage = pool.DynamicMemoryUsage();
+    pool.TrimToSize(nUsage);
+    BOOST_CHECK_EQUAL(pool.size(), 11);
+
+    // The cheapest package goes first, the parent with its child
+    pool.TrimToSize(nUsage - 1);
+    BOOST_CHECK(!pool.exists(vtx[0].GetHash()));
+    BOOST_CHECK(!pool.exists(txChild.GetHash()));
+    BOOST_CHECK_EQUAL(pool.size(), 9);
+    BOOST_CHECK(pool.DynamicMemoryUsage() < nUsage);
+
+    // The minimum fee rises above the fee rate of what was evicted
+    const CTxMemPoolEntry& entry = Entry(pool, vtx[1]);
+    CFeeRate evicted(1000 + 1500, entry.GetTxSize() + ::GetSerializeSize(txChild, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK(pool.GetMinFee(nUsage).GetFeePerK() > evicted.GetFeePerK());
+
+    // Down to the two best
+    pool.TrimToSize(pool.DynamicMemoryUsage() * 2 / 9);
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+    BOOST_CHECK(pool.exists(vtx[8].GetHash()));
+    BOOST_CHECK(pool.exists(vtx[9].GetHash()));
+
+    pool.clear();
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolZerocoinSpendTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+
+    // A zerocoin spend pays no fee, next to two that do
+    CMutableTransaction txSpend = MakeTx(std::vector<COutPoint>(1, COutPoint()), 1, COIN);
+    txSpend.vin[0].scriptSig = CScript() << OP_ZEROCOINSPEND;
+    pool.addUnchecked(txSpend.GetHash(), CTxMemPoolEntry(txSpend, 0, 0, 0.0, 1));
+    mapZerocoinspends[txSpend.GetHash()] = 0;
+    std::vector<CMutableTransaction> vtx;
+    for (int i = 0; i < 2; i++) {
+        vtx.push_back(MakeTx(std::vector<COutPoint>(1, COutPoint(GetRandHash(), 0)), 1, COIN));
+        pool.addUnchecked(vtx[i].GetHash(), CTxMemPoolEntry(vtx[i], 10000, 0, 0.0, 1));
+    }
+
+    // Eviction by fee rate passes it by
+    pool.TrimToSize(0);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    BOOST_CHECK(pool.exists(txSpend.GetHash()));
+
+    // Leaving the pool any other way stops it being tracked
+    std::list<CTransaction> removed;
+    pool.remove(txSpend, removed, true);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK(!mapZerocoinspends.count(txSpend.GetHash()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,77 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "muhash.h"
+#include "random.h"
+#include "test/test_simplicity.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(muhash_tests, BasicTestingSetup)
+
+namespace {
+void Insert(CMuHash3072& muhash, const std::string& str)
+{
+    muhash.Insert((const unsigned char*)str.data(), str.size());
+}
+
+void Remove(CMuHash3072& muhash, const std::string& str)
+{
+    muhash.Remove((const unsigned char*)str.data(), str.size());
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(muhash_set)
+{
+    seed_insecure_rand(true);
+    std::vector<std::string> vElements;
+    for (int i = 0; i < 20; i++)
+        vElements.push_back(GetRandHash().GetHex().substr(0, 1 + insecure_rand() % 64));
+
+    CMuHash3072 muhashAll;
+    for (const std::string& str : vElements)
+        Insert(muhashAll, str);
+    const uint256 hashAll = muhashAll.Finalize();
+    BOOST_CHECK(hashAll != CMuHash3072().Finalize());
+
+    // Any order gives the same hash
+    std::vector<std::string> vShuffled(vElements);
+    std::reverse(vShuffled.begin(), vShuffled.end());
+    std::swap(vShuffled[3], vShuffled[11]);
+    CMuHash3072 muhashShuffled;
+    for (const std::string& str : vShuffled)
+        Insert(muhashShuffled, str);
+    BOOST_CHECK(muhashShuffled.Finalize() == hashAll);
+
+    // Parts hashed apart combine into the whole
+    CMuHash3072 muhashFirst, muhashSecond;
+    for (size_t i = 0; i < vElements.size(); i++)
+        Insert(i % 3 ? muhashFirst : muhashSecond, vElements[i]);
+    muhashFirst *= muhashSecond;
+    BOOST_CHECK(muhashFirst.Finalize() == hashAll);
+
+    // Removing elements gives the hash of the rest, and of the empty set in the end
+    CMuHash3072 muhashRest;
+    for (size_t i = 5; i < vElements.size(); i++)
+        Insert(muhashRest, vElements[i]);
+    CMuHash3072 muhashRemoved(muhashAll);
+    for (size_t i = 0; i < 5; i++)
+        Remove(muhashRemoved, vElements[i]);
+    BOOST_CHECK(muhashRemoved.Finalize() == muhashRest.Finalize());
+    for (size_t i = 5; i < vElements.size(); i++)
+        Remove(muhashRemoved, vElements[i]);
+    BOOST_CHECK(muhashRemoved.Finalize() == CMuHash3072().Finalize());
+
+    // A changed element changes the hash
+    CMuHash3072 muhashChanged(muhashRest);
+    Insert(muhashChanged, vElements[0] + "x");
+    Insert(muhashRest, vElements[0]);
+    BOOST_CHECK(muhashChanged.Finalize() != muhashRest.Finalize());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
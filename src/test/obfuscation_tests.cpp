@@ -0,0 +1,87 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "key.h"
+#include "obfuscation.h"
+#include "random.h"
+#include "test/test_simplicity.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(obfuscation_tests, BasicTestingSetup)
+
+namespace {
+CMessageSignatureStats GetStats(MessageSignatureType type)
+{
+    std::vector<CMessageSignatureStats> vStats;
+    GetMessageSignatureStats(vStats);
+    return vStats[type];
+}
+
+CMessageSignatureCheck SignedCheck(const CKey& key, const std::string& strMessage, MessageSignatureType type)
+{
+    CMessageSignatureCheck check;
+    std::string errorMessage;
+    BOOST_CHECK(obfuScationSigner.SignMessage(strMessage, errorMessage, check.vchSig, key));
+    check.pubkey = key.GetPubKey();
+    check.vMessages.push_back(strMessage);
+    check.type = type;
+    return check;
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(obfuscation_signature_cache)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CMessageSignatureCheck check = SignedCheck(key, "signature cache " + GetRandHash().ToString(), SIG_PAYMENT_WINNER);
+    std::string errorMessage;
+
+    const CMessageSignatureStats before = GetStats(SIG_PAYMENT_WINNER);
+    BOOST_CHECK(obfuScationSigner.VerifyMessage(check.pubkey, check.vchSig, check.vMessages[0], errorMessage, SIG_PAYMENT_WINNER));
+    BOOST_CHECK(obfuScationSigner.VerifyMessage(check.pubkey, check.vchSig, check.vMessages[0], errorMessage, SIG_PAYMENT_WINNER));
+    CMessageSignatureStats after = GetStats(SIG_PAYMENT_WINNER);
+    BOOST_CHECK_EQUAL(after.nVerified - before.nVerified, 1U);
+    BOOST_CHECK_EQUAL(after.nCached - before.nCached, 1U);
+
+    // Neither another message nor another key is taken from the cache
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    BOOST_CHECK(!obfuScationSigner.VerifyMessage(check.pubkey, check.vchSig, check.vMessages[0] + "x", errorMessage, SIG_PAYMENT_WINNER));
+    BOOST_CHECK(!obfuScationSigner.VerifyMessage(keyOther.GetPubKey(), check.vchSig, check.vMessages[0], errorMessage, SIG_PAYMENT_WINNER));
+    after = GetStats(SIG_PAYMENT_WINNER);
+    BOOST_CHECK_EQUAL(after.nVerified - before.nVerified, 3U);
+    BOOST_CHECK_EQUAL(after.nFailed - before.nFailed, 2U);
+    BOOST_CHECK_EQUAL(after.nCached - before.nCached, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(obfuscation_signature_batch)
+{
+    // A batch checked ahead leaves the handlers nothing but cache hits, an
+    // invalid signature is left for its handler
+    CKey key;
+    key.MakeNewKey(true);
+    std::vector<CMessageSignatureCheck> vChecks;
+    for (int i = 0; i < 200; i++)
+        vChecks.push_back(SignedCheck(key, "signature batch " + GetRandHash().ToString(), SIG_BUDGET_VOTE));
+    const std::vector<CMessageSignatureCheck> vSigned = vChecks;
+    vChecks.back().vMessages[0] += "x";
+    // a broadcast is valid for one of two messages
+    vChecks[0].vMessages.insert(vChecks[0].vMessages.begin(), "old format");
+
+    const CMessageSignatureStats before = GetStats(SIG_BUDGET_VOTE);
+    VerifyMessageSignatures(vChecks);
+    CMessageSignatureStats after = GetStats(SIG_BUDGET_VOTE);
+    BOOST_CHECK_EQUAL(after.nVerified - before.nVerified, vSigned.size() + 1);
+    BOOST_CHECK_EQUAL(after.nFailed - before.nFailed, 2U);
+
+    std::string errorMessage;
+    for (CMessageSignatureCheck check : vSigned)
+        BOOST_CHECK(obfuScationSigner.VerifyMessage(check.pubkey, check.vchSig, check.vMessages[0], errorMessage, SIG_BUDGET_VOTE));
+    after = GetStats(SIG_BUDGET_VOTE);
+    BOOST_CHECK_EQUAL(after.nCached - before.nCached, vSigned.size() - 1);
+    BOOST_CHECK_EQUAL(after.nVerified - before.nVerified, vSigned.size() + 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -106,4 +106,36 @@ BOOST_AUTO_TEST_CASE(pmt_test1)
     }
 }
 
+BOOST_AUTO_TEST_CASE(merkle_checked)
+{
+    CBlock block;
+    for (unsigned int j = 0; j < 7; j++) {
+        CMutableTransaction tx;
+        tx.nLockTime = j;
+        block.vtx.push_back(CTransaction(tx));
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    BOOST_CHECK(!block.IsMerkleChecked());
+    block.fMerkleChecked = true;
+    BOOST_CHECK(block.IsMerkleChecked());
+
+    // A copy whose transactions or root change no longer counts as checked
+    CBlock blockTx = block;
+    BOOST_CHECK(blockTx.IsMerkleChecked());
+    CMutableTransaction tx;
+    tx.nLockTime = 100;
+    blockTx.vtx[3] = CTransaction(tx);
+    BOOST_CHECK(!blockTx.IsMerkleChecked());
+    blockTx = block;
+    blockTx.vtx.push_back(CTransaction(tx));
+    BOOST_CHECK(!blockTx.IsMerkleChecked());
+    blockTx = block;
+    blockTx.hashMerkleRoot = uint256(1);
+    BOOST_CHECK(!blockTx.IsMerkleChecked());
+
+    // and neither does a tree built again
+    block.BuildMerkleTree();
+    BOOST_CHECK(!block.IsMerkleChecked());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
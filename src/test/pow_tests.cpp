@@ -0,0 +1,35 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "pow.h"
+#include "primitives/block.h"
+#include "test/test_simplicity.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pow_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pow_batch_unknown_algo)
+{
+    // Algorithm bits that name no algorithm, in a version past the upgrade
+    CBlockHeader header;
+    header.nVersion = (int)(ALGO_VERSION | CBlockHeader::CURRENT_VERSION);
+    header.nBits = Params().ProofOfWorkLimit(POW_QUARK).GetCompact();
+    BOOST_REQUIRE(header.IsProofOfWork());
+    BOOST_REQUIRE_EQUAL(CBlockHeader::GetAlgo(header.nVersion), -1);
+
+    std::vector<const CBlockHeader*> vHeaders(1, &header);
+    std::vector<bool> vChecked;
+    std::vector<uint256> vHashPoW;
+    CheckProofOfWorkBatch(vHeaders, vChecked, &vHashPoW);
+    BOOST_REQUIRE_EQUAL(vChecked.size(), 1U);
+    BOOST_CHECK(!vChecked[0]);
+    BOOST_CHECK(vHashPoW[0] == 0);
+
+    uint256 hashPoW;
+    BOOST_CHECK(!CheckProofOfWork(&header, hashPoW));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,114 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "pubkey.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "test/test_simplicity.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sigcache_tests, BasicTestingSetup)
+
+namespace {
+/** What a signature check is cached by */
+struct CSigData {
+    uint256 sighash;
+    std::vector<unsigned char> vchSig;
+    CPubKey pubkey;
+};
+
+CSigData GetRandSigData()
+{
+    CSigData data;
+    data.sighash = GetRandHash();
+    data.vchSig.resize(72);
+    GetRandBytes(data.vchSig.data(), data.vchSig.size());
+    unsigned char vchPubKey[33];
+    GetRandBytes(vchPubKey, sizeof(vchPubKey));
+    vchPubKey[0] = 2;
+    data.pubkey.Set(vchPubKey, vchPubKey + sizeof(vchPubKey));
+    return data;
+}
+} // anon namespace
+
+BOOST_AUTO_TEST_CASE(sigcache_contains)
+{
+    CSignatureCache cache(1 << 20);
+    BOOST_CHECK_EQUAL(cache.Slots(), (1 << 20) / 32);
+
+    // Entries depend on every part of the signature
+    CSigData data = GetRandSigData();
+    uint256 entry = cache.ComputeEntry(data.sighash, data.vchSig, data.pubkey);
+    BOOST_CHECK(entry == cache.ComputeEntry(data.sighash, data.vchSig, data.pubkey));
+    BOOST_CHECK(entry != cache.ComputeEntry(GetRandHash(), data.vchSig, data.pubkey));
+    std::vector<unsigned char> vchSigOther(data.vchSig);
+    vchSigOther.back() ^= 1;
+    BOOST_CHECK(entry != cache.ComputeEntry(data.sighash, vchSigOther, data.pubkey));
+    BOOST_CHECK(entry != cache.ComputeEntry(data.sighash, data.vchSig, GetRandSigData().pubkey));
+    // and on the salt of the cache
+    BOOST_CHECK(entry != CSignatureCache(1 << 20).ComputeEntry(data.sighash, data.vchSig, data.pubkey));
+
+    // Up to half full nothing is dropped
+    std::vector<uint256> vEntries;
+    for (size_t i = 0; i < cache.Slots() / 2; i++) {
+        vEntries.push_back(GetRandHash());
+        cache.Insert(vEntries.back());
+    }
+    for (const uint256& hash : vEntries)
+        BOOST_CHECK(cache.Contains(hash));
+    for (int i = 0; i < 1000; i++)
+        BOOST_CHECK(!cache.Contains(GetRandHash()));
+
+    // Past full, new entries go in and some old ones are dropped
+    for (size_t i = 0; i < cache.Slots(); i++) {
+        vEntries.push_back(GetRandHash());
+        cache.Insert(vEntries.back());
+    }
+    size_t nFound = 0;
+    for (const uint256& hash : vEntries)
+        nFound += cache.Contains(hash);
+    BOOST_CHECK(nFound <= cache.Slots());
+    BOOST_CHECK(nFound > cache.Slots() * 9 / 10);
+    BOOST_CHECK(cache.Contains(vEntries.back()));
+
+    // A zero-sized cache holds nothing
+    CSignatureCache cacheNone(0);
+    cacheNone.Insert(entry);
+    BOOST_CHECK(!cacheNone.Contains(entry));
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_concurrent)
+{
+    // Readers never miss an entry while writers move others around it
+    CSignatureCache cache(1 << 20);
+    std::vector<uint256> vStable;
+    for (size_t i = 0; i < cache.Slots() / 4; i++) {
+        vStable.push_back(GetRandHash());
+        cache.Insert(vStable.back());
+    }
+
+    std::atomic<int> nMissing(0);
+    boost::thread_group threads;
+    for (int i = 0; i < 2; i++) {
+        threads.create_thread([&cache]() {
+            // The cache ends up half full, so no stable entry is dropped
+            for (size_t n = 0; n < cache.Slots() / 8; n++)
+                cache.Insert(GetRandHash());
+        });
+    }
+    for (int i = 0; i < 2; i++) {
+        threads.create_thread([&cache, &vStable, &nMissing]() {
+            for (int nRound = 0; nRound < 20; nRound++)
+                for (const uint256& hash : vStable)
+                    if (!cache.Contains(hash))
+                        nMissing++;
+        });
+    }
+    threads.join_all();
+    BOOST_CHECK_EQUAL(nMissing, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,70 +7,496 @@
 
 #include "txdb.h"
 
+#include "crypto/common.h"
+#include "guiinterface.h"
+#include "init.h"
 #include "main.h"
 #include "pow.h"
 #include "uint256.h"
+#include "utiltime.h"
 #include "zspl/accumulators.h"
 
+#include <atomic>
 #include <stdint.h>
+#include <string.h>
 
 #include <boost/thread.hpp>
 
 
-void static BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCoins& coins)
+namespace {
+/** An unspent output as the coin database stores it, with the metadata of its transaction */
+class CDiskTxOut
 {
-    if (coins.IsPruned())
-        batch.Erase(std::make_pair('c', hash));
-    else
-        batch.Write(std::make_pair('c', hash), coins);
+public:
+    int nHeight;
+    bool fCoinBase;
+    bool fCoinStake;
+    int nTxVersion;
+    CTxOut txout;
+
+    CDiskTxOut() : nHeight(0), fCoinBase(false), fCoinStake(false), nTxVersion(0) {}
+    CDiskTxOut(const CCoins& coins, unsigned int n) : nHeight(coins.nHeight), fCoinBase(coins.fCoinBase), fCoinStake(coins.fCoinStake), nTxVersion(coins.nVersion), txout(coins.vout[n]) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        // height and coinbase/coinstake flags in one varint, as CCoins has them
+        unsigned int nCode = nHeight * 4 + (fCoinBase ? 1 : 0) + (fCoinStake ? 2 : 0);
+        READWRITE(VARINT(nCode));
+        if (ser_action.ForRead()) {
+            nHeight = nCode / 4;
+            fCoinBase = nCode & 1;
+            fCoinStake = (nCode & 2) != 0;
+        }
+        READWRITE(VARINT(nTxVersion));
+        CTxOutCompressor txoutc(REF(txout));
+        READWRITE(txoutc);
+    }
+};
+
+//! 'C' + txid + output index
+static const size_t COIN_KEY_SIZE = 1 + 32 + 4;
+
+/**
+ * Call fn(n, slKey, slValue, out) for each record of txid, starting at the
+ * cursor, which is positioned on the first record of txid or past it.
+ */
+template <typename Fn>
+void ForEachCoinRecord(leveldb::Iterator* pcursor, const uint256& txid, Fn fn)
+{
+    for (; pcursor->Valid(); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        if (slKey.size() != COIN_KEY_SIZE || slKey[0] != 'C' || memcmp(slKey.data() + 1, txid.begin(), 32) != 0)
+            break;
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        CDiskTxOut out;
+        ssValue >> out;
+        fn(ReadLE32((const unsigned char*)slKey.data() + 33), slKey, slValue, out);
+    }
+    HandleError(pcursor->status());
+}
+
+//! Gather the outputs of txid into coins, returns whether there were any
+bool ReadCoinRecords(leveldb::Iterator* pcursor, const uint256& txid, CCoins& coins)
+{
+    coins = CCoins();
+    ForEachCoinRecord(pcursor, txid, [&coins](uint32_t n, const leveldb::Slice& slKey, const leveldb::Slice& slValue, const CDiskTxOut& out) {
+        if (coins.vout.size() <= n)
+            coins.vout.resize(n + 1);
+        coins.vout[n] = out.txout;
+        coins.nHeight = out.nHeight;
+        coins.fCoinBase = out.fCoinBase;
+        coins.fCoinStake = out.fCoinStake;
+        coins.nVersion = out.nTxVersion;
+    });
+    return !coins.vout.empty();
+}
+
+//! The record of output n of txid as the database stores it, the key followed by the value
+std::string CoinRecord(const uint256& txid, uint32_t n, const CDiskTxOut& out)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << std::make_pair('C', COutPoint(txid, n)) << out;
+    return ss.str();
+}
+
+//! UTXO set statistics are summed over this many ranges of the first byte of the txid
+static const int STATS_RANGES = 64;
+
+bool SumCoinRecords(const CLevelDBWrapper& db, const leveldb::Snapshot* snapshot, int nRange, CCoinsStatsSum& sum)
+{
+    const unsigned int nFirst = nRange * 256 / STATS_RANGES;
+    const unsigned int nEnd = (nRange + 1) * 256 / STATS_RANGES;
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator(snapshot));
+    std::string strStart(1, 'C');
+    strStart.push_back((char)nFirst);
+    pcursor->Seek(strStart);
+
+    std::string strTxidLast;
+    for (uint64_t nRecords = 0; pcursor->Valid(); pcursor->Next(), nRecords++) {
+        leveldb::Slice slKey = pcursor->key();
+        if (slKey.size() != COIN_KEY_SIZE || slKey[0] != 'C' || (unsigned char)slKey[1] >= nEnd)
+            break;
+        // the records of a transaction are adjacent
+        if (strTxidLast.compare(0, std::string::npos, slKey.data() + 1, 32) != 0) {
+            strTxidLast.assign(slKey.data() + 1, 32);
+            sum.nTransactions++;
+        }
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        CDiskTxOut out;
+        ssValue >> out;
+        sum.AddOutput(slKey.ToString() + slValue.ToString(), out.txout.nValue);
+        if (nRecords % 4096 == 0 && ShutdownRequested())
+            return false;
+    }
+    HandleError(pcursor->status());
+    return true;
+}
+
+leveldb::Iterator* SeekCoins(const CLevelDBWrapper& db, const uint256& txid)
+{
+    leveldb::Iterator* pcursor = db.NewLookupIterator();
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << std::make_pair('C', txid);
+    pcursor->Seek(ssKey.str());
+    return pcursor;
 }
+} // anon namespace
 
-void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
+void CCoinsStatsSum::AddOutput(const std::string& strRecord, CAmount nValue)
 {
-    batch.Write('B', hash);
+    nTransactionOutputs++;
+    nSerializedSize += strRecord.size();
+    nTotalAmount += nValue;
+    muhash.Insert((const unsigned char*)strRecord.data(), strRecord.size());
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+void CCoinsStatsSum::RemoveOutput(const std::string& strRecord, CAmount nValue)
 {
+    nTransactionOutputs--;
+    nSerializedSize -= strRecord.size();
+    nTotalAmount -= nValue;
+    muhash.Remove((const unsigned char*)strRecord.data(), strRecord.size());
+}
+
+CCoinsStatsSum& CCoinsStatsSum::operator+=(const CCoinsStatsSum& other)
+{
+    nTransactions += other.nTransactions;
+    nTransactionOutputs += other.nTransactionOutputs;
+    nSerializedSize += other.nSerializedSize;
+    nTotalAmount += other.nTotalAmount;
+    muhash *= other.muhash;
+    return *this;
+}
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe), fFlushing(false), fFlushFailed(false), fStop(false), fStatsValid(false), fStatsPending(false)
+{
+    threadFlush = boost::thread(&CCoinsViewDB::ThreadFlush, this);
+}
+
+CCoinsViewDB::~CCoinsViewDB()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+        condFlush.notify_all();
+    }
+    // the batch in flight is still written
+    threadFlush.join();
 }
 
 bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
 {
-    return db.Read(std::make_pair('c', txid), coins);
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CCoinsMap::const_iterator it = mapFlushing.find(txid);
+        if (it != mapFlushing.end()) {
+            coins = it->second.coins;
+            return true;
+        }
+    }
+    try {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(SeekCoins(db, txid));
+        return ReadCoinRecords(pcursor.get(), txid, coins);
+    } catch (const std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256& txid) const
 {
-    return db.Exists(std::make_pair('c', txid));
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CCoinsMap::const_iterator it = mapFlushing.find(txid);
+        if (it != mapFlushing.end())
+            return !it->second.coins.IsPruned();
+    }
+    boost::scoped_ptr<leveldb::Iterator> pcursor(SeekCoins(db, txid));
+    if (!pcursor->Valid()) {
+        HandleError(pcursor->status());
+        return false;
+    }
+    leveldb::Slice slKey = pcursor->key();
+    return slKey.size() == COIN_KEY_SIZE && slKey[0] == 'C' && memcmp(slKey.data() + 1, txid.begin(), 32) == 0;
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const
 {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fFlushing && hashFlushing != uint256(0))
+            return hashFlushing;
+    }
     uint256 hashBestChain;
-    if (!db.Read('B', hashBestChain))
+    if (!db.Read('H', hashBestChain))
         return uint256(0);
     return hashBestChain;
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
 {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (fFlushing)
+        condFlush.wait(lock);
+    if (fFlushFailed)
+        return false;
+    // The writer takes the whole map, and the caller is left with the empty one
+    mapFlushing.swap(mapCoins);
+    hashFlushing = hashBlock;
+    fFlushing = true;
+    condFlush.notify_all();
+    return true;
+}
+
+bool CCoinsViewDB::WaitForFlush() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (fFlushing)
+        condFlush.wait(lock);
+    return !fFlushFailed;
+}
+
+bool CCoinsViewDB::Sync()
+{
+    return WaitForFlush();
+}
+
+void CCoinsViewDB::ThreadFlush()
+{
+    RenameThread("simplicity-coinsdb");
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        while (!fFlushing && !fStop)
+            condFlush.wait(lock);
+        if (!fFlushing)
+            return;
+
+        // Readers only look into mapFlushing while it is being written
+        const bool fTrackStats = fStatsValid || fStatsPending;
+        lock.unlock();
+        bool fOk;
+        CCoinsStatsSum sumDelta;
+        try {
+            fOk = WriteCoins(mapFlushing, hashFlushing, fTrackStats ? &sumDelta : NULL);
+        } catch (const std::exception& e) {
+            LogPrintf("%s : %s\n", __func__, e.what());
+            fOk = false;
+        }
+        CCoinsMap mapDone;
+        lock.lock();
+        if (!fOk) {
+            LogPrintf("%s : failed to write the coin database, no further changes will be accepted\n", __func__);
+            fFlushFailed = true;
+            fStatsValid = false;
+        } else if (fStatsValid) {
+            sumStats += sumDelta;
+            if (hashFlushing != uint256(0))
+                hashStats = hashFlushing;
+        } else if (fStatsPending) {
+            sumStatsPending += sumDelta;
+        }
+        mapDone.swap(mapFlushing);
+        fFlushing = false;
+        condFlush.notify_all();
+
+        // Free the written entries without holding up the readers
+        lock.unlock();
+        mapDone.clear();
+        lock.lock();
+    }
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap& mapCoins, const uint256& hashBlock, CCoinsStatsSum* psumDelta)
+{
+    int64_t nTimeStart = GetTimeMicros();
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
-        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
-            changed++;
-        }
+    size_t nWritten = 0;
+    size_t nErased = 0;
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        const CCoinsCacheEntry& entry = it->second;
+        if (!(entry.flags & CCoinsCacheEntry::DIRTY))
+            continue;
+        changed++;
+        if (psumDelta) {
+            // Compare with the records there are, those not in the new version go.
+            // The cache kept the version the records were written from.
+            std::map<uint32_t, std::pair<std::string, CAmount> > mapOld;
+            const CCoins& coinsBefore = entry.coinsBefore;
+            if (!(entry.flags & CCoinsCacheEntry::FRESH) && !coinsBefore.vout.empty()) {
+                for (unsigned int i = 0; i < coinsBefore.vout.size(); i++) {
+                    if (!coinsBefore.vout[i].IsNull())
+                        mapOld[i] = std::make_pair(CoinRecord(it->first, i, CDiskTxOut(coinsBefore, i)), coinsBefore.vout[i].nValue);
+                }
+            } else if (!(entry.flags & CCoinsCacheEntry::FRESH)) {
+                // written without the version it changed: read the records
+                boost::scoped_ptr<leveldb::Iterator> pcursor(SeekCoins(db, it->first));
+                ForEachCoinRecord(pcursor.get(), it->first, [&mapOld](uint32_t n, const leveldb::Slice& slKey, const leveldb::Slice& slValue, const CDiskTxOut& out) {
+                    mapOld[n] = std::make_pair(slKey.ToString() + slValue.ToString(), out.txout.nValue);
+                });
+            }
+            psumDelta->nTransactions += (entry.coins.IsPruned() ? 0 : 1) - (mapOld.empty() ? 0 : 1);
+            for (unsigned int i = 0; i < entry.coins.vout.size(); i++) {
+                if (entry.coins.vout[i].IsNull())
+                    continue;
+                std::string strRecord = CoinRecord(it->first, i, CDiskTxOut(entry.coins, i));
+                std::map<uint32_t, std::pair<std::string, CAmount> >::iterator itOld = mapOld.find(i);
+                if (itOld != mapOld.end() && itOld->second.first == strRecord)
+                    mapOld.erase(itOld);
+                else
+                    psumDelta->AddOutput(strRecord, entry.coins.vout[i].nValue);
+            }
+            for (const auto& old : mapOld)
+                psumDelta->RemoveOutput(old.second.first, old.second.second);
+        }
+        // A fresh entry has no records yet; otherwise the spent outputs go,
+        // and the unspent ones are only rewritten when some were added
+        if (!(entry.flags & CCoinsCacheEntry::FRESH)) {
+            for (uint32_t n : entry.vSpent) {
+                batch.Erase(std::make_pair('C', COutPoint(it->first, n)));
+                nErased++;
+            }
+            if (!(entry.flags & CCoinsCacheEntry::ADDED))
+                continue;
+        }
+        for (unsigned int i = 0; i < entry.coins.vout.size(); i++) {
+            if (!entry.coins.vout[i].IsNull()) {
+                batch.Write(std::make_pair('C', COutPoint(it->first, i)), CDiskTxOut(entry.coins, i));
+                nWritten++;
+            }
+        }
     }
     if (hashBlock != uint256(0))
-        BatchWriteHashBestChain(batch, hashBlock);
+        batch.Write('H', hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+    bool fOk = db.WriteBatch(batch);
+    LogPrint("coindb", "Committed %u changed transactions (out of %u) to coin database: %u outputs written, %u erased in %.2fms\n",
+        (unsigned int)changed, (unsigned int)count, (unsigned int)nWritten, (unsigned int)nErased, 0.001 * (GetTimeMicros() - nTimeStart));
+    return fOk;
+}
+
+bool CCoinsViewDB::Upgrade(std::string& strError)
+{
+    int nVersion = 0;
+    bool fVersion = db.Read('V', nVersion);
+    if (fVersion && nVersion > COINS_DB_VERSION) {
+        strError = _("The coin database is from a newer version. Restart with -reindex to rebuild it");
+        return error("%s : unknown coin database version %d", __func__, nVersion);
+    }
+
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << std::make_pair('c', uint256(0));
+    pcursor->Seek(ssKeySet.str());
+    bool fLegacyRecords = pcursor->Valid() && pcursor->key()[0] == 'c';
+    bool fLegacyBest = db.Exists('B');
+    bool fBest = db.Exists('H');
+
+    // Older versions neither check the version nor know 'H'. Once they wrote to a
+    // converted database, or to one being converted, its outputs are in both layouts.
+    if ((fVersion && (fLegacyRecords || fLegacyBest)) || (fLegacyBest && fBest)) {
+        strError = _("The coin database was changed by an older version. Restart with -reindex to rebuild it");
+        return error("%s : coin database version %d holds per-transaction records", __func__, nVersion);
+    }
+    if (fVersion)
+        return true;
+    if (!fLegacyRecords && !fLegacyBest && !fBest) {
+        // a new database
+        if (!db.Write('V', COINS_DB_VERSION)) {
+            strError = _("Error upgrading coin database");
+            return error("%s : failed to write the coin database version", __func__);
+        }
+        return true;
+    }
+
+    // Move the best block first: from then on older versions find no chain
+    // state at all rather than what is left of it
+    if (fLegacyBest) {
+        uint256 hashBestChain;
+        CLevelDBBatch batch;
+        if (!db.Read('B', hashBestChain)) {
+            strError = _("Error upgrading coin database");
+            return error("%s : failed to read the best block", __func__);
+        }
+        batch.Write('H', hashBestChain);
+        batch.Erase('B');
+        if (!db.WriteBatch(batch)) {
+            strError = _("Error upgrading coin database");
+            return error("%s : failed to write the coin database", __func__);
+        }
+    }
+
+    LogPrintf("Upgrading the coin database to one record per output...\n");
+    const std::string strProgress = _("Upgrading coin database...");
+    uiInterface.ShowProgress(strProgress, 0);
+    size_t nTransactions = 0;
+    size_t nOutputs = 0;
+    int nReported = 0;
+    // Each batch converts a run of transactions atomically, so an interrupted
+    // upgrade leaves every transaction in either layout and picks up from there
+    while (pcursor->Valid() && pcursor->key()[0] == 'c') {
+        if (ShutdownRequested()) {
+            LogPrintf("Coin database upgrade interrupted after %u transactions\n", (unsigned int)nTransactions);
+            break;
+        }
+        CLevelDBBatch batch;
+        for (size_t nBatch = 0; nBatch < 100000 && pcursor->Valid(); nBatch++, pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            if (slKey[0] != 'c')
+                break;
+            uint256 txid;
+            CCoins coins;
+            try {
+                CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+                char chType;
+                ssKey >> chType >> txid;
+                leveldb::Slice slValue = pcursor->value();
+                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+                ssValue >> coins;
+            } catch (const std::exception& e) {
+                uiInterface.ShowProgress("", 100);
+                strError = _("Error upgrading coin database");
+                return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            }
+            batch.Erase(std::make_pair('c', txid));
+            for (unsigned int i = 0; i < coins.vout.size(); i++) {
+                if (!coins.vout[i].IsNull()) {
+                    batch.Write(std::make_pair('C', COutPoint(txid, i)), CDiskTxOut(coins, i));
+                    nOutputs++;
+                }
+            }
+            nTransactions++;
+        }
+        HandleError(pcursor->status());
+        if (!db.WriteBatch(batch)) {
+            uiInterface.ShowProgress("", 100);
+            strError = _("Error upgrading coin database");
+            return error("%s : failed to write the coin database", __func__);
+        }
+        // the txids are uniform, so the first byte of the next one tells how far along we are
+        int nDone = pcursor->Valid() && pcursor->key()[0] == 'c' ? (unsigned char)pcursor->key()[1] * 100 / 256 : 100;
+        if (nDone >= nReported + 10) {
+            LogPrintf("Upgrading coin database: %d%% (%u transactions, %u outputs)\n", nDone, (unsigned int)nTransactions, (unsigned int)nOutputs);
+            nReported = nDone;
+        }
+        uiInterface.ShowProgress(strProgress, std::max(1, std::min(99, nDone)));
+    }
+    uiInterface.ShowProgress("", 100);
+    if (ShutdownRequested())
+        return true;
+
+    if (!db.Write('V', COINS_DB_VERSION)) {
+        strError = _("Error upgrading coin database");
+        return error("%s : failed to write the coin database version", __func__);
+    }
+    LogPrintf("Upgraded the coin database: %u transactions, %u outputs\n", (unsigned int)nTransactions, (unsigned int)nOutputs);
+    return true;
 }
 
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
@@ -106,57 +532,114 @@ bool CBlockTreeDB::ReadLastBlockFile(int& nFile)
     return Read('l', nFile);
 }
 
+bool CCoinsViewDB::ScanStats(const leveldb::Snapshot* snapshot, CCoinsStatsSum& sum) const
+{
+    // The calling thread and -par - 1 helpers take the ranges in turn
+    std::vector<CCoinsStatsSum> vSums(STATS_RANGES);
+    std::atomic<int> nNext(0);
+    std::atomic<bool> fFailed(false);
+    auto work = [&]() {
+        int nRange;
+        while (!fFailed && (nRange = nNext++) < STATS_RANGES) {
+            try {
+                if (!SumCoinRecords(db, snapshot, nRange, vSums[nRange]))
+                    fFailed = true;
+            } catch (const std::exception& e) {
+                LogPrintf("%s : Deserialize or I/O error - %s\n", __func__, e.what());
+                fFailed = true;
+            }
+        }
+    };
+    boost::thread_group threads;
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        threads.create_thread(work);
+    work();
+    threads.join_all();
+    if (fFailed)
+        return false;
+
+    for (const CCoinsStatsSum& sumRange : vSums)
+        sum += sumRange;
+    return true;
+}
+
 bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
 {
-    /* It seems that there are no "const iterators" for LevelDB.  Since we
-       only need read operations on it, use a const-cast to get around
-       that restriction.  */
-    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    boost::unique_lock<boost::mutex> lockScan(mutexScan);
+    CCoinsStatsSum sum;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (fFlushing)
+            condFlush.wait(lock);
+        if (fFlushFailed)
+            return false;
+        if (fStatsValid) {
+            sum = sumStats;
+            stats.hashBlock = hashStats;
+        } else {
+            // No write can start before the snapshot is taken and the writer
+            // is told to collect what it changes from then on
+            const leveldb::Snapshot* snapshot = db.GetSnapshot();
+            fStatsPending = true;
+            sumStatsPending = CCoinsStatsSum();
+            lock.unlock();
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
-    ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        try {
+            int64_t nTimeStart = GetTimeMicros();
+            bool fOk = ScanStats(snapshot, sum);
+            db.ReleaseSnapshot(snapshot);
+
+            lock.lock();
+            fStatsPending = false;
+            if (!fOk)
+                return false;
+            LogPrint("coindb", "%s : scanned %u outputs in %.2fms\n", __func__, (unsigned int)sum.nTransactionOutputs, 0.001 * (GetTimeMicros() - nTimeStart));
+            while (fFlushing)
+                condFlush.wait(lock);
+            sum += sumStatsPending;
+            if (!db.Read('H', stats.hashBlock))
+                stats.hashBlock = uint256(0);
+            sumStats = sum;
+            hashStats = stats.hashBlock;
+            fStatsValid = !fFlushFailed;
+        }
+    }
+
+    stats.nTransactions = sum.nTransactions;
+    stats.nTransactionOutputs = sum.nTransactionOutputs;
+    stats.nSerializedSize = sum.nSerializedSize;
+    stats.nTotalAmount = sum.nTotalAmount;
+    stats.hashSerialized = sum.muhash.Finalize();
+    LOCK(cs_main);
+    BlockMap::const_iterator mi = mapBlockIndex.find(stats.hashBlock);
+    stats.nHeight = mi != mapBlockIndex.end() ? mi->second->nHeight : 0;
+    return true;
+}
+
+bool CCoinsViewDB::ForEachOutput(const std::function<void(const COutPoint&, const CTxOut&, int)>& fn) const
+{
+    if (!WaitForFlush())
+        return false;
+    try {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator(NULL));
+        pcursor->Seek(std::string(1, 'C'));
+        for (uint64_t nRecords = 0; pcursor->Valid(); pcursor->Next(), nRecords++) {
             leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i = 0; i < coins.vout.size(); i++) {
-                    const CTxOut& out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i + 1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
-            }
-            pcursor->Next();
-        } catch (std::exception& e) {
-            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            if (slKey.size() != COIN_KEY_SIZE || slKey[0] != 'C')
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CDiskTxOut out;
+            ssValue >> out;
+            uint256 txid;
+            memcpy(txid.begin(), slKey.data() + 1, 32);
+            fn(COutPoint(txid, ReadLE32((const unsigned char*)slKey.data() + 33)), out.txout, out.nHeight);
+            if (nRecords % 4096 == 0 && ShutdownRequested())
+                return false;
         }
+        HandleError(pcursor->status());
+    } catch (const std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
-    stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
@@ -168,10 +651,53 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     batch.Write('l', nLastFile);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(std::make_pair('b', (*it)->GetBlockHash()), CDiskBlockIndex(*it));
+        if ((*it)->hashProofOfWork != 0)
+            batch.Write(std::make_pair('w', (*it)->GetBlockHash()), (*it)->hashProofOfWork);
     }
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::WritePoWHashes(const std::vector<std::pair<uint256, uint256> >& vHashes)
+{
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<uint256, uint256> >::const_iterator it = vHashes.begin(); it != vHashes.end(); it++)
+        batch.Write(std::make_pair('w', it->first), it->second);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadPoWHashes(std::vector<std::pair<uint256, uint256> >& vHashes)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << std::make_pair('w', uint256(0));
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'w')
+                break;
+            uint256 hashBlock;
+            ssKey >> hashBlock;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            uint256 hashPoW;
+            ssValue >> hashPoW;
+            vHashes.push_back(std::make_pair(hashBlock, hashPoW));
+            pcursor->Next();
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+
+    return true;
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256& txid, CDiskTxPos& pos)
 {
     return Read(std::make_pair('t', txid), pos);
@@ -265,14 +791,6 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 //pindexNew->prevoutStake = diskindex.prevoutStake;
                 //pindexNew->nStakeTime = diskindex.nStakeTime;
                 //pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
-                //pindexNew->hashProofOfWork = diskindex.hashProofOfWork;
-
-                // treat PoW and PoS blocks the same - don't waste time on redundant PoW checks that won't catch invalid PoS blocks anyway - nNonce = 0 for PoS blocks
-                if ((pindexNew->nNonce != 0 || pindexNew->nVersion >= Params().WALLET_UPGRADE_VERSION()) && pindexNew->IsProofOfWork() && CBlockHeader::GetAlgo(pindexNew->nVersion) != POW_SCRYPT_SQUARED) {
-                    CBlockHeader header = pindexNew->GetBlockHeader();
-                    if (!CheckProofOfWork(&header))
-                        return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
-                }
 
                 //populate accumulator checksum map in memory
                 if(pindexNew->nAccumulatorCheckpoint != 0 && pindexNew->nAccumulatorCheckpoint != nPreviousCheckpoint) {
@@ -292,6 +810,41 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
         }
     }
 
+    // Check the proof of work of the loaded headers. Hashes cached by an
+    // earlier run are checked against nBits only; the rest are computed once
+    // and written back so the next start does not hash them again.
+    int64_t nStart = GetTimeMillis();
+    std::vector<std::pair<uint256, uint256> > vCached;
+    if (!ReadPoWHashes(vCached))
+        return false;
+    for (std::vector<std::pair<uint256, uint256> >::const_iterator it = vCached.begin(); it != vCached.end(); it++) {
+        BlockMap::iterator mi = mapBlockIndex.find(it->first);
+        if (mi != mapBlockIndex.end())
+            mi->second->hashProofOfWork = it->second;
+    }
+
+    std::vector<std::pair<uint256, uint256> > vComputed;
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++) {
+        CBlockIndex* pindex = it->second;
+        bool fCached = pindex->hashProofOfWork != 0;
+        // treat PoW and PoS blocks the same - don't waste time on redundant PoW checks that won't catch invalid PoS blocks anyway - nNonce = 0 for PoS blocks
+        // scrypt² headers are only checked when a cached hash makes it cheap
+        if (!((pindex->nNonce != 0 || pindex->nVersion >= Params().WALLET_UPGRADE_VERSION()) && pindex->IsProofOfWork()))
+            continue;
+        if (!fCached && CBlockHeader::GetAlgo(pindex->nVersion) == POW_SCRYPT_SQUARED)
+            continue;
+
+        CBlockHeader header = pindex->GetBlockHeader();
+        if (!CheckProofOfWork(&header, pindex->hashProofOfWork))
+            return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindex->ToString());
+        if (!fCached && pindex->hashProofOfWork != 0)
+            vComputed.push_back(std::make_pair(pindex->GetBlockHash(), pindex->hashProofOfWork));
+    }
+    if (!vComputed.empty() && !WritePoWHashes(vComputed))
+        return error("%s : failed to write proof-of-work hashes", __func__);
+    LogPrintf("%s : checked proof of work of %u block index entries, %u cached, %u hashed, %dms\n", __func__,
+        mapBlockIndex.size(), vCached.size(), vComputed.size(), GetTimeMillis() - nStart);
+
     return true;
 }
 
@@ -429,3 +982,72 @@ bool CZerocoinDB::EraseAccumulatorValue(const uint32_t& nChecksum)
     LogPrint("zero", "%s : checksum:%d\n", __func__, nChecksum);
     return Erase(std::make_pair('2', nChecksum));
 }
+
+bool CZerocoinDB::WriteBlockPubcoins(int nHeight, const uint256& hashBlock, const std::vector<CIndexedPubcoin>& vPubcoins)
+{
+    return Write(std::make_pair('h', nHeight), std::make_pair(hashBlock, vPubcoins));
+}
+
+bool CZerocoinDB::ReadBlockPubcoins(int nHeight, uint256& hashBlock, std::vector<CIndexedPubcoin>& vPubcoins)
+{
+    std::pair<uint256, std::vector<CIndexedPubcoin> > entry;
+    if (!Read(std::make_pair('h', nHeight), entry))
+        return false;
+    hashBlock = entry.first;
+    vPubcoins.swap(entry.second);
+    return true;
+}
+
+bool CZerocoinDB::EraseBlockPubcoins(int nHeight)
+{
+    return Erase(std::make_pair('h', nHeight));
+}
+
+CWitnessDB::CWitnessDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "witnesses", nCacheSize, fMemory, fWipe)
+{
+}
+
+bool CWitnessDB::WriteWitnessBatch(const std::vector<std::pair<uint256, std::pair<CoinWitnessCacheData, uint256> > >& vWrite, const std::vector<uint256>& vErase)
+{
+    CLevelDBBatch batch;
+    for (const auto& it : vWrite)
+        batch.Write(std::make_pair('w', it.first), it.second);
+    for (const uint256& hashPubcoin : vErase)
+        batch.Erase(std::make_pair('w', hashPubcoin));
+
+    LogPrint("zero", "Writing %u witnesses, erasing %u\n", vWrite.size(), vErase.size());
+    return WriteBatch(batch);
+}
+
+bool CWitnessDB::LoadWitnesses(std::vector<std::pair<uint256, std::pair<CoinWitnessCacheData, uint256> > >& vWitnesses)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << std::make_pair('w', uint256(0));
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'w')
+                break;
+            uint256 hashPubcoin;
+            ssKey >> hashPubcoin;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            std::pair<CoinWitnessCacheData, uint256> witness;
+            ssValue >> witness;
+            vWitnesses.emplace_back(hashPubcoin, witness);
+            pcursor->Next();
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+
+    return true;
+}
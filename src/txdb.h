@@ -9,13 +9,20 @@
 
 #include "leveldbwrapper.h"
 #include "main.h"
+#include "muhash.h"
+#include "zspl/witness.h"
 #include "zspl/zerocoin.h"
 
+#include <functional>
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
 class CCoins;
 class uint256;
 
@@ -25,21 +32,93 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! Layout of the coin database: 1 is one record per unspent output, under
+//! the 'V' key; a database without it holds one record per transaction
+static const int COINS_DB_VERSION = 1;
+
+/** Statistics of part of the UTXO set, or of changes to it, that add up */
+struct CCoinsStatsSum {
+    int64_t nTransactions;
+    int64_t nTransactionOutputs;
+    int64_t nSerializedSize;
+    CAmount nTotalAmount;
+    CMuHash3072 muhash;
+
+    CCoinsStatsSum() : nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+
+    //! Count in or out an output by its database record, the key followed by the value
+    void AddOutput(const std::string& strRecord, CAmount nValue);
+    void RemoveOutput(const std::string& strRecord, CAmount nValue);
+    CCoinsStatsSum& operator+=(const CCoinsStatsSum& other);
+};
 
-/** CCoinsView backed by the LevelDB coin database (chainstate/) */
+/**
+ * CCoinsView backed by the LevelDB coin database (chainstate/).
+ *
+ * Every unspent output is a record of its own, keyed by outpoint, so that
+ * spending an output deletes one small record instead of rewriting what is
+ * left of its transaction. The outputs of a transaction are adjacent in the
+ * database and GetCoins() gathers them with a single seek.
+ *
+ * BatchWrite() hands the changed entries to a writer thread and returns
+ * without waiting for the disk; reads are answered from the batch in flight
+ * until it is written. Sync() waits for the writer.
+ *
+ * The best block is stored under 'H' rather than the 'B' of the
+ * per-transaction layout, so older versions do not take the converted
+ * database for theirs.
+ *
+ * GetStats() scans a snapshot of the database in key ranges on several
+ * threads. Once computed, the statistics are kept up to date by the writer
+ * from the records it replaces, so later calls return at once.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CLevelDBWrapper db;
 
+private:
+    mutable boost::mutex mutex;
+    mutable boost::condition_variable condFlush;
+    CCoinsMap mapFlushing;  //!< entries being written, only changed under mutex
+    uint256 hashFlushing;
+    bool fFlushing;
+    bool fFlushFailed;
+    bool fStop;
+    boost::thread threadFlush;
+
+    //! Statistics at hashStats while fStatsValid, only changed under mutex
+    mutable CCoinsStatsSum sumStats;
+    mutable uint256 hashStats;
+    mutable bool fStatsValid;
+    //! Changes written while a scan is running, to bring its result up to date
+    mutable CCoinsStatsSum sumStatsPending;
+    mutable bool fStatsPending;
+    mutable boost::mutex mutexScan; //!< one scan at a time
+
+    void ThreadFlush();
+    //! Write the changed entries, and add what they change to *psumDelta if given
+    bool WriteCoins(const CCoinsMap& mapCoins, const uint256& hashBlock, CCoinsStatsSum* psumDelta);
+    //! Sum up the records of a snapshot, in parallel over ranges of txids
+    bool ScanStats(const leveldb::Snapshot* snapshot, CCoinsStatsSum& sum) const;
+    //! Wait for the batch in flight, false if a write failed
+    bool WaitForFlush() const;
+
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetCoins(const uint256& txid, CCoins& coins) const;
     bool HaveCoins(const uint256& txid) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
+    bool Sync();
     bool GetStats(CCoinsStats& stats) const;
+    //! Call fn for each unspent output once written, false if the scan failed
+    bool ForEachOutput(const std::function<void(const COutPoint&, const CTxOut&, int)>& fn) const;
+    //! Convert a database of per-transaction records; resumes where an interrupted run stopped.
+    //! Refuses a database of an unknown version or one an older version wrote to since.
+    bool Upgrade(std::string& strError);
 };
 
 /** Access to the block database (blocks/index/) */
@@ -65,6 +144,9 @@ public:
     bool ReadFlag(const std::string& name, bool& fValue);
     bool WriteInt(const std::string& name, int nValue);
     bool ReadInt(const std::string& name, int& nValue);
+    /** Proof-of-work hashes cached per block hash ('w' records, kept apart from the 'b' index records) */
+    bool WritePoWHashes(const std::vector<std::pair<uint256, uint256> >& vHashes);
+    bool ReadPoWHashes(std::vector<std::pair<uint256, uint256> >& vHashes);
     bool LoadBlockIndexGuts();
 };
 
@@ -93,6 +175,26 @@ public:
     bool WriteAccumulatorValue(const uint32_t& nChecksum, const CBigNum& bnValue);
     bool ReadAccumulatorValue(const uint32_t& nChecksum, CBigNum& bnValue);
     bool EraseAccumulatorValue(const uint32_t& nChecksum);
+    /** Mint outputs of the block at a height, in block order, with the hash of that block */
+    bool WriteBlockPubcoins(int nHeight, const uint256& hashBlock, const std::vector<CIndexedPubcoin>& vPubcoins);
+    bool ReadBlockPubcoins(int nHeight, uint256& hashBlock, std::vector<CIndexedPubcoin>& vPubcoins);
+    bool EraseBlockPubcoins(int nHeight);
+};
+
+/** Accumulator witnesses of the wallet's mints (witnesses/), see CWitnessStore */
+class CWitnessDB : public CLevelDBWrapper
+{
+public:
+    CWitnessDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+private:
+    CWitnessDB(const CWitnessDB&);
+    void operator=(const CWitnessDB&);
+
+public:
+    /** Witnesses by pubcoin hash, with the hash of the block their accumulation ended at */
+    bool WriteWitnessBatch(const std::vector<std::pair<uint256, std::pair<CoinWitnessCacheData, uint256> > >& vWrite, const std::vector<uint256>& vErase);
+    bool LoadWitnesses(std::vector<std::pair<uint256, std::pair<CoinWitnessCacheData, uint256> > >& vWitnesses);
 };
 
 #endif // BITCOIN_TXDB_H
@@ -8,12 +8,19 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <map>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/identity.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index_container.hpp>
+
 class CAutoFile;
 
 inline double AllowFreeThreshold()
@@ -33,7 +40,11 @@ inline bool AllowFree(double dPriority)
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
 /**
- * CTxMemPool stores these:
+ * CTxMemPool stores these. Besides the transaction itself an entry keeps
+ * the count, size and fees of its in-pool descendants and of its in-pool
+ * ancestors, each including the entry; CTxMemPool updates them as the
+ * pool changes, so that eviction and block assembly can rank whole
+ * packages without walking the pool.
  */
 class CTxMemPoolEntry
 {
@@ -42,14 +53,22 @@ private:
     CAmount nFee;         //! Cached to avoid expensive parent-transaction lookups
     size_t nTxSize;       //! ... and avoid recomputing tx size
     size_t nModSize;      //! ... and modified size for priority
+    size_t nUsageSize;    //! ... and heap memory of the transaction
     int64_t nTime;        //! Local time when entering the mempool
     double dPriority;     //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
+    CAmount nFeeDelta;    //! Fee adjustment from PrioritiseTransaction
+
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
+
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight);
-    CTxMemPoolEntry();
-    CTxMemPoolEntry(const CTxMemPoolEntry& other);
 
     const CTransaction& GetTx() const { return this->tx; }
     double GetPriority(unsigned int currentHeight) const;
@@ -57,8 +76,140 @@ public:
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+    CAmount GetModifiedFee() const { return nFee + nFeeDelta; }
+    size_t DynamicMemoryUsage() const { return nUsageSize; }
+
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+
+    void UpdateDescendantState(int64_t nModifySize, CAmount nModifyFee, int64_t nModifyCount);
+    void UpdateAncestorState(int64_t nModifySize, CAmount nModifyFee, int64_t nModifyCount);
+    void UpdateFeeDelta(CAmount nNewFeeDelta);
 };
 
+// Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
+struct update_descendant_state {
+    update_descendant_state(int64_t _nModifySize, CAmount _nModifyFee, int64_t _nModifyCount) : nModifySize(_nModifySize), nModifyFee(_nModifyFee), nModifyCount(_nModifyCount) {}
+    void operator()(CTxMemPoolEntry& e) { e.UpdateDescendantState(nModifySize, nModifyFee, nModifyCount); }
+
+private:
+    int64_t nModifySize;
+    CAmount nModifyFee;
+    int64_t nModifyCount;
+};
+
+struct update_ancestor_state {
+    update_ancestor_state(int64_t _nModifySize, CAmount _nModifyFee, int64_t _nModifyCount) : nModifySize(_nModifySize), nModifyFee(_nModifyFee), nModifyCount(_nModifyCount) {}
+    void operator()(CTxMemPoolEntry& e) { e.UpdateAncestorState(nModifySize, nModifyFee, nModifyCount); }
+
+private:
+    int64_t nModifySize;
+    CAmount nModifyFee;
+    int64_t nModifyCount;
+};
+
+struct update_fee_delta {
+    update_fee_delta(CAmount _nFeeDelta) : nFeeDelta(_nFeeDelta) {}
+    void operator()(CTxMemPoolEntry& e) { e.UpdateFeeDelta(nFeeDelta); }
+
+private:
+    CAmount nFeeDelta;
+};
+
+/** Extracts the txid of an entry, the key of the hashed index */
+struct mempoolentry_txid {
+    typedef uint256 result_type;
+    result_type operator()(const CTxMemPoolEntry& entry) const { return entry.GetTx().GetHash(); }
+};
+
+/**
+ * Orders entries by the better of their own fee rate and the fee rate of
+ * them with their descendants, lowest first. Evicting from the front
+ * removes the packages that are least worth mining.
+ */
+class CompareTxMemPoolEntryByDescendantScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        bool fUseADescendants = UseDescendantScore(a);
+        bool fUseBDescendants = UseDescendantScore(b);
+
+        double aModFee = fUseADescendants ? a.GetModFeesWithDescendants() : a.GetModifiedFee();
+        double aSize = fUseADescendants ? a.GetSizeWithDescendants() : a.GetTxSize();
+        double bModFee = fUseBDescendants ? b.GetModFeesWithDescendants() : b.GetModifiedFee();
+        double bSize = fUseBDescendants ? b.GetSizeWithDescendants() : b.GetTxSize();
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = aModFee * bSize;
+        double f2 = aSize * bModFee;
+        if (f1 == f2)
+            return a.GetTime() >= b.GetTime();
+        return f1 < f2;
+    }
+
+    //! Whether the fee rate with descendants is higher than the fee rate alone
+    bool UseDescendantScore(const CTxMemPoolEntry& a) const
+    {
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
+        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
+        return f2 > f1;
+    }
+};
+
+/**
+ * Orders entries by the lower of their own fee rate and the fee rate of
+ * them with their ancestors, highest first: the order in which packages
+ * are worth adding to a block.
+ */
+class CompareTxMemPoolEntryByAncestorFee
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double aFees, aSize, bFees, bSize;
+        GetModFeeAndSize(a, aFees, aSize);
+        GetModFeeAndSize(b, bFees, bSize);
+
+        double f1 = aFees * bSize;
+        double f2 = aSize * bFees;
+        if (f1 == f2)
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        return f1 > f2;
+    }
+
+    static void GetModFeeAndSize(const CTxMemPoolEntry& a, double& dModFees, double& dSize)
+    {
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithAncestors();
+        double f2 = (double)a.GetModFeesWithAncestors() * a.GetTxSize();
+        if (f1 > f2) {
+            dModFees = a.GetModFeesWithAncestors();
+            dSize = a.GetSizeWithAncestors();
+        } else {
+            dModFees = a.GetModifiedFee();
+            dSize = a.GetTxSize();
+        }
+    }
+};
+
+class CompareTxMemPoolEntryByEntryTime
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        return a.GetTime() < b.GetTime();
+    }
+};
+
+// Multi_index tags for the orderings of CTxMemPool::mapTx
+struct descendant_score {};
+struct entry_time {};
+struct ancestor_score {};
+
 class CMinerPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -91,6 +242,20 @@ public:
  * are added to the pool: if a new transaction double-spends
  * an input of a transaction in the pool, it is dropped,
  * as are non-standard transactions.
+ *
+ * mapTx is a boost::multi_index over the entries with four indexes: by
+ * txid, by descendant score (for eviction), by entry time (for expiry)
+ * and by ancestor score (for block assembly). mapLinks holds the in-pool
+ * parents and children of each entry, from which the ancestor and
+ * descendant state of the entries is kept current as transactions come
+ * and go. CalculateMemPoolAncestors limits how long chains in the pool
+ * can grow, which bounds the cost of those updates.
+ *
+ * The pool is bounded in memory by TrimToSize, which evicts the packages
+ * with the lowest descendant score, except those holding a zerocoin spend,
+ * and raises a minimum fee rate (GetMinFee) for new transactions to at
+ * least what was evicted. That minimum decays back with a half-life of
+ * ROLLING_FEE_HALFLIFE once blocks come in.
  */
 class CTxMemPool
 {
@@ -101,10 +266,77 @@ private:
 
     CFeeRate minRelayFee; //! Passed to constructor to avoid dependency on main
     uint64_t totalTxSize; //! sum of all mempool tx' byte sizes
+    uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+    mutable double rollingMinimumFeeRate; //! minimum fee to get into the pool, decreases exponentially
+
+    void trackPackageRemoved(const CFeeRate& rate);
 
 public:
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
+
+    typedef boost::multi_index_container<
+        CTxMemPoolEntry,
+        boost::multi_index::indexed_by<
+            // sorted by txid
+            boost::multi_index::hashed_unique<mempoolentry_txid, CCoinsKeyHasher>,
+            // sorted by fee rate with descendants, lowest first
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<descendant_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByDescendantScore>,
+            // sorted by entry time
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<entry_time>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByEntryTime>,
+            // sorted by fee rate with ancestors, highest first
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<ancestor_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByAncestorFee> > >
+        indexed_transaction_set;
+
     mutable CCriticalSection cs;
-    std::map<uint256, CTxMemPoolEntry> mapTx;
+    indexed_transaction_set mapTx;
+
+    typedef indexed_transaction_set::nth_index<0>::type::iterator txiter;
+    struct CompareIteratorByHash {
+        bool operator()(const txiter& a, const txiter& b) const
+        {
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        }
+    };
+    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+
+    const setEntries& GetMemPoolParents(txiter entry) const;
+    const setEntries& GetMemPoolChildren(txiter entry) const;
+
+private:
+    struct TxLinks {
+        setEntries parents;
+        setEntries children;
+    };
+
+    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    txlinksMap mapLinks;
+
+    void UpdateParent(txiter entry, txiter parent, bool add);
+    void UpdateChild(txiter entry, txiter child, bool add);
+
+    /** Recompute the ancestor and descendant state of an entry from the links */
+    void RecalculateState(txiter entry);
+    /** Set ancestor state of an entry, and add it to the descendant state of its ancestors */
+    void UpdateAncestorsOf(bool add, txiter entry, setEntries& setAncestors);
+    void UpdateEntryForAncestors(txiter it, const setEntries& setAncestors);
+    /** Unlink entries about to be removed, and take them out of the state of the ones that stay */
+    void UpdateForRemoveFromMempool(const setEntries& entriesToRemove, bool updateDescendants);
+    /** Remove entries whose ancestor and descendant state are already updated */
+    void removeUnchecked(txiter entry);
+
+public:
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
@@ -114,13 +346,21 @@ public:
     /**
      * If sanity-checking is turned on, check makes sure the pool is
      * consistent (does not contain two transactions that spend the same inputs,
-     * all inputs are in the mapNextTx array). If sanity-checking is turned off,
-     * check does nothing.
+     * all inputs are in the mapNextTx array, the links and the ancestor and
+     * descendant state of every entry match). If sanity-checking is turned
+     * off, check does nothing.
      */
     void check(const CCoinsViewCache* pcoins) const;
     void setSanityCheck(bool _fSanityCheck) { fSanityCheck = _fSanityCheck; }
 
+    /**
+     * addUnchecked must update the state of all ancestors and descendants
+     * of the entry. The first form looks the ancestors up itself, without
+     * limits; AcceptToMemoryPool passes the set it already checked against
+     * the limits.
+     */
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry);
+    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry, setEntries& setAncestors);
     void remove(const CTransaction& tx, std::list<CTransaction>& removed, bool fRecursive = false);
     void removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned int nMemPoolHeight);
     void removeConflicts(const CTransaction& tx, std::list<CTransaction>& removed);
@@ -137,6 +377,37 @@ public:
     void ApplyDeltas(const uint256 hash, double& dPriorityDelta, CAmount& nFeeDelta);
     void ClearPrioritisation(const uint256 hash);
 
+    /**
+     * Remove a set of transactions from the mempool. Their descendants must
+     * be in the set too, unless updateDescendants takes the removed ones
+     * out of the ancestor state of the descendants that stay.
+     */
+    void RemoveStaged(setEntries& stage, bool updateDescendants = false);
+
+    /**
+     * Find the in-pool ancestors of entry, failing if any of the limits
+     * on ancestors, or on the descendants of any of them, would be
+     * exceeded with the entry added. fSearchForParents looks the parents
+     * up by the inputs of the transaction, for an entry not in the pool
+     * yet; otherwise mapLinks has them.
+     */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString, bool fSearchForParents = true) const;
+
+    /** Add entry and its in-pool descendants to setDescendants, unless they are in it already */
+    void CalculateDescendants(txiter it, setEntries& setDescendants) const;
+
+    /**
+     * The minimum fee rate to get into the pool, which may be higher
+     * than the minimum relay fee after TrimToSize evicted transactions.
+     */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+
+    /** Evict the packages with the lowest descendant score until the pool uses at most sizelimit bytes, keeping zerocoin spends */
+    void TrimToSize(size_t sizelimit);
+
+    /** Remove transactions that entered the pool before time, and their descendants; returns how many */
+    int Expire(int64_t time);
+
     unsigned long size()
     {
         LOCK(cs);
@@ -148,7 +419,7 @@ public:
         return totalTxSize;
     }
 
-    bool exists(uint256 hash)
+    bool exists(uint256 hash) const
     {
         LOCK(cs);
         return (mapTx.count(hash) != 0);
@@ -165,6 +436,8 @@ public:
     /** Write/Read estimates to disk */
     bool WriteFeeEstimates(CAutoFile& fileout) const;
     bool ReadFeeEstimates(CAutoFile& filein);
+
+    size_t DynamicMemoryUsage() const;
 };
 
 /** 
@@ -31,6 +31,9 @@ void UnregisterAllValidationInterfaces();
 void SyncWithWallets(const CTransaction& tx, const CBlock* pblock);
 
 class CValidationInterface {
+public:
+    virtual ~CValidationInterface() {}
+
 protected:
 // XX42    virtual void EraseFromWallet(const uint256& hash){};
     virtual void UpdatedBlockTip(const CBlockIndex *pindex) {}
@@ -4,6 +4,11 @@
 
 #include "wallet/wallet.h"
 
+#include "main.h"
+#include "random.h"
+#include "stakeinput.h"
+
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -20,6 +25,8 @@
 #define RANDOM_REPEATS 5
 
 
+extern CWallet* pwalletMain;
+
 typedef std::set<std::pair<const CWalletTx*,unsigned int> > CoinSet;
 
 BOOST_FIXTURE_TEST_SUITE(wallet_tests, TestingSetup)
@@ -304,4 +311,146 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+/** Connect a block on top of the active chain that holds tx at index 0, its index is kept in vIndexes */
+static CBlockIndex* ConnectFakeBlock(CWalletTx& wtx, std::vector<std::unique_ptr<CBlockIndex> >& vIndexes)
+{
+    LOCK(cs_main);
+    vIndexes.emplace_back(new CBlockIndex());
+    CBlockIndex* pindex = vIndexes.back().get();
+    pindex->pprev = chainActive.Tip();
+    pindex->nHeight = pindex->pprev->nHeight + 1;
+    pindex->nTime = 1000000000;
+    pindex->hashMerkleRoot = wtx.GetHash();
+    BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(GetRandHash(), pindex)).first;
+    pindex->phashBlock = &mi->first;
+    chainActive.SetTip(pindex);
+    wtx.hashBlock = pindex->GetBlockHash();
+    wtx.nIndex = 0;
+    return pindex;
+}
+
+/** The transactions SelectStakeCoins picks, with their total value */
+static std::set<uint256> SelectStake(CAmount nTargetAmount, int nHeight, CAmount& nValueRet)
+{
+    std::list<std::unique_ptr<CStakeInput> > listInputs;
+    BOOST_CHECK(pwalletMain->SelectStakeCoins(listInputs, nTargetAmount, nHeight));
+    std::set<uint256> setTx;
+    nValueRet = 0;
+    for (std::unique_ptr<CStakeInput>& input : listInputs) {
+        CTransaction tx;
+        BOOST_CHECK(input->GetTxFrom(tx));
+        setTx.insert(tx.GetHash());
+        nValueRet += input->GetValue();
+    }
+    return setTx;
+}
+
+BOOST_AUTO_TEST_CASE(stakeable_index_tests)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript scriptMine = GetScriptForDestination(key.GetPubKey().GetID());
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->AddKeyPubKey(key, key.GetPubKey()));
+    }
+    const CBlockIndex* pindexGenesis = chainActive.Tip();
+    std::vector<std::unique_ptr<CBlockIndex> > vIndexes;
+    CAmount nValue;
+
+    // A confirmed payment is found when the index is built
+    CMutableTransaction txPayment;
+    txPayment.vin.resize(1);
+    txPayment.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txPayment.vout.push_back(CTxOut(10 * COIN, scriptMine));
+    CWalletTx wtxPayment(pwalletMain, txPayment);
+    const CBlockIndex* pindexPayment = ConnectFakeBlock(wtxPayment, vIndexes);
+    BOOST_CHECK(pwalletMain->AddToWallet(wtxPayment));
+    std::set<uint256> setTx = SelectStake(100 * COIN, 1000, nValue);
+    BOOST_CHECK(setTx.size() == 1 && setTx.count(wtxPayment.GetHash()));
+    BOOST_CHECK_EQUAL(nValue, 10 * COIN);
+
+    // An unconfirmed one is not
+    CMutableTransaction txUnconfirmed;
+    txUnconfirmed.vin.resize(1);
+    txUnconfirmed.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txUnconfirmed.vout.push_back(CTxOut(5 * COIN, scriptMine));
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, txUnconfirmed)));
+    pwalletMain->UpdatedBlockTip(chainActive.Tip());
+    BOOST_CHECK_EQUAL(SelectStake(100 * COIN, 1000, nValue).size(), 1U);
+
+    // A coinstake becomes available at its maturity only
+    CMutableTransaction txStake;
+    txStake.vin.resize(1);
+    txStake.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txStake.vout.resize(2);
+    txStake.vout[0].SetEmpty();
+    txStake.vout[1] = CTxOut(20 * COIN, scriptMine);
+    CWalletTx wtxStake(pwalletMain, txStake);
+    BOOST_CHECK(wtxStake.IsCoinStake());
+    const CBlockIndex* pindexStake = ConnectFakeBlock(wtxStake, vIndexes);
+    BOOST_CHECK(pwalletMain->AddToWallet(wtxStake));
+    pwalletMain->UpdatedBlockTip(chainActive.Tip());
+    const int nHeightMature = pindexStake->nHeight + Params().COINBASE_MATURITY();
+    BOOST_CHECK(!SelectStake(100 * COIN, nHeightMature, nValue).count(wtxStake.GetHash()));
+    setTx = SelectStake(100 * COIN, nHeightMature + 1, nValue);
+    BOOST_CHECK(setTx.size() == 2 && setTx.count(wtxStake.GetHash()));
+    BOOST_CHECK_EQUAL(nValue, 30 * COIN);
+
+    // The target amount and locked coins are respected
+    SelectStake(15 * COIN, 1000, nValue);
+    BOOST_CHECK_EQUAL(nValue, 10 * COIN);
+    COutPoint outpointPayment(wtxPayment.GetHash(), 0);
+    {
+        LOCK(pwalletMain->cs_wallet);
+        pwalletMain->LockCoin(outpointPayment);
+    }
+    setTx = SelectStake(100 * COIN, 1000, nValue);
+    BOOST_CHECK(setTx.size() == 1 && setTx.count(wtxStake.GetHash()));
+    {
+        LOCK(pwalletMain->cs_wallet);
+        pwalletMain->UnlockCoin(outpointPayment);
+    }
+
+    // A confirmed spend takes the output out of the index
+    CMutableTransaction txSpend;
+    txSpend.vin.resize(1);
+    txSpend.vin[0].prevout = outpointPayment;
+    txSpend.vout.push_back(CTxOut(9 * COIN, CScript() << OP_TRUE));
+    CWalletTx wtxSpend(pwalletMain, txSpend);
+    ConnectFakeBlock(wtxSpend, vIndexes);
+    BOOST_CHECK(pwalletMain->AddToWallet(wtxSpend));
+    pwalletMain->UpdatedBlockTip(chainActive.Tip());
+    setTx = SelectStake(100 * COIN, 1000, nValue);
+    BOOST_CHECK(setTx.size() == 1 && setTx.count(wtxStake.GetHash()));
+
+    // Disconnecting the stake and the spend brings the payment back, without the stake
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(const_cast<CBlockIndex*>(pindexPayment));
+    }
+    pwalletMain->SyncTransaction(txSpend, NULL);
+    pwalletMain->SyncTransaction(txStake, NULL);
+    pwalletMain->UpdatedBlockTip(chainActive.Tip());
+    setTx = SelectStake(100 * COIN, 1000, nValue);
+    BOOST_CHECK(setTx.size() == 1 && setTx.count(wtxPayment.GetHash()));
+
+    // And so does a reorganisation the wallet only hears of through the new tip
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(const_cast<CBlockIndex*>(pindexGenesis));
+    }
+    pwalletMain->UpdatedBlockTip(chainActive.Tip());
+    BOOST_CHECK(SelectStake(100 * COIN, 1000, nValue).empty());
+
+    // Leave no fake blocks behind for the suites that follow
+    {
+        LOCK(cs_main);
+        for (const std::unique_ptr<CBlockIndex>& pindex : vIndexes) {
+            const uint256 hash = pindex->GetBlockHash();
+            mapBlockIndex.erase(hash);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -31,6 +31,7 @@
 #include "libzerocoin/Denominations.h"
 #include "zspl/zsplwallet.h"
 #include "zspl/zspltracker.h"
+#include "zspl/witnessstore.h"
 #include "zspl/deterministicmint.h"
 #include <assert.h>
 
@@ -698,6 +699,15 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
         // Break debit/credit balance caches:
         wtx.MarkDirty();
 
+        // Have the stake index look at its outputs, and at the ones it spends
+        if (fStakeableIndexed) {
+            setStakeableDirty.insert(hash);
+            for (const CTxIn& txin : wtx.vin) {
+                if (!txin.IsZerocoinSpend() && mapWallet.count(txin.prevout.hash))
+                    setStakeableDirty.insert(txin.prevout.hash);
+            }
+        }
+
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
 
@@ -747,6 +757,98 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
         if (!txin.IsZerocoinSpend() && mapWallet.count(txin.prevout.hash))
             mapWallet[txin.prevout.hash].MarkDirty();
     }
+
+    if (fStakeableIndexed)
+        UpdateStakeable();
+}
+
+void CWallet::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    if (!fStakeableIndexed)
+        return;
+
+    LOCK2(cs_main, cs_wallet);
+    // After a reorganisation look again at every output confirmed above the
+    // fork, also the ones whose transaction did not come back through SyncTransaction
+    if (pindexStakeable && !chainActive.Contains(pindexStakeable)) {
+        const CBlockIndex* pindexFork = chainActive.FindFork(pindexStakeable);
+        for (const auto& it : mapStakeable) {
+            if (!pindexFork || it.second.nHeight > pindexFork->nHeight)
+                setStakeableDirty.insert(it.first.hash);
+        }
+    }
+    UpdateStakeable();
+}
+
+void CWallet::EraseStakeable(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet);
+    std::map<COutPoint, CStakeableOutput>::iterator it = mapStakeable.lower_bound(COutPoint(hash, 0));
+    while (it != mapStakeable.end() && it->first.hash == hash) {
+        std::map<int, std::set<COutPoint> >::iterator mi = mapStakeableByHeight.find(it->second.nHeightMature);
+        if (mi != mapStakeableByHeight.end()) {
+            mi->second.erase(it->first);
+            if (mi->second.empty())
+                mapStakeableByHeight.erase(mi);
+        }
+        mapStakeable.erase(it++);
+    }
+}
+
+void CWallet::UpdateStakeable()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    for (const uint256& hash : setStakeableDirty) {
+        EraseStakeable(hash);
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+        if (mi == mapWallet.end())
+            continue;
+
+        // Only confirmed transactions: they are final and trusted, and
+        // nothing less deep can meet the stake min age or depth anyway
+        const CWalletTx& wtx = mi->second;
+        const CBlockIndex* pindex = NULL;
+        if (wtx.GetDepthInMainChain(pindex, false) <= 0 || !pindex)
+            continue;
+        int nHeightMature = pindex->nHeight;
+        if (wtx.IsCoinBase() || wtx.IsCoinStake())
+            nHeightMature += Params().COINBASE_MATURITY();
+
+        for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+            const CTxOut& txout = wtx.vout[i];
+            if (txout.IsZerocoinMint() || txout.nValue <= 0 || IsSpent(hash, i))
+                continue;
+            isminetype mine = IsMine(txout);
+            if (mine == ISMINE_NO || mine == ISMINE_WATCH_ONLY)
+                continue;
+
+            COutPoint outpoint(hash, i);
+            CStakeableOutput& out = mapStakeable[outpoint];
+            out.tx = &wtx;
+            out.i = i;
+            out.nHeight = pindex->nHeight;
+            out.nBlockTime = pindex->GetBlockTime();
+            out.nHeightMature = nHeightMature;
+            mapStakeableByHeight[nHeightMature].insert(outpoint);
+        }
+    }
+    setStakeableDirty.clear();
+    pindexStakeable = chainActive.Tip();
+}
+
+void CWallet::IndexStakeable()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    int64_t nTimeStart = GetTimeMillis();
+    mapStakeable.clear();
+    mapStakeableByHeight.clear();
+    for (const auto& it : mapWallet)
+        setStakeableDirty.insert(it.first);
+    UpdateStakeable();
+    fStakeableIndexed = true;
+    LogPrint("staking", "%s: %u stakeable outputs in %dms\n", __func__, mapStakeable.size(), GetTimeMillis() - nTimeStart);
 }
 
 void CWallet::EraseFromWallet(const uint256& hash)
@@ -755,6 +857,7 @@ void CWallet::EraseFromWallet(const uint256& hash)
         return;
     {
         LOCK(cs_wallet);
+        EraseStakeable(hash);
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
     }
@@ -1330,6 +1433,8 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, b
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
             }
         }
+        if (fStakeableIndexed)
+            UpdateStakeable();
         ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
     return ret;
@@ -1796,31 +1901,40 @@ bool less_then_denom(const COutput& out1, const COutput& out2)
 bool CWallet::SelectStakeCoins(std::list<std::unique_ptr<CStakeInput> >& listInputs, CAmount nTargetAmount,
         int blockHeight, bool fPrecompute)
 {
-    LOCK(cs_main);
+    // The index is built from the whole wallet once, and kept up to date from then on
+    if (!fStakeableIndexed) {
+        LOCK2(cs_main, cs_wallet);
+        if (!fStakeableIndexed)
+            IndexStakeable();
+    }
+
+    LOCK(cs_wallet);
     //Add SPL
-    std::vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, NULL, false, STAKABLE_COINS);
     CAmount nAmountSelected = 0;
     if (GetBoolArg("-splstake", true) && !fPrecompute) {
-        for (const COutput &out : vCoins) {
-            //make sure not to outrun target amount
-            if (nAmountSelected + out.tx->vout[out.i].nValue > nTargetAmount)
-                continue;
+        // Only the buckets spendable on top of the previous block
+        for (auto it = mapStakeableByHeight.begin(); it != mapStakeableByHeight.end() && it->first < blockHeight; ++it) {
+            for (const COutPoint& outpoint : it->second) {
+                const CStakeableOutput& out = mapStakeable.at(outpoint);
+                const CAmount nValue = out.tx->vout[out.i].nValue;
+                //make sure not to outrun target amount
+                if (nAmountSelected + nValue > nTargetAmount)
+                    continue;
 
-            if (out.tx->vin[0].IsZerocoinSpend() && !out.tx->IsInMainChain())
-                continue;
+                if (IsLockedCoin(outpoint.hash, outpoint.n))
+                    continue;
 
-            CBlockIndex* utxoBlock = mapBlockIndex.at(out.tx->hashBlock);
-            //check for maturity (min age/depth)
-            if (!Params().HasStakeMinAgeOrDepth(blockHeight, GetAdjustedTime(), utxoBlock->nHeight, utxoBlock->GetBlockTime()))
-                continue;
+                //check for maturity (min age/depth)
+                if (!Params().HasStakeMinAgeOrDepth(blockHeight, GetAdjustedTime(), out.nHeight, out.nBlockTime))
+                    continue;
 
-            //add to our stake set
-            nAmountSelected += out.tx->vout[out.i].nValue;
+                //add to our stake set
+                nAmountSelected += nValue;
 
-            std::unique_ptr<CSplStake> input(new CSplStake());
-            input->SetInput((CTransaction) *out.tx, out.i);
-            listInputs.emplace_back(std::move(input));
+                std::unique_ptr<CSplStake> input(new CSplStake());
+                input->SetInput((CTransaction) *out.tx, out.i);
+                listInputs.emplace_back(std::move(input));
+            }
         }
     }
 
@@ -2388,94 +2502,105 @@ bool CWallet::CreateCoinStake(
         nTxNewTime = pindexPrev->nTime;
     }
 
-    for (std::unique_ptr<CStakeInput>& stakeInput : listInputs) {
+    std::vector<CStakeInput*> vInputs;
+    for (std::unique_ptr<CStakeInput>& stakeInput : listInputs)
+        vInputs.emplace_back(stakeInput.get());
+
+    size_t nFirst = 0;
+    while (nFirst < vInputs.size()) {
         nCredit = 0;
         // Make sure the wallet is unlocked and shutdown hasn't been requested
         if (IsLocked() || ShutdownRequested())
             return false;
 
         uint256 hashProofOfStake = 0;
-        nAttempts++;
-        //iterates each utxo inside of CheckStakeKernelHash()
-        if (Stake(pindexPrev, stakeInput.get(), nBits, nTxNewTime, hashProofOfStake)) {
+        //searches the drift window of all remaining utxos at once, the first one with a kernel wins
+        std::vector<CStakeInput*> vRemaining(vInputs.begin() + nFirst, vInputs.end());
+        size_t nFound = 0;
+        if (!StakeInputs(pindexPrev, vRemaining, nBits, nTxNewTime, hashProofOfStake, nFound)) {
+            nAttempts += vRemaining.size();
+            break;
+        }
+        nAttempts += nFound + 1;
+        CStakeInput* stakeInput = vRemaining[nFound];
+        nFirst += nFound + 1;
 
-            // Found a kernel
-            LogPrintf("CreateCoinStake : kernel found\n");
-            nCredit += stakeInput->GetValue();
+        // Found a kernel
+        LogPrintf("CreateCoinStake : kernel found\n");
+        nCredit += stakeInput->GetValue();
 
-            {
-                TRY_LOCK(zsplTracker->cs_spendcache, fLocked);
-                if (!fLocked)
-                    continue;
+        {
+            TRY_LOCK(zsplTracker->cs_spendcache, fLocked);
+            if (!fLocked)
+                continue;
 
-                uint256 hashTxOut = txNew.GetHash();
-                CTxIn in;
-                if (!stakeInput->CreateTxIn(this, in, hashTxOut)) {
-                    LogPrintf("%s : failed to create TxIn\n", __func__);
-                    txNew.vin.clear();
-                    txNew.vout.clear();
-                    continue;
-                }
-                txNew.vin.emplace_back(in);
+            uint256 hashTxOut = txNew.GetHash();
+            CTxIn in;
+            if (!stakeInput->CreateTxIn(this, in, hashTxOut)) {
+                LogPrintf("%s : failed to create TxIn\n", __func__);
+                txNew.vin.clear();
+                txNew.vout.clear();
+                continue;
             }
+            txNew.vin.emplace_back(in);
+        }
 
-            // Calculate reward
-            CAmount nBlockValue;
-            uint64_t nCoinAge = 0;
+        // Calculate reward
+        CAmount nBlockValue;
+        uint64_t nCoinAge = 0;
 
-            if (!GetCoinAge(txNew, nTxNewTime, pindexPrev->nHeight + 1, nCoinAge))
-                return error("CreateCoinStake : failed to calculate coin age");
-            //LogPrintf("%s : nCoinAge=%"PRId64"\n", __func__, nCoinAge);
+        if (!GetCoinAge(txNew, nTxNewTime, pindexPrev->nHeight + 1, nCoinAge))
+            return error("CreateCoinStake : failed to calculate coin age");
+        //LogPrintf("%s : nCoinAge=%"PRId64"\n", __func__, nCoinAge);
 
-            nBlockValue = GetBlockValue(pindexPrev->nHeight + 1, true, nCoinAge);
-            nCredit += nBlockValue;
+        nBlockValue = GetBlockValue(pindexPrev->nHeight + 1, true, nCoinAge);
+        nCredit += nBlockValue;
 
-            // Create the output transaction(s)
-            std::vector<CTxOut> vout;
-            if (!stakeInput->CreateTxOuts(this, vout, nCredit)) {
-                LogPrintf("%s : failed to get scriptPubKey\n", __func__);
-                txNew.vin.clear();
-                txNew.vout.clear();
-                continue;
-            }
-            txNew.vout.insert(txNew.vout.end(), vout.begin(), vout.end());
-
-            CAmount nMinFee = 0;
-            if (!stakeInput->IsZSPL()) {
-                // Set output amount
-                unsigned int outputs = txNew.vout.size() - 1;
-                CAmount nRemaining = nCredit - nMinFee;
-                if (outputs > 1) {
-                    // Split the stake across the outputs
-                    CAmount nShare = nRemaining / outputs;
-                    for (unsigned int i = 1; i < outputs; i++) {
-                        // loop through all but the last one.
-                        txNew.vout[i].nValue = nShare;
-                        nRemaining -= nShare;
-                    }
+        // Create the output transaction(s)
+        std::vector<CTxOut> vout;
+        if (!stakeInput->CreateTxOuts(this, vout, nCredit)) {
+            LogPrintf("%s : failed to get scriptPubKey\n", __func__);
+            txNew.vin.clear();
+            txNew.vout.clear();
+            continue;
+        }
+        txNew.vout.insert(txNew.vout.end(), vout.begin(), vout.end());
+
+        CAmount nMinFee = 0;
+        if (!stakeInput->IsZSPL()) {
+            // Set output amount
+            unsigned int outputs = txNew.vout.size() - 1;
+            CAmount nRemaining = nCredit - nMinFee;
+            if (outputs > 1) {
+                // Split the stake across the outputs
+                CAmount nShare = nRemaining / outputs;
+                for (unsigned int i = 1; i < outputs; i++) {
+                    // loop through all but the last one.
+                    txNew.vout[i].nValue = nShare;
+                    nRemaining -= nShare;
                 }
-                // put the remaining on the last output (which all into the first if only one output)
-                txNew.vout[outputs].nValue += nRemaining;
             }
+            // put the remaining on the last output (which all into the first if only one output)
+            txNew.vout[outputs].nValue += nRemaining;
+        }
 
-            // Limit size
-            unsigned int nBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBytes >= DEFAULT_BLOCK_MAX_SIZE / 5)
-                return error("CreateCoinStake : exceeded coinstake size limit");
-
-            //Masternode payment
-            FillBlockPayee(txNew, nMinFee, true, stakeInput->IsZSPL(), nBlockValue);
+        // Limit size
+        unsigned int nBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
+        if (nBytes >= DEFAULT_BLOCK_MAX_SIZE / 5)
+            return error("CreateCoinStake : exceeded coinstake size limit");
 
-            //Mark mints as spent
-            if (stakeInput->IsZSPL()) {
-                CZSplStake* z = (CZSplStake*)stakeInput.get();
-                if (!z->MarkSpent(this, txNew.GetHash()))
-                    return error("%s: failed to mark mint as used\n", __func__);
-            }
+        //Masternode payment
+        FillBlockPayee(txNew, nMinFee, true, stakeInput->IsZSPL(), nBlockValue);
 
-            fKernelFound = true;
-            break;
+        //Mark mints as spent
+        if (stakeInput->IsZSPL()) {
+            CZSplStake* z = (CZSplStake*)stakeInput;
+            if (!z->MarkSpent(this, txNew.GetHash()))
+                return error("%s: failed to mark mint as used\n", __func__);
         }
+
+        fKernelFound = true;
+        break;
     }
     LogPrint("staking", "%s: attempted staking %d times\n", __func__, nAttempts);
 
@@ -3955,8 +4080,14 @@ bool CWallet::MintsToInputVector(std::map<CBigNum, CZerocoinMint>& mapMintsSelec
             CoinWitnessData *coinWitness = zsplTracker->GetSpendCache(meta.hashStake);
 
             if (!coinWitness->nHeightAccEnd) {
-                *coinWitness = CoinWitnessData(mint);
-                coinWitness->SetHeightMintAdded(mint.GetHeight());
+                // Continue from the stored witness when there is one
+                CoinWitnessCacheData witnessData;
+                if (pwitnessStore && pwitnessStore->Get(meta.hashPubcoin, pindexCheckpoint, witnessData)) {
+                    *coinWitness = CoinWitnessData(witnessData);
+                } else {
+                    *coinWitness = CoinWitnessData(mint);
+                    coinWitness->SetHeightMintAdded(mint.GetHeight());
+                }
             }
 
             // Generate the witness for each mint being spent
@@ -4690,6 +4821,8 @@ bool CWallet::SpendZerocoin(CAmount nAmount, CWalletTx& wtxNew, CZerocoinSpendRe
     for (CZerocoinMint mint : vMintsSelected) {
         uint256 hashPubcoin = GetPubCoinHash(mint.GetValue());
         zsplTracker->SetPubcoinUsed(hashPubcoin, txidSpend);
+        if (pwitnessStore)
+            pwitnessStore->Untrack(hashPubcoin);
 
         CMintMeta metaCheck = zsplTracker->GetMetaFromPubcoin(hashPubcoin);
         if (!metaCheck.isUsed) {
@@ -29,6 +29,7 @@
 #include "zspl/zspltracker.h"
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -196,6 +197,33 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Index of the outputs SelectStakeCoins can stake: confirmed, unspent, ours
+     * and not zerocoin mints. Kept up to date from AddToWallet and the chain
+     * notifications, so selecting stake inputs neither walks mapWallet nor takes
+     * cs_main. The outputs are bucketed by the tip height they are spendable
+     * from, their confirmation height plus the coinbase maturity for coinbases
+     * and coinstakes.
+     */
+    struct CStakeableOutput {
+        const CWalletTx* tx;
+        unsigned int i;
+        int nHeight;            //!< height of the block the output confirmed in
+        unsigned int nBlockTime;
+        int nHeightMature;      //!< bucket: tip height the output is spendable from
+    };
+    std::map<COutPoint, CStakeableOutput> mapStakeable;
+    std::map<int, std::set<COutPoint> > mapStakeableByHeight;
+    std::set<uint256> setStakeableDirty; //!< transactions whose outputs are to be indexed again
+    const CBlockIndex* pindexStakeable;  //!< tip the index was last brought up to date with
+    std::atomic<bool> fStakeableIndexed;
+
+    void EraseStakeable(const uint256& hash);
+    //! Index the outputs of the dirty transactions again, with cs_main and cs_wallet held
+    void UpdateStakeable();
+    //! Build the index from the whole wallet, with cs_main and cs_wallet held
+    void IndexStakeable();
+
 public:
     bool MintableCoins();
     bool SelectStakeCoins(std::list<std::unique_ptr<CStakeInput> >& listInputs, CAmount nTargetAmount, int blockHeight, bool fPrecompute = false);
@@ -309,6 +337,8 @@ public:
         nNextResend = 0;
         nLastResend = 0;
         nTimeFirstKey = 0;
+        pindexStakeable = NULL;
+        fStakeableIndexed = false;
         fWalletUnlockAnonymizeOnly = false;
         fBackupMints = false;
 
@@ -472,6 +502,7 @@ public:
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet = false);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void UpdatedBlockTip(const CBlockIndex* pindex);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256& hash);
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false, bool fromStartup = false);
@@ -6,7 +6,39 @@
 #include "accumulators.h"
 #include "main.h"
 #include "txdb.h"
+#include "checkqueue.h"
 #include "libzerocoin/Denominations.h"
+#include "sync.h"
+#include "util.h"
+
+//! One check per denomination, the master takes one as well
+static CCheckQueue<CAccumulateCheck> accumulatecheckqueue(1, MAX_SCRIPTCHECK_THREADS);
+//! Held by the single user of accumulatecheckqueue; the zSPL rebuilds accumulate on several threads
+static CCriticalSection cs_accumulatecheckqueue;
+
+bool CAccumulateCheck::operator()()
+{
+    try {
+        if (fSkipValidation) {
+            std::vector<CBigNum> vValues;
+            vValues.reserve(vPubcoins.size());
+            for (const libzerocoin::PublicCoin& pubCoin : vPubcoins)
+                vValues.emplace_back(pubCoin.getValue());
+            paccumulator->increment(vValues);
+        } else {
+            paccumulator->accumulate(vPubcoins);
+        }
+    } catch (const std::exception& e) {
+        return error("%s : %s", __func__, e.what());
+    }
+    return true;
+}
+
+void ThreadAccumulateCheck()
+{
+    RenameThread("simplicity-accumch");
+    accumulatecheckqueue.Thread();
+}
 
 
 //Construct accumulators for all denominations
@@ -71,6 +103,34 @@ bool AccumulatorMap::Accumulate(const libzerocoin::PublicCoin& pubCoin, bool fSk
     return true;
 }
 
+//Add a list of zerocoins. The denominations are independent, so they are accumulated alongside each other
+//on the accumulator check threads, each with a single exponentiation by the product of its coins.
+bool AccumulatorMap::Accumulate(const std::list<libzerocoin::PublicCoin>& listPubcoins, bool fSkipValidation)
+{
+    std::map<libzerocoin::CoinDenomination, std::vector<libzerocoin::PublicCoin> > mapByDenom;
+    for (const libzerocoin::PublicCoin& pubCoin : listPubcoins) {
+        if (pubCoin.getDenomination() == libzerocoin::CoinDenomination::ZQ_ERROR)
+            return false;
+        mapByDenom[pubCoin.getDenomination()].emplace_back(pubCoin);
+    }
+
+    std::vector<CAccumulateCheck> vChecks;
+    for (auto& it : mapByDenom)
+        vChecks.emplace_back(mapAccumulators.at(it.first).get(), it.second, fSkipValidation);
+
+    // Another thread accumulating with the queue leaves this one to do it inline
+    TRY_LOCK(cs_accumulatecheckqueue, fQueue);
+    if (!fQueue || !nScriptCheckThreads || vChecks.size() < 2) {
+        bool fOk = true;
+        for (CAccumulateCheck& check : vChecks)
+            fOk &= check();
+        return fOk;
+    }
+    CCheckQueueControl<CAccumulateCheck> control(&accumulatecheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
+
 libzerocoin::Accumulator AccumulatorMap::GetAccumulator(libzerocoin::CoinDenomination denom)
 {
     return libzerocoin::Accumulator(params, denom, GetValue(denom));
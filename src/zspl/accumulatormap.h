@@ -9,6 +9,9 @@
 #include "libzerocoin/Coin.h"
 #include "accumulatorcheckpoints.h"
 
+#include <list>
+#include <vector>
+
 //A map with an accumulator for each denomination
 class AccumulatorMap
 {
@@ -20,10 +23,40 @@ public:
     bool Load(uint256 nCheckpoint);
     void Load(const AccumulatorCheckpoints::Checkpoint& checkpoint);
     bool Accumulate(const libzerocoin::PublicCoin& pubCoin, bool fSkipValidation = false);
+    bool Accumulate(const std::list<libzerocoin::PublicCoin>& listPubcoins, bool fSkipValidation = false);
     libzerocoin::Accumulator GetAccumulator(libzerocoin::CoinDenomination denom);
     CBigNum GetValue(libzerocoin::CoinDenomination denom);
     uint256 GetCheckpoint();
     void Reset();
     void Reset(libzerocoin::ZerocoinParams* params2);
 };
+
+/** Accumulation of the coins of one denomination, on the accumulator check queue */
+class CAccumulateCheck
+{
+private:
+    libzerocoin::Accumulator* paccumulator;
+    std::vector<libzerocoin::PublicCoin> vPubcoins;
+    bool fSkipValidation;
+
+public:
+    CAccumulateCheck() : paccumulator(NULL), fSkipValidation(false) {}
+    CAccumulateCheck(libzerocoin::Accumulator* paccumulatorIn, std::vector<libzerocoin::PublicCoin>& vPubcoinsIn, bool fSkipValidationIn) : paccumulator(paccumulatorIn), fSkipValidation(fSkipValidationIn)
+    {
+        vPubcoins.swap(vPubcoinsIn);
+    }
+
+    bool operator()();
+
+    void swap(CAccumulateCheck& check)
+    {
+        std::swap(paccumulator, check.paccumulator);
+        vPubcoins.swap(check.vPubcoins);
+        std::swap(fSkipValidation, check.fSkipValidation);
+    }
+};
+
+/** Run an instance of the accumulator check thread */
+void ThreadAccumulateCheck();
+
 #endif //SIMPLICITY_ACCUMULATORMAP_H
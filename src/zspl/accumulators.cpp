@@ -264,7 +264,7 @@ bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, Accumulat
     bool fFilterInvalid = nHeight >= Params().Zerocoin_Block_RecalculateAccumulators();
 
     //Accumulate all coins over the last ten blocks that havent been accumulated (height - 20 through height - 11)
-    int nTotalMintsFound = 0;
+    std::list<libzerocoin::PublicCoin> listPubcoinsAll;
     CBlockIndex *pindex = chainActive[nHeightCheckpoint - 20];
 
     while (pindex->nHeight < nHeight - 10) {
@@ -279,27 +279,21 @@ bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, Accumulat
         }
 
         //grab mints from this block
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex))
-            return error("%s: failed to read block from disk", __func__);
-
         std::list<libzerocoin::PublicCoin> listPubcoins;
-        if (!BlockToPubcoinList(block, listPubcoins, fFilterInvalid))
+        if (!BlockIndexToPubcoinList(pindex, listPubcoins, fFilterInvalid))
             return error("%s: failed to get zerocoin mintlist from block %d", __func__, pindex->nHeight);
 
-        nTotalMintsFound += listPubcoins.size();
         LogPrint("zero", "%s found %d mints\n", __func__, listPubcoins.size());
-
-        //add the pubcoins to accumulator
-        for (const libzerocoin::PublicCoin& pubcoin : listPubcoins) {
-            if(!mapAccumulators.Accumulate(pubcoin, true))
-                return error("%s: failed to add pubcoin to accumulator at height %d", __func__, pindex->nHeight);
-        }
+        listPubcoinsAll.splice(listPubcoinsAll.end(), listPubcoins);
         pindex = chainActive.Next(pindex);
     }
 
+    //add the pubcoins to the accumulators, one denomination per thread
+    if (!mapAccumulators.Accumulate(listPubcoinsAll, true))
+        return error("%s: failed to add pubcoins to accumulator at height %d", __func__, nHeight);
+
     // if there were no new mints found, the accumulator checkpoint will be the same as the last checkpoint
-    if (nTotalMintsFound == 0)
+    if (listPubcoinsAll.empty())
         nCheckpoint = chainActive[nHeight - 1]->nAccumulatorCheckpoint;
     else
         nCheckpoint = mapAccumulators.GetCheckpoint();
@@ -360,11 +354,8 @@ int ComputeAccumulatedCoins(int nHeightEnd, libzerocoin::CoinDenomination denom)
 
 std::list<libzerocoin::PublicCoin> GetPubcoinFromBlock(const CBlockIndex* pindex){
     //grab mints from this block
-    CBlock block;
-    if(!ReadBlockFromDisk(block, pindex))
-        throw GetPubcoinException("GetPubcoinFromBlock: failed to read block from disk while adding pubcoins to witness");
     std::list<libzerocoin::PublicCoin> listPubcoins;
-    if(!BlockToPubcoinList(block, listPubcoins, true))
+    if(!BlockIndexToPubcoinList(pindex, listPubcoins, true))
         throw GetPubcoinException("GetPubcoinFromBlock: failed to get zerocoin mintlist from block "+std::to_string(pindex->nHeight)+"\n");
     return listPubcoins;
 }
@@ -375,7 +366,7 @@ int AddBlockMintsToAccumulator(const libzerocoin::CoinDenomination den, const CB
                                libzerocoin::Accumulator* accumulator, bool isWitness, std::list<CBigNum>& notAddedCoins)
 {
     // if this block contains mints of the denomination that is being spent, then add them to the witness
-    int nMintsAdded = 0;
+    std::vector<CBigNum> vValues;
     if (pindex->MintedDenomination(den)) {
         //add the mints to the witness
         for (const libzerocoin::PublicCoin& pubcoin : GetPubcoinFromBlock(pindex)) {
@@ -388,19 +379,19 @@ int AddBlockMintsToAccumulator(const libzerocoin::CoinDenomination den, const CB
                 continue;
             }
 
-            accumulator->increment(pubcoin.getValue());
-            ++nMintsAdded;
+            vValues.emplace_back(pubcoin.getValue());
         }
+        accumulator->increment(vValues);
     }
 
-    return nMintsAdded;
+    return vValues.size();
 }
 
 int AddBlockMintsToAccumulator(const libzerocoin::PublicCoin& coin, const int nHeightMintAdded, const CBlockIndex* pindex,
                                libzerocoin::Accumulator* accumulator, bool isWitness)
 {
     // if this block contains mints of the denomination that is being spent, then add them to the witness
-    int nMintsAdded = 0;
+    std::vector<CBigNum> vValues;
     if (pindex->MintedDenomination(coin.getDenomination())) {
         //add the mints to the witness
         for (const libzerocoin::PublicCoin& pubcoin : GetPubcoinFromBlock(pindex)) {
@@ -410,12 +401,12 @@ int AddBlockMintsToAccumulator(const libzerocoin::PublicCoin& coin, const int nH
             if (isWitness && pindex->nHeight == nHeightMintAdded && pubcoin.getValue() == coin.getValue())
                 continue;
 
-            accumulator->increment(pubcoin.getValue());
-            ++nMintsAdded;
+            vValues.emplace_back(pubcoin.getValue());
         }
+        accumulator->increment(vValues);
     }
 
-    return nMintsAdded;
+    return vValues.size();
 }
 
 
@@ -501,6 +492,17 @@ int SearchMintHeightOf(CBigNum value){
 }
 
 
+int GetWitnessStopHeight(const CBlockIndex* pindexCheckpoint)
+{
+    if (pindexCheckpoint) {
+        int nHeightStop = pindexCheckpoint->nHeight - 10;
+        return nHeightStop - nHeightStop % 10;
+    }
+
+    int nChainHeight = chainActive.Height();
+    return nChainHeight - nChainHeight % 10 - 20; // at least two checkpoints deep
+}
+
 void AccumulateRange(CoinWitnessData* coinWitness, int nHeightEnd)
 {
     // bool fDoubleCounted = false;
@@ -555,19 +557,9 @@ bool GenerateAccumulatorWitness(CoinWitnessData* coinWitness, AccumulatorMap& ma
         }
 
         //add the pubcoins from the blockchain up to the next checksum starting from the block
-        int nChainHeight = chainActive.Height();
-        int nHeightMax = nChainHeight % 10;
-        nHeightMax = nChainHeight - nHeightMax - 20; // at least two checkpoints deep
-
-        // Determine the height to stop at
-        int nHeightStop;
-        if (pindexCheckpoint) {
-            nHeightStop = pindexCheckpoint->nHeight - 10;
-            nHeightStop -= nHeightStop % 10;
+        int nHeightStop = GetWitnessStopHeight(pindexCheckpoint);
+        if (pindexCheckpoint)
             LogPrint("zero", "%s: using checkpoint height %d\n", __func__, pindexCheckpoint->nHeight);
-        } else {
-            nHeightStop = nHeightMax;
-        }
 
         if (nHeightStop > coinWitness->nHeightAccEnd)
             AccumulateRange(coinWitness, nHeightStop - 1);
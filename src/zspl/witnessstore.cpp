@@ -0,0 +1,289 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "zspl/witnessstore.h"
+
+#include "chainparams.h"
+#include "init.h"
+#include "main.h"
+#include "util.h"
+#include "utiltime.h"
+#include "wallet/wallet.h"
+#include "zspl/accumulators.h"
+#include "zspl/zspltracker.h"
+
+#include <algorithm>
+#include <set>
+
+CWitnessStore* pwitnessStore = NULL;
+
+CWitnessStore::CWitnessStore(size_t nCacheSize, bool fMemory, bool fWipe) : db(nCacheSize, fMemory, fWipe), fUpdatePending(false), fStop(false)
+{
+    std::vector<std::pair<uint256, std::pair<CoinWitnessCacheData, uint256> > > vWitnesses;
+    if (!db.LoadWitnesses(vWitnesses))
+        LogPrintf("%s: failed to load witnesses, they will be recomputed\n", __func__);
+
+    LOCK(cs);
+    for (auto& it : vWitnesses) {
+        CStoredWitness& stored = mapWitnesses[it.first];
+        stored.pwitness.reset(new CoinWitnessData(it.second.first));
+        stored.hashBlockAccEnd = it.second.second;
+    }
+    LogPrintf("%s: loaded %u witnesses\n", __func__, mapWitnesses.size());
+    threadUpdate = boost::thread(&CWitnessStore::ThreadUpdate, this);
+}
+
+CWitnessStore::~CWitnessStore()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutexUpdate);
+        fStop = true;
+        condUpdate.notify_all();
+    }
+    threadUpdate.join();
+}
+
+void CWitnessStore::Reset(CStoredWitness& stored)
+{
+    CoinWitnessData* pwitness = stored.pwitness.get();
+    pwitness->pAccumulator.reset(new libzerocoin::Accumulator(Params().Zerocoin_Params(false), pwitness->denom));
+    pwitness->nMintsAdded = 0;
+    pwitness->nHeightMintAdded = 0;
+    pwitness->nHeightCheckpoint = 0;
+    pwitness->nHeightAccEnd = 0;
+    stored.hashBlockAccEnd.SetNull();
+}
+
+bool CWitnessStore::Initialize(CStoredWitness& stored)
+{
+    AssertLockHeld(cs_main);
+    CoinWitnessData* pwitness = stored.pwitness.get();
+    try {
+        pwitness->SetHeightMintAdded(SearchMintHeightOf(pwitness->coin->getValue()));
+    } catch (searchMintHeightException& e) {
+        // not in the chain (yet)
+        return false;
+    }
+
+    // Start from the accumulator of the checkpoint that precedes the mint
+    CBigNum bnAccValue = 0;
+    if (pwitness->nHeightCheckpoint > chainActive.Height() || !GetAccumulatorValue(pwitness->nHeightCheckpoint, pwitness->denom, bnAccValue)) {
+        Reset(stored);
+        return false;
+    }
+    pwitness->pAccumulator->setValue(bnAccValue);
+    return true;
+}
+
+void CWitnessStore::Track(const CZerocoinMint& mint)
+{
+    CZerocoinMint mintCopy = mint;
+    uint256 hashPubcoin = GetPubCoinHash(mint.GetValue());
+    LOCK(cs);
+    if (mapWitnesses.count(hashPubcoin))
+        return;
+    CStoredWitness& stored = mapWitnesses[hashPubcoin];
+    stored.pwitness.reset(new CoinWitnessData(mintCopy));
+    Reset(stored);
+    vErased.erase(std::remove(vErased.begin(), vErased.end(), hashPubcoin), vErased.end());
+}
+
+void CWitnessStore::Untrack(const uint256& hashPubcoin)
+{
+    LOCK(cs);
+    if (mapWitnesses.erase(hashPubcoin))
+        vErased.emplace_back(hashPubcoin);
+}
+
+bool CWitnessStore::Get(const uint256& hashPubcoin, const CBlockIndex* pindexCheckpoint, CoinWitnessCacheData& data)
+{
+    uint256 hashBlockAccEnd;
+    {
+        LOCK(cs);
+        auto it = mapWitnesses.find(hashPubcoin);
+        if (it == mapWitnesses.end() || !it->second.pwitness->nHeightAccEnd)
+            return false;
+        data = CoinWitnessCacheData(it->second.pwitness.get());
+        hashBlockAccEnd = it->second.hashBlockAccEnd;
+    }
+
+    LOCK(cs_main);
+    if (data.nHeightAccEnd >= GetWitnessStopHeight(pindexCheckpoint))
+        return false;
+    const CBlockIndex* pindex = chainActive[data.nHeightAccEnd];
+    return pindex && pindex->GetBlockHash() == hashBlockAccEnd;
+}
+
+size_t CWitnessStore::Size() const
+{
+    LOCK(cs);
+    return mapWitnesses.size();
+}
+
+void CWitnessStore::SyncMints()
+{
+    std::set<CMintMeta> setMints;
+    bool fLocked;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        setMints = pwalletMain->zsplTracker->ListMints(true, false, false);
+        fLocked = pwalletMain->IsLocked();
+    }
+
+    std::vector<CMintMeta> vNew;
+    {
+        LOCK(cs);
+        std::set<uint256> setHashes;
+        for (const CMintMeta& meta : setMints) {
+            setHashes.insert(meta.hashPubcoin);
+            if (!mapWitnesses.count(meta.hashPubcoin))
+                vNew.emplace_back(meta);
+        }
+        for (auto it = mapWitnesses.begin(); it != mapWitnesses.end();) {
+            if (setHashes.count(it->first)) {
+                ++it;
+                continue;
+            }
+            vErased.emplace_back(it->first);
+            mapWitnesses.erase(it++);
+        }
+    }
+
+    // Deterministic mints are regenerated from the seed, which needs the wallet unlocked
+    if (fLocked)
+        return;
+    for (const CMintMeta& meta : vNew) {
+        CZerocoinMint mint;
+        {
+            LOCK(pwalletMain->cs_wallet);
+            if (!pwalletMain->GetMint(meta.hashSerial, mint))
+                continue;
+        }
+        Track(mint);
+    }
+}
+
+void CWitnessStore::Advance()
+{
+    int64_t nTimeStart = GetTimeMicros();
+    int nMaxBlocks = GetArg("-precomputecachelength", DEFAULT_PRECOMPUTE_LENGTH);
+    nMaxBlocks = std::max(MIN_PRECOMPUTE_LENGTH, std::min(MAX_PRECOMPUTE_LENGTH, nMaxBlocks));
+
+    std::set<uint256> setChanged;
+    std::vector<const CBlockIndex*> vBlocks;
+    {
+        LOCK2(cs_main, cs);
+        int nHeightStop = GetWitnessStopHeight(NULL);
+        int nHeightFirst = nHeightStop;
+        for (auto& it : mapWitnesses) {
+            CStoredWitness& stored = it.second;
+            CoinWitnessData* pwitness = stored.pwitness.get();
+            if (pwitness->nHeightAccEnd) {
+                const CBlockIndex* pindex = chainActive[pwitness->nHeightAccEnd];
+                if (!pindex || pindex->GetBlockHash() != stored.hashBlockAccEnd) {
+                    LogPrint("zero", "%s: witness %s left the active chain at %d, starting over\n", __func__, it.first.GetHex(), pwitness->nHeightAccEnd);
+                    Reset(stored);
+                    setChanged.insert(it.first);
+                }
+            }
+            if (!pwitness->nHeightMintAdded) {
+                if (!Initialize(stored))
+                    continue;
+                setChanged.insert(it.first);
+            }
+            nHeightFirst = std::min(nHeightFirst, std::max(pwitness->nHeightAccStart, pwitness->nHeightAccEnd + 1));
+        }
+        int nHeightLast = std::min(nHeightStop - 1, nHeightFirst + nMaxBlocks - 1);
+        for (int nHeight = nHeightFirst; nHeight <= nHeightLast; nHeight++)
+            vBlocks.emplace_back(chainActive[nHeight]);
+    }
+
+    // Accumulate block by block, so that each block is read from disk at most once
+    LOCK(cs);
+    unsigned int nBlocksRead = 0;
+    try {
+        for (const CBlockIndex* pindex : vBlocks) {
+            if (ShutdownRequested())
+                break;
+            std::list<libzerocoin::PublicCoin> listPubcoins;
+            bool fRead = false;
+            for (auto& it : mapWitnesses) {
+                CoinWitnessData* pwitness = it.second.pwitness.get();
+                if (!pwitness->nHeightMintAdded || std::max(pwitness->nHeightAccStart, pwitness->nHeightAccEnd + 1) != pindex->nHeight)
+                    continue;
+
+                if (pindex->MintedDenomination(pwitness->denom)) {
+                    if (!fRead) {
+                        listPubcoins = GetPubcoinFromBlock(pindex);
+                        fRead = true;
+                        ++nBlocksRead;
+                    }
+                    std::vector<CBigNum> vValues;
+                    for (const libzerocoin::PublicCoin& pubcoin : listPubcoins) {
+                        if (pubcoin.getDenomination() != pwitness->denom)
+                            continue;
+                        if (pindex->nHeight == pwitness->nHeightMintAdded && pubcoin.getValue() == pwitness->coin->getValue())
+                            continue;
+                        vValues.emplace_back(pubcoin.getValue());
+                    }
+                    pwitness->pAccumulator->increment(vValues);
+                    pwitness->nMintsAdded += vValues.size();
+                }
+                pwitness->nHeightAccEnd = pindex->nHeight;
+                it.second.hashBlockAccEnd = pindex->GetBlockHash();
+                setChanged.insert(it.first);
+            }
+        }
+    } catch (GetPubcoinException& e) {
+        LogPrintf("%s: %s\n", __func__, e.message);
+    }
+
+    std::vector<std::pair<uint256, std::pair<CoinWitnessCacheData, uint256> > > vWrite;
+    for (const uint256& hashPubcoin : setChanged) {
+        auto it = mapWitnesses.find(hashPubcoin);
+        if (it != mapWitnesses.end())
+            vWrite.emplace_back(hashPubcoin, std::make_pair(CoinWitnessCacheData(it->second.pwitness.get()), it->second.hashBlockAccEnd));
+    }
+    if (vWrite.empty() && vErased.empty())
+        return;
+    if (!db.WriteWitnessBatch(vWrite, vErased)) {
+        LogPrintf("%s: failed to write witnesses\n", __func__);
+        return;
+    }
+    vErased.clear();
+
+    LogPrint("bench", "        - %u witnesses advanced over %u blocks (%u read) in %.2fms\n", vWrite.size(), vBlocks.size(), nBlocksRead, 0.001 * (GetTimeMicros() - nTimeStart));
+}
+
+void CWitnessStore::ThreadUpdate()
+{
+    RenameThread("simplicity-witness");
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutexUpdate);
+            while (!fUpdatePending && !fStop)
+                condUpdate.wait(lock);
+            if (fStop)
+                return;
+            // tips that arrive while this one is worked on are caught up with in one go
+            fUpdatePending = false;
+        }
+        if (!pwalletMain || ShutdownRequested())
+            continue;
+        try {
+            SyncMints();
+            Advance();
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+    }
+}
+
+void CWitnessStore::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    // Only sent once the initial block download is done
+    boost::unique_lock<boost::mutex> lock(mutexUpdate);
+    fUpdatePending = true;
+    condUpdate.notify_one();
+}
@@ -0,0 +1,79 @@
+// Copyright (c) 2018-2019 The Simplicity developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SIMPLICITY_WITNESSSTORE_H
+#define SIMPLICITY_WITNESSSTORE_H
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "sync.h"
+#include "txdb.h"
+#include "uint256.h"
+#include "validationinterface.h"
+#include "zspl/witness.h"
+
+class CBlockIndex;
+class CZerocoinMint;
+
+/**
+ * Accumulator witnesses of the wallet's unspent mints, kept on disk (one
+ * record per pubcoin, carrying its denomination) and advanced as blocks are
+ * connected. The witnesses trail the tip by two checkpoints, like the ones
+ * GenerateAccumulatorWitness builds, so a spend or a stake only accumulates
+ * the blocks of the newest checkpoints instead of every block since the mint.
+ *
+ * Each block is read once for all witnesses of the denominations it minted.
+ * A witness whose last accumulated block left the active chain starts over.
+ * The work runs on a thread of its own; UpdatedBlockTip only wakes it.
+ */
+class CWitnessStore : public CValidationInterface
+{
+private:
+    struct CStoredWitness {
+        std::unique_ptr<CoinWitnessData> pwitness;
+        uint256 hashBlockAccEnd; //!< block nHeightAccEnd of the witness was taken from
+    };
+
+    CWitnessDB db;
+    mutable CCriticalSection cs;
+    std::map<uint256, CStoredWitness> mapWitnesses; //pubcoin hash, witness
+    std::vector<uint256> vErased;                    //pubcoin hashes still to be erased from the db
+
+    boost::mutex mutexUpdate;
+    boost::condition_variable condUpdate;
+    bool fUpdatePending; //!< the tip moved since the worker last caught up, only changed under mutexUpdate
+    bool fStop;
+    boost::thread threadUpdate;
+
+    void Reset(CStoredWitness& stored);
+    bool Initialize(CStoredWitness& stored) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    void SyncMints();
+    void Advance();
+    void ThreadUpdate();
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindex);
+
+public:
+    CWitnessStore(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CWitnessStore();
+
+    /** Start keeping a witness for a mint, accumulated from the next block on */
+    void Track(const CZerocoinMint& mint);
+    /** Stop keeping the witness of a spent or archived mint */
+    void Untrack(const uint256& hashPubcoin);
+    /** Stored witness of a pubcoin, if it is on the active chain and not past the checkpoint's stop height */
+    bool Get(const uint256& hashPubcoin, const CBlockIndex* pindexCheckpoint, CoinWitnessCacheData& data);
+    size_t Size() const;
+};
+
+extern CWitnessStore* pwitnessStore;
+
+#endif //SIMPLICITY_WITNESSSTORE_H
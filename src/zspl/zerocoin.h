@@ -236,6 +236,27 @@ public:
     };
 };
 
+/** A mint output of a block, as recorded by the pubcoin height index of the zerocoinDB */
+class CIndexedPubcoin
+{
+public:
+    CBigNum value;
+    libzerocoin::CoinDenomination denomination;
+    bool fInvalidOutPoint; //mint that BlockToPubcoinList drops when filtering invalid outpoints
+
+    CIndexedPubcoin() : value(0), denomination(libzerocoin::ZQ_ERROR), fInvalidOutPoint(false) {}
+    CIndexedPubcoin(const CBigNum& value, libzerocoin::CoinDenomination denomination, bool fInvalidOutPoint) : value(value), denomination(denomination), fInvalidOutPoint(fInvalidOutPoint) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(value);
+        READWRITE(denomination);
+        READWRITE(fInvalidOutPoint);
+    };
+};
+
 class CZerocoinSpendReceipt
 {
 private:
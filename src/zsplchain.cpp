@@ -80,6 +80,68 @@ bool BlockToPubcoinList(const CBlock& block, std::list<libzerocoin::PublicCoin>&
     return true;
 }
 
+bool BlockToIndexedPubcoins(const CBlock& block, std::vector<CIndexedPubcoin>& vPubcoins)
+{
+    for (const CTransaction& tx : block.vtx) {
+        if(!tx.HasZerocoinMintOutputs())
+            continue;
+
+        // Flag the mints BlockToPubcoinList filters out: all of a transaction that uses
+        // invalid outpoints, and everything from an invalid outpoint of its own on
+        bool fInvalid = false;
+        for (const CTxIn& in : tx.vin) {
+            if (!ValidOutPoint(in.prevout, INT_MAX)) {
+                fInvalid = true;
+                break;
+            }
+        }
+
+        uint256 txHash = tx.GetHash();
+        for (unsigned int i = 0; i < tx.vout.size(); i++) {
+            if (!fInvalid && !ValidOutPoint(COutPoint(txHash, i), INT_MAX))
+                fInvalid = true;
+
+            const CTxOut& txOut = tx.vout[i];
+            if(!txOut.IsZerocoinMint())
+                continue;
+
+            CValidationState state;
+            libzerocoin::PublicCoin pubCoin(Params().Zerocoin_Params(false));
+            if(!TxOutToPublicCoin(txOut, pubCoin, state))
+                return false;
+
+            vPubcoins.emplace_back(pubCoin.getValue(), pubCoin.getDenomination(), fInvalid);
+        }
+    }
+
+    return true;
+}
+
+bool BlockIndexToPubcoinList(const CBlockIndex* pindex, std::list<libzerocoin::PublicCoin>& listPubcoins, bool fFilterInvalid)
+{
+    uint256 hashBlock;
+    std::vector<CIndexedPubcoin> vPubcoins;
+    if (!zerocoinDB->ReadBlockPubcoins(pindex->nHeight, hashBlock, vPubcoins) || hashBlock != pindex->GetBlockHash()) {
+        // Connected before the index existed, or the entry is from another branch: index it now
+        vPubcoins.clear();
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex))
+            return false;
+        if (!BlockToIndexedPubcoins(block, vPubcoins))
+            return BlockToPubcoinList(block, listPubcoins, fFilterInvalid);
+        if (!zerocoinDB->WriteBlockPubcoins(pindex->nHeight, pindex->GetBlockHash(), vPubcoins))
+            LogPrintf("%s: failed to index the mints of block %d\n", __func__, pindex->nHeight);
+    }
+
+    for (const CIndexedPubcoin& pubcoin : vPubcoins) {
+        if (fFilterInvalid && pubcoin.fInvalidOutPoint)
+            continue;
+        listPubcoins.emplace_back(Params().Zerocoin_Params(false), pubcoin.value, pubcoin.denomination);
+    }
+
+    return true;
+}
+
 //return a list of zerocoin mints contained in a specific block
 bool BlockToZerocoinMintList(const CBlock& block, std::list<CZerocoinMint>& vMints, bool fFilterInvalid)
 {
@@ -276,6 +338,10 @@ std::string ReindexZerocoinDB()
             return _("Reindexing zerocoin failed");
         }
 
+        std::vector<CIndexedPubcoin> vIndexedPubcoins;
+        if (BlockToIndexedPubcoins(block, vIndexedPubcoins) && !zerocoinDB->WriteBlockPubcoins(pindex->nHeight, pindex->GetBlockHash(), vIndexedPubcoins))
+            return _("Error writing zerocoinDB to disk");
+
         for (const CTransaction& tx : block.vtx) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 if (tx.IsCoinBase())
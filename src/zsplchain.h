@@ -12,7 +12,9 @@
 #include <string>
 
 class CBlock;
+class CBlockIndex;
 class CBigNum;
+class CIndexedPubcoin;
 struct CMintMeta;
 class CTransaction;
 class CTxIn;
@@ -23,6 +25,10 @@ class uint256;
 
 bool BlockToMintValueVector(const CBlock& block, const libzerocoin::CoinDenomination denom, std::vector<CBigNum>& vValues);
 bool BlockToPubcoinList(const CBlock& block, std::list<libzerocoin::PublicCoin>& listPubcoins, bool fFilterInvalid);
+/** Mint outputs of a block in the form kept by the pubcoin height index */
+bool BlockToIndexedPubcoins(const CBlock& block, std::vector<CIndexedPubcoin>& vPubcoins);
+/** Same as BlockToPubcoinList, from the pubcoin height index; the block is only read if it is not indexed */
+bool BlockIndexToPubcoinList(const CBlockIndex* pindex, std::list<libzerocoin::PublicCoin>& listPubcoins, bool fFilterInvalid);
 bool BlockToZerocoinMintList(const CBlock& block, std::list<CZerocoinMint>& vMints, bool fFilterInvalid);
 void FindMints(std::vector<CMintMeta> vMintsToFind, std::vector<CMintMeta>& vMintsToUpdate, std::vector<CMintMeta>& vMissingMints);
 int GetZerocoinStartHeight();